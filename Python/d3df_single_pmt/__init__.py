@@ -5,6 +5,8 @@ Main features:
 * Agilent DSA90804A CSV conversion utilities.
 * Pulse alignment, normalization and timing analysis helpers.
 * Simple CAEN HV serial command wrapper.
+* Merge/rebin/extract tools for the binary histogram archives of WaveDemo.
+* SQLite catalog of the runs of a data folder (run_catalog).
 """
 
 from .converter import (
@@ -16,14 +18,25 @@ from .converter import (
 )
 from .analysis import (
     load_hdf5_data,
+    load_hdf5_metadata,
+    iter_hdf5_chunks,
     align_pulses_by_peak,
     normalize_pulses_to_max,
     analyze_pulse_timing,
+    analyze_pulse_timing_streaming,
     analyze_file,
     analyze_folder,
 )
+from .histo_archive import (
+    read_archive,
+    write_archive,
+    merge_archives,
+    rebin_histograms,
+    select_histograms,
+)
 from .dsa_converter import convert_dsa_csv_to_hdf5, simple_transpose_csv
 from .caen_hv import send_caen_command
+from .run_catalog import RunCatalog, open_catalog
 from .plot_analysis import (
     plot_adc_overlay,
     plot_adc_diagram_advanced,
@@ -37,9 +50,13 @@ __all__ = [
     'convert_dt_to_h5',
     'convert_dt_to_hdf5',
     'convert_folder',
-    'load_hdf5_data', 'align_pulses_by_peak', 'normalize_pulses_to_max',
-    'analyze_pulse_timing', 'analyze_file', 'analyze_folder',
+    'load_hdf5_data', 'load_hdf5_metadata', 'iter_hdf5_chunks',
+    'align_pulses_by_peak', 'normalize_pulses_to_max',
+    'analyze_pulse_timing', 'analyze_pulse_timing_streaming',
+    'analyze_file', 'analyze_folder',
+    'read_archive', 'write_archive', 'merge_archives', 'rebin_histograms', 'select_histograms',
     'convert_dsa_csv_to_hdf5', 'simple_transpose_csv', 'send_caen_command',
+    'RunCatalog', 'open_catalog',
     'plot_adc_overlay', 'plot_adc_diagram_advanced',
     'plot_pulse_timing_analysis', 'plot_waveform_analysis',
 ]
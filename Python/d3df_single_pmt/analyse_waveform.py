@@ -6,6 +6,11 @@ import h5py
 import re
 from scipy import signal
 
+try:
+    from .analysis import PulseArrays, align_pulse_array, normalize_pulses_to_max as normalize_pulses_to_max_df
+except ImportError:  # run as a script
+    from d3df_single_pmt.analysis import PulseArrays, align_pulse_array, normalize_pulses_to_max as normalize_pulses_to_max_df
+
 def parse_run_info(run_info_path):
     """Parse a run_info file extracting key experimental parameters.
 
@@ -290,6 +295,11 @@ def plot_adc_diagram(ADC_df, prefix, alpha=0.1, max_pulses=None, folder_path='.'
     print(f"Saved ADC diagram: {output_path}")
 
 
+def _pulse_arrays(ADC_df):
+    """PulseArrays of a DataFrame (an all-zero pulse keeps its peak at the reference position)."""
+    return ADC_df if isinstance(ADC_df, PulseArrays) else PulseArrays(ADC_df, zero_at_reference=True)
+
+
 def align_pulses_by_peak(ADC_df, reference_position=None, search_window=None):
     """
     Align pulses by shifting them to a common peak position.
@@ -308,60 +318,8 @@ def align_pulses_by_peak(ADC_df, reference_position=None, search_window=None):
         print("No ADC data available for alignment")
         return None, None
     
-    n_pulses = ADC_df.shape[0]
-    n_samples = ADC_df.shape[1]
-    
-    # Set default reference position to middle of window
-    if reference_position is None:
-        reference_position = n_samples // 2
-    
-    # Set default search window to full range
-    if search_window is None:
-        search_window = (0, n_samples)
-    
-    # Find peak position in each pulse
-    peak_positions = np.zeros(n_pulses, dtype=int)
-    
-    for i in range(n_pulses):
-        pulse = ADC_df.iloc[i, :].values
-        search_region = pulse[search_window[0]:search_window[1]]
-        
-        # Determine if pulse is positive or negative by checking absolute extrema
-        abs_max = np.max(np.abs(search_region))
-        if abs_max == 0:
-            peak_positions[i] = reference_position
-            continue
-        
-        # Find peak (most extreme value)
-        if np.max(search_region) > abs(np.min(search_region)):
-            # Positive pulse
-            peak_idx = np.argmax(search_region) + search_window[0]
-        else:
-            # Negative pulse
-            peak_idx = np.argmin(search_region) + search_window[0]
-        
-        peak_positions[i] = peak_idx
-    
-    # Calculate median peak position for robust reference
-    median_peak = int(np.median(peak_positions))
-    
-    # Align pulses by shifting to reference position
-    aligned_data = np.zeros_like(ADC_df.values)
-    
-    for i in range(n_pulses):
-        shift = reference_position - peak_positions[i]
-        pulse = ADC_df.iloc[i, :].values
-        
-        if shift == 0:
-            aligned_data[i, :] = pulse
-        elif shift > 0:
-            # Shift right
-            aligned_data[i, shift:] = pulse[:n_samples-shift]
-            aligned_data[i, :shift] = pulse[0]  # Pad with baseline
-        else:
-            # Shift left
-            aligned_data[i, :shift] = pulse[-shift:]
-            aligned_data[i, shift:] = pulse[-1]  # Pad with baseline
+    # Vectorized peak search and shift (see analysis.align_pulse_array)
+    aligned_data, peak_positions = align_pulse_array(ADC_df.values, reference_position, search_window, zero_at_reference=True)
     
     aligned_df = pd.DataFrame(
         aligned_data,
@@ -390,41 +348,8 @@ def normalize_pulses_to_max(ADC_df, method='individual'):
         print("No ADC data available for normalization")
         return None
     
-    normalized_df = ADC_df.copy()
-    
-    if method == 'individual':
-        # Normalize each pulse to its own maximum (0 to 1 range)
-        for i in range(ADC_df.shape[0]):
-            pulse = ADC_df.iloc[i, :]
-            pulse_max = pulse.max()
-            pulse_min = pulse.min()
-            if pulse_max != pulse_min:  # Avoid division by zero
-                normalized_df.iloc[i, :] = (pulse - pulse_min) / (pulse_max - pulse_min)
-            else:
-                normalized_df.iloc[i, :] = 0  # Flat pulse becomes zero
-                
-    elif method == 'global':
-        # Normalize all pulses to the global maximum
-        global_max = ADC_df.values.max()
-        global_min = ADC_df.values.min()
-        if global_max != global_min:
-            normalized_df = (ADC_df - global_min) / (global_max - global_min)
-        else:
-            normalized_df = ADC_df * 0  # All data is the same value
-            
-    elif method == 'baseline':
-        # Subtract baseline (minimum) from each pulse, then normalize to max
-        for i in range(ADC_df.shape[0]):
-            pulse = ADC_df.iloc[i, :]
-            baseline = pulse.min()
-            baseline_corrected = pulse - baseline
-            pulse_max = baseline_corrected.max()
-            if pulse_max > 0:
-                normalized_df.iloc[i, :] = baseline_corrected / pulse_max
-            else:
-                normalized_df.iloc[i, :] = 0
-    
-    return normalized_df
+    # Broadcast over all the pulses (see analysis.normalize_pulse_array); a flat pulse becomes zero
+    return normalize_pulses_to_max_df(ADC_df, method=method)
 
 
 def plot_adc_diagram_normalized(ADC_df, prefix, normalize=True, 
@@ -446,14 +371,16 @@ def plot_adc_diagram_normalized(ADC_df, prefix, normalize=True,
         print("No ADC DataFrame available for normalized diagram")
         return
     
+    pulses = _pulse_arrays(ADC_df)
+    method = norm_method if normalize else None
+    plot_data = pulses.data(align=False, method=method)
+    
     # Apply normalization if requested
     if normalize:
-        plot_df = normalize_pulses_to_max(ADC_df, method=norm_method)
         norm_suffix = f"_normalized_{norm_method}"
         y_label = f"Normalized ADC Values ({norm_method})"
         title_suffix = f" - Normalized ({norm_method})"
     else:
-        plot_df = ADC_df
         norm_suffix = "_raw"
         y_label = "ADC Values"
         title_suffix = " - Raw Values"
@@ -461,24 +388,23 @@ def plot_adc_diagram_normalized(ADC_df, prefix, normalize=True,
     fig, ax = plt.subplots(1, 1, figsize=(12, 8))
     
     # Determine how many pulses to plot
-    n_pulses = plot_df.shape[0]
+    n_pulses = plot_data.shape[0]
     if max_pulses is not None:
         n_pulses = min(n_pulses, max_pulses)
     
     # Create x-axis (sample points)
-    x_axis = range(plot_df.shape[1])
+    x_axis = np.arange(plot_data.shape[1])
     
     # Plot all pulses overlaid
-    for i in range(n_pulses):
-        ax.plot(x_axis, plot_df.iloc[i, :], 'b-', alpha=alpha, linewidth=0.5)
+    ax.plot(x_axis, plot_data[:n_pulses].T, 'b-', alpha=alpha, linewidth=0.5)
     
     # Calculate and plot average pulse
-    avg_pulse = plot_df.iloc[:n_pulses, :].mean(axis=0)
+    avg_pulse = pulses.mean_pulse(False, method, n_pulses)
     ax.plot(x_axis, avg_pulse, 'r-', linewidth=2, 
             label=f'Average ({n_pulses} pulses)')
     
     # Calculate and plot standard deviation envelope
-    std_pulse = plot_df.iloc[:n_pulses, :].std(axis=0)
+    std_pulse = pulses.std_pulse(False, method, n_pulses)
     ax.fill_between(x_axis, 
                     avg_pulse - std_pulse, 
                     avg_pulse + std_pulse, 
@@ -512,7 +438,8 @@ def analyze_pulse_timing(ADC_df, sampling_rate, method='individual',
     Aligns pulses by peak position before averaging for accurate timing.
     
     Args:
-        ADC_df: pandas DataFrame where each row is an ADC pulse
+        ADC_df: pandas DataFrame where each row is an ADC pulse, or PulseArrays
+                (its aligned/normalized arrays are reused)
         sampling_rate: sampling rate in Hz from HDF5 metadata
         method: normalization method ('individual', 'global', 'baseline')
         threshold_low: lower threshold for timing measurements (0.1 = 10%)
@@ -531,19 +458,18 @@ def analyze_pulse_timing(ADC_df, sampling_rate, method='individual',
         print("No valid sampling rate available from HDF5 metadata - cannot perform timing analysis")
         return None
     
+    pulses = _pulse_arrays(ADC_df)
+    
     # Align pulses by peak position for accurate averaging
     if align_pulses:
-        print(f"Aligning {ADC_df.shape[0]} pulses for timing analysis...")
-        ADC_df, peak_positions = align_pulses_by_peak(ADC_df)
-        if ADC_df is None:
-            print("Failed to align pulses")
-            return None
+        print(f"Aligning {pulses.shape[0]} pulses for timing analysis...")
+        peak_positions = pulses.peaks
         print(f"  Peak positions found: min={peak_positions.min()}, max={peak_positions.max()}, median={int(np.median(peak_positions))}")
     
     # Calculate timing information from sampling rate
     sample_rate = sampling_rate
     time_per_sample = 1.0 / sample_rate
-    n_samples = ADC_df.shape[1]
+    n_samples = pulses.shape[1]
     time_axis = np.arange(n_samples) * time_per_sample
     
     print("Time information from HDF5 sampling rate:")
@@ -551,11 +477,8 @@ def analyze_pulse_timing(ADC_df, sampling_rate, method='individual',
     print(f"  Time per sample: {time_per_sample:.9e} s")
     print(f"  Time range: {time_axis[0]:.6e} to {time_axis[-1]:.6e} s")
     
-    # Normalize the data for consistent threshold measurements
-    normalized_df = normalize_pulses_to_max(ADC_df, method=method)
-    
-    # Calculate mean pulse
-    mean_pulse = normalized_df.mean(axis=0).values
+    # Mean of the normalized pulses (consistent threshold measurements)
+    mean_pulse = pulses.mean_pulse(align_pulses, method)
     x_axis = np.arange(len(mean_pulse))
     
     # Determine if pulse is positive or negative
@@ -1069,7 +992,8 @@ def plot_adc_diagram_advanced(ADC_df, prefix, alpha=0.05, max_pulses=10000, norm
     Create an advanced diagram with multiple views and statistics.
     
     Args:
-        ADC_df: pandas DataFrame where each row is an ADC pulse/channel
+        ADC_df: pandas DataFrame where each row is an ADC pulse/channel, or PulseArrays
+                (its aligned/normalized arrays are reused)
         prefix: prefix for saving the plot
         alpha: transparency for individual pulses
         max_pulses: maximum number of pulses to plot
@@ -1081,31 +1005,30 @@ def plot_adc_diagram_advanced(ADC_df, prefix, alpha=0.05, max_pulses=10000, norm
         print("No ADC DataFrame available for advanced diagram")
         return
     
+    pulses = _pulse_arrays(ADC_df)
+    
     # Align pulses by peak position first
     if align_pulses:
-        print(f"Aligning {ADC_df.shape[0]} pulses by peak position...")
-        ADC_df, peak_positions = align_pulses_by_peak(ADC_df)
-        if ADC_df is None:
-            print("Failed to align pulses")
-            return
+        print(f"Aligning {pulses.shape[0]} pulses by peak position...")
+        peak_positions = pulses.peaks
         print(f"  Peak positions: min={peak_positions.min()}, max={peak_positions.max()}, median={int(np.median(peak_positions))}")
     
-    ADC_df = normalize_pulses_to_max(ADC_df, method=norm_method) if normalize else ADC_df
+    method = norm_method if normalize else None
+    data = pulses.data(align_pulses, method)
     
     fig, axes = plt.subplots(2, 2, figsize=(16, 10))
     fig.suptitle(f'ADC Diagram Analysis: {prefix}', fontsize=16)
     
     # Determine how many pulses to plot
-    n_pulses = min(ADC_df.shape[0], max_pulses) if max_pulses else ADC_df.shape[0]
-    x_axis = range(ADC_df.shape[1])
+    n_pulses = min(data.shape[0], max_pulses) if max_pulses else data.shape[0]
+    x_axis = np.arange(data.shape[1])
     
     # Plot 1: All pulses overlaid  diagram)
     ax1 = axes[0, 0]
-    for i in range(n_pulses):
-        ax1.plot(x_axis, ADC_df.iloc[i, :], 'b-', alpha=alpha, linewidth=0.3)
+    ax1.plot(x_axis, data[:n_pulses].T, 'b-', alpha=alpha, linewidth=0.3)
     
     # Add average
-    avg_pulse = ADC_df.iloc[:n_pulses, :].mean(axis=0)
+    avg_pulse = pulses.mean_pulse(align_pulses, method, n_pulses)
     ax1.plot(x_axis, avg_pulse, 'r-', linewidth=2, label=f'Average')
     ax1.set_xlabel('Sample Points')
     ax1.set_ylabel('ADC Values')
@@ -1115,7 +1038,7 @@ def plot_adc_diagram_advanced(ADC_df, prefix, alpha=0.05, max_pulses=10000, norm
     
     # Plot 2: Average pulse with error bars
     ax2 = axes[0, 1]
-    std_pulse = ADC_df.iloc[:n_pulses, :].std(axis=0)
+    std_pulse = pulses.std_pulse(align_pulses, method, n_pulses)
     ax2.errorbar(x_axis[::10], avg_pulse[::10], yerr=std_pulse[::10], 
                  fmt='ro-', capsize=3, alpha=0.7, markersize=3)
     ax2.plot(x_axis, avg_pulse, 'r-', linewidth=1)
@@ -1142,7 +1065,7 @@ def plot_adc_diagram_advanced(ADC_df, prefix, alpha=0.05, max_pulses=10000, norm
     n_individual = min(10, n_pulses)
     colors = plt.cm.tab10(range(n_individual))
     for i in range(n_individual):
-        ax4.plot(x_axis, ADC_df.iloc[i, :], color=colors[i], 
+        ax4.plot(x_axis, data[i], color=colors[i], 
                 linewidth=1, alpha=0.8, label=f'Pulse {i}')
     ax4.plot(x_axis, avg_pulse, 'k--', linewidth=2, label='Average')
     ax4.set_xlabel('Sample Points')
@@ -1398,9 +1321,12 @@ def run_analysis(ADC_df, timestamps_df, prefix, metadata=None, folder_path='.'):
     # plot_adc_diagram_normalized(ADC_df, prefix, normalize=True, 
     #                           norm_method='baseline', alpha=0.1, max_pulses=500)
     
+    # Aligned and normalized arrays, computed once for the diagrams and the timing analysis
+    pulses = _pulse_arrays(ADC_df)
+    
     # Advanced analysis with pulse alignment
-    # plot_adc_diagram_advanced(ADC_df, prefix, alpha=0.05, normalize=False, folder_path=folder_path, align_pulses=True)
-    plot_adc_diagram_advanced(ADC_df, prefix, alpha=0.05, max_pulses=1000,
+    # plot_adc_diagram_advanced(pulses, prefix, alpha=0.05, normalize=False, folder_path=folder_path, align_pulses=True)
+    plot_adc_diagram_advanced(pulses, prefix, alpha=0.05, max_pulses=1000,
                              normalize=True, norm_method='individual', folder_path=folder_path, align_pulses=True)
     
     # Analyze pulse timing characteristics
@@ -1416,7 +1342,7 @@ def run_analysis(ADC_df, timestamps_df, prefix, metadata=None, folder_path='.'):
         timing_info = None
     else:
         timing_info = analyze_pulse_timing(
-            ADC_df, sampling_rate,
+            pulses, sampling_rate,
             method='individual',
             threshold_low=0.1,
             threshold_high=0.9,
@@ -1,55 +1,83 @@
 import os
+import json
+import hashlib
 import numpy as np
 import pandas as pd
 import h5py
 from .converter import parse_run_info
+from .run_catalog import catalog_run_info
 
 
 __all__ = [
     'load_hdf5_data',
+    'load_hdf5_metadata',
+    'iter_hdf5_chunks',
+    'find_pulse_peaks',
+    'align_pulse_array',
+    'normalize_pulse_array',
+    'PulseArrays',
     'align_pulses_by_peak',
     'normalize_pulses_to_max',
     'analyze_pulse_timing',
+    'analyze_pulse_timing_streaming',
     'analyze_file',
     'analyze_folder'
 ]
 
+# Target size (bytes, float64) of the blocks read by the streaming path
+STREAM_BLOCK_BYTES = 32 * 2**20
+
+# Per-folder cache of the analyze_folder summaries; bump the version when the summary changes
+ANALYSIS_CACHE_FILE = '.analysis_cache.json'
+ANALYSIS_CACHE_VERSION = 2
+FINGERPRINT_BYTES = 2**20
+
+def _load_metadata(f, hdf5_file):
+    metadata = {k: f.attrs[k] for k in f.attrs.keys()}
+    need_run = any(
+        k not in metadata
+        for k in [
+            'pmt_hv',
+            'source',
+            'scintillator',
+            'trigger_threshold_common',
+        ]
+    )
+    # the run catalog of the folder knows the metadata of its waveform files: no folder listing
+    if need_run and 'source_file' in metadata:
+        cataloged = catalog_run_info(str(metadata['source_file']))
+        if cataloged:
+            metadata.update(cataloged)
+            return metadata
+    run_info_candidates = []
+    if 'run_info_file' in metadata:
+        run_info_candidates.append(str(metadata['run_info_file']))
+    if 'source_file' in metadata:
+        base = os.path.basename(str(metadata['source_file']))
+        derived = base.replace('Wave_0_0', 'run_info') + '.txt'
+        run_info_candidates.append(
+            os.path.join(os.path.dirname(hdf5_file), derived)
+        )
+    run_info_candidates.extend([
+        os.path.join(os.path.dirname(hdf5_file), fn)
+        for fn in os.listdir(os.path.dirname(hdf5_file))
+        if fn.lower().startswith('run_info') and fn.lower().endswith('.txt')
+    ])
+    if need_run:
+        for cand in run_info_candidates:
+            parsed = parse_run_info(cand)
+            if parsed:
+                metadata.update(parsed)
+                metadata.setdefault('run_info_file', cand)
+                break
+    return metadata
+
 def load_hdf5_data(hdf5_file):
     try:
         with h5py.File(hdf5_file, 'r') as f:
             timestamps = f['timestamps'][:]
             adc_data = f['adc_data'][:]
-            metadata = {k: f.attrs[k] for k in f.attrs.keys()}
-            need_run = any(
-                k not in metadata
-                for k in [
-                    'pmt_hv',
-                    'source',
-                    'scintillator',
-                    'trigger_threshold_common',
-                ]
-            )
-            run_info_candidates = []
-            if 'run_info_file' in metadata:
-                run_info_candidates.append(str(metadata['run_info_file']))
-            if 'source_file' in metadata:
-                base = os.path.basename(str(metadata['source_file']))
-                derived = base.replace('Wave_0_0', 'run_info') + '.txt'
-                run_info_candidates.append(
-                    os.path.join(os.path.dirname(hdf5_file), derived)
-                )
-            run_info_candidates.extend([
-                os.path.join(os.path.dirname(hdf5_file), fn)
-                for fn in os.listdir(os.path.dirname(hdf5_file))
-                if fn.lower().startswith('run_info') and fn.lower().endswith('.txt')
-            ])
-            if need_run:
-                for cand in run_info_candidates:
-                    parsed = parse_run_info(cand)
-                    if parsed:
-                        metadata.update(parsed)
-                        metadata.setdefault('run_info_file', cand)
-                        break
+            metadata = _load_metadata(f, hdf5_file)
         sampling_rate = metadata.get('sampling_rate', 3.2e9)
         n_samples = adc_data.shape[1]
         timestamps_df = pd.DataFrame(
@@ -67,63 +95,160 @@ def load_hdf5_data(hdf5_file):
         print(f"Failed to load {hdf5_file}: {e}")
         return None, None, {}
 
+def load_hdf5_metadata(hdf5_file):
+    with h5py.File(hdf5_file, 'r') as f:
+        metadata = _load_metadata(f, hdf5_file)
+        metadata.setdefault('num_events', f['adc_data'].shape[0])
+        metadata.setdefault('num_samples_per_event', f['adc_data'].shape[1])
+    return metadata
+
+def iter_hdf5_chunks(hdf5_file, chunk_events=None, scale=None):
+    # Yields (first event, scaled block) reading `chunk_events` rows of adc_data at a time;
+    # by default a multiple of the HDF5 chunk rows of about STREAM_BLOCK_BYTES
+    with h5py.File(hdf5_file, 'r') as f:
+        dset = f['adc_data']
+        n_events, n_samples = dset.shape
+        if scale is None:
+            scale = _load_metadata(f, hdf5_file).get('adc_voltage_scaling', 1.0)
+        if chunk_events is None:
+            rows = dset.chunks[0] if dset.chunks else 1
+            chunk_events = max(1, STREAM_BLOCK_BYTES // (8 * max(n_samples, 1)) // rows) * rows
+        for start in range(0, n_events, chunk_events):
+            yield start, dset[start:start + chunk_events] * scale
+
+# Array core of the pulse analysis: the peak search is one argmax/argmin over the 2D array (events x samples),
+# the alignment one strided gather and the normalization one broadcast. PulseArrays keeps the results of a
+# dataset, so that the timing analysis and the plots share them instead of recomputing them.
+def find_pulse_peaks(adc, reference_position=None, search_window=None, zero_at_reference=False):
+    # Index of the most extreme sample of each pulse (max if it is larger than |min|, else min) in the search
+    # window; reference_position (default: middle) for an empty window, and with zero_at_reference for a pulse
+    # that is zero in the whole window (otherwise the min rule gives the window start)
+    adc = np.asarray(adc)
+    n_samples = adc.shape[1]
+    if reference_position is None:
+        reference_position = n_samples // 2
+    start, stop = search_window if search_window is not None else (0, n_samples)
+    region = adc[:, start:stop]
+    if region.shape[1] == 0:
+        return np.full(adc.shape[0], reference_position, dtype=int)
+    vmax, vmin = region.max(axis=1), region.min(axis=1)
+    peaks = np.where(vmax > np.abs(vmin), region.argmax(axis=1), region.argmin(axis=1)) + start
+    if zero_at_reference:
+        peaks = np.where(np.maximum(np.abs(vmax), np.abs(vmin)) == 0, reference_position, peaks)
+    return peaks.astype(int)
+
+def align_pulse_array(adc, reference_position=None, search_window=None, zero_at_reference=False):
+    # Shift each pulse so that its peak is at reference_position, padding with its first/last sample.
+    # The rows are padded once by the largest shift and each aligned row is a window of its padded row:
+    # aligned[i, j] = adc[i, clip(j - shift[i])]
+    adc = np.asarray(adc)
+    n_pulses, n_samples = adc.shape
+    if reference_position is None:
+        reference_position = n_samples // 2
+    peaks = find_pulse_peaks(adc, reference_position, search_window, zero_at_reference)
+    shift = reference_position - peaks
+    pad = int(np.abs(shift).max()) if n_pulses else 0
+    if pad == 0:
+        return adc.copy(), peaks
+    padded = np.pad(adc, ((0, 0), (pad, pad)), mode='edge')
+    windows = np.lib.stride_tricks.sliding_window_view(padded, n_samples, axis=1)
+    return windows[np.arange(n_pulses), pad - shift], peaks
+
+def normalize_pulse_array(adc, method='individual'):
+    # 'individual' and 'baseline' (the same after the subtraction of the minimum): each pulse to 0..1;
+    # 'global': the whole array to 0..1. A flat pulse (or array) is 0; any other method: not normalized (a copy)
+    adc = np.asarray(adc)
+    if method not in ('individual', 'global', 'baseline'):
+        return adc.copy()
+    if method == 'global':
+        gmax, gmin = adc.max(), adc.min()
+        if gmax == gmin:
+            return np.zeros(adc.shape)
+        out = np.subtract(adc, gmin, dtype=float)
+        out /= gmax - gmin
+        return out
+    pmax, pmin = adc.max(axis=1), adc.min(axis=1)
+    flat = pmax == pmin
+    out = np.subtract(adc, pmin[:, None], dtype=float)
+    out /= np.where(flat, 1.0, pmax - pmin)[:, None]
+    out[flat] = 0
+    return out
+
+class PulseArrays:
+    # Intermediates of one dataset (events x samples), each computed on first use and then shared:
+    # peak positions, aligned array, normalized arrays (per method and alignment) and mean/std pulses.
+    # The timing analysis and the plots accept a PulseArrays in place of the DataFrame.
+    def __init__(self, adc, reference_position=None, zero_at_reference=False):
+        if isinstance(adc, PulseArrays):
+            adc = adc.raw
+        self.index = adc.index if isinstance(adc, pd.DataFrame) else None
+        self.columns = adc.columns if isinstance(adc, pd.DataFrame) else None
+        self.raw = adc.values if isinstance(adc, pd.DataFrame) else np.asarray(adc)
+        self.reference_position = reference_position
+        self.zero_at_reference = zero_at_reference
+        self._aligned = self._peaks = None
+        self._normalized = {}
+        self._stats = {}
+
+    @property
+    def shape(self):
+        return self.raw.shape
+
+    @property
+    def empty(self):
+        return self.raw.size == 0
+
+    @property
+    def peaks(self):
+        return self._align()[1]
+
+    @property
+    def aligned(self):
+        return self._align()[0]
+
+    def _align(self):
+        if self._aligned is None:
+            self._aligned, self._peaks = align_pulse_array(self.raw, self.reference_position, zero_at_reference=self.zero_at_reference)
+        return self._aligned, self._peaks
+
+    def data(self, align=True, method=None):
+        # aligned (or raw) array, normalized with `method` (None = not normalized)
+        base = self.aligned if align else self.raw
+        if method is None:
+            return base
+        key = (bool(align), method)
+        if key not in self._normalized:
+            self._normalized[key] = normalize_pulse_array(base, method)
+        return self._normalized[key]
+
+    def mean_pulse(self, align=True, method=None, n_pulses=None):
+        return self._stat('mean', align, method, n_pulses)
+
+    def std_pulse(self, align=True, method=None, n_pulses=None):
+        # sample standard deviation (ddof=1, as DataFrame.std)
+        return self._stat('std', align, method, n_pulses)
+
+    def _stat(self, kind, align, method, n_pulses):
+        key = (kind, bool(align), method, n_pulses)
+        if key not in self._stats:
+            data = self.data(align, method)[:n_pulses]
+            self._stats[key] = data.mean(axis=0) if kind == 'mean' else data.std(axis=0, ddof=1)
+        return self._stats[key]
+
+    def frame(self, data):
+        # DataFrame of an array of this dataset with the index/columns of the source
+        return pd.DataFrame(data, index=self.index, columns=self.columns)
+
 def align_pulses_by_peak(ADC_df, reference_position=None, search_window=None):
     if ADC_df is None or ADC_df.empty:
         return None, None
-    n_pulses, n_samples = ADC_df.shape
-    if reference_position is None:
-        reference_position = n_samples // 2
-    if search_window is None:
-        search_window = (0, n_samples)
-    peak_positions = np.zeros(n_pulses, dtype=int)
-    for i in range(n_pulses):
-        pulse = ADC_df.iloc[i].values
-        region = pulse[search_window[0]:search_window[1]]
-        if region.size == 0:
-            peak_positions[i] = reference_position
-            continue
-        if np.max(region) > abs(np.min(region)):
-            peak_idx = np.argmax(region) + search_window[0]
-        else:
-            peak_idx = np.argmin(region) + search_window[0]
-        peak_positions[i] = peak_idx
-    aligned = np.zeros_like(ADC_df.values)
-    for i in range(n_pulses):
-        shift = reference_position - peak_positions[i]
-        pulse = ADC_df.iloc[i].values
-        if shift == 0:
-            aligned[i] = pulse
-        elif shift > 0:
-            aligned[i, shift:] = pulse[: n_samples - shift]
-            aligned[i, :shift] = pulse[0]
-        else:
-            aligned[i, :shift] = pulse[-shift:]
-            aligned[i, shift:] = pulse[-1]
-    return (
-        pd.DataFrame(aligned, index=ADC_df.index, columns=ADC_df.columns),
-        peak_positions,
-    )
+    aligned, peaks = align_pulse_array(ADC_df.values, reference_position, search_window)
+    return pd.DataFrame(aligned, index=ADC_df.index, columns=ADC_df.columns), peaks
 
 def normalize_pulses_to_max(ADC_df, method='individual'):
     if ADC_df is None or ADC_df.empty:
         return None
-    out = ADC_df.copy()
-    if method == 'individual':
-        for i in range(out.shape[0]):
-            pulse = out.iloc[i]
-            pmax, pmin = pulse.max(), pulse.min()
-            out.iloc[i] = (pulse - pmin) / (pmax - pmin) if pmax != pmin else 0
-    elif method == 'global':
-        gmax, gmin = out.values.max(), out.values.min()
-        out = (out - gmin) / (gmax - gmin) if gmax != gmin else out*0
-    elif method == 'baseline':
-        for i in range(out.shape[0]):
-            pulse = out.iloc[i]
-            base = pulse.min()
-            corr = pulse - base
-            pmax = corr.max()
-            out.iloc[i] = corr / pmax if pmax > 0 else 0
-    return out
+    return pd.DataFrame(normalize_pulse_array(ADC_df.values, method), index=ADC_df.index, columns=ADC_df.columns)
 
 def _measure_rise_positive(mp, low, high):
     rs = re = None
@@ -207,14 +332,8 @@ def _measure_width(mp, mid, positive):
             if mp[i] <= mid and mp[i+1] > mid: we = i; break
     return {'width_start_idx': ws, 'width_end_idx': we, 'pulse_width': (we - ws) if ws is not None and we is not None else None}
 
-def analyze_pulse_timing(ADC_df, sampling_rate, method='individual', threshold_low=0.1, threshold_high=0.9, align=True):
-    if ADC_df is None or ADC_df.empty or sampling_rate <= 0:
-        return None
-    if align:
-        ADC_df, _ = align_pulses_by_peak(ADC_df)
+def _timing_from_mean_pulse(mean_pulse, sampling_rate, threshold_low, threshold_high):
     tps = 1.0 / sampling_rate
-    norm = normalize_pulses_to_max(ADC_df, method=method)
-    mean_pulse = norm.mean(axis=0).values
     baseline = np.median(mean_pulse[:10])
     peak_max, peak_min = mean_pulse.max(), mean_pulse.min()
     if abs(peak_max - baseline) > abs(peak_min - baseline):
@@ -236,29 +355,184 @@ def analyze_pulse_timing(ADC_df, sampling_rate, method='individual', threshold_l
     if info.get('pulse_width') is not None: info['pulse_width_ns'] = info['pulse_width'] * tps * 1e9
     return info
 
-def analyze_file(hdf5_file, align=True):
+def _raw_amplitude(mean_pulse):
+    # amplitude of the unnormalized mean pulse (data units): scales with the gain, unlike 'amplitude' (~1 once normalized)
+    baseline = np.median(mean_pulse[:10])
+    return max(abs(mean_pulse.max() - baseline), abs(mean_pulse.min() - baseline))
+
+def analyze_pulse_timing(ADC_df, sampling_rate, method='individual', threshold_low=0.1, threshold_high=0.9, align=True):
+    # ADC_df: DataFrame, array or PulseArrays (its aligned/normalized arrays are reused)
+    if ADC_df is None or sampling_rate <= 0:
+        return None
+    pulses = ADC_df if isinstance(ADC_df, PulseArrays) else PulseArrays(ADC_df)
+    if pulses.empty:
+        return None
+    mean_pulse = pulses.mean_pulse(align, method)
+    info = _timing_from_mean_pulse(mean_pulse, sampling_rate, threshold_low, threshold_high)
+    info['raw_amplitude'] = _raw_amplitude(pulses.mean_pulse(align, None))
+    return info
+
+def analyze_pulse_timing_streaming(chunks, sampling_rate, method='individual', threshold_low=0.1, threshold_high=0.9, align=True):
+    # analyze_pulse_timing on an iterable of blocks (events x samples, e.g. iter_hdf5_chunks): only one block
+    # and the per-sample sums are in memory. The mean pulse matches the in-memory one up to the rounding of the
+    # sums, so the crossing indices are the same; with method='global' the range of the whole run is applied
+    # to the mean at the end (the normalization is linear).
+    if sampling_rate <= 0:
+        return None
+    total = raw_total = None
+    n_pulses = 0
+    gmax, gmin = -np.inf, np.inf
+    for _, block in chunks:
+        block = np.asarray(block, dtype=float)
+        if block.size == 0:
+            continue
+        if align:
+            block, _ = align_pulse_array(block)
+        raw_total = block.sum(axis=0) if raw_total is None else raw_total + block.sum(axis=0)
+        if method == 'global':
+            gmax, gmin = max(gmax, block.max()), min(gmin, block.min())
+        else:
+            block = normalize_pulse_array(block, method)
+        total = block.sum(axis=0) if total is None else total + block.sum(axis=0)
+        n_pulses += block.shape[0]
+    if n_pulses == 0:
+        return None
+    mean_pulse = total / n_pulses
+    if method == 'global':
+        mean_pulse = (mean_pulse - gmin) / (gmax - gmin) if gmax != gmin else mean_pulse * 0
+    info = _timing_from_mean_pulse(mean_pulse, sampling_rate, threshold_low, threshold_high)
+    info['raw_amplitude'] = _raw_amplitude(raw_total / n_pulses)
+    info['n_pulses'] = n_pulses
+    return info
+
+def analyze_file(hdf5_file, align=True, streaming=False, chunk_events=None):
+    if streaming or chunk_events:
+        try:
+            meta = load_hdf5_metadata(hdf5_file)
+            sr = meta.get('sampling_rate', 0)
+            chunks = iter_hdf5_chunks(hdf5_file, chunk_events, meta.get('adc_voltage_scaling', 1.0))
+            timing = analyze_pulse_timing_streaming(chunks, sr, align=align)
+        except Exception as e:
+            print(f"Failed to analyze {hdf5_file}: {e}")
+            return None
+        return {'file': hdf5_file, 'metadata': meta, 'timing': timing}
     ADC_df, ts_df, meta = load_hdf5_data(hdf5_file)
     if ADC_df is None: return None
     sr = meta.get('sampling_rate', 0)
     timing = analyze_pulse_timing(ADC_df, sr, align=align)
     return {'file': hdf5_file, 'metadata': meta, 'timing': timing}
 
-def analyze_folder(folder_path, pattern='.h5', align=True):
+def _summarize_file(fpath, align=True, streaming=False, chunk_events=None):
+    res = analyze_file(fpath, align=align, streaming=streaming, chunk_events=chunk_events)
+    if not res or not res['timing']:
+        return None
+    t = res['timing']; meta = res['metadata']
+    summary = {
+        'file': os.path.basename(fpath), 'sampling_rate': meta.get('sampling_rate', np.nan), 'baseline': t.get('baseline', np.nan),
+        'amplitude': t.get('amplitude', np.nan), 'raw_amplitude': t.get('raw_amplitude', np.nan), 'rise_samples': t.get('rise_time', -1), 'fall_samples': t.get('fall_time', -1),
+        'width_samples': t.get('pulse_width', -1), 'rise_time_ns': t.get('rise_time_ns', np.nan), 'fall_time_ns': t.get('fall_time_ns', np.nan),
+        'pulse_width_ns': t.get('pulse_width_ns', np.nan), 'pmt_hv': meta.get('pmt_hv', np.nan), 'source': meta.get('source', ''),
+        'scintillator': meta.get('scintillator', ''), 'trigger_threshold_common': meta.get('trigger_threshold_common', np.nan)
+    }
+    # plain Python values, the same whether the summary is fresh or from the cache
+    return {k: _json_value(v) for k, v in summary.items()}
+
+def _json_value(v):
+    if isinstance(v, bytes):
+        return v.decode('utf-8', 'replace')
+    if isinstance(v, np.generic):
+        return v.item()
+    return v
+
+def _file_fingerprint(fpath):
+    # size, mtime and a hash of the first FINGERPRINT_BYTES (a rewritten file with the same mtime is unlikely
+    # to have the same header: the HDF5 superblock and attributes are at the start)
+    st = os.stat(fpath)
+    h = hashlib.sha1()
+    with open(fpath, 'rb') as f:
+        h.update(f.read(FINGERPRINT_BYTES))
+    return f"{st.st_size}:{st.st_mtime_ns}:{h.hexdigest()}"
+
+def _metadata_fingerprint(fpath):
+    # the summary also depends on the metadata taken from outside the file (run_info file or run catalog row)
+    try:
+        with h5py.File(fpath, 'r') as f:
+            metadata = _load_metadata(f, os.path.abspath(fpath))
+    except Exception:
+        return None
+    text = json.dumps({k: _json_value(v) for k, v in metadata.items()}, sort_keys=True, default=str)
+    return hashlib.sha1(text.encode()).hexdigest()
+
+def _cache_key(fpath, params):
+    fingerprint = [_file_fingerprint(fpath), _metadata_fingerprint(fpath), params]
+    return hashlib.sha1(json.dumps(fingerprint, sort_keys=True).encode()).hexdigest()
+
+def _load_cache(cache_path):
+    try:
+        with open(cache_path, 'r') as f:
+            cache = json.load(f)
+        if cache.get('version') == ANALYSIS_CACHE_VERSION:
+            return cache.get('entries', {})
+    except (OSError, ValueError):
+        pass
+    return {}
+
+def _save_cache(cache_path, entries):
+    tmp = cache_path + '.tmp'
+    try:
+        with open(tmp, 'w') as f:
+            json.dump({'version': ANALYSIS_CACHE_VERSION, 'entries': entries}, f)
+        os.replace(tmp, cache_path)
+    except OSError as e:
+        print(f"Failed to save the analysis cache {cache_path}: {e}")
+
+def analyze_folder(folder_path, pattern='.h5', align=True, streaming=False, chunk_events=None, cache=True, workers=None):
+    # The summaries are cached in ANALYSIS_CACHE_FILE, keyed by the file and metadata fingerprints and the parameters
+    # that change the results; only the new or changed files (or run_info) are analyzed, in a pool of `workers`
+    # processes (default: one per CPU)
+    from concurrent.futures import ProcessPoolExecutor
     files = [os.path.join(folder_path, f) for f in os.listdir(folder_path) if f.endswith(pattern)]
-    results = []
+    cache_path = os.path.join(folder_path, ANALYSIS_CACHE_FILE)
+    entries = _load_cache(cache_path) if cache else {}
+    params = {'version': ANALYSIS_CACHE_VERSION, 'align': bool(align)}
+    summaries, keys, todo = {}, {}, []
     for fpath in files:
-        print(f"Analyzing {os.path.basename(fpath)}")
-        res = analyze_file(fpath, align=align)
-        if res and res['timing']:
-            t = res['timing']; meta = res['metadata']
-            summary = {
-                'file': os.path.basename(fpath), 'sampling_rate': meta.get('sampling_rate', np.nan), 'baseline': t.get('baseline', np.nan),
-                'amplitude': t.get('amplitude', np.nan), 'rise_samples': t.get('rise_time', -1), 'fall_samples': t.get('fall_time', -1),
-                'width_samples': t.get('pulse_width', -1), 'rise_time_ns': t.get('rise_time_ns', np.nan), 'fall_time_ns': t.get('fall_time_ns', np.nan),
-                'pulse_width_ns': t.get('pulse_width_ns', np.nan), 'pmt_hv': meta.get('pmt_hv', np.nan), 'source': meta.get('source', ''),
-                'scintillator': meta.get('scintillator', ''), 'trigger_threshold_common': meta.get('trigger_threshold_common', np.nan)
-            }
-            results.append(summary)
+        name = os.path.basename(fpath)
+        try:
+            keys[name] = _cache_key(fpath, params)
+        except OSError as e:
+            print(f"Failed to read {name}: {e}")
+            continue
+        entry = entries.get(name)
+        if entry is not None and entry.get('key') == keys[name]:
+            summaries[name] = entry.get('summary')
+        else:
+            todo.append(fpath)
+    if cache and len(todo) < len(keys):
+        print(f"Using cached results for {len(keys) - len(todo)} of {len(keys)} files")
+    if workers is None:
+        workers = os.cpu_count() or 1
+    workers = max(1, min(workers, len(todo)))
+    if workers == 1:
+        for fpath in todo:
+            print(f"Analyzing {os.path.basename(fpath)}")
+            summaries[os.path.basename(fpath)] = _summarize_file(fpath, align, streaming, chunk_events)
+    elif todo:
+        print(f"Analyzing {len(todo)} files in {workers} processes")
+        with ProcessPoolExecutor(max_workers=workers) as pool:
+            futures = {os.path.basename(f): pool.submit(_summarize_file, f, align, streaming, chunk_events) for f in todo}
+            for name, fut in futures.items():
+                try:
+                    summaries[name] = fut.result()
+                except Exception as e:
+                    print(f"Failed to analyze {name}: {e}")
+                    keys.pop(name)
+                else:
+                    print(f"Analyzed {name}")
+    if cache and todo:
+        # the failed files are cached too (None), the deleted ones are dropped
+        _save_cache(cache_path, {name: {'key': keys[name], 'summary': summaries.get(name)} for name in keys})
+    results = [summaries[os.path.basename(f)] for f in files if summaries.get(os.path.basename(f))]
     return pd.DataFrame(results)
 
 def main():
@@ -276,6 +550,22 @@ def main():
         '--no-align', action='store_true',
         help='Disable peak alignment'
     )
+    parser.add_argument(
+        '--streaming', action='store_true',
+        help='Read the waveforms in chunks (bounded memory, for large runs)'
+    )
+    parser.add_argument(
+        '--chunk-events', type=int, default=None,
+        help='Events per chunk of the streaming analysis (implies --streaming)'
+    )
+    parser.add_argument(
+        '--workers', type=int, default=None,
+        help='Processes analyzing the files (default: one per CPU)'
+    )
+    parser.add_argument(
+        '--no-cache', action='store_true',
+        help=f'Re-analyze all the files (ignore {ANALYSIS_CACHE_FILE})'
+    )
     parser.add_argument(
         '--save-csv', action='store_true',
         help='Save summary CSV'
@@ -286,7 +576,11 @@ def main():
     )
     args = parser.parse_args()
     
-    df = analyze_folder(args.folder, pattern='.h5', align=(not args.no_align))
+    df = analyze_folder(
+        args.folder, pattern='.h5', align=(not args.no_align),
+        streaming=args.streaming, chunk_events=args.chunk_events,
+        cache=(not args.no_cache), workers=args.workers
+    )
     print(df)
     
     if df.empty:
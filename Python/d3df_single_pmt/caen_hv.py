@@ -1,10 +1,12 @@
 """CAEN HV simple serial control utilities."""
 from __future__ import annotations
 import time
+import random
+import threading
 import serial
 from serial.serialutil import SerialException
 
-__all__ = ['send_caen_command']
+__all__ = ['send_caen_command', 'CaenHVConnection', 'SimulatedCaenHV', 'simulated_supply']
 
 def _build_command(
     cmd: str,
@@ -17,6 +19,151 @@ def _build_command(
         base += f",VAL:{val}"
     return base
 
+SIM_PREFIX = 'sim://'  # device name of the simulated supply (e.g. sim://hv0)
+
+
+def is_simulated(device: str) -> bool:
+    return device == 'sim' or device.startswith(SIM_PREFIX)
+
+
+def _parse_response(out: str) -> str:
+    out = out.strip()
+    if not out:
+        return ''
+    if ':' in out:
+        return out.split(':')[-1].split('\n')[0].strip().strip(';')
+    return out
+
+
+class SimulatedCaenHV:
+    """Simulated CAEN HV supply answering the serial protocol ($BD:00,CMD:...,CH:..,PAR:..[,VAL:..]).
+
+    Each channel ramps VMON towards VSET (0 when off) at RUP/RDW V/s, with gaussian readback noise.
+    `speedup` scales the time (faster ramps in tests); `latency` is the reply time of one command.
+    """
+
+    def __init__(self, channels: int = 4, ramp_up: float = 50.0, ramp_down: float = 50.0, noise: float = 0.05,
+                 latency: float = 0.02, speedup: float = 1.0, on: bool = True):
+        self.noise = noise
+        self.latency = latency
+        self.speedup = speedup
+        self.commands = 0
+        self.lock = threading.Lock()
+        now = time.monotonic()
+        self.ch = {str(c): {'VSET': 0.0, 'VMON': 0.0, 'ISET': 10.0, 'RUP': ramp_up, 'RDW': ramp_down,
+                            'ON': on, 't': now} for c in range(channels)}
+        self.rng = random.Random(0)
+
+    def _update(self, c):
+        now = time.monotonic()
+        dt = (now - c['t']) * self.speedup
+        c['t'] = now
+        target = c['VSET'] if c['ON'] else 0.0
+        step = (c['RUP'] if abs(target) > abs(c['VMON']) else c['RDW']) * dt
+        if abs(target - c['VMON']) <= step:
+            c['VMON'] = target
+        else:
+            c['VMON'] += step if target > c['VMON'] else -step
+
+    def handle(self, command: str) -> str:
+        fields = dict(f.split(':', 1) for f in command.strip().lstrip('$').split(',') if ':' in f)
+        cmd, par, chan = fields.get('CMD', ''), fields.get('PAR', ''), fields.get('CH', '0')
+        if self.latency:
+            time.sleep(self.latency)
+        with self.lock:
+            self.commands += 1
+            c = self.ch.get(chan)
+            if c is None:
+                return '#BD:00,CH:ERR'
+            self._update(c)
+            if cmd == 'MON':
+                if par == 'VMON':
+                    val = c['VMON'] + (self.rng.gauss(0.0, self.noise) if self.noise and c['VMON'] else 0.0)
+                    return f'#BD:00,CMD:OK,VAL:{val:.1f}'
+                if par == 'IMON':
+                    return f"#BD:00,CMD:OK,VAL:{abs(c['VMON']) * 1e-3:.2f}"
+                if par == 'STAT':
+                    ramping = c['VMON'] != (c['VSET'] if c['ON'] else 0.0)
+                    return f"#BD:00,CMD:OK,VAL:{int(c['ON']) | (ramping << 1)}"
+                if par in c:
+                    return f'#BD:00,CMD:OK,VAL:{c[par]}'
+                return '#BD:00,PAR:ERR'
+            if cmd == 'SET':
+                if par in ('ON', 'OFF'):
+                    c['ON'] = par == 'ON'
+                    return '#BD:00,CMD:OK'
+                if par not in ('VSET', 'ISET', 'RUP', 'RDW'):
+                    return '#BD:00,PAR:ERR'
+                try:
+                    c[par] = float(fields['VAL'])
+                except (KeyError, ValueError):
+                    return '#BD:00,VAL:ERR'
+                return '#BD:00,CMD:OK'
+            return '#BD:00,CMD:ERR'
+
+
+_simulated: dict[str, SimulatedCaenHV] = {}
+_simulated_lock = threading.Lock()
+
+
+def simulated_supply(device: str = SIM_PREFIX) -> SimulatedCaenHV:
+    """The simulated supply of a device name (one per name and process)."""
+    with _simulated_lock:
+        if device not in _simulated:
+            _simulated[device] = SimulatedCaenHV()
+        return _simulated[device]
+
+
+class CaenHVConnection:
+    """Serial line to a CAEN HV supply kept open between commands (sim://... = simulated supply)."""
+
+    def __init__(self, device: str = '/dev/caen_hv', baudrate: int = 9600, timeout: float = 1.0):
+        self.device = device
+        self.baudrate = baudrate
+        self.timeout = timeout
+        self.ser = None
+
+    def open(self):
+        if self.ser is not None or is_simulated(self.device):
+            return
+        try:
+            self.ser = serial.serial_for_url(
+                self.device,
+                self.baudrate,
+                parity=serial.PARITY_NONE,
+                xonxoff=True,
+                stopbits=serial.STOPBITS_ONE,
+                timeout=self.timeout,
+            )
+        except SerialException as e:
+            raise RuntimeError(f"Serial open failed: {e}") from e
+
+    def close(self):
+        if self.ser is not None:
+            try:
+                self.ser.close()
+            except SerialException:
+                pass
+        self.ser = None
+
+    def query(self, cmd: str, par: str, val: str | None = None, channel: str = '2') -> str:
+        command = _build_command(cmd, par, channel, val)
+        if is_simulated(self.device):
+            return _parse_response(simulated_supply(self.device).handle(command))
+        self.open()
+        try:
+            self.ser.reset_input_buffer()
+            self.ser.write((command + '\r\n').encode())
+            time.sleep(0.2)
+            out_bytes = b''
+            while self.ser.in_waiting > 0:
+                out_bytes += self.ser.read(1)
+            return _parse_response(out_bytes.decode(errors='ignore'))
+        except SerialException as e:
+            self.close()
+            raise RuntimeError(f"Serial IO failed: {e}") from e
+
+
 def send_caen_command(
     cmd: str,
     par: str,
@@ -26,33 +173,11 @@ def send_caen_command(
     baudrate: int = 9600,
     timeout: float = 1.0,
 ) -> str:
-    command = _build_command(cmd, par, channel, val)
-    try:
-        ser = serial.serial_for_url(
-            device,
-            baudrate,
-            parity=serial.PARITY_NONE,
-            xonxoff=True,
-            stopbits=serial.STOPBITS_ONE,
-            timeout=timeout,
-        )
-    except SerialException as e:
-        raise RuntimeError(f"Serial open failed: {e}") from e
+    conn = CaenHVConnection(device, baudrate, timeout)
     try:
-        ser.write((command + '\r\n').encode())
-        time.sleep(0.2)
-        out_bytes = b''
-        while ser.in_waiting > 0:
-            out_bytes += ser.read(1)
-        ser.close()
-        out = out_bytes.decode(errors='ignore').strip()
-        if not out:
-            return ''
-        if ':' in out:
-            return out.split(':')[-1].split('\n')[0].strip().strip(';')
-        return out
-    except SerialException as e:
-        raise RuntimeError(f"Serial IO failed: {e}") from e
+        return conn.query(cmd, par, val, channel)
+    finally:
+        conn.close()
 
 def main():
     import argparse
@@ -69,7 +194,7 @@ def main():
         '--channel', default='1', help='HV channel (default 1)'
     )
     parser.add_argument(
-        '--device', default='COM10', help='Serial device path or URL  (default COM10)'
+        '--device', default='COM10', help='Serial device path or URL, sim:// = simulated supply (default COM10)'
     )
     parser.add_argument(
         '--baudrate', type=int, default=9600, help='Baud rate (default 9600)'
@@ -3,6 +3,8 @@ import re
 import numpy as np
 import h5py
 
+from .run_catalog import catalog_run_info
+
 
 __all__ = [
     'parse_run_info',
@@ -81,7 +83,9 @@ def convert_csv_to_hdf5(
     csv_dir = os.path.dirname(csv_file)
     hdf5_filename = os.path.join(csv_dir, f"{output_prefix}.h5")
     run_info_path = _derive_run_info(csv_file)
-    run_info_data = parse_run_info(run_info_path)
+    run_info_data = catalog_run_info(csv_file)
+    if run_info_data is None:
+        run_info_data = parse_run_info(run_info_path)
     if os.path.exists(hdf5_filename):
         print(f"HDF5 exists; skip: {hdf5_filename}")
         return hdf5_filename
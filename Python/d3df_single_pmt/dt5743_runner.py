@@ -4,6 +4,7 @@ import argparse
 import subprocess
 import threading
 import time
+import json
 from datetime import datetime
 import logging
 
@@ -13,6 +14,8 @@ except Exception:
     yaml = None
 
 from .caen_hv import main as caen_hv_main
+from .scan_pipeline import PostProcessPool, point_files, DEFAULT_WORKERS, DEFAULT_MAX_PENDING
+from .run_catalog import open_catalog
 from io import StringIO
 import contextlib
 from logging import handlers
@@ -61,7 +64,9 @@ def generate_ini_from_yaml(yaml_path, output_ini_path, overrides, channel_overri
                    'OUTPUT_FILE_FORMAT', 'OUTPUT_FILE_HEADER', 'OUTPUT_FILE_TIMESTAMP_UNIT',
                    'STATS_RUN_ENABLE', 'PLOT_RUN_ENABLE', 'DGTZ_RESET', 'SYNC_ENABLE',
                    'TRIGGER_FIXED', 'BOARD_REF', 'CHANNEL_REF', 'ENERGY_H_NBIN', 'TIME_H_NBIN',
-                   'TIME_H_MODE', 'TIME_H_MIN', 'TIME_H_MAX', 'BATCH_MODE', 'BATCH_MAX_EVENTS', 'BATCH_MAX_TIME']:
+                   'TIME_H_MODE', 'TIME_H_MIN', 'TIME_H_MAX', 'BATCH_MODE', 'BATCH_MAX_EVENTS', 'BATCH_MAX_TIME',
+                   'STATUS_HISTOGRAMS', 'EMULATE_THRESHOLDS', 'EMULATE_DISCR',
+                   'CALIBRATION_EVENTS', 'CALIBRATION_PATTERNS', 'CALIBRATION_FILE']:
             cfg.setdefault('OPTIONS', {})[key] = value
         else:
             cfg.setdefault('COMMON', {})[key] = value
@@ -101,8 +106,9 @@ def generate_ini_from_yaml(yaml_path, output_ini_path, overrides, channel_overri
     def write_section(section_name, section_data):
         lines.append(f"[{section_name}]\n")
         for key, value in section_data.items():
-            ini_val = value_to_ini(value)
-            lines.append(f"{key} = {ini_val}\n")
+            # A list is written as repeated keys (e.g. several CUT lines)
+            for item in (value if isinstance(value, list) else [value]):
+                lines.append(f"{key} = {value_to_ini(item)}\n")
         lines.append("\n")
 
     # Write sections in order
@@ -146,9 +152,24 @@ def prepend_setup_to_run_info(run_info_path, setup):
 
 
 def find_latest_run_files(output_dir):
-    """Return latest Wave_0_0.txt and run_info.txt in output_dir, if present."""
+    """Return latest Wave_0_0.txt and run_info.txt in output_dir, if present.
+
+    The run catalog of the folder answers when its newest run is complete; otherwise (no catalog, or a run
+    in progress whose files are not cataloged yet) the folder is listed.
+    """
     if not os.path.isdir(output_dir):
         return None, None
+    catalog = open_catalog(output_dir, create=False)
+    if catalog is not None:
+        try:
+            newest = catalog.find_runs(limit=1)
+            if newest and newest[0]['state'] != 'running':
+                wave = catalog.latest_file('wave', 0, 0, folder=output_dir)
+                info = catalog.latest_file('run_info', folder=output_dir)
+                if wave or info:
+                    return wave, info
+        except Exception:
+            pass
     txts = [f for f in os.listdir(output_dir) if f.endswith('_Wave_0_0.txt')]
     infos = [f for f in os.listdir(output_dir) if f.endswith('_run_info.txt')]
     if not txts and not infos:
@@ -169,8 +190,31 @@ def find_latest_run_files(output_dir):
     )
 
 
-def run_wavedemo(exe_path, ini_path, batch_mode=None, output_path=None, enable_quit=True, logger=None):
-    """Run WaveDemo_x743.exe with provided ini and optional overrides, streaming stdout."""
+def parse_status_line(line):
+    """Return the decoded WaveDemo status record (``--status``) in ``line``, or None.
+
+    Status records are JSON objects with an ``ev`` field, one per line.
+    """
+    line = line.strip()
+    if not line.startswith('{"ev"'):
+        return None
+    try:
+        rec = json.loads(line)
+    except ValueError:
+        return None
+    return rec if isinstance(rec, dict) else None
+
+
+def run_wavedemo(exe_path, ini_path, batch_mode=None, output_path=None, enable_quit=True, logger=None,
+                 status_stream=False, status_records=None, marker_file=None, extra_args=None):
+    """Run WaveDemo_x743.exe with provided ini and optional overrides, streaming stdout.
+
+    With ``status_stream`` the exe is started with ``--status - --quiet``: its stdout then carries only
+    JSON Lines status records, which are forwarded unchanged to our stdout (for a supervising process)
+    and appended to ``status_records`` if a list is given.
+    With ``marker_file`` the exe reads scan step markers from that file (continuous acquisition).
+    ``extra_args`` are appended to the command line (e.g. ``['--reprocess', raw_file]``).
+    """
     cmd = [exe_path]
     if ini_path:
         cmd.append(ini_path)
@@ -178,6 +222,14 @@ def run_wavedemo(exe_path, ini_path, batch_mode=None, output_path=None, enable_q
         cmd.extend(['--batch-mode', str(batch_mode)])
     if output_path:
         cmd.extend(['--output-path', output_path])
+    if status_stream:
+        cmd.extend(['--status', '-'])
+        if batch_mode:
+            cmd.append('--quiet')
+    if marker_file:
+        cmd.extend(['--marker-file', marker_file])
+    if extra_args:
+        cmd.extend(extra_args)
 
     # Start process and stream output line-by-line
     if logger:
@@ -224,6 +276,15 @@ def run_wavedemo(exe_path, ini_path, batch_mode=None, output_path=None, enable_q
     try:
         # Read stdout live
         for line in proc.stdout:
+            rec = parse_status_line(line) if status_stream else None
+            if rec is not None:
+                sys.stdout.write(line)
+                sys.stdout.flush()
+                if status_records is not None and rec.get('ev') != 'histo':
+                    status_records.append(rec)
+                if logger and rec.get('ev') in ('state', 'error'):
+                    logger.info(f"WaveDemo status: {line.strip()}")
+                continue
             if logger:
                 logger.info(line.rstrip())
             stdout_lines.append(line)
@@ -242,6 +303,54 @@ def run_wavedemo(exe_path, ini_path, batch_mode=None, output_path=None, enable_q
     return proc.returncode, ''.join(stdout_lines), ''.join(stderr_lines)
 
 
+def find_raw_file(status_records, output_dir):
+    """Raw data file of a run, from its status records or the newest *_raw.dat in output_dir."""
+    for rec in status_records:
+        if rec.get('ev') == 'file' and rec.get('kind') == 'raw' and rec.get('path'):
+            return rec['path']
+    if not os.path.isdir(output_dir):
+        return None
+    raws = [os.path.join(output_dir, f) for f in os.listdir(output_dir) if f.endswith('_raw.dat')]
+    return max(raws, key=os.path.getmtime) if raws else None
+
+
+def replay_thresholds(args, raw_path, overrides, channel_overrides, logger):
+    """Replay a raw data file with the thresholds of --emulate-thresholds (WaveDemo --reprocess).
+
+    One pass over the file gives the counts, rates and histograms of every emulated threshold
+    (<prefix>thr_emulation.txt); returns the 'thr_point' status records (empty without --status-stream).
+    """
+    # the replay writes only the histograms and the emulation summary
+    replay = dict(overrides, SAVE_RAW_DATA='NO', SAVE_WAVEFORM='NO', SAVE_LISTS='NO', SAVE_TDC_LIST='NO',
+                  BATCH_MAX_EVENTS=0, BATCH_MAX_TIME=0,
+                  EMULATE_THRESHOLDS=' '.join(f'{t:g}' for t in args.emulate_thresholds),
+                  EMULATE_DISCR=args.emulate_discr)
+    ini_path = os.path.join(args.data_output, 'WaveDemoConfig.replay.ini')
+    generate_ini_from_yaml(args.yaml, ini_path, replay, channel_overrides)
+    logger.info(f"Emulating {len(args.emulate_thresholds)} thresholds on {raw_path}...")
+    records = []
+    code, _, _ = run_wavedemo(args.exe, ini_path, batch_mode=args.batch_mode, output_path=args.data_output,
+                              enable_quit=False, logger=logger, status_stream=args.status_stream,
+                              status_records=records, extra_args=['--reprocess', raw_path])
+    if code != 0:
+        logger.error(f"Threshold emulation failed with code {code}")
+    points = [r for r in records if r.get('ev') == 'thr_point']
+    for r in points:
+        logger.info(f"  thr {r['thr']:g} V {r['discr']} b{r['board']} ch{r['channel']}: "
+                    f"{r['triggered']}/{r['events']} events, {r['rate']:.1f} Hz")
+    return points
+
+
+def format_hv(val):
+    """HV value as a negative string (integer when possible), as in the run_info header."""
+    val = float(val)
+    if val > 0:
+        val = -val
+    if val.is_integer():
+        return str(int(val))
+    return f"{val:.3f}".rstrip('0').rstrip('.')
+
+
 def get_current_hv(hv_device=None, hv_baudrate=None, hv_timeout=None, hv_channel=None):
     """Query CAEN HV monitor (vmon) via caen-hv CLI and return HV value as negative string.
 
@@ -275,13 +384,7 @@ def get_current_hv(hv_device=None, hv_baudrate=None, hv_timeout=None, hv_channel
                 m = re.search(r"[-+]?\d+(?:\.\d+)?", line)
                 if m:
                     try:
-                        val = float(m.group(0))
-                        if val > 0:
-                            val = -val
-                        if val.is_integer():
-                            parsed = str(int(val))
-                        else:
-                            parsed = f"{val:.3f}".rstrip('0').rstrip('.')
+                        parsed = format_hv(m.group(0))
                         logging.getLogger('dt5743_runner').info(f"Parsed HV value: {parsed}")
                         return parsed
                     except Exception:
@@ -290,12 +393,7 @@ def get_current_hv(hv_device=None, hv_baudrate=None, hv_timeout=None, hv_channel
         m2 = re.search(r"[-+]?\d+(?:\.\d+)?", output)
         if m2:
             try:
-                val = float(m2.group(0))
-                if val > 0:
-                    val = -val
-                if val.is_integer():
-                    return str(int(val))
-                return f"{val:.3f}".rstrip('0').rstrip('.')
+                return format_hv(m2.group(0))
             except Exception:
                 raw = m2.group(0)
                 return '-' + raw.lstrip('+') if not raw.startswith('-') else raw
@@ -304,6 +402,112 @@ def get_current_hv(hv_device=None, hv_baudrate=None, hv_timeout=None, hv_channel
         return ''
 
 
+def set_hv(args, value, logger):
+    """Set the PMT HV via caen-hv (and log the readback with --check-hv)."""
+    try:
+        # Call caen-hv main with args-like emulation
+        sys_argv_backup = sys.argv
+        hv_argv = ['caen-hv']
+        if args.hv_device:
+            hv_argv += ['--device', str(args.hv_device)]
+        if args.hv_baudrate:
+            hv_argv += ['--baudrate', str(args.hv_baudrate)]
+        if args.hv_timeout is not None:
+            hv_argv += ['--timeout', str(args.hv_timeout)]
+        if args.hv_channel is not None:
+            hv_argv += ['--channel', str(args.hv_channel)]
+        # Correct HV set syntax: set vset --val <HV>
+        hv_argv += ['set', 'vset', '--val', str(value)]
+        sys.argv = hv_argv
+        logger.info(f"Setting HV via command: caen-hv set vset --val {value} (device={args.hv_device}, baud={args.hv_baudrate}, timeout={args.hv_timeout}, channel={args.hv_channel})")
+        caen_hv_main()
+        # Optional check/monitor after set
+        if args.check_hv:
+            buf = StringIO()
+            sys.argv = hv_argv[:1] + hv_argv[1:hv_argv.index('set')] + ['mon', 'vmon']
+            with contextlib.redirect_stdout(buf):
+                caen_hv_main()
+            for ln in buf.getvalue().splitlines():
+                logger.info(ln)
+        logger.info("HV set/check complete.")
+        sys.argv = sys_argv_backup
+    except Exception as e:
+        logger.error(f"HV set/check failed: {e}")
+
+
+def run_point(args, ini_path, hv, logger, catalog=None, point=None):
+    """Acquire one scan point: run WaveDemo and add the setup header to its run_info.
+
+    The run is recorded in the run catalog (if any) when it starts and when it ends; with --status-stream its
+    id is announced to the supervising process by a {"ev":"catalog"} record.
+    Returns the status records of the run (empty without --status-stream) and its catalog id (or None).
+    """
+    setup = {'pmt': args.pmt, 'source': args.source, 'scintillator': args.scintillator}
+    run_id = None
+    if catalog is not None:
+        try:
+            run_id = catalog.start_run(folder=args.data_output, scan_id=args.scan_id, point=point, hv_set=hv,
+                                       threshold=args.trigger_threshold, config_path=ini_path, setup=setup)
+            if args.status_stream:
+                sys.stdout.write(json.dumps({'ev': 'catalog', 'run_id': run_id, 'catalog': catalog.path}) + '\n')
+                sys.stdout.flush()
+        except Exception as e:
+            logger.warning(f"Run catalog not updated: {e}")
+
+    # Run WaveDemo in batch mode
+    logger.info("Launching WaveDemo and waiting for it to finish...")
+    status_records = []
+    code, out, err = run_wavedemo(
+        args.exe,
+        ini_path,
+        batch_mode=args.batch_mode,
+        output_path=args.data_output,
+        logger=logger,
+        status_stream=args.status_stream,
+        status_records=status_records,
+        marker_file=args.marker_file,
+    )
+    if code != 0:
+        logger.error(f"WaveDemo_x743.exe exited with error code: {code}")
+        if err:
+            for el in err.splitlines():
+                logger.error(el)
+    else:
+        logger.info('WaveDemo completed successfully.')
+
+    # Find generated run_info and prepend setup header (reported by the status stream, if any)
+    _, info_path = point_files(status_records, args.data_output)
+    # Determine PMT_HV from monitor if available; otherwise fall back to the set value
+    if args.hv_mon is not None:
+        hv_str = format_hv(args.hv_mon)
+    elif args.no_hv_control:
+        hv_str = ''
+    else:
+        hv_str = get_current_hv(
+            hv_device=args.hv_device,
+            hv_baudrate=args.hv_baudrate,
+            hv_timeout=args.hv_timeout,
+            hv_channel=args.hv_channel,
+        )
+    if not hv_str:
+        hv_str = f"{int(hv) if hv is not None else ''}"
+    setup['pmt_hv'] = hv_str
+    if info_path:
+        changed = prepend_setup_to_run_info(info_path, setup)
+        if changed:
+            logger.info(f"Prepended setup header to: {info_path}")
+        else:
+            logger.info(f"Setup header already present or run_info missing: {info_path}")
+    else:
+        logger.warning('No run_info file found to modify.')
+    if run_id is not None:
+        try:
+            catalog.end_run(run_id, exit_code=code, status_records=status_records, run_info_path=info_path)
+        except Exception as e:
+            logger.warning(f"Run catalog not updated: {e}")
+    return status_records, run_id
+
+
 def main():
     parser = argparse.ArgumentParser(
         description='Configure and run WaveDemo_x743.exe, optionally set HV, and augment run_info.'
@@ -333,6 +537,39 @@ def main():
     parser.add_argument('--hv-baudrate', type=int, default=9600, help='Baudrate for CAEN HV serial (default: 9600)')
     parser.add_argument('--hv-timeout', type=float, help='Timeout seconds for CAEN HV communication')
     parser.add_argument('--hv-channel', type=int, help='Target CAEN HV channel to operate on')
+    parser.add_argument('--no-hv-control', action='store_true',
+                        help='The HV supply is controlled by the caller (web interface HV broker): '
+                             '--set-hv only records the value and the supply is never accessed')
+    parser.add_argument('--hv-mon', type=float,
+                        help='HV readback recorded as PMT_HV in run_info (instead of querying the supply)')
+    parser.add_argument('--status-stream', action='store_true',
+                        help='Run WaveDemo with a JSON Lines status stream and forward the records to stdout')
+    parser.add_argument('--live-histos', type=str.upper, choices=['NO', 'ENERGY', 'TIME', 'ALL'],
+                        help='Histograms sent as deltas on the status stream for a live view (STATUS_HISTOGRAMS)')
+    parser.add_argument('--emulate-thresholds', type=lambda v: [float(x) for x in v.split(',') if x.strip()],
+                        help='Comma-separated thresholds (V) emulated on the raw data of each point: the point is '
+                             'acquired once (at --trigger-threshold, the lowest one) and replayed (EMULATE_THRESHOLDS)')
+    parser.add_argument('--emulate-discr', type=str.upper, choices=['SAME', 'LED', 'CFD', 'BOTH'], default='SAME',
+                        help='Discriminators emulated for each threshold (EMULATE_DISCR, default: SAME)')
+    parser.add_argument('--marker-file',
+                        help='Scan step marker file read by WaveDemo (continuous acquisition across scan steps)')
+    parser.add_argument('--hv-scan', type=lambda v: [float(x) for x in v.split(',') if x.strip()],
+                        help='Comma-separated HV points acquired one after the other (instead of --set-hv)')
+    parser.add_argument('--hv-settle', type=float, default=0,
+                        help='Seconds to wait after setting the HV of a point (default: 0)')
+    parser.add_argument('--postprocess', action='store_true',
+                        help='Convert and analyze each point in the background while the scan goes on '
+                             '(needs SAVE_WAVEFORM with OUTPUT_FILE_FORMAT = ASCII)')
+    parser.add_argument('--postprocess-workers', type=int, default=DEFAULT_WORKERS,
+                        help=f'Processes converting/analyzing the points (default: {DEFAULT_WORKERS})')
+    parser.add_argument('--scan-id',
+                        help='Id grouping the runs of this scan in the run catalog (default: the start time)')
+    parser.add_argument('--scan-point', type=int, default=0,
+                        help='Index of the first point of this invocation in the scan (default: 0)')
+    parser.add_argument('--no-catalog', action='store_true',
+                        help='Do not record the runs in <data-output>/run_catalog.sqlite')
+    parser.add_argument('--postprocess-max-pending', type=int, default=DEFAULT_MAX_PENDING,
+                        help=f'Points queued for post-processing before the scan waits (default: {DEFAULT_MAX_PENDING})')
     args = parser.parse_args()
 
     # Ensure PyYAML availability
@@ -351,6 +588,10 @@ def main():
         overrides['TRIGGER_THRESHOLD'] = args.trigger_threshold
     if args.sampling_frequency is not None:
         overrides['SAMPLING_FREQUENCY'] = args.sampling_frequency
+    if args.live_histos:
+        overrides['STATUS_HISTOGRAMS'] = args.live_histos
+    if args.emulate_thresholds:
+        overrides['SAVE_RAW_DATA'] = 'YES'  # replayed with the emulated thresholds
 
     # Parse per-channel thresholds
     channel_overrides = {}
@@ -380,81 +621,65 @@ def main():
     ini_path = generate_ini_from_yaml(args.yaml, ini_out_path, overrides, channel_overrides)
     logger = setup_logger(args.data_output)
     logger.info(f"Generated INI: {os.path.abspath(ini_path)}")
+    catalog = None
+    if not args.no_catalog:
+        catalog = open_catalog(args.data_output)
+        if catalog is None:
+            logger.warning(f"Can't open the run catalog in {args.data_output}")
+        if not args.scan_id:
+            args.scan_id = datetime.now().strftime('%Y-%m-%d_%H-%M-%S')
+
+    # Scan points: the post-processing of a point runs in the background while the HV of the next one
+    # is set and it is acquired
+    hv_points = args.hv_scan if args.hv_scan else [args.set_hv]
+    pool = None
+    results = []
+    if args.postprocess:
+        pool = PostProcessPool(workers=args.postprocess_workers, max_pending=args.postprocess_max_pending)
+
+    def postprocessed(result, error, run_id=None):
+        if error is not None or not result or not result.get('summary'):
+            logger.error(f"Post-processing failed: {error or 'no valid pulses'}")
+            return
+        results.append(result['summary'])
+        logger.info(f"Analyzed {result['hdf5']} in {result['convert_s'] + result['analyze_s']:.1f} s")
+        if catalog is not None and run_id is not None:
+            try:
+                catalog.set_analysis(run_id, result['summary'])
+            except Exception as e:
+                logger.warning(f"Run catalog not updated: {e}")
 
-    # Optionally set HV via caen-hv
-    if args.set_hv is not None:
-        try:
-            # Call caen-hv main with args-like emulation
-            sys_argv_backup = sys.argv
-            hv_argv = ['caen-hv']
-            if args.hv_device:
-                hv_argv += ['--device', str(args.hv_device)]
-            if args.hv_baudrate:
-                hv_argv += ['--baudrate', str(args.hv_baudrate)]
-            if args.hv_timeout is not None:
-                hv_argv += ['--timeout', str(args.hv_timeout)]
-            if args.hv_channel is not None:
-                hv_argv += ['--channel', str(args.hv_channel)]
-            # Correct HV set syntax: set vset --val <HV>
-            hv_argv += ['set', 'vset', '--val', str(args.set_hv)]
-            sys.argv = hv_argv
-            logger.info(f"Setting HV via command: caen-hv set vset --val {args.set_hv} (device={args.hv_device}, baud={args.hv_baudrate}, timeout={args.hv_timeout}, channel={args.hv_channel})")
-            caen_hv_main()
-            # Optional check/monitor after set
-            if args.check_hv:
-                buf = StringIO()
-                sys.argv = hv_argv[:1] + hv_argv[1:hv_argv.index('set')] + ['mon', 'vmon']
-                with contextlib.redirect_stdout(buf):
-                    caen_hv_main()
-                for ln in buf.getvalue().splitlines():
-                    logger.info(ln)
-            logger.info("HV set/check complete.")
-            sys.argv = sys_argv_backup
-        except Exception as e:
-            logger.error(f"HV set/check failed: {e}")
-
-    # Run WaveDemo in batch mode
-    logger.info("Launching WaveDemo and waiting for it to finish...")
-    code, out, err = run_wavedemo(
-        args.exe,
-        ini_path,
-        batch_mode=args.batch_mode,
-        output_path=args.data_output,
-        logger=logger,
-    )
-    if code != 0:
-        logger.error(f"WaveDemo_x743.exe exited with error code: {code}")
-        if err:
-            for el in err.splitlines():
-                logger.error(el)
-    else:
-        logger.info('WaveDemo completed successfully.')
-
-    # Find generated run_info and prepend setup header
-    txt_path, info_path = find_latest_run_files(args.data_output)
-    # Determine PMT_HV from monitor if available; otherwise fall back to --set-hv
-    hv_str = get_current_hv(
-        hv_device=args.hv_device,
-        hv_baudrate=args.hv_baudrate,
-        hv_timeout=args.hv_timeout,
-        hv_channel=args.hv_channel,
-    )
-    if not hv_str:
-        hv_str = f"{int(args.set_hv) if args.set_hv is not None else ''}"
-    setup = {
-        'pmt': args.pmt,
-        'pmt_hv': hv_str,
-        'source': args.source,
-        'scintillator': args.scintillator,
-    }
-    if info_path:
-        changed = prepend_setup_to_run_info(info_path, setup)
-        if changed:
-            logger.info(f"Prepended setup header to: {info_path}")
-        else:
-            logger.info(f"Setup header already present or run_info missing: {info_path}")
-    else:
-        logger.warning('No run_info file found to modify.')
+    try:
+        for i, hv in enumerate(hv_points):
+            if len(hv_points) > 1:
+                logger.info(f"Scan point {i + 1}/{len(hv_points)}: HV={hv}")
+            if hv is not None and not args.no_hv_control:
+                set_hv(args, hv, logger)
+                if args.hv_settle > 0:
+                    logger.info(f"Waiting {args.hv_settle} s for the HV to settle...")
+                    time.sleep(args.hv_settle)
+            status_records, run_id = run_point(args, ini_path, hv, logger, catalog, args.scan_point + i)
+            if args.emulate_thresholds:
+                raw_path = find_raw_file(status_records, args.data_output)
+                if raw_path:
+                    replay_thresholds(args, raw_path, overrides, channel_overrides, logger)
+                else:
+                    logger.warning('No raw data file to replay for the threshold emulation.')
+            if pool is not None:
+                wave_path, _ = point_files(status_records, args.data_output)
+                if wave_path:
+                    pool.submit(wave_path, lambda r, e, run_id=run_id: postprocessed(r, e, run_id))
+                else:
+                    logger.warning('No waveform file to post-process (SAVE_WAVEFORM with OUTPUT_FILE_FORMAT = ASCII).')
+    finally:
+        if pool is not None:
+            logger.info(f"Waiting for the post-processing of {pool.pending()} points...")
+            pool.close()
+    if results:
+        import pandas as pd
+        summary_path = os.path.join(args.data_output, 'scan_analysis.csv')
+        pd.DataFrame(results).to_csv(summary_path, index=False)
+        logger.info(f"Saved scan analysis: {summary_path}")
 
 
 if __name__ == '__main__':
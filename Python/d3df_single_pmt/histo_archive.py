@@ -0,0 +1,272 @@
+import os
+import time
+from concurrent.futures import ProcessPoolExecutor
+import numpy as np
+
+
+__all__ = [
+    'read_archive',
+    'write_archive',
+    'merge_archives',
+    'rebin_histograms',
+    'select_histograms',
+    'save_npz',
+]
+
+# Layout of the WaveDemo histogram archive (Readout_DT5743/include/WDHArchive.h)
+ARCHIVE_MAGIC = b'WDHARC01'
+RECORD_MAGIC = 0x52484457
+HEADER_DTYPE = np.dtype([
+    ('magic', 'S8'), ('header_size', '<u4'), ('record_size', '<u4'),
+    ('run_number', '<i4'), ('reserved', '<u4'), ('creation_time', '<u8'),
+    ('start_time', 'S32'), ('software', 'S32'),
+])
+RECORD_DTYPE = np.dtype([
+    ('magic', '<u4'), ('type', '<u2'), ('flags', '<u2'),
+    ('board', '<i2'), ('channel', '<i2'), ('step', '<i4'),
+    ('nbin', '<u4'), ('entries', '<u4'), ('overflow', '<u4'), ('underflow', '<u4'),
+    ('xmin', '<f8'), ('xmax', '<f8'), ('calib_m', '<f4'), ('calib_q', '<f4'),
+    ('hv_set', '<f4'), ('hv_mon', '<f4'), ('threshold', '<f4'), ('reserved', '<u4'),
+    ('save_time', '<u8'), ('name', 'S32'), ('unit', 'S16'),
+])
+TYPE_NAMES = {0: 'energy', 1: 'time', 2: 'plugin'}
+FLAG_SETTLING = 0x1
+FLAG_EMULATED = 0x4         # point of the threshold emulation (step = index of the point)
+COUNT_FIELDS = ('entries', 'overflow', 'underflow')
+UINT32_MAX = np.iinfo(np.uint32).max
+
+
+def histogram_key(rec):
+    return (int(rec['type']), bytes(rec['name']), int(rec['board']), int(rec['channel']),
+            int(rec['step']), int(rec['flags']) & (FLAG_SETTLING | FLAG_EMULATED))
+
+
+def read_archive(path):
+    """Read an archive; returns (header, {key: (record, bins)}) with the last saved record of each key."""
+    buf = np.fromfile(path, dtype=np.uint8)
+    if buf.size < HEADER_DTYPE.itemsize:
+        raise ValueError(f'{path}: not a histogram archive')
+    header = np.frombuffer(buf, HEADER_DTYPE, count=1)[0].copy()
+    if (bytes(header['magic']) != ARCHIVE_MAGIC or header['header_size'] != HEADER_DTYPE.itemsize
+            or header['record_size'] != RECORD_DTYPE.itemsize):
+        raise ValueError(f'{path}: not a histogram archive of this version')
+    histos = {}
+    pos = HEADER_DTYPE.itemsize
+    while pos + RECORD_DTYPE.itemsize <= buf.size:
+        rec = np.frombuffer(buf, RECORD_DTYPE, count=1, offset=pos)[0].copy()
+        end = pos + RECORD_DTYPE.itemsize + 4 * int(rec['nbin'])
+        if rec['magic'] != RECORD_MAGIC:
+            raise ValueError(f'{path}: corrupted record at byte {pos}')
+        if end > buf.size:
+            break  # truncated by an interrupted save
+        bins = np.frombuffer(buf, '<u4', count=int(rec['nbin']), offset=pos + RECORD_DTYPE.itemsize).copy()
+        histos[histogram_key(rec)] = (rec, bins)
+        pos = end
+    return header, histos
+
+
+def write_archive(path, header, histos):
+    """Write the histograms in one pass (temporary file renamed at the end)."""
+    header = header.copy()
+    header['magic'] = ARCHIVE_MAGIC
+    header['header_size'] = HEADER_DTYPE.itemsize
+    header['record_size'] = RECORD_DTYPE.itemsize
+    tmp = f'{path}.tmp'
+    with open(tmp, 'wb') as fh:
+        fh.write(header.tobytes())
+        for rec, bins in histos.values():
+            rec = rec.copy()
+            rec['magic'] = RECORD_MAGIC
+            rec['nbin'] = bins.size
+            fh.write(rec.tobytes())
+            fh.write(np.ascontiguousarray(bins, dtype='<u4').tobytes())
+    os.replace(tmp, path)
+
+
+def _map(func, items, workers):
+    items = list(items)
+    if workers == 1 or len(items) < 2:
+        return [func(item) for item in items]
+    with ProcessPoolExecutor(max_workers=workers) as pool:
+        return list(pool.map(func, items))
+
+
+def _same_binning(a, b):
+    return a['nbin'] == b['nbin'] and a['xmin'] == b['xmin'] and a['xmax'] == b['xmax']
+
+
+def merge_archives(paths, workers=None):
+    """Sum the histograms with the same key of several archives (read in parallel)."""
+    archives = _map(read_archive, paths, workers)
+    sums = {}
+    for path, (_, histos) in zip(paths, archives):
+        for key, (rec, bins) in histos.items():
+            if key not in sums:
+                sums[key] = (rec.copy(), bins.astype(np.uint64))
+                continue
+            total_rec, total = sums[key]
+            if not _same_binning(total_rec, rec):
+                raise ValueError(f'{path}: binning of {describe_key(key)} differs from the other archives')
+            total += bins
+            for field in COUNT_FIELDS:
+                total_rec[field] = min(int(total_rec[field]) + int(rec[field]), UINT32_MAX)
+            total_rec['save_time'] = max(total_rec['save_time'], rec['save_time'])
+    merged = {}
+    for key, (rec, total) in sums.items():
+        if total.size and total.max() > UINT32_MAX:
+            raise ValueError(f'{describe_key(key)}: merged counts exceed 32 bits')
+        merged[key] = (rec, total.astype(np.uint32))
+
+    headers = [header for header, _ in archives]
+    header = headers[0].copy()
+    runs = {int(h['run_number']) for h in headers}
+    header['run_number'] = runs.pop() if len(runs) == 1 else -1
+    starts = sorted(bytes(h['start_time']) for h in headers if bytes(h['start_time']))
+    header['start_time'] = starts[0] if starts else b''
+    header['creation_time'] = int(time.time())
+    return header, merged
+
+
+def rebin_histograms(histos, factor):
+    """Sum groups of factor adjacent bins (the last group is padded with empty bins)."""
+    if factor < 1:
+        raise ValueError('the rebin factor must be >= 1')
+    out = {}
+    for key, (rec, bins) in histos.items():
+        rec = rec.copy()
+        nbin = -(-bins.size // factor)
+        padded = np.zeros(nbin * factor, dtype=np.uint64)
+        padded[:bins.size] = bins
+        width = (rec['xmax'] - rec['xmin']) / max(int(rec['nbin']), 1)
+        rec['xmax'] = rec['xmin'] + width * nbin * factor
+        rec['nbin'] = nbin
+        if rec['type'] == 0:
+            rec['calib_m'] = rec['calib_m'] * factor
+        out[key] = (rec, np.minimum(padded.reshape(nbin, factor).sum(axis=1), UINT32_MAX).astype(np.uint32))
+    return out
+
+
+def select_histograms(histos, board=None, channel=None, kind=None, step=None, name=None):
+    """Keep the histograms that match all the given fields (kind = energy, time or plugin)."""
+    out = {}
+    for key, (rec, bins) in histos.items():
+        if board is not None and rec['board'] != board:
+            continue
+        if channel is not None and rec['channel'] != channel:
+            continue
+        if kind is not None and TYPE_NAMES.get(int(rec['type'])) != kind:
+            continue
+        if step is not None and rec['step'] != step:
+            continue
+        if name is not None and rec['name'].decode() != name:
+            continue
+        out[key] = (rec, bins)
+    return out
+
+
+def describe_key(key):
+    kind, name, board, channel, step, flags = key
+    text = f'{name.decode()} b{board} ch{channel}'
+    if flags & FLAG_EMULATED:
+        text += f' thr{step:02d}'
+    elif step >= 0:
+        text += f' step{step:03d}' + ('s' if flags & FLAG_SETTLING else '')
+    return text
+
+
+def save_npz(path, histos):
+    """Save the bins and the record fields of each histogram (arrays <label> and <label>_info)."""
+    arrays = {}
+    for key, (rec, bins) in histos.items():
+        label = describe_key(key).replace(' ', '_').replace('.', '_')
+        arrays[label] = bins
+        arrays[f'{label}_info'] = np.array(rec)
+    np.savez_compressed(path, **arrays)
+
+
+def _rebin_file(job):
+    src, dst, factor = job
+    header, histos = read_archive(src)
+    write_archive(dst, header, rebin_histograms(histos, factor))
+    return dst
+
+
+def _extract_file(job):
+    src, dst, filters = job
+    header, histos = read_archive(src)
+    histos = select_histograms(histos, **filters)
+    if dst.endswith('.npz'):
+        save_npz(dst, histos)
+    else:
+        write_archive(dst, header, histos)
+    return dst, len(histos)
+
+
+def _outputs(inputs, output, suffix):
+    # one input: output is the file; several inputs: output is a folder (same file names)
+    if len(inputs) == 1 and not os.path.isdir(output):
+        return [output]
+    os.makedirs(output, exist_ok=True)
+    return [os.path.join(output, os.path.splitext(os.path.basename(f))[0] + suffix) for f in inputs]
+
+
+def main():
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description='Merge, rebin and extract WaveDemo histogram archives (.wdh).'
+    )
+    parser.add_argument('--workers', type=int, default=None,
+                        help='Processes reading the archives (default: one per CPU)')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p_list = sub.add_parser('list', help='List the histograms of an archive')
+    p_list.add_argument('archive')
+
+    p_merge = sub.add_parser('merge', help='Sum the histograms with the same key of several archives')
+    p_merge.add_argument('archives', nargs='+')
+    p_merge.add_argument('-o', '--output', required=True, help='Merged archive')
+
+    p_rebin = sub.add_parser('rebin', help='Sum groups of adjacent bins')
+    p_rebin.add_argument('archives', nargs='+')
+    p_rebin.add_argument('-o', '--output', required=True, help='Output archive (folder for several inputs)')
+    p_rebin.add_argument('--factor', type=int, required=True, help='Bins summed into one')
+
+    p_extract = sub.add_parser('extract', help='Copy a subset of the histograms to an archive or to .npz')
+    p_extract.add_argument('archives', nargs='+')
+    p_extract.add_argument('-o', '--output', required=True,
+                           help='Output .wdh or .npz (folder for several inputs)')
+    p_extract.add_argument('--board', type=int, default=None)
+    p_extract.add_argument('--channel', type=int, default=None)
+    p_extract.add_argument('--type', dest='kind', choices=sorted(TYPE_NAMES.values()), default=None)
+    p_extract.add_argument('--step', type=int, default=None)
+    p_extract.add_argument('--name', default=None, help='Histogram name (energy, time or <plugin>.<histogram>)')
+    p_extract.add_argument('--npz', action='store_true', help='Write .npz files (with a folder output)')
+    args = parser.parse_args()
+
+    if args.command == 'list':
+        header, histos = read_archive(args.archive)
+        print(f"Run {header['run_number']}  start {header['start_time'].decode()}  "
+              f"{len(histos)} histograms  ({header['software'].decode()})")
+        for key, (rec, bins) in histos.items():
+            print(f"  {describe_key(key):32s} {rec['nbin']:6d} bins  {rec['xmin']:g}..{rec['xmax']:g} "
+                  f"{rec['unit'].decode():3s}  entries {rec['entries']}")
+    elif args.command == 'merge':
+        header, histos = merge_archives(args.archives, args.workers)
+        write_archive(args.output, header, histos)
+        print(f'{len(args.archives)} archives, {len(histos)} histograms -> {args.output}')
+    elif args.command == 'rebin':
+        outputs = _outputs(args.archives, args.output, '.wdh')
+        jobs = [(src, dst, args.factor) for src, dst in zip(args.archives, outputs)]
+        for dst in _map(_rebin_file, jobs, args.workers):
+            print(dst)
+    else:
+        filters = dict(board=args.board, channel=args.channel, kind=args.kind, step=args.step, name=args.name)
+        outputs = _outputs(args.archives, args.output, '.npz' if args.npz else '.wdh')
+        jobs = [(src, dst, filters) for src, dst in zip(args.archives, outputs)]
+        for dst, n in _map(_extract_file, jobs, args.workers):
+            print(f'{dst}: {n} histograms')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,289 @@
+"""Single owner of the CAEN HV serial line.
+
+One broker thread per device keeps the port open and runs the commands one at a time, by priority:
+scan control first, then the user commands, then the periodic readback. The readback (VMON of the channels
+in use, every `poll_interval` seconds) is cached, so any number of monitors read the cache instead of the port.
+"""
+from __future__ import annotations
+import time
+import heapq
+import itertools
+import threading
+import logging
+from concurrent.futures import Future
+from typing import Dict, Optional, Any
+
+from .caen_hv import CaenHVConnection, SIM_PREFIX, simulated_supply
+
+__all__ = ['HVBroker', 'get_broker', 'find_broker', 'self_test', 'PRIORITY_CONTROL', 'PRIORITY_UI', 'PRIORITY_POLL']
+
+PRIORITY_CONTROL = 0    # scan control (set HV, settling checks)
+PRIORITY_UI = 1         # commands from the user interface
+PRIORITY_POLL = 2       # periodic readback
+
+DEFAULT_POLL_INTERVAL = 1.0     # s between two readbacks of a channel
+IO_RETRIES = 2                  # attempts of one command (the port is reopened after an error)
+
+logger = logging.getLogger('hv_broker')
+
+
+class HVBroker:
+    def __init__(self, device: str, baudrate: int = 9600, timeout: float = 1.0,
+                 poll_interval: float = DEFAULT_POLL_INTERVAL):
+        self.device = device
+        self.poll_interval = poll_interval
+        self.conn = CaenHVConnection(device, baudrate, timeout)
+        self.readbacks: Dict[str, Dict[str, Any]] = {}   # channel -> {'vmon', 'ts', 'error'}
+        self.channels: set[str] = set()                  # channels polled
+        self.stats = {'commands': 0, 'polls': 0, 'errors': 0}
+        self._queue: list = []
+        self._seq = itertools.count()
+        self._cv = threading.Condition()
+        self._running = True
+        self._thread = threading.Thread(target=self._loop, name=f'hv-broker {device}', daemon=True)
+        self._thread.start()
+
+    # ---------------------- commands ----------------------
+    def submit(self, cmd: str, par: str, val: Optional[str] = None, channel: str = '1',
+               priority: int = PRIORITY_UI) -> Future:
+        future: Future = Future()
+        with self._cv:
+            if not self._running:
+                raise RuntimeError('HV broker stopped')
+            heapq.heappush(self._queue, (priority, next(self._seq), cmd.upper(), par.upper(), val, str(channel), future))
+            self._cv.notify()
+        return future
+
+    def request(self, cmd: str, par: str, val: Optional[str] = None, channel: str = '1',
+                priority: int = PRIORITY_UI, wait: Optional[float] = 30.0) -> str:
+        """Run one command and return the response (raises RuntimeError on failure)."""
+        return self.submit(cmd, par, val, channel, priority).result(timeout=wait)
+
+    def read_vmon(self, channel: str = '1', max_age: Optional[float] = None,
+                  priority: int = PRIORITY_CONTROL) -> Optional[float]:
+        """VMON of a channel: the cached readback if younger than max_age, else a new reading."""
+        channel = str(channel)
+        self.watch(channel)
+        rb = self.readback(channel)
+        if max_age is not None and rb and rb['error'] is None and time.time() - rb['ts'] <= max_age:
+            return rb['vmon']
+        resp = self.request('MON', 'VMON', channel=channel, priority=priority)
+        return self._store(channel, resp)
+
+    # ---------------------- cached readback ----------------------
+    def watch(self, channel: str):
+        """Add a channel to the periodic readback."""
+        with self._cv:
+            if str(channel) not in self.channels:
+                self.channels.add(str(channel))
+                self._cv.notify()
+
+    def readback(self, channel: str = '1') -> Optional[Dict[str, Any]]:
+        """Latest readback of a channel ({'vmon', 'ts', 'error'}), without access to the device."""
+        with self._cv:
+            rb = self.readbacks.get(str(channel))
+            return dict(rb) if rb else None
+
+    def wait_readback(self, channel: str = '1', newer_than: float = 0.0, timeout: Optional[float] = None):
+        """Wait for a readback taken after `newer_than` (time.time())."""
+        channel = str(channel)
+        self.watch(channel)
+        deadline = None if timeout is None else time.time() + timeout
+        with self._cv:
+            while True:
+                rb = self.readbacks.get(channel)
+                if rb and rb['ts'] > newer_than:
+                    return dict(rb)
+                left = None if deadline is None else deadline - time.time()
+                if left is not None and left <= 0:
+                    return dict(rb) if rb else None
+                self._cv.wait(left)
+
+    def _store(self, channel: str, resp: str) -> Optional[float]:
+        try:
+            vmon = float(str(resp).replace(',', '.').strip())
+            error = None
+        except ValueError:
+            vmon, error = None, f'unexpected response {resp!r}'
+        with self._cv:
+            self.readbacks[channel] = {'vmon': vmon, 'ts': time.time(), 'error': error}
+            self._cv.notify_all()
+        return vmon
+
+    def status(self) -> Dict[str, Any]:
+        with self._cv:
+            return {'device': self.device, 'queued': len(self._queue), 'channels': sorted(self.channels),
+                    'poll_interval': self.poll_interval, **self.stats,
+                    'readbacks': {c: dict(rb) for c, rb in self.readbacks.items()}}
+
+    def stop(self):
+        with self._cv:
+            self._running = False
+            pending, self._queue = self._queue, []
+            self._cv.notify_all()
+        for item in pending:
+            item[-1].set_exception(RuntimeError('HV broker stopped'))
+        self._thread.join(timeout=5)
+        self.conn.close()
+
+    # ---------------------- broker thread ----------------------
+    def _execute(self, cmd, par, val, channel) -> str:
+        for attempt in range(1, IO_RETRIES + 1):
+            try:
+                return self.conn.query(cmd, par, val, channel)
+            except RuntimeError as e:
+                self.stats['errors'] += 1
+                self.conn.close()
+                if attempt == IO_RETRIES:
+                    raise
+                logger.warning(f"HV {cmd} {par} failed ({e}); retrying")
+
+    def _next_poll(self):
+        # channel whose readback is the oldest, if due
+        due = None
+        now = time.time()
+        for ch in self.channels:
+            rb = self.readbacks.get(ch)
+            ts = rb['ts'] if rb else 0.0
+            if now - ts >= self.poll_interval and (due is None or ts < due[1]):
+                due = (ch, ts)
+        if due is not None:
+            return due[0], 0.0
+        wait = min((self.readbacks[ch]['ts'] + self.poll_interval - now for ch in self.channels
+                    if ch in self.readbacks), default=None)
+        return None, wait
+
+    def _loop(self):
+        while True:
+            with self._cv:
+                while self._running:
+                    if self._queue:
+                        item = heapq.heappop(self._queue)
+                        poll = None
+                        break
+                    poll, wait = self._next_poll()
+                    if poll is not None:
+                        item = None
+                        break
+                    self._cv.wait(wait)
+                else:
+                    return
+            if item is not None:
+                _, _, cmd, par, val, channel, future = item
+                if not future.set_running_or_notify_cancel():
+                    continue
+                try:
+                    resp = self._execute(cmd, par, val, channel)
+                except Exception as e:
+                    future.set_exception(e)
+                    continue
+                self.stats['commands'] += 1
+                if cmd == 'MON' and par == 'VMON':
+                    self._store(channel, resp)
+                future.set_result(resp)
+                continue
+            # periodic readback
+            try:
+                resp = self._execute('MON', 'VMON', None, poll)
+                self.stats['polls'] += 1
+                self._store(poll, resp)
+            except Exception as e:
+                with self._cv:
+                    rb = self.readbacks.get(poll) or {'vmon': None}
+                    self.readbacks[poll] = {'vmon': rb['vmon'], 'ts': time.time(), 'error': str(e)}
+                    self._cv.notify_all()
+
+
+_brokers: Dict[str, HVBroker] = {}
+_brokers_lock = threading.Lock()
+
+
+def get_broker(device: str, baudrate: int = 9600, timeout: float = 1.0,
+               poll_interval: float = DEFAULT_POLL_INTERVAL) -> HVBroker:
+    """The broker of a device (created at the first use; the first caller sets the line parameters)."""
+    with _brokers_lock:
+        broker = _brokers.get(device)
+        if broker is None:
+            broker = _brokers[device] = HVBroker(device, baudrate, timeout, poll_interval)
+        return broker
+
+
+def find_broker(device: str) -> Optional[HVBroker]:
+    """The broker of a device if it exists (None: not created yet, nothing is opened)."""
+    with _brokers_lock:
+        return _brokers.get(device)
+
+
+def stop_brokers():
+    with _brokers_lock:
+        brokers = list(_brokers.values())
+        _brokers.clear()
+    for broker in brokers:
+        broker.stop()
+
+
+# ---------------------- self-test ----------------------
+def self_test(device: str = SIM_PREFIX + 'selftest') -> bool:
+    """Run the priority, caching and ramp paths of a broker against the simulated supply. Return True if all pass."""
+    sim = simulated_supply(device)
+    sim.latency, sim.speedup, sim.noise = 0.05, 2.0, 0.0
+    broker = HVBroker(device, poll_interval=0.2)
+    results = []
+
+    def check(name, ok, detail=''):
+        results.append(ok)
+        print(f"{'PASS' if ok else 'FAIL'}: {name}{' (' + detail + ')' if detail else ''}")
+
+    try:
+        # priority: with the broker busy, a control command queued after the user commands runs before them
+        done = []
+        blocker = broker.submit('MON', 'VSET', channel='1')
+        futures = [broker.submit('MON', 'VSET', channel='1', priority=PRIORITY_UI) for _ in range(3)]
+        futures.append(broker.submit('MON', 'VSET', channel='1', priority=PRIORITY_CONTROL))
+        for i, f in enumerate(futures):
+            f.add_done_callback(lambda _, i=i: done.append(i))
+        for f in [blocker] + futures:
+            f.result(timeout=5)
+        check('control command ahead of the queued user commands', done[0] == 3, f'completion order {done}')
+
+        # caching: the readers of a watched channel share the periodic readback
+        broker.watch('1')
+        rb = broker.wait_readback('1', newer_than=time.time(), timeout=5)
+        check('periodic readback', rb is not None and rb['error'] is None and broker.stats['polls'] > 0)
+        before = sim.commands
+        values = [broker.read_vmon('1', max_age=60) for _ in range(20)]
+        check('cached reads without access to the supply', sim.commands - before <= 1 and None not in values,
+              f'{sim.commands - before} commands for 20 reads')
+
+        # ramp: VMON follows VSET at the RUP rate (50 V/s, x speedup) and the readback reaches it
+        target = float(broker.read_vmon('1')) + 100.0
+        t0 = time.time()
+        broker.request('SET', 'VSET', f'{target:.1f}', channel='1', priority=PRIORITY_CONTROL)
+        trace = []
+        while time.time() - t0 < 10:
+            rb = broker.wait_readback('1', newer_than=time.time(), timeout=2)
+            if rb and rb['vmon'] is not None:
+                trace.append(rb['vmon'])
+                if abs(rb['vmon'] - target) < 0.5:
+                    break
+        ramp_time = time.time() - t0
+        check('ramp reaches VSET', bool(trace) and abs(trace[-1] - target) < 0.5, f'{ramp_time:.2f} s')
+        check('ramp is gradual and monotonic', len(trace) > 2 and trace[0] < target - 10
+              and all(b >= a for a, b in zip(trace, trace[1:])), f'{len(trace)} readbacks')
+    finally:
+        broker.stop()
+    return all(results)
+
+
+def main():
+    import argparse
+    parser = argparse.ArgumentParser(description='HV broker (single owner of the CAEN HV serial line).')
+    parser.add_argument('--self-test', action='store_true', help='Check priority, caching and ramp against the simulated supply')
+    args = parser.parse_args()
+    if args.self_test:
+        raise SystemExit(0 if self_test() else 1)
+    parser.print_help()
+
+
+if __name__ == '__main__':
+    main()
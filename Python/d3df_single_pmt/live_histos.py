@@ -0,0 +1,166 @@
+"""Live histograms and rates of a measurement, for the web UI.
+
+WaveDemo sends the bins changed since its previous record on the status stream ("histo" records,
+STATUS_HISTOGRAMS) and the per-channel rates ("stats" records). LiveHistograms keeps the current contents and,
+for each bin, the sequence number of its last change, so the frame of a viewer holds only the bins changed since
+the frame it got before: a slow viewer gets fewer and larger frames instead of a backlog, and viewers at the same
+point of the stream share the same encoded frame.
+
+Frame layout (little endian; all the blocks are multiples of 4 bytes, so the arrays can be read in place):
+    header  magic 'WDLH', u8 version, u8 flags (FRAME_FULL), u16 n_histos, u16 n_rates, u16 reserved,
+            u32 seq, f64 t (s since epoch)                                                              24 bytes
+    n_rates x  u8 board, u8 channel, u16 reserved, f32 read_rate, f32 filt_rate (Hz)                    12 bytes
+    n_histos x u8 board, u8 channel, u8 kind (0=energy, 1=time), u8 flags (HISTO_FULL), u32 nbin,
+               u32 entries, u32 ovf, u32 unf, u32 n                                                     24 bytes
+               followed by n u32 bin indices and n u32 bin contents
+A histogram with HISTO_FULL replaces the previous one (the bins not listed are empty); otherwise the listed
+bins are updated.
+"""
+from __future__ import annotations
+import time
+import struct
+import threading
+from collections import OrderedDict
+from typing import Dict, Optional, Tuple, Any
+
+import numpy as np
+
+__all__ = ['LiveHistograms', 'decode_frame', 'FRAME_MAGIC']
+
+FRAME_MAGIC = b'WDLH'
+FRAME_VERSION = 1
+FRAME_FULL = 0x1            # first frame of a viewer: every histogram is complete
+HISTO_FULL = 0x1
+KINDS = {'energy': 0, 'time': 1}
+
+_HEADER = struct.Struct('<4sBBHHHId')
+_RATE = struct.Struct('<BBHff')
+_HISTO = struct.Struct('<BBBBIIIII')
+
+FRAME_CACHE_SIZE = 16       # encoded frames kept for the viewers at the same point of the stream
+
+
+class _Histo:
+    __slots__ = ('bins', 'changed', 'reset_seq', 'entries', 'ovf', 'unf')
+
+    def __init__(self, nbin, seq):
+        self.bins = np.zeros(nbin, dtype=np.uint32)
+        self.changed = np.zeros(nbin, dtype=np.uint32)     # seq of the last change of each bin
+        self.reset_seq = seq
+        self.entries = self.ovf = self.unf = 0
+
+
+class LiveHistograms:
+    def __init__(self):
+        self.seq = 0
+        self._histos: Dict[Tuple[int, int, int], _Histo] = {}
+        self._histo_seq: Dict[Tuple[int, int, int], int] = {}     # seq of the last change of each histogram
+        self._rates: Dict[Tuple[int, int], Tuple[float, float]] = {}
+        self._rates_seq = 0
+        self._frames: OrderedDict = OrderedDict()
+        self._lock = threading.Lock()
+
+    # ---------------------- input (status stream) ----------------------
+    def apply(self, rec: Dict[str, Any]) -> bool:
+        """Apply a 'histo' or 'stats' status record; returns True if it was one of them."""
+        ev = rec.get('ev')
+        if ev == 'histo':
+            kind = KINDS.get(rec.get('kind'))
+            if kind is None:
+                return True
+            key = (int(rec.get('board', 0)), int(rec.get('channel', 0)), kind)
+            nbin = int(rec.get('nbin', 0))
+            pairs = np.asarray(rec.get('bins') or [], dtype=np.int64).reshape(-1, 2)
+            pairs = pairs[(pairs[:, 0] >= 0) & (pairs[:, 0] < nbin)]
+            with self._lock:
+                self.seq += 1
+                h = self._histos.get(key)
+                if h is None or h.bins.size != nbin or rec.get('full'):
+                    h = self._histos[key] = _Histo(nbin, self.seq)
+                h.bins[pairs[:, 0]] = pairs[:, 1]
+                h.changed[pairs[:, 0]] = self.seq
+                h.entries = int(rec.get('entries', 0))
+                h.ovf = int(rec.get('ovf', 0))
+                h.unf = int(rec.get('unf', 0))
+                self._histo_seq[key] = self.seq
+            return True
+        if ev == 'stats':
+            rates = {(int(c.get('board', 0)), int(c.get('channel', 0))):
+                     (float(c.get('read_rate', 0.0)), float(c.get('filt_rate', 0.0)))
+                     for c in rec.get('channels') or []}
+            with self._lock:
+                self.seq += 1
+                self._rates = rates
+                self._rates_seq = self.seq
+            return True
+        return False
+
+    def histogram(self, board: int, channel: int, kind: str = 'energy'):
+        """(bins copy, seq of the last change) of a histogram, or (None, 0)."""
+        key = (board, channel, KINDS[kind])
+        with self._lock:
+            h = self._histos.get(key)
+            if h is None:
+                return None, 0
+            return h.bins.copy(), self._histo_seq.get(key, 0)
+
+    # ---------------------- output (viewers) ----------------------
+    def frame(self, since: int = 0) -> Tuple[Optional[bytes], int]:
+        """Frame with the changes after sequence `since` (0 = everything); returns (frame or None, seq)."""
+        with self._lock:
+            seq = self.seq
+            if seq <= since:
+                return None, seq
+            cached = self._frames.get((since, seq))
+            if cached is not None:
+                return cached, seq
+            frame = self._encode(since, seq)
+            self._frames[(since, seq)] = frame
+            while len(self._frames) > FRAME_CACHE_SIZE:
+                self._frames.popitem(last=False)
+            return frame, seq
+
+    def _encode(self, since, seq):
+        parts = []
+        rates = self._rates if self._rates_seq > since else {}
+        for (b, ch), (read_rate, filt_rate) in sorted(rates.items()):
+            parts.append(_RATE.pack(b, ch, 0, read_rate, filt_rate))
+        n_histos = 0
+        for key, h in self._histos.items():
+            if self._histo_seq.get(key, 0) <= since:
+                continue
+            full = since == 0 or h.reset_seq > since
+            idx = np.flatnonzero(h.bins) if full else np.flatnonzero(h.changed > since)
+            parts.append(_HISTO.pack(key[0], key[1], key[2], HISTO_FULL if full else 0, h.bins.size,
+                                     h.entries, h.ovf, h.unf, idx.size))
+            parts.append(idx.astype('<u4').tobytes())
+            parts.append(h.bins[idx].astype('<u4').tobytes())
+            n_histos += 1
+        header = _HEADER.pack(FRAME_MAGIC, FRAME_VERSION, FRAME_FULL if since == 0 else 0,
+                              n_histos, len(rates), 0, seq & 0xFFFFFFFF, time.time())
+        return header + b''.join(parts)
+
+
+def decode_frame(data: bytes, histos: Optional[Dict[Tuple[int, int, int], np.ndarray]] = None):
+    """Apply a frame to `histos` ({(board, channel, kind): bins}); returns (header dict, rates, histos)."""
+    histos = {} if histos is None else histos
+    magic, version, flags, n_histos, n_rates, _, seq, t = _HEADER.unpack_from(data, 0)
+    if magic != FRAME_MAGIC or version != FRAME_VERSION:
+        raise ValueError('not a live histogram frame of this version')
+    pos = _HEADER.size
+    rates = {}
+    for _ in range(n_rates):
+        b, ch, _, read_rate, filt_rate = _RATE.unpack_from(data, pos)
+        rates[(b, ch)] = (read_rate, filt_rate)
+        pos += _RATE.size
+    for _ in range(n_histos):
+        b, ch, kind, hflags, nbin, entries, ovf, unf, n = _HISTO.unpack_from(data, pos)
+        pos += _HISTO.size
+        idx = np.frombuffer(data, '<u4', n, pos)
+        val = np.frombuffer(data, '<u4', n, pos + 4 * n)
+        pos += 8 * n
+        key = (b, ch, kind)
+        if hflags & HISTO_FULL or key not in histos or histos[key].size != nbin:
+            histos[key] = np.zeros(nbin, dtype=np.uint32)
+        histos[key][idx] = val
+    return {'flags': flags, 'seq': seq, 't': t}, rates, histos
@@ -12,8 +12,7 @@ import matplotlib.pyplot as plt
 
 from .analysis import (
     load_hdf5_data,
-    align_pulses_by_peak,
-    normalize_pulses_to_max,
+    PulseArrays,
     analyze_pulse_timing,
 )
 
@@ -58,7 +57,7 @@ def plot_adc_overlay(
     """Plot all ADC pulses overlaid (oscilloscope-style diagram).
 
     Args:
-        ADC_df: DataFrame where each row is an ADC pulse
+        ADC_df: DataFrame where each row is an ADC pulse (or PulseArrays)
         prefix: prefix for saving the plot
         alpha: transparency for individual pulses (0.1 = very transparent)
         max_pulses: maximum number of pulses to plot (None = all)
@@ -70,28 +69,28 @@ def plot_adc_overlay(
         print("No ADC DataFrame available for overlay")
         return
 
+    pulses = ADC_df if isinstance(ADC_df, PulseArrays) else PulseArrays(ADC_df)
     fig, ax = plt.subplots(1, 1, figsize=(12, 8))
 
-    n_pulses = ADC_df.shape[0]
+    n_pulses = pulses.shape[0]
     if max_pulses is not None:
         n_pulses = min(n_pulses, max_pulses)
 
-    n_samples = ADC_df.shape[1]
+    n_samples = pulses.shape[1]
     
     # Calculate time axis
     x_axis, x_label = calculate_time_axis(n_samples, sampling_rate)
 
-    # Plot all pulses overlaid
-    for i in range(n_pulses):
-        ax.plot(x_axis, ADC_df.iloc[i, :], 'b-', alpha=alpha, linewidth=0.5)
+    # Plot all pulses overlaid (one line per column)
+    ax.plot(x_axis, pulses.raw[:n_pulses].T, 'b-', alpha=alpha, linewidth=0.5)
 
     # Calculate and plot average pulse
-    avg_pulse = ADC_df.iloc[:n_pulses, :].mean(axis=0)
+    avg_pulse = pulses.mean_pulse(align=False, n_pulses=n_pulses)
     ax.plot(x_axis, avg_pulse, 'r-', linewidth=2,
             label=f'Average ({n_pulses} pulses)')
 
     # Calculate and plot standard deviation envelope
-    std_pulse = ADC_df.iloc[:n_pulses, :].std(axis=0)
+    std_pulse = pulses.std_pulse(align=False, n_pulses=n_pulses)
     ax.fill_between(
         x_axis,
         avg_pulse - std_pulse,
@@ -152,7 +151,8 @@ def plot_adc_diagram_advanced(
     """Create advanced diagram with multiple views and statistics.
 
     Args:
-        ADC_df: DataFrame where each row is an ADC pulse
+        ADC_df: DataFrame where each row is an ADC pulse, or PulseArrays
+            (its aligned/normalized arrays are reused)
         prefix: prefix for saving the plot
         alpha: transparency for individual pulses
         max_pulses: maximum number of pulses to plot
@@ -167,21 +167,20 @@ def plot_adc_diagram_advanced(
         print("No ADC DataFrame available for advanced diagram")
         return
 
+    pulses = ADC_df if isinstance(ADC_df, PulseArrays) else PulseArrays(ADC_df)
+
     # Align pulses by peak position first
     if align_data:
-        print(f"Aligning {ADC_df.shape[0]} pulses by peak position...")
-        ADC_df, peak_positions = align_pulses_by_peak(ADC_df)
-        if ADC_df is None:
-            print("Failed to align pulses")
-            return
+        print(f"Aligning {pulses.shape[0]} pulses by peak position...")
+        peak_positions = pulses.peaks
         print(
             f"  Peak positions: min={peak_positions.min()}, "
             f"max={peak_positions.max()}, "
             f"median={int(np.median(peak_positions))}"
         )
 
-    if normalize:
-        ADC_df = normalize_pulses_to_max(ADC_df, method=norm_method)
+    method = norm_method if normalize else None
+    data = pulses.data(align_data, method)
 
     fig, axes = plt.subplots(2, 2, figsize=(16, 10))
     
@@ -200,22 +199,19 @@ def plot_adc_diagram_advanced(
     fig.suptitle(title, fontsize=16)
 
     n_pulses = (
-        min(ADC_df.shape[0], max_pulses) if max_pulses else ADC_df.shape[0]
+        min(data.shape[0], max_pulses) if max_pulses else data.shape[0]
     )
-    n_samples = ADC_df.shape[1]
+    n_samples = data.shape[1]
     
     # Calculate time axis
     x_axis, x_label = calculate_time_axis(n_samples, sampling_rate)
 
     # Plot 1: All pulses overlaid (eye diagram)
     ax1 = axes[0, 0]
-    for i in range(n_pulses):
-        ax1.plot(
-            x_axis, ADC_df.iloc[i, :], 'b-', alpha=alpha, linewidth=0.3
-        )
+    ax1.plot(x_axis, data[:n_pulses].T, 'b-', alpha=alpha, linewidth=0.3)
 
     # Add average
-    avg_pulse = ADC_df.iloc[:n_pulses, :].mean(axis=0)
+    avg_pulse = pulses.mean_pulse(align_data, method, n_pulses)
     ax1.plot(x_axis, avg_pulse, 'r-', linewidth=2, label='Average')
     ax1.set_xlabel(x_label)
     ax1.set_ylabel('ADC Values')
@@ -225,7 +221,7 @@ def plot_adc_diagram_advanced(
 
     # Plot 2: Average pulse with error bars
     ax2 = axes[0, 1]
-    std_pulse = ADC_df.iloc[:n_pulses, :].std(axis=0)
+    std_pulse = pulses.std_pulse(align_data, method, n_pulses)
     ax2.errorbar(
         x_axis[::10],
         avg_pulse[::10],
@@ -273,7 +269,7 @@ def plot_adc_diagram_advanced(
     for i in range(n_individual):
         ax4.plot(
             x_axis,
-            ADC_df.iloc[i, :],
+            data[i],
             color=colors[i],
             linewidth=1,
             alpha=0.8,
@@ -615,6 +611,9 @@ def plot_waveform_analysis(
         f"{ADC_df.shape[1]} samples each"
     )
     
+    # Aligned and normalized arrays computed once for the plots and the timing
+    pulses = PulseArrays(ADC_df)
+
     # Extract sampling rate from metadata
     sampling_rate = metadata.get('sampling_rate') if metadata else None
     if metadata:
@@ -624,7 +623,7 @@ def plot_waveform_analysis(
     if plot_overlay:
         print(f"Creating ADC overlay plot for {prefix}...")
         plot_adc_overlay(
-            ADC_df,
+            pulses,
             prefix,
             alpha=alpha,
             max_pulses=max_pulses,
@@ -635,7 +634,7 @@ def plot_waveform_analysis(
 
     # Create advanced diagram
     plot_adc_diagram_advanced(
-        ADC_df,
+        pulses,
         prefix,
         alpha=alpha,
         max_pulses=max_pulses,
@@ -652,7 +651,7 @@ def plot_waveform_analysis(
     if sampling_rate:
         print(f"Analyzing pulse timing for {prefix}...")
         timing_info = analyze_pulse_timing(
-            ADC_df,
+            pulses,
             sampling_rate,
             method='individual',
             threshold_low=0.1,
@@ -1,6 +1,7 @@
 """Plot pulse timing parameters vs PMT HV grouped by source and scintillator.
 
-This module reads analysis_results_*.h5 files produced by analysis.py and creates
+This module reads analysis_results_*.h5 files produced by analysis.py (or analyzes a
+folder of run files directly, reusing the cached results of the unchanged files) and creates
 plots showing rise time, fall time, and pulse width (in ns) as functions of PMT HV,
 grouped by source and scintillator combinations.
 """
@@ -220,7 +221,14 @@ def main():
     parser.add_argument(
         'file',
         nargs='?',
-        help='Path to analysis_results_*.h5 file (if not provided, searches current directory)',
+        help='Path to analysis_results_*.h5 file or to a folder of run .h5 files to analyze '
+             '(if not provided, searches current directory)',
+    )
+    parser.add_argument(
+        '--workers',
+        type=int,
+        default=None,
+        help='Processes analyzing the changed run files of a folder (default: one per CPU)',
     )
     parser.add_argument(
         '--output',
@@ -231,7 +239,13 @@ def main():
     args = parser.parse_args()
     
     # Find HDF5 file
-    if args.file:
+    if args.file and os.path.isdir(args.file):
+        # Analyze the scan folder (only the new or changed files, see analysis.analyze_folder)
+        from .analysis import analyze_folder
+        h5_file = None
+        output_folder = args.output if args.output is not None else args.file
+        df = analyze_folder(args.file, workers=args.workers)
+    elif args.file:
         h5_file = args.file
         if not os.path.exists(h5_file):
             print(f"Error: File '{h5_file}' not found.")
@@ -248,16 +262,18 @@ def main():
         h5_file = max(h5_files, key=lambda p: p.stat().st_mtime)
         print(f"Using most recent analysis file: {h5_file}")
     
-    # Determine output folder: use HDF5 file's directory if not specified
-    if args.output is None:
-        output_folder = os.path.dirname(os.path.abspath(h5_file))
-        if not output_folder:
-            output_folder = '.'
-    else:
-        output_folder = args.output
-    
-    # Load data
-    df = load_analysis_results(h5_file)
+    if h5_file is not None:
+        # Determine output folder: use HDF5 file's directory if not specified
+        if args.output is None:
+            output_folder = os.path.dirname(os.path.abspath(h5_file))
+            if not output_folder:
+                output_folder = '.'
+        else:
+            output_folder = args.output
+
+        # Load data
+        df = load_analysis_results(h5_file)
+
     if df is None or df.empty:
         print("Error: Failed to load data or data is empty.")
         return
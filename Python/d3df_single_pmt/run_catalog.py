@@ -0,0 +1,462 @@
+"""Catalog of the acquisitions of a data folder (SQLite), for indexed lookups and scan summaries.
+
+The runner records each WaveDemo run when it starts (state 'running') and when it ends: exit code, events,
+duration, the output files reported by the status stream ('file' records) and the run_info metadata (PMT HV,
+source, scintillator, thresholds). The web interface groups the runs of a measurement by scan id and adds the
+analysis of each point. Lookups that used to list the folder and parse the file names (latest run, run_info of a
+waveform file, history of a scan) become queries on the indexes. Folders written before the catalog, or by
+WaveDemo alone, are indexed once with `run-catalog index <folder>`.
+
+The catalog is <data_output>/run_catalog.sqlite, in WAL mode so that the web interface reads while a runner
+writes. Each call opens its own connection: a catalog object can be shared by threads, and several processes
+can use the same file.
+"""
+from __future__ import annotations
+import os
+import re
+import json
+import time
+import sqlite3
+import hashlib
+from datetime import datetime
+from typing import Any, Dict, Iterable, List
+
+__all__ = [
+    'RunCatalog',
+    'CATALOG_NAME',
+    'catalog_path',
+    'open_catalog',
+    'config_hash',
+    'catalog_run_info',
+]
+
+CATALOG_NAME = 'run_catalog.sqlite'
+SCHEMA_VERSION = 1
+BUSY_TIMEOUT = 30.0         # s waiting for a lock held by another process
+
+_SCHEMA = """
+CREATE TABLE IF NOT EXISTS runs (
+    run_id      INTEGER PRIMARY KEY AUTOINCREMENT,
+    scan_id     TEXT,               -- measurement grouping the runs (web interface id or runner --scan-id)
+    point       INTEGER,            -- index of the run in the scan
+    prefix      TEXT,               -- file prefix of WaveDemo (date and time or run number)
+    folder      TEXT,
+    started     REAL NOT NULL,      -- s since epoch
+    ended       REAL,
+    state       TEXT NOT NULL,      -- running, completed, stopped, failed
+    exit_code   INTEGER,
+    config_hash TEXT,
+    config_path TEXT,
+    hv_set      REAL,
+    hv_mon      REAL,
+    threshold   REAL,               -- common trigger threshold (V)
+    events      INTEGER,
+    duration    REAL,               -- acquisition time (s)
+    rate        REAL,
+    pmt         TEXT,
+    source      TEXT,
+    scintillator TEXT,
+    run_info    TEXT,               -- JSON: parse_run_info of the run_info file
+    analysis    TEXT                -- JSON: post-processing summary
+);
+CREATE INDEX IF NOT EXISTS runs_started ON runs(started);
+CREATE INDEX IF NOT EXISTS runs_scan ON runs(scan_id, point);
+CREATE INDEX IF NOT EXISTS runs_hv ON runs(hv_set);
+CREATE INDEX IF NOT EXISTS runs_config ON runs(config_hash);
+CREATE INDEX IF NOT EXISTS runs_prefix ON runs(folder, prefix);
+CREATE TABLE IF NOT EXISTS files (
+    run_id      INTEGER NOT NULL REFERENCES runs(run_id) ON DELETE CASCADE,
+    kind        TEXT NOT NULL,      -- as in the 'file' status records: wave, run_info, raw, ehisto, ...
+    board       INTEGER,
+    channel     INTEGER,
+    path        TEXT NOT NULL UNIQUE
+);
+CREATE INDEX IF NOT EXISTS files_run ON files(run_id);
+CREATE INDEX IF NOT EXISTS files_kind ON files(kind, board, channel);
+CREATE TABLE IF NOT EXISTS thresholds (
+    run_id      INTEGER NOT NULL REFERENCES runs(run_id) ON DELETE CASCADE,
+    board       INTEGER NOT NULL,
+    channel     INTEGER NOT NULL,
+    threshold   REAL NOT NULL,
+    PRIMARY KEY (run_id, board, channel)
+);
+"""
+
+# Output files of WaveDemo (WDFiles.c), for the indexing of existing folders: suffix after the prefix -> kind
+_FILE_PATTERNS = [
+    (re.compile(r'run_info\.txt'), 'run_info'),
+    (re.compile(r'raw\.dat'), 'raw'),
+    (re.compile(r'List_Merged\.\w+'), 'list_merged'),
+    (re.compile(r'histos\.wdh'), 'histo_archive'),
+    (re.compile(r'thr_emulation\.txt'), 'thr_emulation'),
+    (re.compile(r'calibration\.txt'), 'calibration'),
+    (re.compile(r'TDC_(\d+)_(\d+)\.\w+'), 'tdc_list'),
+    (re.compile(r'List_(\d+)_(\d+)\.\w+'), 'list'),
+    (re.compile(r'Wave_(\d+)_(\d+)\.\w+'), 'wave'),
+    (re.compile(r'Ehisto_(\d+)_(\d+)\.\w+'), 'ehisto'),
+    (re.compile(r'Thisto_(\d+)_(\d+)\.\w+'), 'thisto'),
+]
+_PREFIX_TIME = '%Y-%m-%d_%H-%M-%S'
+
+
+def catalog_path(folder):
+    return os.path.join(folder, CATALOG_NAME)
+
+
+def open_catalog(folder, create=True):
+    """Catalog of a data folder; None if it doesn't exist and create is False (or it can't be opened)."""
+    path = catalog_path(folder)
+    if not create and not os.path.isfile(path):
+        return None
+    try:
+        return RunCatalog(path, create=create)
+    except (sqlite3.Error, OSError):
+        return None
+
+
+def config_hash(ini_path):
+    """Hash of a WaveDemo config file: the settings only (comments, blank lines and spacing are ignored)."""
+    h = hashlib.sha1()
+    try:
+        with open(ini_path, 'r', encoding='utf-8', errors='ignore') as f:
+            for line in f:
+                line = line.split('#', 1)[0].strip()
+                if line:
+                    h.update(' '.join(line.split()).encode() + b'\n')
+    except OSError:
+        return None
+    return h.hexdigest()[:16]
+
+
+def catalog_run_info(run_info_path):
+    """run_info metadata of a file from the catalog of its folder, without parsing it (None if not cataloged)."""
+    if not run_info_path:
+        return None
+    catalog = open_catalog(os.path.dirname(os.path.abspath(run_info_path)), create=False)
+    if catalog is None:
+        return None
+    try:
+        return catalog.run_info_of(run_info_path)
+    except sqlite3.Error:
+        return None
+
+
+def _norm(path):
+    return os.path.abspath(path)
+
+
+def _split_name(name):
+    """(prefix, kind, board, channel) of a WaveDemo output file name, or None."""
+    for i in range(len(name)):
+        if name[i] != '_':
+            continue
+        rest = name[i + 1:]
+        for pattern, kind in _FILE_PATTERNS:
+            m = pattern.fullmatch(rest)
+            if m:
+                board = int(m.group(1)) if m.groups() else None
+                channel = int(m.group(2)) if m.groups() else None
+                return name[:i + 1], kind, board, channel
+    return None
+
+
+def _run_record(row):
+    rec = dict(row)
+    for key in ('run_info', 'analysis'):
+        rec[key] = json.loads(rec[key]) if rec.get(key) else None
+    return rec
+
+
+class RunCatalog:
+    def __init__(self, path, create=True):
+        self.path = os.path.abspath(path)
+        if not create:
+            return
+        os.makedirs(os.path.dirname(self.path), exist_ok=True)
+        with self._connect() as con:
+            con.execute('PRAGMA journal_mode=WAL')
+            con.executescript(_SCHEMA)
+            con.execute(f'PRAGMA user_version={SCHEMA_VERSION}')
+
+    def _connect(self):
+        con = sqlite3.connect(self.path, timeout=BUSY_TIMEOUT)
+        con.row_factory = sqlite3.Row
+        con.execute('PRAGMA foreign_keys=ON')
+        return _Connection(con)
+
+    # ---------------------- run start / end ----------------------
+    def start_run(self, folder=None, scan_id=None, point=None, hv_set=None, threshold=None, config_path=None,
+                  setup=None, started=None):
+        """Add a run in state 'running'; returns its run_id."""
+        setup = setup or {}
+        with self._connect() as con:
+            cur = con.execute(
+                'INSERT INTO runs (scan_id, point, folder, started, state, config_hash, config_path, hv_set, threshold,'
+                ' pmt, source, scintillator) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)',
+                (scan_id, point, _norm(folder) if folder else None, started or time.time(), 'running',
+                 config_hash(config_path) if config_path else None, os.path.abspath(config_path) if config_path else None,
+                 hv_set, threshold, setup.get('pmt'), setup.get('source'), setup.get('scintillator')))
+            return cur.lastrowid
+
+    def end_run(self, run_id, exit_code=None, status_records=(), run_info_path=None, hv_mon=None, ended=None):
+        """Complete a run from the exit code of WaveDemo, its status records and its run_info file."""
+        events = duration = state = None
+        files = []
+        for rec in status_records or ():
+            ev = rec.get('ev')
+            if ev == 'stats':
+                events = int(rec.get('events', 0))
+                duration = float(rec.get('real_time_ms', 0)) / 1000
+            elif ev == 'progress' and events is None:
+                events = int(rec.get('events', 0))
+            elif ev == 'state':
+                state = rec.get('state')
+            elif ev == 'file' and rec.get('path'):
+                files.append((rec.get('kind'), rec.get('board'), rec.get('channel'), rec['path']))
+                if rec.get('kind') == 'run_info' and not run_info_path:
+                    run_info_path = rec['path']
+        if exit_code not in (None, 0):
+            state = 'failed'
+        elif state not in ('completed', 'stopped'):
+            state = 'completed' if exit_code == 0 else 'failed'
+        if run_info_path and not any(f[0] == 'run_info' for f in files):
+            files.append(('run_info', None, None, run_info_path))
+        fields = {
+            'ended': ended or time.time(), 'state': state, 'exit_code': exit_code, 'events': events,
+            'duration': duration, 'rate': events / duration if events is not None and duration else None,
+        }
+        if hv_mon is not None:
+            fields['hv_mon'] = hv_mon
+        for kind, _, _, path in files:
+            parsed = _split_name(os.path.basename(path))
+            if parsed is not None:
+                fields['prefix'] = parsed[0]
+                break
+        self.update_run(run_id, **fields)
+        self.add_files(run_id, files)
+        if run_info_path:
+            self.set_run_info(run_id, run_info_path)
+
+    def update_run(self, run_id, **fields):
+        if not fields:
+            return
+        cols = ', '.join(f'{k} = ?' for k in fields)
+        with self._connect() as con:
+            con.execute(f'UPDATE runs SET {cols} WHERE run_id = ?', (*fields.values(), run_id))
+
+    def add_files(self, run_id, files: Iterable):
+        """Files of a run: (kind, board, channel, path); a path already cataloged moves to this run."""
+        rows = []
+        for kind, board, channel, path in files:
+            board = None if board is None or int(board) < 0 else int(board)
+            channel = None if channel is None or int(channel) < 0 else int(channel)
+            rows.append((run_id, kind, board, channel, _norm(path)))
+        with self._connect() as con:
+            con.executemany('INSERT OR REPLACE INTO files (run_id, kind, board, channel, path) VALUES (?, ?, ?, ?, ?)', rows)
+
+    def set_run_info(self, run_id, run_info_path):
+        """Metadata of the run_info file: PMT HV, source, scintillator and trigger thresholds."""
+        from .converter import parse_run_info
+        info = parse_run_info(run_info_path)
+        if not info:
+            return
+        fields = {'run_info': json.dumps(info)}
+        for key in ('source', 'scintillator'):
+            if key in info:
+                fields[key] = info[key]
+        if 'pmt_hv' in info:
+            fields['hv_mon'] = float(info['pmt_hv'])
+        if 'trigger_threshold_common' in info:
+            fields['threshold'] = info['trigger_threshold_common']
+        self.update_run(run_id, **fields)
+        rows = []
+        for key, val in info.items():
+            m = re.fullmatch(r'trigger_threshold_board(\d+)_ch(\d+)', key)
+            if m:
+                rows.append((run_id, int(m.group(1)), int(m.group(2)), float(val)))
+        with self._connect() as con:
+            con.executemany('INSERT OR REPLACE INTO thresholds (run_id, board, channel, threshold) VALUES (?, ?, ?, ?)', rows)
+
+    def set_analysis(self, run_id, summary):
+        self.update_run(run_id, analysis=json.dumps(summary, default=float))
+
+    # ---------------------- queries ----------------------
+    def get_run(self, run_id):
+        """A run with its files and channel thresholds (None if unknown)."""
+        with self._connect() as con:
+            row = con.execute('SELECT * FROM runs WHERE run_id = ?', (run_id,)).fetchone()
+            if row is None:
+                return None
+            rec = _run_record(row)
+            rec['files'] = [dict(r) for r in con.execute(
+                'SELECT kind, board, channel, path FROM files WHERE run_id = ? ORDER BY kind, board, channel', (run_id,))]
+            rec['thresholds'] = [dict(r) for r in con.execute(
+                'SELECT board, channel, threshold FROM thresholds WHERE run_id = ? ORDER BY board, channel', (run_id,))]
+        return rec
+
+    def find_runs(self, scan_id=None, state=None, hv_min=None, hv_max=None, since=None, until=None,
+                  config_hash=None, limit=None, newest_first=True) -> List[Dict[str, Any]]:
+        """Runs matching all the given conditions (HV in absolute value, times in s since epoch)."""
+        where, args = [], []
+        for cond, val in (('scan_id = ?', scan_id), ('state = ?', state), ('ABS(hv_set) >= ?', hv_min),
+                          ('ABS(hv_set) <= ?', hv_max), ('started >= ?', since), ('started <= ?', until),
+                          ('config_hash = ?', config_hash)):
+            if val is not None:
+                where.append(cond)
+                args.append(abs(val) if cond.startswith('ABS') else val)
+        sql = 'SELECT * FROM runs' + (' WHERE ' + ' AND '.join(where) if where else '')
+        sql += ' ORDER BY started DESC' if newest_first else ' ORDER BY started'
+        if limit:
+            sql += ' LIMIT ?'
+            args.append(int(limit))
+        with self._connect() as con:
+            return [_run_record(r) for r in con.execute(sql, args)]
+
+    def scan_summary(self, scan_id) -> List[Dict[str, Any]]:
+        """Runs of a scan in acquisition order, with the analysis of each point and the path of its run_info."""
+        with self._connect() as con:
+            return [_run_record(r) for r in con.execute(
+                "SELECT runs.*, (SELECT path FROM files f WHERE f.run_id = runs.run_id AND f.kind = 'run_info')"
+                ' AS run_info_path FROM runs WHERE scan_id = ? ORDER BY point, started', (scan_id,))]
+
+    def latest_file(self, kind, board=None, channel=None, folder=None):
+        """Path of the file of this kind of the newest run that still has it (None if none)."""
+        sql = 'SELECT f.path FROM files f JOIN runs r ON r.run_id = f.run_id WHERE f.kind = ?'
+        args = [kind]
+        if board is not None:
+            sql += ' AND f.board = ?'
+            args.append(board)
+        if channel is not None:
+            sql += ' AND f.channel = ?'
+            args.append(channel)
+        if folder is not None:
+            sql += ' AND r.folder = ?'
+            args.append(_norm(folder))
+        sql += ' ORDER BY r.started DESC'
+        with self._connect() as con:
+            for row in con.execute(sql, args):
+                if os.path.exists(row['path']):
+                    return row['path']
+        return None
+
+    def run_info_of(self, path):
+        """Cataloged run_info metadata of the run owning a file (None if the file or the metadata is unknown)."""
+        with self._connect() as con:
+            row = con.execute('SELECT r.run_info FROM files f JOIN runs r ON r.run_id = f.run_id WHERE f.path = ?',
+                              (_norm(path),)).fetchone()
+        return json.loads(row['run_info']) if row is not None and row['run_info'] else None
+
+    # ---------------------- existing folders ----------------------
+    def index_folder(self, folder):
+        """Add the runs of a folder that are not cataloged yet (from the file names); returns the runs added."""
+        folder = os.path.abspath(folder)
+        runs: Dict[str, List] = {}
+        for name in os.listdir(folder):
+            parsed = _split_name(name)
+            if parsed is not None:
+                prefix, kind, board, channel = parsed
+                runs.setdefault(prefix, []).append((kind, board, channel, os.path.join(folder, name)))
+        with self._connect() as con:
+            known = {r['prefix'] for r in con.execute('SELECT prefix FROM runs WHERE folder = ?', (_norm(folder),))}
+        added = 0
+        for prefix, files in sorted(runs.items()):
+            if prefix in known:
+                continue
+            try:
+                started = datetime.strptime(prefix.rstrip('_'), _PREFIX_TIME).timestamp()
+            except ValueError:
+                started = min(os.path.getmtime(f[3]) for f in files)
+            ended = max(os.path.getmtime(f[3]) for f in files)
+            run_id = self.start_run(folder=folder, started=started)
+            self.update_run(run_id, prefix=prefix, ended=ended, state='completed')
+            self.add_files(run_id, files)
+            info = next((f[3] for f in files if f[0] == 'run_info'), None)
+            if info:
+                self.set_run_info(run_id, info)
+            added += 1
+        return added
+
+
+class _Connection:
+    """sqlite3 connection committed (or rolled back) and closed at the end of a with block."""
+
+    def __init__(self, con):
+        self.con = con
+
+    def __enter__(self):
+        return self.con
+
+    def __exit__(self, exc_type, exc, tb):
+        try:
+            if exc_type is None:
+                self.con.commit()
+            else:
+                self.con.rollback()
+        finally:
+            self.con.close()
+        return False
+
+
+def _format_run(r):
+    ts = datetime.fromtimestamp(r['started']).strftime('%Y-%m-%d %H:%M:%S')
+    hv = r['hv_set'] if r['hv_set'] is not None else r['hv_mon']
+    hv = f"{hv:g} V" if hv is not None else '-'
+    thr = f"{r['threshold']:g} V" if r['threshold'] is not None else '-'
+    events = r['events'] if r['events'] is not None else '-'
+    return f"{r['run_id']:6d}  {ts}  {r['state']:9s}  HV {hv:>8s}  thr {thr:>8s}  events {events:>9}  {r['prefix'] or ''}"
+
+
+def main():
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description='Catalog of the WaveDemo runs of a data folder (run_catalog.sqlite).'
+    )
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p_index = sub.add_parser('index', help='Add the runs of a folder that are not cataloged yet')
+    p_index.add_argument('folder')
+
+    p_list = sub.add_parser('list', help='List the runs (newest first)')
+    p_list.add_argument('folder')
+    p_list.add_argument('--scan', help='Runs of one scan id')
+    p_list.add_argument('--hv-min', type=float, help='Min |HV| (V)')
+    p_list.add_argument('--hv-max', type=float, help='Max |HV| (V)')
+    p_list.add_argument('--state', choices=['running', 'completed', 'stopped', 'failed'])
+    p_list.add_argument('--limit', type=int, default=50)
+
+    p_show = sub.add_parser('show', help='Show one run with its files')
+    p_show.add_argument('folder')
+    p_show.add_argument('run_id', type=int)
+    args = parser.parse_args()
+
+    catalog = open_catalog(args.folder, create=(args.command == 'index'))
+    if catalog is None:
+        parser.error(f'no catalog in {args.folder} (run: run-catalog index {args.folder})')
+    if args.command == 'index':
+        n = catalog.index_folder(args.folder)
+        print(f'{n} runs added to {catalog.path}')
+    elif args.command == 'list':
+        for r in catalog.find_runs(scan_id=args.scan, state=args.state, hv_min=args.hv_min, hv_max=args.hv_max,
+                                   limit=args.limit):
+            print(_format_run(r))
+    else:
+        r = catalog.get_run(args.run_id)
+        if r is None:
+            parser.error(f'run {args.run_id} not found')
+        print(_format_run(r))
+        for key in ('scan_id', 'point', 'config_hash', 'config_path', 'hv_mon', 'duration', 'rate', 'pmt', 'source',
+                    'scintillator'):
+            if r[key] is not None:
+                print(f'  {key:12s} {r[key]}')
+        for t in r['thresholds']:
+            print(f"  threshold    board {t['board']} channel {t['channel']}: {t['threshold']:g} V")
+        for f in r['files']:
+            where = f" {f['board']}/{f['channel']}" if f['board'] is not None else ''
+            print(f"  {f['kind']:12s}{where} {f['path']}")
+        if r['analysis']:
+            print(f"  analysis     {json.dumps(r['analysis'])}")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,131 @@
+import os
+import time
+import threading
+import logging
+from concurrent.futures import ProcessPoolExecutor
+
+
+__all__ = [
+    'PostProcessPool',
+    'postprocess_point',
+    'analysis_cpus',
+    'point_files',
+]
+
+# Resource limits of the post-processing, so that it never competes with the live readout
+DEFAULT_WORKERS = 1         # conversion/analysis processes
+DEFAULT_MAX_PENDING = 2     # finished points waiting for (or in) post-processing before the scan waits
+DEFAULT_NICE = 10           # priority decrease of the workers (POSIX nice; below normal / idle on Windows)
+DEFAULT_RESERVED_CPUS = 1   # CPUs left to WaveDemo and the HV control (the workers run on the others)
+
+logger = logging.getLogger('scan_pipeline')
+
+
+def analysis_cpus(reserved=DEFAULT_RESERVED_CPUS):
+    """CPUs for the post-processing workers: all but the first `reserved` ones (None = no restriction)."""
+    n = os.cpu_count() or 1
+    if reserved <= 0 or n <= reserved:
+        return None
+    return list(range(reserved, n))
+
+
+def _init_worker(nice, cpus):
+    # Lower the priority and restrict the CPUs of this worker; failures leave the defaults
+    try:
+        import psutil
+        proc = psutil.Process()
+        if os.name == 'nt':
+            proc.nice(psutil.IDLE_PRIORITY_CLASS if nice >= 15 else psutil.BELOW_NORMAL_PRIORITY_CLASS)
+        elif nice > 0:
+            os.nice(nice)
+        if cpus and hasattr(proc, 'cpu_affinity'):
+            proc.cpu_affinity(cpus)
+    except Exception:
+        pass
+
+
+def postprocess_point(wave_path, streaming=True):
+    """Convert the waveform file of one scan point to HDF5 and analyze it (runs in a worker)."""
+    from .converter import convert_dt_to_h5
+    from .analysis import _summarize_file
+
+    t0 = time.time()
+    h5_path = convert_dt_to_h5(wave_path)
+    t1 = time.time()
+    if not h5_path:
+        return {'wave': wave_path, 'hdf5': None, 'summary': None, 'convert_s': t1 - t0, 'analyze_s': 0.0}
+    # streaming: the memory of a worker doesn't grow with the size of the run
+    summary = _summarize_file(h5_path, streaming=streaming)
+    return {'wave': wave_path, 'hdf5': h5_path, 'summary': summary, 'convert_s': t1 - t0, 'analyze_s': time.time() - t1}
+
+
+def point_files(status_records, output_dir=None):
+    """Waveform file (board 0, channel 0) and run_info of a run, from its status records or the newest files."""
+    wave_path = info_path = None
+    for rec in status_records:
+        if rec.get('ev') != 'file' or not rec.get('path'):
+            continue
+        if rec.get('kind') == 'wave' and rec.get('board', 0) == 0 and rec.get('channel', 0) == 0:
+            wave_path = rec['path']
+        elif rec.get('kind') == 'run_info':
+            info_path = rec['path']
+    if output_dir and (wave_path is None or info_path is None):
+        from .dt5743_runner import find_latest_run_files
+        latest_wave, latest_info = find_latest_run_files(output_dir)
+        wave_path = wave_path or latest_wave
+        info_path = info_path or latest_info
+    return wave_path, info_path
+
+
+class PostProcessPool:
+    """Bounded pool post-processing the finished scan points while the scan moves on.
+
+    At most `max_pending` points are queued or running: `submit` blocks beyond that (between two points, never
+    during an acquisition), so a slow analysis delays the scan instead of piling up. The workers run at a
+    lower priority and on the CPUs given by `cpus` (see analysis_cpus).
+    """
+
+    def __init__(self, workers=DEFAULT_WORKERS, max_pending=DEFAULT_MAX_PENDING, nice=DEFAULT_NICE,
+                 cpus='auto', streaming=True):
+        if cpus == 'auto':
+            cpus = analysis_cpus()
+        self.workers = max(1, int(workers))
+        self.max_pending = max(1, int(max_pending))
+        self.streaming = streaming
+        self._slots = threading.BoundedSemaphore(self.max_pending)
+        self._pool = ProcessPoolExecutor(max_workers=self.workers, initializer=_init_worker, initargs=(nice, cpus))
+        self._futures = []
+        self._lock = threading.Lock()
+
+    def submit(self, wave_path, callback=None):
+        """Queue one point; callback(result, error) is called from a pool thread when it is done."""
+        t0 = time.time()
+        self._slots.acquire()
+        waited = time.time() - t0
+        if waited > 1:
+            logger.info(f"Scan waited {waited:.1f} s for the post-processing queue")
+        future = self._pool.submit(postprocess_point, wave_path, self.streaming)
+
+        def done(f):
+            self._slots.release()
+            if callback is None:
+                return
+            try:
+                result, error = f.result(), None
+            except Exception as e:
+                result, error = None, e
+            callback(result, error)
+
+        future.add_done_callback(done)
+        with self._lock:
+            self._futures = [f for f in self._futures if not f.done()]
+            self._futures.append(future)
+        return future
+
+    def pending(self):
+        with self._lock:
+            return sum(1 for f in self._futures if not f.done())
+
+    def close(self, wait=True):
+        """Wait for the queued points (wait=False cancels those not started) and stop the workers."""
+        self._pool.shutdown(wait=wait, cancel_futures=not wait)
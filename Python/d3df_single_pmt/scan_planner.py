@@ -0,0 +1,276 @@
+"""Adaptive HV scan: choose the next point and its duration from the results so far.
+
+The response (gain or a timing parameter) is fitted after each point with a polynomial in log|HV| of log(value):
+degree 1 is the power law of the PMT gain (G ~ V^k), degree 2 adds the curvature of the timing curves.
+The next point is the HV where the predicted relative uncertainty of the fit is the largest, and its duration
+is the time needed to measure it there with the target precision (from the statistical error per second of the
+points already measured). The scan stops when the fit is within the target precision over the whole range, or
+at the point/time budget.
+
+SimulatedPMT is a response model with counting statistics, used by the `scan-planner` command to compare the
+adaptive scan with a fixed grid without hardware.
+"""
+from __future__ import annotations
+import math
+from typing import List, Optional, Tuple, Dict, Any
+
+import numpy as np
+
+__all__ = ['AdaptiveScanPlanner', 'SimulatedPMT', 'histogram_mean', 'simulate_scan', 'simulate_grid']
+
+DEFAULT_TARGET = 0.01           # relative precision of the fitted curve
+DEFAULT_HV_STEP = 10.0          # V, resolution of the chosen points
+DEFAULT_MIN_TIME = 10.0         # s per point
+DEFAULT_MAX_TIME = 300.0        # s per point
+DEFAULT_MAX_POINTS = 20
+DEFAULT_RESOLUTION = 0.3        # relative rms of the measured distribution, when a point has no error of its own
+
+
+def histogram_mean(bins) -> Tuple[Optional[float], Optional[float], int]:
+    """Mean of a histogram (bin units), its statistical error and the entries."""
+    bins = np.asarray(bins, dtype=np.float64)
+    n = bins.sum()
+    if n < 2:
+        return None, None, int(n)
+    x = np.arange(bins.size) + 0.5
+    mean = float((bins * x).sum() / n)
+    rms = math.sqrt(max(float((bins * (x - mean) ** 2).sum() / n), 0.0))
+    return mean, rms / math.sqrt(n), int(n)
+
+
+class AdaptiveScanPlanner:
+    def __init__(self, hv_min: float, hv_max: float, hv_step: float = DEFAULT_HV_STEP, degree: int = 1,
+                 target: float = DEFAULT_TARGET, min_time: float = DEFAULT_MIN_TIME, max_time: float = DEFAULT_MAX_TIME,
+                 max_points: int = DEFAULT_MAX_POINTS, budget: Optional[float] = None,
+                 resolution: float = DEFAULT_RESOLUTION):
+        lo, hi = sorted((abs(hv_min), abs(hv_max)))
+        if lo <= 0 or hi <= lo:
+            raise ValueError('the HV range must not include 0 and must not be empty')
+        self.sign = -1.0 if hv_min < 0 or hv_max < 0 else 1.0
+        self.hv_step = max(float(hv_step), 1e-6)
+        self.grid = np.arange(lo, hi + self.hv_step / 2, self.hv_step)
+        self.degree = int(degree)
+        self.target = float(target)
+        self.min_time = float(min_time)
+        self.max_time = max(float(max_time), self.min_time)
+        self.max_points = int(max_points)
+        self.budget = budget
+        self.resolution = float(resolution)
+        self.points: List[Dict[str, Any]] = []
+        self.time_used = 0.0
+        self.attempts = 0               # points acquired (with a valid result or not)
+        self.done_reason: Optional[str] = None
+        self._fit = None
+
+    # ---------------------- results ----------------------
+    def add(self, hv: float, value: Optional[float], sigma: Optional[float], duration: float,
+            events: Optional[int] = None):
+        """Result of one point; sigma None = resolution / sqrt(events) of the value. Invalid values are skipped."""
+        self.time_used += max(float(duration), 0.0)
+        self.attempts += 1
+        if value is None or not np.isfinite(value) or value <= 0:
+            return
+        if sigma is None or not np.isfinite(sigma) or sigma <= 0:
+            sigma = value * self.resolution / math.sqrt(max(events or 1, 1))
+        self.points.append({'hv': abs(float(hv)), 'value': float(value), 'sigma': float(sigma),
+                            'duration': max(float(duration), 1e-3)})
+        self._fit = None
+
+    def _features(self, hv):
+        x = np.log(np.atleast_1d(np.asarray(hv, dtype=np.float64)))
+        return np.vander(x - math.log(self.grid[0]), self.degree + 1, increasing=True)
+
+    def fit(self):
+        """Weighted least squares of log(value); returns (coef, cov) or None with too few points.
+
+        The covariance is scaled by the reduced chi2 when it exceeds 1, so that a curve the model doesn't
+        describe keeps the uncertainty (and the scan) going."""
+        if self._fit is not None:
+            return self._fit
+        hvs = {p['hv'] for p in self.points}
+        if len(hvs) < self.degree + 1:
+            return None
+        X = self._features([p['hv'] for p in self.points])
+        z = np.log([p['value'] for p in self.points])
+        w = 1.0 / np.square([p['sigma'] / p['value'] for p in self.points])
+        A = X.T @ (X * w[:, None])
+        try:
+            cov = np.linalg.inv(A)
+        except np.linalg.LinAlgError:
+            return None
+        coef = cov @ (X.T @ (w * z))
+        dof = len(z) - X.shape[1]
+        if dof > 0:
+            chi2 = float((w * (z - X @ coef) ** 2).sum())
+            cov = cov * max(chi2 / dof, 1.0)
+        self._fit = (coef, cov)
+        return self._fit
+
+    def predict(self, hv) -> Tuple[np.ndarray, np.ndarray]:
+        """Fitted value and its relative uncertainty at hv (NaN before the first fit)."""
+        f = self._fit or self.fit()
+        X = self._features(np.abs(hv))
+        if f is None:
+            nan = np.full(X.shape[0], np.nan)
+            return nan, nan
+        coef, cov = f
+        return np.exp(X @ coef), np.sqrt(np.einsum('ij,jk,ik->i', X, cov, X))
+
+    def precision(self) -> float:
+        """Largest relative uncertainty of the fit over the scan range (inf before the first fit)."""
+        _, rel = self.predict(self.grid)
+        return float(np.nanmax(rel)) if np.isfinite(rel).any() else math.inf
+
+    # ---------------------- planning ----------------------
+    def _initial_points(self):
+        # degree + 2 points spread over the range (one more than the parameters: the chi2 has a meaning)
+        n = self.degree + 2
+        idx = np.round(np.linspace(0, self.grid.size - 1, n)).astype(int)
+        return [float(self.grid[i]) for i in idx]
+
+    def _noise_per_sqrt_s(self, hv):
+        # relative error x sqrt(s) of the measured point nearest to hv (statistics scale as 1/sqrt(time))
+        p = min(self.points, key=lambda p: abs(math.log(p['hv'] / hv)))
+        return p['sigma'] / p['value'] * math.sqrt(p['duration'])
+
+    def next_point(self) -> Optional[Tuple[float, float]]:
+        """(hv, duration) of the next point, or None when the scan is done (see done_reason)."""
+        if self.attempts >= self.max_points:
+            self.done_reason = 'max points'
+            return None
+        if self.budget is not None and self.time_used >= self.budget:
+            self.done_reason = 'time budget'
+            return None
+        measured = {p['hv'] for p in self.points}
+        initial = [hv for hv in self._initial_points() if hv not in measured]
+        if initial:
+            return self.sign * initial[0], self._clip_time(self.min_time)
+        _, rel = self.predict(self.grid)
+        worst = int(np.nanargmax(rel))
+        if rel[worst] <= self.target:
+            self.done_reason = 'target precision'
+            return None
+        hv = float(self.grid[worst])
+        duration = (self._noise_per_sqrt_s(hv) / self.target) ** 2
+        return self.sign * hv, self._clip_time(duration)
+
+    def _clip_time(self, duration):
+        duration = min(max(duration, self.min_time), self.max_time)
+        if self.budget is not None:
+            duration = min(duration, max(self.budget - self.time_used, self.min_time))
+        return float(math.ceil(duration))
+
+    def summary(self) -> Dict[str, Any]:
+        f = self.fit()
+        return {'points': len(self.points), 'time': self.time_used, 'precision': self.precision(),
+                'coef': f[0].tolist() if f else None, 'done': self.done_reason}
+
+
+class SimulatedPMT:
+    """Response of a PMT vs HV with counting statistics.
+
+    gain: G = gain0 (V/v0)^k; rise time: rise0 (V/v0)^-0.5 + rise_inf (ns). The rate above threshold grows
+    with the gain up to `rate0`; each point measures the mean of a distribution of relative rms `resolution`.
+    """
+
+    def __init__(self, gain0=1000.0, v0=1800.0, k=7.0, rate0=200.0, resolution=DEFAULT_RESOLUTION,
+                 rise0=2.0, rise_inf=1.0, seed=None):
+        self.gain0, self.v0, self.k = gain0, v0, k
+        self.rate0, self.resolution = rate0, resolution
+        self.rise0, self.rise_inf = rise0, rise_inf
+        self.rng = np.random.default_rng(seed)
+
+    def gain(self, hv):
+        return self.gain0 * (abs(hv) / self.v0) ** self.k
+
+    def rise_time(self, hv):
+        return self.rise0 * (abs(hv) / self.v0) ** -0.5 + self.rise_inf
+
+    def rate(self, hv):
+        return self.rate0 * min(1.0, (self.gain(hv) / self.gain0) ** 0.3)
+
+    def measure(self, hv, duration, metric='gain'):
+        """(value, sigma, events) of a point."""
+        events = int(self.rng.poisson(self.rate(hv) * duration))
+        true = self.gain(hv) if metric == 'gain' else self.rise_time(hv)
+        if events < 2:
+            return None, None, events
+        sigma = true * self.resolution / math.sqrt(events)
+        return float(true + self.rng.normal(0.0, sigma)), sigma, events
+
+
+def simulate_scan(model: SimulatedPMT, planner: AdaptiveScanPlanner, metric='gain', overhead=0.0):
+    """Run an adaptive scan on the model; returns (planner, [(hv, duration)...], total time with overhead)."""
+    plan = []
+    while True:
+        nxt = planner.next_point()
+        if nxt is None:
+            break
+        hv, duration = nxt
+        value, sigma, events = model.measure(hv, duration, metric)
+        planner.add(hv, value, sigma, duration, events)
+        plan.append((hv, duration))
+    return planner, plan, planner.time_used + overhead * len(plan)
+
+
+def simulate_grid(model: SimulatedPMT, hvs, duration, metric='gain', degree=1, overhead=0.0):
+    """Fixed grid with the same duration per point; returns (planner holding the fit, total time)."""
+    planner = AdaptiveScanPlanner(min(hvs), max(hvs), hv_step=DEFAULT_HV_STEP, degree=degree,
+                                  min_time=duration, max_time=duration, max_points=len(hvs))
+    for hv in hvs:
+        value, sigma, events = model.measure(hv, duration, metric)
+        planner.add(hv, value, sigma, duration, events)
+    return planner, planner.time_used + overhead * len(hvs)
+
+
+def main():
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        description='Simulate an adaptive HV scan against a fixed grid (simulated PMT response).'
+    )
+    parser.add_argument('--hv-min', type=float, default=1500)
+    parser.add_argument('--hv-max', type=float, default=2000)
+    parser.add_argument('--hv-step', type=float, default=DEFAULT_HV_STEP, help='Resolution of the adaptive points (V)')
+    parser.add_argument('--metric', choices=['gain', 'rise'], default='gain')
+    parser.add_argument('--degree', type=int, default=None, help='Fit degree (default: 1 for gain, 2 for rise)')
+    parser.add_argument('--target', type=float, default=DEFAULT_TARGET, help='Relative precision of the fit')
+    parser.add_argument('--min-time', type=float, default=DEFAULT_MIN_TIME)
+    parser.add_argument('--max-time', type=float, default=DEFAULT_MAX_TIME)
+    parser.add_argument('--max-points', type=int, default=DEFAULT_MAX_POINTS)
+    parser.add_argument('--grid-step', type=float, default=50, help='Step of the fixed grid (V)')
+    parser.add_argument('--grid-time', type=float, default=None,
+                        help='Time per grid point (default: the shortest reaching the same precision)')
+    parser.add_argument('--overhead', type=float, default=30, help='HV ramp and setup time per point (s)')
+    parser.add_argument('--rate', type=float, default=200, help='Rate at 1800 V (Hz)')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    degree = args.degree if args.degree is not None else (1 if args.metric == 'gain' else 2)
+
+    planner = AdaptiveScanPlanner(args.hv_min, args.hv_max, args.hv_step, degree=degree, target=args.target,
+                                  min_time=args.min_time, max_time=args.max_time, max_points=args.max_points)
+    planner, plan, total = simulate_scan(SimulatedPMT(rate0=args.rate, seed=args.seed), planner, args.metric,
+                                         args.overhead)
+    print(f"Adaptive: {len(plan)} points, {planner.time_used:.0f} s acquisition, {total:.0f} s with overhead, "
+          f"precision {planner.precision():.4f} ({planner.done_reason})")
+    for hv, duration in plan:
+        print(f"  HV {hv:8.1f} V  {duration:6.0f} s")
+
+    hvs = list(np.arange(args.hv_min, args.hv_max + args.grid_step / 2, args.grid_step))
+    if args.grid_time is not None:
+        times = [args.grid_time]
+    else:
+        times = [args.min_time * 2 ** i for i in range(12)]
+    for t in times:
+        grid, grid_total = simulate_grid(SimulatedPMT(rate0=args.rate, seed=args.seed), hvs, t, args.metric,
+                                         degree, args.overhead)
+        if grid.precision() <= planner.precision() or t == times[-1]:
+            break
+    print(f"Grid:     {len(hvs)} points x {t:.0f} s, {grid.time_used:.0f} s acquisition, {grid_total:.0f} s with "
+          f"overhead, precision {grid.precision():.4f}")
+    if total > 0:
+        print(f"Scan time ratio (grid / adaptive): {grid_total / total:.1f}")
+
+
+if __name__ == '__main__':
+    main()
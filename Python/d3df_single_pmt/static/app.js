@@ -194,10 +194,66 @@
     };
   }
 
+  // Live spectra websocket: binary delta frames (layout in live_histos.py)
+  const liveHistos = {};
+  const liveChart = new Chart(el('chart_live'), { type:'line', data:{ labels:[], datasets:[{ label:'Counts', data:[], borderColor:cvars.events, stepped:true, pointRadius:0, borderWidth:1 }] }, options:{ responsive:true, animation:false, scales:{ x:{ title:{ display:true, text:'Bin', color:cvars.fg }, ticks:{ color:cvars.fg, maxTicksLimit:16 }, grid:{ color:cvars.border } }, y:{ beginAtZero:true, ticks:{ color:cvars.fg }, grid:{ color:cvars.border } } } } });
+  let wsLive = null;
+  function liveKey(b, ch, kind){ return b + ':' + ch + ':' + kind; }
+  function showLive(){
+    const sel = el('live_sel');
+    const h = sel ? liveHistos[sel.value] : null;
+    if(!h) return;
+    if(liveChart.data.labels.length !== h.bins.length){ liveChart.data.labels = Array.from(h.bins.keys()); }
+    liveChart.data.datasets[0].data = Array.from(h.bins);
+    liveChart.data.datasets[0].label = 'Counts (entries ' + h.entries + ', ovf ' + h.ovf + ', unf ' + h.unf + ')';
+    liveChart.update();
+  }
+  function applyLiveFrame(buf){
+    const dv = new DataView(buf);
+    if(String.fromCharCode(dv.getUint8(0), dv.getUint8(1), dv.getUint8(2), dv.getUint8(3)) !== 'WDLH' || dv.getUint8(4) !== 1) return;
+    const nHistos = dv.getUint16(6, true), nRates = dv.getUint16(8, true);
+    let pos = 24;
+    const rates = [];
+    for(let i = 0; i < nRates; i++, pos += 12){
+      rates.push('B' + dv.getUint8(pos) + ' CH' + dv.getUint8(pos + 1) + ': ' + dv.getFloat32(pos + 4, true).toFixed(1) + ' Hz');
+    }
+    if(nRates) el('live_rates').textContent = rates.join('   ');
+    const sel = el('live_sel');
+    let changed = false;
+    for(let i = 0; i < nHistos; i++){
+      const b = dv.getUint8(pos), ch = dv.getUint8(pos + 1), kind = dv.getUint8(pos + 2), full = dv.getUint8(pos + 3) & 1;
+      const nbin = dv.getUint32(pos + 4, true), n = dv.getUint32(pos + 20, true);
+      const key = liveKey(b, ch, kind);
+      let h = liveHistos[key];
+      if(!h || full || h.bins.length !== nbin){
+        h = liveHistos[key] = { bins: new Uint32Array(nbin) };
+        if(sel && !sel.querySelector("option[value='" + key + "']")){
+          const opt = document.createElement('option');
+          opt.value = key; opt.textContent = 'B' + b + ' CH' + ch + ' ' + (kind === 0 ? 'energy' : 'time');
+          sel.appendChild(opt);
+        }
+      }
+      h.entries = dv.getUint32(pos + 8, true); h.ovf = dv.getUint32(pos + 12, true); h.unf = dv.getUint32(pos + 16, true);
+      const idx = new Uint32Array(buf, pos + 24, n), val = new Uint32Array(buf, pos + 24 + 4 * n, n);
+      for(let j = 0; j < n; j++){ h.bins[idx[j]] = val[j]; }
+      if(sel && sel.value === key) changed = true;
+      pos += 24 + 8 * n;
+    }
+    if(changed) showLive();
+  }
+  function connectLive(id){
+    if(wsLive){ wsLive.close(); wsLive = null; }
+    wsLive = new WebSocket('ws://' + location.host + '/ws/live/' + id + '?max_fps=2');
+    wsLive.binaryType = 'arraybuffer';
+    wsLive.onmessage = function(ev){ if(ev.data instanceof ArrayBuffer){ try { applyLiveFrame(ev.data); } catch(e) { /* ignore */ } } };
+  }
+  if(el('live_sel')) el('live_sel').onchange = showLive;
+
   // Measurement websocket
   let wsM = null;
   function connectMeasure(id){
     if(wsM){ wsM.close(); wsM = null; }
+    connectLive(id);
     wsM = new WebSocket('ws://' + location.host + '/ws/measure/' + id);
     wsM.onmessage = function(ev){
       try {
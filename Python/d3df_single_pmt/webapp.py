@@ -4,19 +4,40 @@ Provides endpoints:
 - POST /hv/set {value,...} : set HV (VSET)
 - GET /hv/read : current HV (VMON)
 - POST /hv/send {cmd,par,val?,channel?,device?...} : raw command
-- WebSocket /ws/hv?interval=2 : live HV monitoring
+- GET /hv/status : HV broker queue and cached readbacks (only brokers already connected)
+- WebSocket /ws/hv?interval=2 : live HV monitoring (cached readbacks)
 
 Measurement control:
-- POST /measure/start {yaml, data_output, exe, batch_mode, max_events, max_time, trigger_threshold, sampling_frequency, channel_thresholds, hv_sequence, thresholds, repeat, loop}
+- POST /measure/start {yaml, data_output, exe, batch_mode, max_events, max_time, trigger_threshold, sampling_frequency, channel_thresholds, hv_sequence, thresholds, repeat, loop, continuous}
 - POST /measure/stop/{id}
 - GET /measure/status : list active measurements
+- GET /measure/history/{id} : run history of a measurement (from the run catalog after a restart)
+- GET /runs?data_output=... : runs of the run catalog of a data folder (filters: scan, HV range, state, since)
 - WebSocket /ws/measure/{id} : live progress (events, rate, elapsed, hv, threshold)
+- WebSocket /ws/live/{id}?max_fps=2 : live histograms and rates (binary delta frames, see live_histos)
 
 Design notes:
 - Uses subprocess to invoke dt5743_runner for each measurement configuration.
 - HV set performed before each run when hv value specified.
-- Progress parsing is heuristic: looks for integers in lines containing 'event' or 'Events'.
-- Event rate computed as events / elapsed_seconds.
+- All HV traffic goes through the broker of the device (hv_broker): one thread owns the serial port, scan control
+  runs ahead of the user commands, and the monitors share one cached periodic readback. Device sim://<name>
+  selects the simulated supply. Only the devices listed in DIGITIZER_HV_DEVICES can be opened.
+- Progress comes from the WaveDemo JSON Lines status stream (runner --status-stream): state transitions,
+  batch progress and per-channel rates. Console scraping is kept as a fallback for older executables.
+- With postprocess=true each point is converted to HDF5 and analyzed in a bounded background pool
+  (scan_pipeline.PostProcessPool) while the HV of the next point ramps and it is acquired; the timing results
+  are added to the run history. The workers run at low priority, off the first CPU.
+- With continuous=true a single WaveDemo acquisition spans the whole scan: each step is announced through a
+  marker file (runner --marker-file) and WaveDemo saves the histograms per step, so the digitizer is
+  initialised once instead of once per HV/threshold point. Steps last max_time seconds.
+- With adaptive=true the HV points and their durations are chosen by scan_planner.AdaptiveScanPlanner within the
+  range of hv_sequence, from a fit of the energy (live histogram) or of a post-processing result vs HV.
+- With thr_emulation=true a threshold scan takes one acquisition per HV point, at the lowest of thresholds, with
+  the raw data saved; WaveDemo then replays it with all the thresholds at once (EMULATE_THRESHOLDS) and the
+  counts and rates of each threshold are added to the run history ('thr_emulation').
+- Every run is recorded by the runner in the run catalog of data_output (run_catalog.RunCatalog), grouped by the
+  measurement id; the post-processing results are added to the runs, so the history of a measurement and the
+  summaries of past scans are queries instead of folder listings.
 - For long-running loops, user can stop via /measure/stop/{id}.
 
 This is a simple starting point; refine parsing or persistence as needed.
@@ -29,6 +50,7 @@ import subprocess
 import sys
 import re
 import os
+import json
 from typing import Dict, List, Optional, Any
 import logging
 import psutil
@@ -38,13 +60,16 @@ from fastapi.security import HTTPBasic, HTTPBasicCredentials
 from pydantic import BaseModel, Field
 import secrets
 
-from .caen_hv import send_caen_command
+from .hv_broker import get_broker, find_broker, stop_brokers, PRIORITY_CONTROL, PRIORITY_UI
+from .scan_pipeline import PostProcessPool, point_files, DEFAULT_MAX_PENDING
+from .live_histos import LiveHistograms
+from .scan_planner import AdaptiveScanPlanner, histogram_mean
+from .run_catalog import open_catalog
 
 app = FastAPI(title="Digitizer Web Interface", version="0.1.0")
 security = HTTPBasic()
 
-# Global HV lock and log to ensure one HV command at a time
-hv_lock = threading.Lock()
+# Global HV log (the commands themselves are serialized by the HV broker of each device)
 hv_log_lines: List[str] = []
 
 def is_wavedemo_running() -> bool:
@@ -61,6 +86,16 @@ def is_wavedemo_running() -> bool:
 AUTH_USERNAME = os.getenv("DIGITIZER_USERNAME", "d3df")
 AUTH_PASSWORD = os.getenv("DIGITIZER_PASSWORD", "dt5743")
 
+# HV devices the clients may open (comma-separated): a broker thread is started per device, so the device
+# strings sent by the clients are checked against this list
+HV_DEVICES = [d.strip() for d in os.getenv("DIGITIZER_HV_DEVICES", "COM10").split(',') if d.strip()]
+
+def hv_broker_of(device: str, baudrate: int = 9600, timeout: float = 1.0):
+    """Broker of an allowed HV device (HTTP 403 for a device not in HV_DEVICES)."""
+    if device not in HV_DEVICES:
+        raise HTTPException(status_code=403, detail=f"HV device not allowed: {device} (see DIGITIZER_HV_DEVICES)")
+    return get_broker(device, baudrate=baudrate, timeout=timeout)
+
 def verify_credentials(credentials: HTTPBasicCredentials = Depends(security)):
     correct_username = secrets.compare_digest(credentials.username, AUTH_USERNAME)
     correct_password = secrets.compare_digest(credentials.password, AUTH_PASSWORD)
@@ -116,6 +151,22 @@ class MeasureStartRequest(BaseModel):
     hv_channel: Optional[int] = None
     source: Optional[str] = Field(None, description="Radiation source identifier")
     scintillator: Optional[str] = Field(None, description="Scintillator type/identifier")
+    continuous: bool = Field(False, description="If True, run the whole scan in one acquisition, separating the steps with markers")
+    postprocess: bool = Field(False, description="If True, convert and analyze each point in the background while the scan goes on")
+    postprocess_workers: int = Field(1, description="Processes converting/analyzing the finished points")
+    postprocess_max_pending: int = Field(DEFAULT_MAX_PENDING, description="Finished points queued for post-processing before the scan waits")
+    live_histograms: str = Field("ENERGY", description="Histograms streamed for the live view: NO, ENERGY, TIME or ALL")
+    adaptive: bool = Field(False, description="If True, the HV points and durations are chosen by the adaptive planner within the range of hv_sequence")
+    adaptive_metric: str = Field("energy", description="Fitted quantity: energy (mean of the board 0 channel 0 energy histogram) or amplitude (of the unnormalized mean pulse), rise_time_ns, fall_time_ns, pulse_width_ns (needs postprocess)")
+    adaptive_target: float = Field(0.01, description="Relative precision of the fitted curve at which the scan stops")
+    adaptive_degree: Optional[int] = Field(None, description="Degree of the log-log fit (default 1 for energy/amplitude, 2 for timing)")
+    adaptive_hv_step: float = Field(10.0, description="HV resolution of the chosen points (V)")
+    adaptive_min_time: float = Field(10.0, description="Shortest acquisition of a point (s)")
+    adaptive_max_time: float = Field(300.0, description="Longest acquisition of a point (s)")
+    adaptive_max_points: int = Field(20, description="Points per threshold")
+    adaptive_budget: Optional[float] = Field(None, description="Total acquisition time per threshold (s)")
+    thr_emulation: bool = Field(False, description="If True, each HV point is acquired once at the lowest of thresholds and the other thresholds are emulated in a replay of its raw data")
+    thr_emulation_discr: str = Field("SAME", description="Discriminators emulated for each threshold: SAME, LED, CFD or BOTH")
 
 class MeasureStatus(BaseModel):
     id: str
@@ -139,6 +190,7 @@ class MeasureStatus(BaseModel):
     runs: List[Dict[str, Any]] = Field(default_factory=list)  # history of completed runs
     runner_log: List[str] = Field(default_factory=list)  # dt5743_runner subprocess output
     hv_log: List[str] = Field(default_factory=list)  # CAEN HV commands and monitoring
+    postprocess_pending: int = 0  # points queued or being converted/analyzed
 
 # ---------------------- RUNTIME STATE ----------------------
 class MeasurementTask:
@@ -161,6 +213,11 @@ class MeasurementTask:
         self.runner_log_lines: list[str] = []  # separate log for dt5743_runner subprocess output
         self.runs: List[Dict[str, Any]] = []  # list of dicts capturing history of runs
         self.run_info_path: Optional[str] = None  # path to current run_info.txt file
+        self.run_file_records: List[Dict[str, Any]] = []  # 'file' status records of the current run
+        self.thr_points: List[Dict[str, Any]] = []  # 'thr_point' status records of the current run (thr_emulation)
+        self.catalog_run_id: Optional[int] = None  # run catalog id of the current run (announced by the runner)
+        self.pool: Optional[PostProcessPool] = None  # background conversion/analysis (postprocess=true)
+        self.live = LiveHistograms()  # live histograms and rates (/ws/live/{id})
         self.thread = threading.Thread(target=self.run_loop, daemon=True)
         self.lock = threading.Lock()
         self.proc: Optional[subprocess.Popen] = None
@@ -180,77 +237,87 @@ class MeasurementTask:
         if len(hv_log_lines) > 10000:
             hv_log_lines.pop(0)
 
-    def _read_hv(self, max_retries: int = 10, retry_delay: float = 2.0) -> Optional[float]:
-        """Read HV with retry logic. Returns HV value on success, None on failure after all retries."""
-        with hv_lock:  # Ensure one HV command at a time globally
-            for attempt in range(1, max_retries + 1):
-                try:
-                    self.append_hv_log(f"MON VMON (attempt {attempt}/{max_retries})")
-                    resp = send_caen_command('MON', 'VMON', channel=str(self.req.hv_channel or '1'), device=self.req.hv_device or 'COM10', baudrate=self.req.hv_baudrate or 9600, timeout=self.req.hv_timeout or 1.0)
-                    try:
-                        hv_value = float(str(resp).replace(',', '.').strip())
-                        self.append_hv_log(f"Response: {hv_value} V")
-                        if attempt > 1:
-                            logger.info(f"HV read successful on attempt {attempt}")
-                        return hv_value
-                    except Exception as parse_err:
-                        msg = f"Failed to parse HV response on attempt {attempt}/{max_retries}: {parse_err}"
-                        logger.warning(msg)
-                        self.append_hv_log(f"Parse error: {parse_err}")
-                        if attempt < max_retries:
-                            time.sleep(retry_delay)
-                        continue
-                except Exception as e:
-                    msg = f"Failed to read HV on attempt {attempt}/{max_retries}: {e}"
-                    logger.warning(msg)
-                    self.append_hv_log(f"Error: {e}")
-                    if attempt < max_retries:
-                        time.sleep(retry_delay)
-                    else:
-                        logger.error(f"Failed to read HV after {max_retries} attempts")
-                        return None
-            return None
+    def hv_broker(self):
+        return get_broker(self.req.hv_device or 'COM10', baudrate=self.req.hv_baudrate or 9600,
+                          timeout=self.req.hv_timeout or 1.0)
+
+    def _read_hv(self, max_retries: int = 10, retry_delay: float = 2.0, max_age: Optional[float] = None) -> Optional[float]:
+        """Read HV with retry logic. Returns HV value on success, None on failure after all retries.
+
+        The reading goes through the HV broker with the scan-control priority; a cached readback younger than
+        max_age is returned without access to the device."""
+        broker = self.hv_broker()
+        channel = str(self.req.hv_channel or '1')
+        for attempt in range(1, max_retries + 1):
+            try:
+                self.append_hv_log(f"MON VMON (attempt {attempt}/{max_retries})")
+                hv_value = broker.read_vmon(channel, max_age=max_age, priority=PRIORITY_CONTROL)
+                if hv_value is not None:
+                    self.append_hv_log(f"Response: {hv_value} V")
+                    if attempt > 1:
+                        logger.info(f"HV read successful on attempt {attempt}")
+                    return hv_value
+                rb = broker.readback(channel) or {}
+                logger.warning(f"Failed to parse HV response on attempt {attempt}/{max_retries}: {rb.get('error')}")
+                self.append_hv_log(f"Parse error: {rb.get('error')}")
+            except Exception as e:
+                logger.warning(f"Failed to read HV on attempt {attempt}/{max_retries}: {e}")
+                self.append_hv_log(f"Error: {e}")
+            if attempt < max_retries:
+                time.sleep(retry_delay)
+        logger.error(f"Failed to read HV after {max_retries} attempts")
+        return None
 
     def _set_hv(self, value: float, max_retries: int = 10, retry_delay: float = 2.0) -> bool:
         """Set HV with retry logic. Returns True on success, False on failure after all retries."""
-        with hv_lock:  # Ensure one HV command at a time globally
-            for attempt in range(1, max_retries + 1):
-                try:
-                    logger.info(f"Setting HV to {value} V (attempt {attempt}/{max_retries})...")
-                    self.append_hv_log(f"SET VSET {value} V (attempt {attempt}/{max_retries})")
-                    
-                    send_caen_command('SET', 'VSET', str(value), 
-                                    channel=str(self.req.hv_channel or '1'), 
-                                    device=self.req.hv_device or 'COM10', 
-                                    baudrate=self.req.hv_baudrate or 9600, 
-                                    timeout=self.req.hv_timeout or 1.0)
-                    
-                    logger.info(f"HV set to {value} V successfully on attempt {attempt}")
-                    self.append_hv_log(f"Success: HV set to {value} V")
-                    return True
-                    
-                except Exception as e:
-                    logger.error(f"Failed to set HV to {value} V on attempt {attempt}/{max_retries}: {e}")
-                    self.append_hv_log(f"Error: {e}")
-                    
-                    if attempt < max_retries:
-                        logger.info(f"Retrying in {retry_delay}s...")
-                        self.append_hv_log(f"Retrying in {retry_delay}s...")
-                        time.sleep(retry_delay)
-                    else:
-                        logger.error(f"Failed to set HV to {value} V after {max_retries} attempts")
-                        self.append_hv_log(f"Failed after {max_retries} attempts")
-                        return False
-            return False
+        broker = self.hv_broker()
+        for attempt in range(1, max_retries + 1):
+            try:
+                logger.info(f"Setting HV to {value} V (attempt {attempt}/{max_retries})...")
+                self.append_hv_log(f"SET VSET {value} V (attempt {attempt}/{max_retries})")
+
+                # scan control goes ahead of the queued user commands and readbacks
+                broker.request('SET', 'VSET', str(value), channel=str(self.req.hv_channel or '1'),
+                               priority=PRIORITY_CONTROL)
+
+                logger.info(f"HV set to {value} V successfully on attempt {attempt}")
+                self.append_hv_log(f"Success: HV set to {value} V")
+                return True
+
+            except Exception as e:
+                logger.error(f"Failed to set HV to {value} V on attempt {attempt}/{max_retries}: {e}")
+                self.append_hv_log(f"Error: {e}")
+
+                if attempt < max_retries:
+                    logger.info(f"Retrying in {retry_delay}s...")
+                    self.append_hv_log(f"Retrying in {retry_delay}s...")
+                    time.sleep(retry_delay)
+                else:
+                    logger.error(f"Failed to set HV to {value} V after {max_retries} attempts")
+                    self.append_hv_log(f"Failed after {max_retries} attempts")
+                    return False
+        return False
 
     def wait_for_hv(self, target: float, tolerance: float = 0.5, max_wait: float = 30.0, poll_interval: float = 2.0) -> bool:
+        """Wait for VMON within tolerance of target, from the periodic readbacks of the broker.
+
+        Only readbacks taken after the call count (a cached value may predate the SET); no command is queued,
+        so waiting doesn't add traffic on the serial line."""
+        broker = self.hv_broker()
+        channel = str(self.req.hv_channel or '1')
         start = time.time()
         logger.info(f"Waiting for HV to reach target {target} V (±{tolerance} V), max_wait={max_wait}s")
         with self.lock:
             self.append_hv_log(f"Waiting for HV to reach target {target} V (±{tolerance} V)")
+        newer_than = start
         while time.time() - start < max_wait:
-            hv = self._read_hv()
-            msg_mon = f"Monitored HV: {hv} V" if hv is not None else "Monitored HV: read error"
+            left = max_wait - (time.time() - start)
+            rb = broker.wait_readback(channel, newer_than=newer_than, timeout=min(left, max(poll_interval, broker.poll_interval) * 2))
+            if rb is None or rb['ts'] <= newer_than:
+                continue
+            newer_than = rb['ts']
+            hv = rb['vmon'] if rb['error'] is None else None
+            msg_mon = f"Monitored HV: {hv} V" if hv is not None else f"Monitored HV: read error ({rb['error']})"
             logger.info(msg_mon)
             with self.lock:
                 self.append_log(msg_mon)
@@ -262,22 +329,33 @@ class MeasurementTask:
                     with self.lock:
                         self.append_hv_log(msg_reached)
                     return True
-            time.sleep(poll_interval)
         msg_timeout = f"HV did not reach target within tolerance after {max_wait}s (last measured HV may differ)"
         logger.warning(msg_timeout)
         with self.lock:
             self.append_hv_log(msg_timeout)
         return False
 
-    def build_runner_cmd(self, hv: Optional[float], threshold: Optional[float]) -> List[str]:
+    def build_runner_cmd(self, hv: Optional[float], threshold: Optional[float], marker_file: Optional[str] = None,
+                         duration: Optional[float] = None) -> List[str]:
         py = sys.executable
-        cmd = [py, '-m', 'd3df_single_pmt.dt5743_runner', '--yaml', self.req.yaml, '--data-output', self.req.data_output, '--exe', self.req.exe, '--batch-mode', str(self.req.batch_mode), '--max-events', str(self.req.max_events), '--max-time', str(self.req.max_time)]
+        max_events = 0 if marker_file else self.req.max_events
+        max_time = 0 if marker_file else self.req.max_time  # continuous: the run ends with the 'end' marker
+        if duration is not None:
+            max_time = int(duration)  # adaptive scan: duration chosen by the planner
+        cmd = [py, '-m', 'd3df_single_pmt.dt5743_runner', '--yaml', self.req.yaml, '--data-output', self.req.data_output, '--exe', self.req.exe, '--batch-mode', str(self.req.batch_mode), '--max-events', str(max_events), '--max-time', str(max_time), '--status-stream']
+        cmd += ['--scan-id', self.id, '--scan-point', str(self.iteration)]
+        if marker_file:
+            cmd += ['--marker-file', marker_file]
         if threshold is not None:
             cmd += ['--trigger-threshold', str(threshold)]
         if self.req.channel_thresholds:
             cmd += ['--channel-thresholds', self.req.channel_thresholds]
         if hv is not None:
             cmd += ['--set-hv', str(hv)]
+        # the HV is set and monitored here through the broker; the runner must not open the serial port
+        cmd += ['--no-hv-control']
+        if self.current_hv is not None and not marker_file:
+            cmd += ['--hv-mon', str(self.current_hv)]
         if self.req.hv_device:
             cmd += ['--hv-device', self.req.hv_device]
         if self.req.hv_baudrate:
@@ -286,6 +364,11 @@ class MeasurementTask:
             cmd += ['--hv-timeout', str(self.req.hv_timeout)]
         if self.req.hv_channel is not None:
             cmd += ['--hv-channel', str(self.req.hv_channel)]
+        if self.req.live_histograms:
+            cmd += ['--live-histos', self.req.live_histograms]
+        if self.req.thr_emulation and self.req.thresholds and not marker_file:
+            cmd += ['--emulate-thresholds', ','.join(str(t) for t in self.req.thresholds),
+                    '--emulate-discr', self.req.thr_emulation_discr]
         if self.req.source:
             cmd += ['--source', self.req.source]
         if self.req.scintillator:
@@ -295,6 +378,9 @@ class MeasurementTask:
     def compute_plan(self):
         hv_seq = self.req.hv_sequence or [None]
         thr_seq = self.req.thresholds or [None]
+        if self.req.thr_emulation and self.req.thresholds:
+            # one acquisition at the lowest threshold; the others come from its replay
+            thr_seq = [min(self.req.thresholds, key=abs)]
         iterations = [(h, t) for h in hv_seq for t in thr_seq]
         self.total_iterations = len(iterations)
         if self.req.repeat is not None and self.req.repeat >= 0:
@@ -305,7 +391,98 @@ class MeasurementTask:
             self.repeat_total = 1 if self.req.loop else 1
         return iterations
 
-    def run_single(self, hv: Optional[float], threshold: Optional[float]):
+    def handle_status_record(self, rec: Dict[str, Any]):
+        """Update progress from a WaveDemo status record (caller holds self.lock)."""
+        ev = rec.get('ev')
+        if ev == 'state':
+            state = rec.get('state')
+            if state == 'running':
+                self.run_start_time = time.time()
+            self.append_log(f"WaveDemo state: {state}")
+        elif ev == 'progress':
+            self.events = int(rec.get('events', 0))
+            elapsed_sec = rec.get('elapsed_s', 0)
+            if elapsed_sec:
+                self.rate = self.events / elapsed_sec
+        elif ev == 'stats':
+            self.live.apply(rec)
+            channels = rec.get('channels') or []
+            if channels:
+                self.rate = sum(float(c.get('read_rate', 0.0)) for c in channels)
+            self.events = max(self.events, int(rec.get('events', 0)))
+        elif ev == 'histo':
+            self.live.apply(rec)
+        elif ev == 'error':
+            self.append_log(f"WaveDemo error {rec.get('code')}: {rec.get('msg')}")
+        elif ev == 'file':
+            self.run_file_records.append(rec)
+        elif ev == 'thr_point':
+            self.thr_points.append(rec)
+        elif ev == 'catalog':
+            self.catalog_run_id = rec.get('run_id')
+        elif ev == 'marker':
+            self.append_log(f"WaveDemo step {rec.get('step')}{' (settling)' if rec.get('settling') else ''} at board time {rec.get('board_time_ns')} ns")
+
+    def handle_runner_line(self, line: str):
+        """Update progress from one line of runner output (caller holds self.lock)."""
+        # Live histogram deltas: only for the live view (neither logged nor kept)
+        if line.startswith('{"ev":"histo"'):
+            try:
+                self.live.apply(json.loads(line))
+            except ValueError:
+                pass
+            return
+
+        # Append all subprocess output to dedicated runner log
+        self.runner_log_lines.append(line.rstrip())
+        if len(self.runner_log_lines) > 10000:
+            self.runner_log_lines.pop(0)
+
+        # Structured status stream (preferred)
+        if line.startswith('{"ev"'):
+            try:
+                rec = json.loads(line)
+            except ValueError:
+                rec = None
+            if isinstance(rec, dict):
+                self.handle_status_record(rec)
+                return
+
+        # Detect acquisition start
+        if 'Starting Acquisition' in line:
+            self.run_start_time = time.time()
+
+        # Capture run_info.txt path from log
+        if 'Prepended setup header to:' in line:
+            # Extract path after "Prepended setup header to: "
+            path_match = re.search(r'Prepended setup header to:\s*(.+)', line)
+            if path_match:
+                self.run_info_path = path_match.group(1).strip()
+
+        # Parse "Batch mode progress: 10/30 seconds, 107 events"
+        batch_match = re.search(r'Batch mode progress:\s*(\d+)/(\d+)\s*seconds,\s*(\d+)\s*events?', line, re.IGNORECASE)
+        if batch_match:
+            elapsed_sec = int(batch_match.group(1))
+            max_sec = int(batch_match.group(2))
+            events = int(batch_match.group(3))
+            self.events = events
+            if elapsed_sec > 0:
+                self.rate = events / elapsed_sec
+            return
+        # Parse throughput line: "  0  0  |    9.44 Hz  100.00%   0.00%        320          9"
+        throughput_match = re.search(r'\|\s*([\d.]+)\s*Hz\s+[\d.]+%\s+[\d.]+%\s+(\d+)', line)
+        if throughput_match:
+            rate_hz = float(throughput_match.group(1))
+            total_events = int(throughput_match.group(2))
+            self.events = total_events
+            self.rate = rate_hz
+            return
+        # Removed fallback generic event parsing
+        elapsed = time.time() - self.start_time
+        if elapsed > 0 and self.events > 0:
+            self.rate = self.events / elapsed
+
+    def run_single(self, hv: Optional[float], threshold: Optional[float], duration: Optional[float] = None):
         self.current_hv = hv
         self.current_threshold = threshold
         
@@ -332,6 +509,9 @@ class MeasurementTask:
                 return
             msg_ready = f"HV reached target {hv} V. Proceeding to measurement."
             logger.info(msg_ready)
+            hv_mon = self._read_hv(max_age=self.hv_broker().poll_interval)
+            if hv_mon is not None:
+                self.current_hv = hv_mon
         # Compose info for this iteration
         hv_display = f"{hv} V" if hv is not None else (f"{self.current_hv} V" if self.current_hv is not None else "unknown")
         thr_display = f"{threshold}" if threshold is not None else "default"
@@ -341,7 +521,10 @@ class MeasurementTask:
         with self.lock:
             self.append_log(msg_start)
             self.run_start_time = None  # Reset run start time
-        cmd = self.build_runner_cmd(hv, threshold)
+            self.run_file_records = []
+            self.thr_points = []
+            self.catalog_run_id = None
+        cmd = self.build_runner_cmd(hv, threshold, duration=duration)
         self.proc = subprocess.Popen(
             cmd,
             stdout=subprocess.PIPE,
@@ -353,44 +536,7 @@ class MeasurementTask:
         start = time.time()
         for line in self.proc.stdout:  # type: ignore
             with self.lock:
-                # Append all subprocess output to dedicated runner log
-                self.runner_log_lines.append(line.rstrip())
-                if len(self.runner_log_lines) > 10000:
-                    self.runner_log_lines.pop(0)
-                
-                # Detect acquisition start
-                if 'Starting Acquisition' in line:
-                    self.run_start_time = time.time()
-                
-                # Capture run_info.txt path from log
-                if 'Prepended setup header to:' in line:
-                    # Extract path after "Prepended setup header to: "
-                    path_match = re.search(r'Prepended setup header to:\s*(.+)', line)
-                    if path_match:
-                        self.run_info_path = path_match.group(1).strip()
-                
-                # Parse "Batch mode progress: 10/30 seconds, 107 events"
-                batch_match = re.search(r'Batch mode progress:\s*(\d+)/(\d+)\s*seconds,\s*(\d+)\s*events?', line, re.IGNORECASE)
-                if batch_match:
-                    elapsed_sec = int(batch_match.group(1))
-                    max_sec = int(batch_match.group(2))
-                    events = int(batch_match.group(3))
-                    self.events = events
-                    if elapsed_sec > 0:
-                        self.rate = events / elapsed_sec
-                    continue
-                # Parse throughput line: "  0  0  |    9.44 Hz  100.00%   0.00%        320          9"
-                throughput_match = re.search(r'\|\s*([\d.]+)\s*Hz\s+[\d.]+%\s+[\d.]+%\s+(\d+)', line)
-                if throughput_match:
-                    rate_hz = float(throughput_match.group(1))
-                    total_events = int(throughput_match.group(2))
-                    self.events = total_events
-                    self.rate = rate_hz
-                    continue
-                # Removed fallback generic event parsing
-                elapsed = time.time() - self.start_time
-                if elapsed > 0 and self.events > 0:
-                    self.rate = self.events / elapsed
+                self.handle_runner_line(line)
             # Optional early stop check
             if not self.running:
                 break
@@ -424,14 +570,217 @@ class MeasurementTask:
                 'total_duration': total_duration,
                 'events': self.events,
                 'rate': self.rate,
+                'run_id': self.catalog_run_id,
             }
+            if self.thr_points:
+                run_record['thr_emulation'] = [{k: p.get(k) for k in ('thr', 'discr', 'board', 'channel', 'events', 'triggered', 'rate', 'energy_mean')}
+                                               for p in self.thr_points]
             self.runs.append(run_record)
             self.run_info_path = None  # Reset for next run
+            file_records = list(self.run_file_records)
+        if self.pool is not None and self.running:
+            self.submit_postprocess(run_record, file_records)
+        return run_record
+
+    def submit_postprocess(self, run_record: Dict[str, Any], file_records: List[Dict[str, Any]]):
+        """Queue the conversion and analysis of a finished point; the scan goes on with the next one."""
+        wave_path, _ = point_files(file_records, self.req.data_output)
+        if not wave_path:
+            with self.lock:
+                self.append_log("Post-processing skipped: no waveform file (SAVE_WAVEFORM with OUTPUT_FILE_FORMAT = ASCII)")
+            return
+        run_record['analysis'] = {'state': 'queued', 'wave': wave_path}
+
+        def done(result, error):
+            with self.lock:
+                if error is not None or not result or not result.get('summary'):
+                    run_record['analysis'] = {'state': 'failed', 'wave': wave_path, 'error': str(error) if error else 'no valid pulses'}
+                    self.append_log(f"Post-processing failed for {os.path.basename(wave_path)}: {run_record['analysis']['error']}")
+                    return
+                run_record['analysis'] = dict(result['summary'], state='done', hdf5=result['hdf5'],
+                                              convert_s=round(result['convert_s'], 2), analyze_s=round(result['analyze_s'], 2))
+                analysis = dict(run_record['analysis'])
+                self.append_log(f"Analyzed {os.path.basename(result['hdf5'])}: rise {analysis.get('rise_time_ns')} ns, "
+                                f"fall {analysis.get('fall_time_ns')} ns, width {analysis.get('pulse_width_ns')} ns")
+            catalog = open_catalog(self.req.data_output, create=False) if run_record.get('run_id') is not None else None
+            if catalog is not None:
+                try:
+                    catalog.set_analysis(run_record['run_id'], analysis)
+                except Exception as e:
+                    logger.warning(f"Run catalog not updated: {e}")
+
+        self.pool.submit(wave_path, done)
+
+    def write_marker(self, marker_file: str, line: str):
+        """Append one step marker line for WaveDemo (see WDMarkers.h for the format)."""
+        with open(marker_file, 'a') as f:
+            f.write(line + '\n')
+            f.flush()
+
+    def run_continuous(self, iterations):
+        """Run the whole scan in one WaveDemo acquisition; steps are separated by markers.
+
+        Each step is announced twice: as settling while the HV ramps (its data is kept apart) and then as
+        the measurement step, with the HV read back. WaveDemo saves the histograms of each step.
+        """
+        if not iterations:
+            # nothing to announce: the repeat loop below would spin without ever waiting
+            with self.lock:
+                self.append_log("Continuous acquisition: no scan steps, nothing to run")
+            return
+        os.makedirs(self.req.data_output, exist_ok=True)
+        marker_file = os.path.abspath(os.path.join(self.req.data_output, f"markers_{self.id}.txt"))
+        open(marker_file, 'w').close()
+        msg_start = f"Starting continuous acquisition ({self.total_iterations} steps per repeat, markers: {marker_file})"
+        logger.info(msg_start)
+        with self.lock:
+            self.append_log(msg_start)
+            self.run_start_time = None
+        self.proc = subprocess.Popen(
+            self.build_runner_cmd(None, None, marker_file),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+            stdin=subprocess.PIPE,
+            universal_newlines=True,
+            bufsize=1,
+        )
+        proc = self.proc
+
+        def reader():
+            for line in proc.stdout:  # type: ignore
+                with self.lock:
+                    self.handle_runner_line(line)
+
+        rd = threading.Thread(target=reader, daemon=True)
+        rd.start()
+        step = 0
+        repeat_index = 0
+        while self.running and proc.poll() is None:
+            for idx, (hv, thr) in enumerate(iterations):
+                if not self.running or proc.poll() is not None:
+                    break
+                step += 1
+                with self.lock:
+                    self.iteration = repeat_index * len(iterations) + idx + 1
+                    self.repeat_index = repeat_index
+                    self.current_threshold = thr
+                thr_field = f" thr={thr}" if thr is not None else ""
+                hv_field = f" hv={hv}" if hv is not None else ""
+                hv_mon = None
+                if hv is not None:
+                    self.write_marker(marker_file, f"step={step} settling=1{hv_field}{thr_field}")
+                    if not self._set_hv(hv) or not self.wait_for_hv(hv, tolerance=0.5, max_wait=max((self.req.hv_timeout or 1.0) * 10, 30.0)):
+                        logger.error(f"Skipping step {step}: HV not within tolerance for target {hv} V")
+                        continue
+                    hv_mon = self._read_hv(max_age=self.hv_broker().poll_interval)  # readback of the settling check
+                else:
+                    hv_mon = self._read_hv(max_age=self.hv_broker().poll_interval)
+                self.current_hv = hv_mon if hv_mon is not None else hv
+                mon_field = f" hv_mon={hv_mon}" if hv_mon is not None else ""
+                self.write_marker(marker_file, f"step={step} settling=0{hv_field}{mon_field}{thr_field}")
+                start = time.time()
+                events_start = self.events
+                while self.running and proc.poll() is None and time.time() - start < max(self.req.max_time, 1):
+                    time.sleep(0.5)
+                with self.lock:
+                    duration = time.time() - start
+                    events = self.events - events_start
+                    self.runs.append({
+                        'timestamp': start,
+                        'repeat': repeat_index + 1,
+                        'iteration': self.iteration,
+                        'hv': self.current_hv,
+                        'threshold': thr,
+                        'run_info': '',
+                        'duration': duration,
+                        'total_duration': duration,
+                        'events': events,
+                        'rate': events / duration if duration > 0 else 0.0,
+                        'step': step,
+                    })
+            repeat_index += 1
+            if self.repeat_total is not None and repeat_index >= self.repeat_total:
+                break
+        # End of scan: WaveDemo saves the last step and stops
+        self.write_marker(marker_file, "end")
+        try:
+            proc.wait(timeout=60)
+        except Exception:
+            pass
+        rd.join(timeout=5)
+        self.proc = None
+
+    def point_result(self, run_record: Dict[str, Any], live_seq: int):
+        """(value, sigma, events) of a finished point for the adaptive planner (value None = no result)."""
+        metric = self.req.adaptive_metric
+        if metric == 'energy':
+            bins, seq = self.live.histogram(0, 0, 'energy')
+            if bins is None or seq <= live_seq:
+                return None, None, 0  # no histogram from this run
+            return histogram_mean(bins)
+        # analysis of the point: the next HV depends on it, so the scan waits here
+        while self.running and (run_record.get('analysis') or {}).get('state') == 'queued':
+            time.sleep(0.2)
+        analysis = run_record.get('analysis') or {}
+        if analysis.get('state') != 'done':
+            return None, None, 0
+        # the 'amplitude' of the summary is the one of the normalized mean pulse (~1 at any HV): fit the raw one
+        key = 'raw_amplitude' if metric == 'amplitude' else metric
+        return analysis.get(key), None, run_record.get('events') or 0
+
+    def run_adaptive(self):
+        """HV scan with the points and durations chosen from the results so far (scan_planner)."""
+        hvs = self.req.hv_sequence or []
+        metric = self.req.adaptive_metric
+        degree = self.req.adaptive_degree or (1 if metric in ('energy', 'amplitude') else 2)
+        for thr in (self.req.thresholds or [None]):
+            planner = AdaptiveScanPlanner(min(hvs), max(hvs), hv_step=self.req.adaptive_hv_step, degree=degree,
+                                          target=self.req.adaptive_target, min_time=self.req.adaptive_min_time,
+                                          max_time=self.req.adaptive_max_time, max_points=self.req.adaptive_max_points,
+                                          budget=self.req.adaptive_budget)
+            while self.running:
+                nxt = planner.next_point()
+                if nxt is None:
+                    break
+                hv, duration = nxt
+                with self.lock:
+                    self.iteration += 1
+                    self.append_log(f"Adaptive scan: HV {hv} V for {duration:.0f} s (fit precision {planner.precision():.4f})")
+                live_seq = self.live.seq
+                run_record = self.run_single(hv, thr, duration=duration)
+                if run_record is None:
+                    planner.add(hv, None, None, 0)  # HV not reached: counts as a point, so the scan ends
+                    continue
+                value, sigma, events = self.point_result(run_record, live_seq)
+                planner.add(hv, value, sigma, run_record['duration'], events)
+                with self.lock:
+                    run_record['adaptive'] = {'metric': metric, 'value': value, 'sigma': sigma,
+                                              'precision': planner.precision()}
+            summary = planner.summary()
+            with self.lock:
+                self.append_log(f"Adaptive scan (threshold {thr if thr is not None else 'default'}) done: "
+                                f"{summary['points']} points, {summary['time']:.0f} s, precision {summary['precision']:.4f} "
+                                f"({summary['done'] or 'stopped'}), fit coefficients {summary['coef']}")
 
     def run_loop(self):
         iterations = self.compute_plan()
+        if self.req.continuous:
+            self.run_continuous(iterations)
+            with self.lock:
+                self.running = False
+                msg_complete = "All measurements completed."
+                logger.info(msg_complete)
+                self.append_log(msg_complete)
+            return
+        if self.req.postprocess:
+            # post-processing of point N overlaps the HV ramp and acquisition of point N+1
+            self.pool = PostProcessPool(workers=self.req.postprocess_workers, max_pending=self.req.postprocess_max_pending)
         repeat_index = 0
-        while self.running:
+        if self.req.adaptive:
+            with self.lock:
+                self.total_iterations = self.req.adaptive_max_points * len(self.req.thresholds or [None])
+            self.run_adaptive()
+        while self.running and not self.req.adaptive:
             for idx, (hv, thr) in enumerate(iterations):
                 if not self.running:
                     break
@@ -442,6 +791,11 @@ class MeasurementTask:
             repeat_index += 1
             if self.repeat_total is not None and repeat_index >= self.repeat_total:
                 break
+        if self.pool is not None:
+            with self.lock:
+                self.append_log(f"Waiting for the post-processing of {self.pool.pending()} points...")
+            # a stopped scan drops the points not started yet
+            self.pool.close(wait=self.running)
         with self.lock:
             self.running = False
             msg_complete = "All measurements completed."
@@ -573,6 +927,7 @@ class MeasurementTask:
                 runs=self.runs,
                 runner_log=list(self.runner_log_lines),
                 hv_log=list(hv_log_lines),
+                postprocess_pending=self.pool.pending() if self.pool is not None else 0,
             )
 
 measurements: Dict[str, MeasurementTask] = {}
@@ -581,28 +936,43 @@ measurements: Dict[str, MeasurementTask] = {}
 @app.post('/hv/set')
 def hv_set(req: HVSetRequest, username: str = Depends(verify_credentials)):
     val = req.value
+    broker = hv_broker_of(req.device, baudrate=req.baudrate, timeout=req.timeout)
     try:
-        resp = send_caen_command('SET', 'VSET', str(val), channel=req.channel, device=req.device, baudrate=req.baudrate, timeout=req.timeout)
+        resp = broker.request('SET', 'VSET', str(val), channel=req.channel, priority=PRIORITY_UI)
         return {'status': 'ok', 'response': resp, 'hv_set': val}
     except Exception as e:
         raise HTTPException(status_code=500, detail=str(e))
 
 @app.get('/hv/read')
 def hv_read(channel: str = Query('1'), device: str = Query('COM10'), baudrate: int = Query(9600), timeout: float = Query(1.0), username: str = Depends(verify_credentials)):
+    broker = hv_broker_of(device, baudrate=baudrate, timeout=timeout)
     try:
-        resp = send_caen_command('MON', 'VMON', channel=channel, device=device, baudrate=baudrate, timeout=timeout)
-        return {'status': 'ok', 'hv': resp}
+        # the periodic readback when recent enough, otherwise one reading queued behind the scan control
+        hv = broker.read_vmon(channel, max_age=broker.poll_interval, priority=PRIORITY_UI)
+        rb = broker.readback(channel) or {}
+        if hv is None:
+            raise RuntimeError(rb.get('error') or 'no readback')
+        return {'status': 'ok', 'hv': hv, 'ts': rb.get('ts')}
     except Exception as e:
         raise HTTPException(status_code=500, detail=str(e))
 
 @app.post('/hv/send')
 def hv_send(req: HVSendRequest, username: str = Depends(verify_credentials)):
+    broker = hv_broker_of(req.device, baudrate=req.baudrate, timeout=req.timeout)
     try:
-        resp = send_caen_command(req.cmd.upper(), req.par.upper(), None if req.val is None else str(req.val), channel=req.channel, device=req.device, baudrate=req.baudrate, timeout=req.timeout)
+        resp = broker.request(req.cmd, req.par, None if req.val is None else str(req.val), channel=req.channel, priority=PRIORITY_UI)
         return {'status': 'ok', 'response': resp}
     except Exception as e:
         raise HTTPException(status_code=500, detail=str(e))
 
+@app.get('/hv/status')
+def hv_status(device: str = Query('COM10'), username: str = Depends(verify_credentials)):
+    """Queue, counters and cached readbacks of the HV broker of a device (404 if it is not connected)."""
+    broker = find_broker(device)
+    if broker is None:
+        raise HTTPException(status_code=404, detail=f'HV broker not connected: {device}')
+    return broker.status()
+
 # ---------------------- MEASUREMENT ENDPOINTS ----------------------
 @app.post('/measure/start')
 def measure_start(req: MeasureStartRequest, username: str = Depends(verify_credentials)):
@@ -613,7 +983,29 @@ def measure_start(req: MeasureStartRequest, username: str = Depends(verify_crede
             status_code=409, 
             detail="Cannot start measurement: WaveDemo_x743.exe is already running. Please stop the existing process first."
         )
+    if (req.hv_device or 'COM10') not in HV_DEVICES:
+        raise HTTPException(status_code=400, detail=f"HV device not allowed: {req.hv_device or 'COM10'} (see DIGITIZER_HV_DEVICES)")
     
+    if req.adaptive:
+        if len(set(req.hv_sequence or [])) < 2:
+            raise HTTPException(status_code=400, detail="Adaptive scan: hv_sequence must give the HV range (at least 2 values)")
+        if req.continuous:
+            raise HTTPException(status_code=400, detail="Adaptive scan: not available with continuous=true")
+        if req.adaptive_metric == 'energy' and (req.live_histograms or '').upper() not in ('ENERGY', 'ALL'):
+            raise HTTPException(status_code=400, detail="Adaptive scan on energy: live_histograms must be ENERGY or ALL")
+        if req.adaptive_metric not in ('energy', 'amplitude', 'rise_time_ns', 'fall_time_ns', 'pulse_width_ns'):
+            raise HTTPException(status_code=400, detail=f"Adaptive scan: unknown metric {req.adaptive_metric}")
+        if req.adaptive_metric != 'energy' and not req.postprocess:
+            raise HTTPException(status_code=400, detail="Adaptive scan on a timing/amplitude metric: postprocess must be true")
+
+    if req.thr_emulation:
+        if len(set(req.thresholds or [])) < 2:
+            raise HTTPException(status_code=400, detail="Threshold emulation: thresholds must give at least 2 values")
+        if req.continuous or req.adaptive:
+            raise HTTPException(status_code=400, detail="Threshold emulation: not available with continuous or adaptive scans")
+        if req.thr_emulation_discr.upper() not in ('SAME', 'LED', 'CFD', 'BOTH'):
+            raise HTTPException(status_code=400, detail=f"Threshold emulation: unknown discriminator {req.thr_emulation_discr}")
+
     task = MeasurementTask(req)
     measurements[task.id] = task
     return {'status': 'started', 'id': task.id}
@@ -630,21 +1022,50 @@ def measure_stop(mid: str, username: str = Depends(verify_credentials)):
 def measure_status(username: str = Depends(verify_credentials)):
     return {'measurements': [m.snapshot().dict() for m in measurements.values()]}
 
+def catalog_history(data_output: str, mid: str) -> List[Dict[str, Any]]:
+    """Run history of a past measurement from the run catalog (same fields as MeasurementTask.runs)."""
+    catalog = open_catalog(data_output, create=False)
+    if catalog is None:
+        return []
+    runs = []
+    for r in catalog.scan_summary(mid):
+        runs.append({
+            'timestamp': r['started'],
+            'repeat': '',
+            'iteration': r['point'],
+            'hv': r['hv_mon'] if r['hv_mon'] is not None else r['hv_set'],
+            'threshold': r['threshold'],
+            'run_info': r['run_info_path'] or '',
+            'duration': r['duration'] or 0.0,
+            'events': r['events'],
+            'rate': r['rate'],
+            'run_id': r['run_id'],
+            'state': r['state'],
+            'analysis': r['analysis'],
+        })
+    return runs
+
 @app.get('/measure/history/{mid}')
-def measure_history(mid: str, format: str = Query('csv'), username: str = Depends(verify_credentials)):
+def measure_history(mid: str, format: str = Query('csv'), data_output: Optional[str] = Query(None),
+                    username: str = Depends(verify_credentials)):
     task = measurements.get(mid)
-    if not task:
-        raise HTTPException(status_code=404, detail='Measurement not found')
-    # Copy runs under lock
-    with task.lock:
-        runs = list(task.runs)
+    if task:
+        # Copy runs under lock
+        with task.lock:
+            runs = list(task.runs)
+    else:
+        # measurement of a previous session: its runs are in the catalog of its data folder
+        runs = catalog_history(data_output, mid) if data_output else []
+        if not runs:
+            raise HTTPException(status_code=404, detail='Measurement not found')
     if format.lower() == 'json':
         return {'id': mid, 'runs': runs}
     # Default CSV
     import io, csv, datetime
     buf = io.StringIO()
     writer = csv.writer(buf)
-    writer.writerow(['index','timestamp_iso','repeat','iteration','hv','threshold','duration_s','events','rate_1_per_s','run_info'])
+    writer.writerow(['index','timestamp_iso','repeat','iteration','hv','threshold','duration_s','events','rate_1_per_s','run_info',
+                     'rise_time_ns','fall_time_ns','pulse_width_ns'])
     for idx, r in enumerate(runs, start=1):
         ts_iso = ''
         if isinstance(r.get('timestamp'), (int,float)):
@@ -660,10 +1081,25 @@ def measure_history(mid: str, format: str = Query('csv'), username: str = Depend
             r.get('events',''),
             r.get('rate',''),
             r.get('run_info',''),
+            (r.get('analysis') or {}).get('rise_time_ns',''),
+            (r.get('analysis') or {}).get('fall_time_ns',''),
+            (r.get('analysis') or {}).get('pulse_width_ns',''),
         ])
     csv_data = buf.getvalue()
     return Response(content=csv_data, media_type='text/csv', headers={'Content-Disposition': f'attachment; filename="run_history_{mid}.csv"'})
 
+@app.get('/runs')
+def runs_list(data_output: str = Query('./data_output'), scan: Optional[str] = Query(None),
+              hv_min: Optional[float] = Query(None), hv_max: Optional[float] = Query(None),
+              state: Optional[str] = Query(None), since: Optional[float] = Query(None),
+              limit: int = Query(100), username: str = Depends(verify_credentials)):
+    """Runs of the run catalog of a data folder, newest first (HV in absolute value, since in s since epoch)."""
+    catalog = open_catalog(data_output, create=False)
+    if catalog is None:
+        raise HTTPException(status_code=404, detail=f'No run catalog in {data_output}')
+    return {'runs': catalog.find_runs(scan_id=scan, state=state, hv_min=hv_min, hv_max=hv_max, since=since,
+                                      limit=limit)}
+
 @app.get('/yaml/list')
 def yaml_list(username: str = Depends(verify_credentials)):
     import os
@@ -690,11 +1126,24 @@ def hv_clear_log(username: str = Depends(verify_credentials)):
 @app.websocket('/ws/hv')
 async def ws_hv(ws: WebSocket, interval: float = 2.0, channel: str = '1', device: str = 'COM10', baudrate: int = 9600, timeout: float = 1.0):
     await ws.accept()
+    if device not in HV_DEVICES:
+        await ws.send_json({'error': f'HV device not allowed: {device}'})
+        await ws.close()
+        return
+    # the monitors read the cached readbacks of the broker: any number of them costs one poll per channel
+    broker = get_broker(device, baudrate=baudrate, timeout=timeout)
+    broker.watch(channel)
+    last_ts = 0.0
     try:
         while True:
             try:
-                hv = send_caen_command('MON', 'VMON', channel=channel, device=device, baudrate=baudrate, timeout=timeout)
-                await ws.send_json({'ts': time.time(), 'hv': hv})
+                rb = broker.readback(channel)
+                if rb and rb['ts'] > last_ts:
+                    last_ts = rb['ts']
+                    if rb['error'] is None:
+                        await ws.send_json({'ts': rb['ts'], 'hv': rb['vmon']})
+                    else:
+                        logger.warning(f"HV monitoring error: {rb['error']}")
             except WebSocketDisconnect:
                 # Connection closed by client
                 break
@@ -730,6 +1179,40 @@ async def ws_measure(ws: WebSocket, mid: str):
     finally:
         await ws.close()
 
+@app.websocket('/ws/live/{mid}')
+async def ws_live(ws: WebSocket, mid: str, max_fps: float = 2.0):
+    """Live histograms and rates of a measurement as binary delta frames (see live_histos).
+
+    Each viewer gets at most max_fps frames per second with the changes since its previous frame, so a slow
+    viewer skips intermediate states instead of queueing them."""
+    await ws.accept()
+    task = measurements.get(mid)
+    if not task:
+        await ws.send_json({'error': 'Measurement not found'})
+        await ws.close()
+        return
+    period = 1.0 / min(max(max_fps, 0.1), 10.0)
+    seq = 0
+    try:
+        while True:
+            t0 = time.time()
+            frame, new_seq = task.live.frame(seq)
+            if frame is not None:
+                await ws.send_bytes(frame)
+                seq = new_seq
+            elif not task.running:
+                break
+            await asyncio_sleep(max(period - (time.time() - t0), 0.05))
+    except WebSocketDisconnect:
+        return
+    finally:
+        await ws.close()
+
+@app.on_event('shutdown')
+def stop_hv_brokers():
+    # release the serial ports
+    stop_brokers()
+
 # ---------------------- UTILS ----------------------
 def asyncio_sleep(seconds: float):
     # Lightweight fallback without importing asyncio at module top (avoid event loop confusion if run in thread)
@@ -833,7 +1316,7 @@ table.run-history tbody tr:nth-child(even){background:rgba(0,0,0,0.03)}
         </select>
     </div>
 </h1>
-<div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_setup'><legend>Setup Control</legend><div class='fieldset-content'><label>YAML config <select id='m_yaml'><option value=''>Loading...</option></select></label><label>Data output <input id='m_out' value='./data_output'/></label><label>WaveDemo exe <input id='m_exe' value='WaveDemo_x743.exe'/></label><label>Source <input id='m_source' list='source_list' placeholder='e.g. BKG'/><datalist id='source_list'><option>BKG</option><option>Cs-137_D10-224</option><option>Cd-109_M8-546</option><option>Fe-55_AC-6389</option></datalist></label><label>Scintillator <input id='m_scint' list='scint_list' placeholder='e.g. RMPS470'/><datalist id='scint_list'><option>RMPS470</option><option>BC-408</option></datalist></label><label>HV sequence (comma-separated) <input id='m_hvseq' placeholder='1800,1700'/></label><label>Thresholds (comma-separated) <input id='m_thrseq' placeholder='-0.10,-0.20'/></label><label>Repeat (-1=infinite, empty=1) <input id='m_repeat' value='1'/></label><label>Max events <input id='m_maxev' type='number' value='0'/></label><label>Max time (s) <input id='m_maxt' type='number' value='30'/></label></div></fieldset></div><div class='col'><fieldset class='collapsible-fieldset' id='fs_hv'><legend>HV Control</legend><div class='fieldset-content'><label>Device <input id='hv_device' value='COM10'/></label><label>Channel <input id='hv_channel' value='1'/></label><label>Baudrate <input id='hv_baud' type='number' value='9600'/></label><div style='display:flex;gap:8px;align-items:end'><div style='flex:1'><label>Set HV (V) <input id='hv_value' type='number' step='1' value='1800'/></label></div><div><button id='btn_hv_set' type='button'>Set HV</button><button id='btn_hv_read' type='button'>Read HV</button></div></div><div><label>Raw HV Command</label><div style='display:flex;gap:8px'><input id='hv_cmd' value='MON' style='max-width:80px'/><input id='hv_par' value='VMON' style='max-width:120px'/><input id='hv_val' placeholder='val (optional)' style='max-width:140px'/><button id='btn_hv_send' type='button'>Send</button></div></div><div style='display:flex;gap:8px;align-items:end;margin-top:8px'><div style='flex:1'><label>Monitor interval (s)<input id='hv_interval' type='number' step='0.1' value='2'/></label></div><button id='btn_hv_toggle' type='button'>Start Monitoring</button><span id='hv_status' class='status-badge disconnected'>OFF</span></div><div id='hv_result' style='margin-top:8px'>Result: <code>(none)</code></div></div></fieldset></div></div><div class='row'><div class='col'><fieldset><legend>Measurement Control</legend><div style='display:flex;gap:8px;align-items:end'><button id='btn_m_start' type='button'>Start</button><button id='btn_m_stop' type='button' disabled>Stop</button><div>Current ID: <code id='m_id'>(none)</code></div></div></fieldset></div></div><h2>Live Monitoring</h2><div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_hv_plot'><legend>HV Plot</legend><div class='fieldset-content'><button id='btn_clear_hv' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:8px'>Clear</button><canvas id='chart_hv'></canvas></div></fieldset></div><div class='col'><fieldset class='collapsible-fieldset' id='fs_events_plot'><legend>Events Plot</legend><div class='fieldset-content'><button id='btn_clear_events' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:8px'>Clear</button><canvas id='chart_events'></canvas></div></fieldset></div></div><div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_rate_plot'><legend>Rate Plot</legend><div class='fieldset-content'><button id='btn_clear_rate' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:8px'>Clear</button><canvas id='chart_rate'></canvas></div></fieldset></div><div class='col'><fieldset class='collapsible-fieldset' id='fs_progress'><legend>Progress</legend><div class='fieldset-content'><div class='progress-wrap'><div class='progress-labels'><span>Elapsed: <span id='prog_elapsed'>0s</span></span><span>Remaining: <span id='prog_remaining'>0s</span></span></div><div class='progress-bar'><div id='prog_bar'></div></div></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_mlog'><legend>Measurement Log</legend><div class='fieldset-content'><button id='btn_clear_log' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:6px'>Clear</button><div id='log'></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_hvlog'><legend>HV Log (CAEN commands)</legend><div class='fieldset-content'><button id='btn_clear_hv_log' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:6px'>Clear</button><div id='hv_log'></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_runlog'><legend>Runner Log (dt5743_runner)</legend><div class='fieldset-content'><button id='btn_clear_runner_log' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:6px'>Clear</button><div id='runner_log'></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_history'><legend>Run History</legend><div class='fieldset-content'><button id='btn_run_history_dl' type='button' style='margin-bottom:6px'>Download CSV</button><table class='run-history' id='run_history'><thead><tr><th>#</th><th>Timestamp</th><th>Repeat</th><th>Iteration</th><th>HV</th><th>Threshold</th><th>Duration(s)</th><th>Run Info</th></tr></thead><tbody></tbody></table></div></fieldset></div></div><script src='/static/app.js'></script></body></html>"""
+<div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_setup'><legend>Setup Control</legend><div class='fieldset-content'><label>YAML config <select id='m_yaml'><option value=''>Loading...</option></select></label><label>Data output <input id='m_out' value='./data_output'/></label><label>WaveDemo exe <input id='m_exe' value='WaveDemo_x743.exe'/></label><label>Source <input id='m_source' list='source_list' placeholder='e.g. BKG'/><datalist id='source_list'><option>BKG</option><option>Cs-137_D10-224</option><option>Cd-109_M8-546</option><option>Fe-55_AC-6389</option></datalist></label><label>Scintillator <input id='m_scint' list='scint_list' placeholder='e.g. RMPS470'/><datalist id='scint_list'><option>RMPS470</option><option>BC-408</option></datalist></label><label>HV sequence (comma-separated) <input id='m_hvseq' placeholder='1800,1700'/></label><label>Thresholds (comma-separated) <input id='m_thrseq' placeholder='-0.10,-0.20'/></label><label>Repeat (-1=infinite, empty=1) <input id='m_repeat' value='1'/></label><label>Max events <input id='m_maxev' type='number' value='0'/></label><label>Max time (s) <input id='m_maxt' type='number' value='30'/></label></div></fieldset></div><div class='col'><fieldset class='collapsible-fieldset' id='fs_hv'><legend>HV Control</legend><div class='fieldset-content'><label>Device <input id='hv_device' value='COM10'/></label><label>Channel <input id='hv_channel' value='1'/></label><label>Baudrate <input id='hv_baud' type='number' value='9600'/></label><div style='display:flex;gap:8px;align-items:end'><div style='flex:1'><label>Set HV (V) <input id='hv_value' type='number' step='1' value='1800'/></label></div><div><button id='btn_hv_set' type='button'>Set HV</button><button id='btn_hv_read' type='button'>Read HV</button></div></div><div><label>Raw HV Command</label><div style='display:flex;gap:8px'><input id='hv_cmd' value='MON' style='max-width:80px'/><input id='hv_par' value='VMON' style='max-width:120px'/><input id='hv_val' placeholder='val (optional)' style='max-width:140px'/><button id='btn_hv_send' type='button'>Send</button></div></div><div style='display:flex;gap:8px;align-items:end;margin-top:8px'><div style='flex:1'><label>Monitor interval (s)<input id='hv_interval' type='number' step='0.1' value='2'/></label></div><button id='btn_hv_toggle' type='button'>Start Monitoring</button><span id='hv_status' class='status-badge disconnected'>OFF</span></div><div id='hv_result' style='margin-top:8px'>Result: <code>(none)</code></div></div></fieldset></div></div><div class='row'><div class='col'><fieldset><legend>Measurement Control</legend><div style='display:flex;gap:8px;align-items:end'><button id='btn_m_start' type='button'>Start</button><button id='btn_m_stop' type='button' disabled>Stop</button><div>Current ID: <code id='m_id'>(none)</code></div></div></fieldset></div></div><h2>Live Monitoring</h2><div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_hv_plot'><legend>HV Plot</legend><div class='fieldset-content'><button id='btn_clear_hv' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:8px'>Clear</button><canvas id='chart_hv'></canvas></div></fieldset></div><div class='col'><fieldset class='collapsible-fieldset' id='fs_events_plot'><legend>Events Plot</legend><div class='fieldset-content'><button id='btn_clear_events' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:8px'>Clear</button><canvas id='chart_events'></canvas></div></fieldset></div></div><div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_live'><legend>Live Spectra</legend><div class='fieldset-content'><label>Histogram <select id='live_sel'></select></label><div id='live_rates' style='margin:6px 0;font-family:monospace'></div><canvas id='chart_live'></canvas></div></fieldset></div></div><div class='row'><div class='col'><fieldset class='collapsible-fieldset' id='fs_rate_plot'><legend>Rate Plot</legend><div class='fieldset-content'><button id='btn_clear_rate' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:8px'>Clear</button><canvas id='chart_rate'></canvas></div></fieldset></div><div class='col'><fieldset class='collapsible-fieldset' id='fs_progress'><legend>Progress</legend><div class='fieldset-content'><div class='progress-wrap'><div class='progress-labels'><span>Elapsed: <span id='prog_elapsed'>0s</span></span><span>Remaining: <span id='prog_remaining'>0s</span></span></div><div class='progress-bar'><div id='prog_bar'></div></div></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_mlog'><legend>Measurement Log</legend><div class='fieldset-content'><button id='btn_clear_log' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:6px'>Clear</button><div id='log'></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_hvlog'><legend>HV Log (CAEN commands)</legend><div class='fieldset-content'><button id='btn_clear_hv_log' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:6px'>Clear</button><div id='hv_log'></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_runlog'><legend>Runner Log (dt5743_runner)</legend><div class='fieldset-content'><button id='btn_clear_runner_log' type='button' style='padding:4px 8px;font-size:.85rem;margin-bottom:6px'>Clear</button><div id='runner_log'></div></div></fieldset><fieldset class='collapsible-fieldset' id='fs_history'><legend>Run History</legend><div class='fieldset-content'><button id='btn_run_history_dl' type='button' style='margin-bottom:6px'>Download CSV</button><table class='run-history' id='run_history'><thead><tr><th>#</th><th>Timestamp</th><th>Repeat</th><th>Iteration</th><th>HV</th><th>Threshold</th><th>Duration(s)</th><th>Run Info</th></tr></thead><tbody></tbody></table></div></fieldset></div></div><script src='/static/app.js'></script></body></html>"""
 
 @app.get('/static/app.js')
 def static_app_js(username: str = Depends(verify_credentials)):
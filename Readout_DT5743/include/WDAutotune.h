@@ -0,0 +1,66 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDAUTOTUNE_H
+#define _WDAUTOTUNE_H
+
+#include "WaveDemo.h"
+
+// Host tuning. The autotuner times the candidate settings on synthetic waveforms that match the
+// configured record length and enabled channels, then stores the fastest choice in the profile file
+// (one line per host and setup):
+//     <host> <record_length> <channels> <kernel> <blt> <write_buffer> <idle> <date>
+// Tuned settings: waveform processor kernel (WDcfg.WPKernel), events per block transfer
+// (WDcfg.MaxNumEventsBLT), buffer size of the output files (WDcfg.WriteBufferSize) and readout idle
+// strategy (WDcfg.IdleStrategy).
+
+#define TUNE_MIN_TIME		250			// ms spent on each candidate
+#define TUNE_NUM_WAVES		256			// synthetic waveforms per channel
+#define TUNE_FILE_SIZE		(8 << 20)	// bytes written for each output buffer candidate
+#define TUNE_BLT_TOLERANCE	0.05		// take the largest BLT size within 5% of the best event rate
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Load the host profile or run the autotuner, according to WDcfg.Autotune
+//				(call before programming the digitizers)
+// Inputs:		Force = 1 to run the autotuner in any case (--autotune)
+// Return:		0=OK, -1=error (the default settings are kept)
+// ---------------------------------------------------------------------------------------------------------
+int SetupHostTuning(int Force);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Run the benchmarks, apply the fastest settings to WDcfg and save them in the host profile
+//				(WDcfg is left unchanged if the profile can't be written)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int RunAutotune();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Load the settings of this host and setup from the profile file
+// Return:		1=loaded, 0=no matching profile, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int LoadTuneProfile();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Save the current settings of this host and setup in the profile file
+//				(the lines of the other hosts are kept)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int SaveTuneProfile();
+
+#endif
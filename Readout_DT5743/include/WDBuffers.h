@@ -18,6 +18,13 @@
 
 #include "WaveDemo.h"
 
+// Circular event buffers (one per board). With the threaded pipeline the readout thread is the only
+// producer (head) and the main thread the only consumer (tail, release); no lock is needed.
+#ifdef WIN32
+	#define MEMORY_BARRIER()	MemoryBarrier()
+#else
+	#define MEMORY_BARRIER()	__sync_synchronize()
+#endif
 
 //****************************************************************************
 // Function prototypes
@@ -33,6 +40,7 @@ float WDBuff_occupancy(WaveDemoBuffers_t *buff, int bd);
 
 int WDBuff_remove(WaveDemoBuffers_t *buff, int bd, int num);
 int WDBuff_added(WaveDemoBuffers_t *buff, int bd, int num);
+int WDBuff_release(WaveDemoBuffers_t *buff, int bd);
 
 int WDBuff_get_write_pointer(WaveDemoBuffers_t *buff, int bd, WaveDemoEvent_t** event);
 
@@ -0,0 +1,110 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDCALIB_H
+#define _WDCALIB_H
+
+#include "WaveDemo.h"
+
+// Pulser calibration of the channel delays and gains (--calibrate).
+// The internal pulser of the SAM chips is enabled on all the enabled channels and the run goes through the pulse
+// patterns of CALIBRATION_PATTERNS (a wider pattern injects a larger charge), with CALIBRATION_EVENTS pulser events
+// per channel at each pattern; the trigger settings of the config file are used (e.g. channel self-trigger).
+// All the channels are calibrated by the same events; at the end of the sweep each channel gets:
+//   time offset	mean of (time - time of the TOF start channel in the same event) over all the patterns
+//   gain			straight line E_ref = m * E + q fitted on the mean energy at each pattern, where E_ref is the
+//					mean over the channels (one pattern: q = 0)
+// The table is written in the data path (<prefix>calibration.txt, one line per channel) and sent on the status
+// stream ("calib" records). With --reprocess the table is computed from a raw data file of a pulser run (one pattern).
+// CALIBRATION_FILE loads a table at start: the processing then applies, through per-channel constants computed
+// at load time, the gain to the energy of each waveform (histograms, lists, cuts and plugins) and the time offsets
+// to the time spectrum (difference with the offset of the TOF start channel).
+// --calibrate-sim runs the calibration on simulated pulser events (no digitizer): each channel gets a delay and a
+// gain drawn at random, and the fitted table must give them back within CAL_SIM_TOL_xxx (the time offsets are
+// checked on the CFD channels only: with the LED they include the walk of the different amplitudes).
+
+#define CALIB_FILE_NAME		"calibration.txt"
+#define CALIB_FILE_TAG		"# WaveDemo pulser calibration"
+
+#define CAL_SIM_EVENTS		2000	// simulated pulser events per pattern
+#define CAL_SIM_MAX_DELAY	2.0f	// max delay of a simulated channel (ns, +/-)
+#define CAL_SIM_MAX_GAIN	0.2f	// max gain deviation of a simulated channel (relative, +/-)
+#define CAL_SIM_TOL_TIME	0.05f	// max error of the fitted time offsets (ns)
+#define CAL_SIM_TOL_GAIN	0.01f	// max error of the fitted gains (relative)
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Prepare a calibration run: reset the accumulators, enable the pulser with the first pattern on
+//				all the enabled channels (EnablePulseChannels, PulsePattern) and stop applying the loaded table
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int StartCalibration();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Add one processed channel of an event to the accumulators of the current pattern
+//				(the time reference is the TOF start channel in WDcfg.handles[].RefEvent)
+// Inputs:		bd, ch = board and channel
+//				event = event with the results of the waveform processor
+// ---------------------------------------------------------------------------------------------------------
+void CalibrationEvent(int bd, int ch, WaveDemoEvent_t *event);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 when all the enabled channels have CALIBRATION_EVENTS events at the current pattern
+// ---------------------------------------------------------------------------------------------------------
+int CalibrationStepDone();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Go to the next pattern of the sweep (PulsePattern of the enabled channels is updated; the boards
+//				must be programmed by the caller)
+// Return:		1=next pattern set, 0=end of the sweep
+// ---------------------------------------------------------------------------------------------------------
+int CalibrationNextStep();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Fit the accumulated events, write the table and send it on the status stream
+// Outputs:		TableFile = name of the table file (can be NULL)
+// Return:		number of calibrated channels, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int FinishCalibration(char *TableFile);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Load a calibration table and compute the constants applied by the processing
+//				(call after CheckTOFStartCh)
+// Inputs:		path = table written by a calibration run
+// Return:		number of channels in the table, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int LoadCalibration(const char *path);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Energy of a waveform with the gain of the loaded table (unchanged if no table is loaded)
+// ---------------------------------------------------------------------------------------------------------
+float CalibratedEnergy(int bd, int ch, float Energy);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Correction to subtract from the time of a channel relative to the TOF start channel (ns)
+// ---------------------------------------------------------------------------------------------------------
+float CalibrationTimeCorr(int bd, int ch);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Run the calibration on simulated pulser events and check the fitted table
+//				(call after InitWaveProcess, with the board parameters set)
+// Return:		0=the table matches the simulated channels, 1=mismatch, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int RunCalibrationSim();
+
+#endif
@@ -0,0 +1,78 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+
+#ifndef _WDCLOCK_H
+#define _WDCLOCK_H
+
+#include "WaveDemo.h"
+
+// Host clock of the program: monotonic time in ns (int64) from an arbitrary origin.
+// All the timing decisions are taken on it: statistics (real time and rates), batch-mode limits, periodic tasks of
+// the main loop (statistics refresh, board health checks, marker polling), recovery dead time, stage metrics and
+// latencies. Unlike the wall clock (gettimeofday/_ftime, ms), it never jumps when the system time is adjusted (NTP,
+// daylight saving) and its resolution is below 1 us (QueryPerformanceCounter / CLOCK_MONOTONIC).
+// Times and durations are kept as int64 ns (about 292 years) and converted to ms/s only for the output; the wall
+// clock is used only to date the records (WallClockMs: "t" of the status stream, host time of markers and
+// discontinuities).
+// Mock clock: after SetMockClock both clocks return a time that changes only by AdvanceMockClock, so that the
+// time-dependent logic can be run deterministically (--clock-sim).
+
+#define NS_PER_US		1000LL
+#define NS_PER_MS		1000000LL
+#define NS_PER_S		1000000000LL
+
+#define CLOCK_SIM_READS		1000000		// reads of the real clock checked for monotonicity
+#define CLOCK_SIM_HOURS		1000		// length of the simulated run of the statistics check (h)
+#define CLOCK_SIM_MAX_TIME	5			// batch time limit of the batch-mode check (s)
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Host monotonic time in ns (the mock time when the mock clock is set)
+// ---------------------------------------------------------------------------------------------------------
+int64_t HostClockNs();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Host monotonic time in ms (HostClockNs / NS_PER_MS)
+// ---------------------------------------------------------------------------------------------------------
+int64_t HostClockMs();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Wall clock time in ms since epoch, to date the records (the mock time in ms when the mock clock
+//				is set)
+// ---------------------------------------------------------------------------------------------------------
+uint64_t WallClockMs();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Replace the host and wall clocks by a mock time (deterministic tests)
+// Inputs:		Time = initial mock time (ns)
+// ---------------------------------------------------------------------------------------------------------
+void SetMockClock(int64_t Time);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Advance the mock time (no effect if the mock clock is not set)
+// Inputs:		Dt = time step (ns)
+// ---------------------------------------------------------------------------------------------------------
+void AdvanceMockClock(int64_t Dt);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Go back to the real clocks
+// ---------------------------------------------------------------------------------------------------------
+void ReleaseMockClock();
+
+#endif
@@ -0,0 +1,95 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDCUTS_H
+#define _WDCUTS_H
+
+#include "WaveDemo.h"
+
+// Event cuts. Each CUT line of the config file is an expression over the results of the waveform
+// processor, e.g.
+//     CUT = E[0][3] > 200 && abs(T[0][3] - T[0][0]) < 5
+// The expression is compiled when the config file is read into a postfix code for a small stack machine
+// and evaluated for each enabled channel of each event after the waveform processing; the channels that
+// fail it are not counted in EvFilt_cnt, histogrammed or saved. Several CUT lines are joined with &&.
+// Fields (E = energy, T = time stamp in ns, B = baseline, V = 1 if the channel has a fine time stamp):
+//     E[b][ch], T[b][ch], B[b][ch], V[b][ch]	channel ch of board b in the same event (0 if not available)
+//     E, T, B, V								channel being processed
+//     BD, CH									board and channel being processed
+//     MULT										number of channels of the event with a fine time stamp
+// Operators (C precedence): ! - (unary)  * /  + -  < <= > >=  == !=  &&  ||
+// Functions: abs(x), min(x, y), max(x, y)
+// In unsynchronized mode the event of a board is processed alone, so the fields of the other boards are 0.
+
+#define CUT_CURRENT		0xFF	// board/channel index of the channel being processed
+
+// Opcodes
+#define CUT_OP_CONST	0
+#define CUT_OP_FIELD	1
+#define CUT_OP_NEG		2
+#define CUT_OP_NOT		3
+#define CUT_OP_ABS		4
+#define CUT_OP_ADD		5
+#define CUT_OP_SUB		6
+#define CUT_OP_MUL		7
+#define CUT_OP_DIV		8
+#define CUT_OP_MIN		9
+#define CUT_OP_MAX		10
+#define CUT_OP_LT		11
+#define CUT_OP_LE		12
+#define CUT_OP_GT		13
+#define CUT_OP_GE		14
+#define CUT_OP_EQ		15
+#define CUT_OP_NE		16
+#define CUT_OP_AND		17
+#define CUT_OP_OR		18
+
+// Fields
+#define CUT_FIELD_E		0
+#define CUT_FIELD_T		1
+#define CUT_FIELD_B		2
+#define CUT_FIELD_V		3
+#define CUT_FIELD_BD	4
+#define CUT_FIELD_CH	5
+#define CUT_FIELD_MULT	6
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Compile a cut expression and join it (&&) to the cut already compiled, if any
+// Inputs:		expr = expression text
+// Outputs:		cut = compiled cut
+//				err = error description (at least 200 chars)
+// Return:		0=OK, -1=error (cut unchanged)
+// ---------------------------------------------------------------------------------------------------------
+int CompileCut(const char *expr, WaveDemoCut_t *cut, char *err);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Remove the cut (all the events pass)
+// ---------------------------------------------------------------------------------------------------------
+void ClearCut(WaveDemoCut_t *cut);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Evaluate the cut for one channel of an event
+// Inputs:		cut = compiled cut
+//				events = event of each board (NULL = not available)
+//				b, ch = board and channel being processed
+// Return:		1=pass, 0=rejected
+// ---------------------------------------------------------------------------------------------------------
+int EvalCut(const WaveDemoCut_t *cut, WaveDemoEvent_t *events[MAX_BD], int b, int ch);
+
+#endif
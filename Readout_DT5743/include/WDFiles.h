@@ -23,10 +23,23 @@
 //****************************************************************************
 // Function prototypes
 //****************************************************************************
+FILE *OpenOutputFile(const char *fname, const char *mode);
+int CreatePluginFileName(const char *Plugin, const char *Item, int b, int ch, char *fname);
+int CreateHistoArchiveFileName(char *fname);
+int CreateThrEmulationFileName(const char *Item, int point, int b, int ch, char *fname);
+int CreateCalibrationFileName(char *fname);
 int OpenOutputDataFiles();
 int CheckOutputDataFilePresence();
 int CloseOutputDataFiles();
+int SaveHistogram(char *FileName, Histogram1D_t Histo);
 int SaveAllHistograms();
+int SaveChannelHistograms(int b, int ch, int step, int settling);
+int SaveMarker(const WaveDemoMarker_t *m);
+int SaveMarkerInStreams(int b, int ch, const WaveDemoMarker_t *m);
+int SaveDiscontinuity(const WaveDemoDiscontinuity_t *d);
+int SaveDiscontinuityInStreams(int b, int ch, const WaveDemoDiscontinuity_t *d);
+int ReadRawHeader(FILE* inputFile, char *txtHeader, char *FileFormat, uint32_t *header, size_t headerElements);
+int ReadRawEvent(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int *bd, char channelsEnabled[MAX_CH]);
 int ReadRawData(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int printFlag);
 int SaveRawData(int bd, const char channelsEnabled[MAX_CH], WaveDemoEvent_t* event);
 int SaveTDCList(int bd, int ch, WaveDemoEvent_t* event);
@@ -0,0 +1,105 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDHARCHIVE_H
+#define _WDHARCHIVE_H
+
+#include "WaveDemo.h"
+
+// Binary histogram archive (HISTO_FILE_FORMAT = ARCHIVE): all the histograms of a run in one file
+// (<prefix>histos.wdh) instead of one text file per histogram.
+// The file starts with a HArchiveHeader_t; then each saved histogram is appended as one HArchiveRecord_t
+// followed by Nbin uint32 bin contents (little endian, as in memory). A histogram saved again (e.g. at the end
+// of the run after a step) is appended again: the readers take the last record of each key
+// (Type, Name, Board, Channel, Step, settling and emulated flags). Records of different archives with the same key
+// and binning can be summed (see histo_archive.py in the Python package for the merge, rebin and extract tools).
+
+#define HARC_MAGIC			"WDHARC01"		// file header magic (8 bytes)
+#define HARC_RECORD_MAGIC	0x52484457		// "WDHR" (little endian)
+#define HARC_FILE_NAME		"histos.wdh"
+#define HARC_BUFFER_SIZE	(4 << 20)		// buffer size of the archive file (bytes)
+
+// Histogram types
+#define HARC_TYPE_ENERGY	0
+#define HARC_TYPE_TIME		1
+#define HARC_TYPE_PLUGIN	2
+
+// Record flags
+#define HARC_FLAG_SETTLING	0x1				// the step segment is flagged as settling
+#define HARC_FLAG_HV		0x2				// HVset/HVmon are valid
+#define HARC_FLAG_EMULATED	0x4				// point of the threshold emulation (Step = point, see WDThrEmul.h)
+
+// File header (96 bytes)
+typedef struct {
+	char Magic[8];				// HARC_MAGIC
+	uint32_t HeaderSize;		// sizeof(HArchiveHeader_t)
+	uint32_t RecordSize;		// sizeof(HArchiveRecord_t)
+	int32_t RunNumber;
+	uint32_t Reserved;
+	uint64_t CreationTime;		// host time when the archive was created (s since epoch)
+	char StartTime[32];			// acquisition start time (%Y-%m-%d %H:%M:%S)
+	char Software[32];			// program and release that wrote the archive
+} HArchiveHeader_t;
+
+// Header of one histogram (128 bytes)
+typedef struct {
+	uint32_t Magic;				// HARC_RECORD_MAGIC
+	uint16_t Type;				// HARC_TYPE_xxx
+	uint16_t Flags;				// HARC_FLAG_xxx
+	int16_t Board;
+	int16_t Channel;
+	int32_t Step;				// scan step id (-1 = whole run)
+	uint32_t Nbin;
+	uint32_t Entries;			// counts in the bins
+	uint32_t Overflow;
+	uint32_t Underflow;
+	double Xmin, Xmax;			// range of the bins (Unit)
+	float CalibM, CalibQ;		// energy calibration (keV = CalibM * bin + CalibQ)
+	float HVset, HVmon;			// HV of the scan step (V)
+	float Threshold;			// trigger threshold of the channel (V)
+	uint32_t Reserved;
+	uint64_t SaveTime;			// host time of the save (s since epoch)
+	char Name[32];				// "energy", "time" or "<plugin>.<histogram>"
+	char Unit[16];				// unit of Xmin, Xmax
+} HArchiveRecord_t;
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Open the archive (created with the header if not present, otherwise the records are appended).
+//				The calls can be nested: only the outermost pair opens and closes the file, so all the
+//				histograms of one save go into the archive with one open.
+// Inputs:		fname = archive file
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int BeginHistoArchive(const char *fname);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Close the archive (outermost call of a nested BeginHistoArchive)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int EndHistoArchive();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Append one histogram to the open archive
+// Inputs:		r = record header (Magic, Nbin, Entries, Overflow, Underflow and SaveTime are set here)
+//				Histo = histogram
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int ArchiveHistogram(HArchiveRecord_t *r, const Histogram1D_t *Histo);
+
+#endif
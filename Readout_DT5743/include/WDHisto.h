@@ -24,9 +24,13 @@
 //****************************************************************************
 // Function prototypes
 //****************************************************************************
+int CreateHistogram1D(int Nbin, char *Title, char *Xlabel, char *Ylabel, Histogram1D_t *Histo);
+int DestroyHistogram1D(Histogram1D_t Histo);
+int ResetHistogram1D(Histogram1D_t *Histo);
 int CreateHistograms(uint32_t *AllocatedSize);
 int DestroyHistograms();
 int ResetHistograms();
+int ResetChannelHistograms(int b, int ch);
 int Histo1D_AddCount(Histogram1D_t *Histo, int Bin);
 int Histo2D_AddCount(Histogram2D_t *Histo, int BinX, int BinY);
 
@@ -0,0 +1,97 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDLATENCY_H
+#define _WDLATENCY_H
+
+#include "WaveDemo.h"
+
+// End-to-end latency of the events (LATENCY_TRACKING = YES in the config file).
+// Each readout block is stamped with the host monotonic time at the return of ReadData (event->ReadTime).
+// For each board, the host time is mapped to the board time by a linear fit of the arrival time of the
+// newest event of each block vs. its time stamp (exponential forgetting, LAT_FIT_LAMBDA per block): the slope
+// follows the drift between the board and host clocks, the offset is moved to the lower envelope of the
+// arrivals (min residual of the last LAT_ENVELOPE blocks), i.e. the latency is relative to the fastest readout.
+// The latency of an event at a milestone (LAT_xxx) is the host time minus the mapped host time of its trigger;
+// it is accumulated in log-scale histograms (LAT_BINS_PER_OCTAVE bins per factor 2, in us) per stage and board,
+// from which the percentiles are taken.
+
+#define LAT_READ			0		// readout (ReadData returned)
+#define LAT_DECODED			1		// event decoded into the queue
+#define LAT_PROCESSED		2		// waveform processed
+#define LAT_HISTOGRAMMED	3		// channel added to the histograms
+#define LAT_WRITTEN			4		// channel written into the output files
+#define LAT_PUBLISHED		5		// event sent to the plotter
+#define LAT_NSTAGES			6
+
+#define LAT_FIT_LAMBDA		0.999	// forgetting factor of the time fit (per readout block)
+#define LAT_ENVELOPE		64		// blocks used for the lower envelope of the arrivals
+#define LAT_BINS_PER_OCTAVE	4
+#define LAT_NBINS			(LAT_BINS_PER_OCTAVE * 36)	// up to 2^36 us (about 19 hours)
+
+// Latency percentiles of one stage of one board (ms)
+typedef struct {
+	uint64_t Count;
+	float P50, P90, P99, Max;
+} LatencySummary_t;
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Host monotonic time in us (time base of the latency; HostClockNs, see WDClock.h)
+// ---------------------------------------------------------------------------------------------------------
+uint64_t LatencyClock();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Reset the time fits and the histograms (run start)
+// ---------------------------------------------------------------------------------------------------------
+void ResetLatency();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Add one readout block of a board to the time fit (called by the readout stage after the decoding)
+// Inputs:		b = board index
+//				ReadTime = host time (us) of the block
+//				TDC = time stamp of the newest event of the block (5 ns units)
+// ---------------------------------------------------------------------------------------------------------
+void LatencyBlockRead(int b, uint64_t ReadTime, uint64_t TDC);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Record the latency of an event at a milestone
+// Inputs:		stage = LAT_xxx (LAT_READ uses event->ReadTime, the others the current time)
+//				b = board index
+//				event = event
+//				ch = channel (its group gives the time stamp), -1 = first group of the event
+// ---------------------------------------------------------------------------------------------------------
+void LatencyRecord(int stage, int b, const WaveDemoEvent_t *event, int ch);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Name of a stage
+// ---------------------------------------------------------------------------------------------------------
+const char *LatencyStageName(int stage);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Percentiles of the latency of one stage of one board since the start of the run
+// Return:		number of recorded events
+// ---------------------------------------------------------------------------------------------------------
+uint64_t GetLatencySummary(int stage, int b, LatencySummary_t *s);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Write the latency percentiles in the log
+// ---------------------------------------------------------------------------------------------------------
+void PrintLatencyStats();
+
+#endif
@@ -0,0 +1,98 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDMARKERS_H
+#define _WDMARKERS_H
+
+#include "WaveDemo.h"
+
+// Scan step markers for continuous acquisition across HV/threshold steps.
+// The control side appends one line per condition change to the marker input file:
+//     step=<id> [settling=0|1] [hv=<V>] [hv_mon=<V>] [thr=<V>] [label=<text>]
+//     end                       (stop the acquisition as if a batch limit was reached)
+// Each marker is stamped with the newest board time stamp read so far; every channel switches
+// to the new step when it processes the first event later than that time (segmentation by board time).
+
+#define MARKER_POLL_PERIOD	100		// ms between two reads of the marker input file
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Open the marker input file (created empty if it does not exist)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int OpenStepMarkers(const char *path);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Close the marker input file
+// ---------------------------------------------------------------------------------------------------------
+void CloseStepMarkers();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if the step markers are enabled
+// ---------------------------------------------------------------------------------------------------------
+int StepMarkersEnabled();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Reset the step segmentation (call at the start of the acquisition)
+// ---------------------------------------------------------------------------------------------------------
+void ResetStepMarkers();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Read the new markers from the input file (at most once every MARKER_POLL_PERIOD ms)
+// Inputs:		CurrentTime = host clock in ns (HostClockNs)
+// Return:		number of new markers, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int PollStepMarkers(int64_t CurrentTime);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Close the step segments of one channel that end before the event time (save and reset the
+//				histograms, write the marker into the channel output files, apply the new threshold)
+// Inputs:		b = board index
+//				ch = channel
+//				EventTime = event time stamp in ns
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int ApplyStepMarkers(int b, int ch, uint64_t EventTime);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Get the current step of one channel
+// Outputs:		settling = 1 if the current step is flagged as settling
+// Return:		step id, -1 if the step markers are disabled
+// ---------------------------------------------------------------------------------------------------------
+int GetChannelStep(int b, int ch, int *settling);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Get the marker that opened the current step of one channel
+// Return:		marker, NULL if the channel is still in the data before the first marker
+// ---------------------------------------------------------------------------------------------------------
+const WaveDemoMarker_t *GetChannelMarker(int b, int ch);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if the control side requested the end of the acquisition
+// ---------------------------------------------------------------------------------------------------------
+int StepMarkersEndRequested();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Program again the trigger threshold of the current step in one board (call after the board
+//				has been reprogrammed from the configuration, e.g. by the readout error recovery)
+// Inputs:		b = board index
+// Return:		0=OK, other=error of the digitizer library
+// ---------------------------------------------------------------------------------------------------------
+int RestoreStepThreshold(int b);
+
+#endif
@@ -0,0 +1,122 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDPIPELINE_H
+#define _WDPIPELINE_H
+
+#include "WaveDemo.h"
+
+// Pipeline runtime of the acquisition loop. The work of each loop is split in three stages connected by
+// the event buffers (WDbuff, one bounded queue per board):
+//   READOUT  software trigger, readout of one block per board, decoding into the event queues (producer)
+//   PROCESS  waveform processing, markers, selection, histograms, list files, plots (consumer)
+//   PLUGINS  batches of the processing plugins; the channels are shared among PIPELINE_PLUGIN_THREADS
+//            threads (the main thread is one of them), each one takes the next channel when it is free
+// PIPELINE_MODE = INLINE runs the stages one after the other in the main loop (as the previous versions);
+// THREADED runs the readout stage in its own thread, so that the readout goes on while the main thread
+// processes the previous blocks. PIPELINE_QUEUE_POLICY sets the back-pressure when a queue is full:
+// DROP loses events (counted as lost), BLOCK stops reading until the processing frees enough space.
+// The readout thread is paused whenever the main thread must access the boards or change the run state
+// (keyboard commands, stop, restart), so these parts of the program need no locks.
+// Processing scheduler: each activation of the PROCESS stage (slice) takes at most the number of events
+// that fit in PIPELINE_PROCESS_BUDGET ms, estimated from the measured processing time per event, so that
+// the readout is not delayed by a long backlog. The budget is multiplied by SCHED_DRAIN_FACTOR (drain)
+// when the readout is idle or the queues are above SCHED_HIGH_WATER, and divided by SCHED_YIELD_DIVIDER
+// (yield) when the last block transfer was full, i.e. the board buffers are filling up.
+
+#define SCHED_MIN_SLICE			16		// min events per board in one slice
+#define SCHED_DRAIN_FACTOR		8		// budget multiplier when the backlog is drained
+#define SCHED_YIELD_DIVIDER		4		// budget divider when the readout has priority
+#define SCHED_HIGH_WATER		75.0f	// queue occupancy (%) above which the backlog is drained
+
+#define PSTAGE_READOUT		0
+#define PSTAGE_PROCESS		1
+#define PSTAGE_PLUGINS		2
+#define PSTAGE_NUM			3
+
+// Metrics of one stage (since the start of the run)
+typedef struct {
+	const char *Name;
+	int Threads;				// threads running the stage
+	uint64_t Calls;				// activations of the stage
+	uint64_t Items;				// events read (READOUT), processed (PROCESS), passed to the plugins (PLUGINS)
+	uint64_t BusyTime;			// time spent working (us)
+	uint64_t WaitTime;			// time spent waiting for input or for free space in the output queues (us)
+	uint64_t Dropped;			// events lost because the queues were full (READOUT only)
+	int QueueMax;				// max occupancy of the input queues in events (PROCESS only)
+	double OccupancySum;		// sum of the queue occupancy (%) at the start of the slices (PROCESS only, mean = OccupancySum/Calls)
+	int SliceLimit;				// events per board allowed in the last slice by the scheduler (PROCESS only)
+	int SliceMax;				// max events processed in one slice (PROCESS only, mean = Items/Calls)
+	uint64_t Drains;			// slices with the budget extended to drain the backlog (PROCESS only)
+	uint64_t Yields;			// slices with the budget reduced to give priority to the readout (PROCESS only)
+} PipelineStageStats_t;
+
+typedef int(*PipelineReadoutFn_t)(uint64_t *NumEvents);	// Return: ErrCode (ERR_NONE=OK)
+typedef int(*PipelineProcessFn_t)(int MaxEvents);		// MaxEvents = max events per board; Return: ErrCode (ERR_NONE=OK)
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Create the threads of the pipeline (the readout thread starts paused)
+// Inputs:		ReadoutFn = readout stage, ProcessFn = processing stage
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int PipelineInit(PipelineReadoutFn_t ReadoutFn, PipelineProcessFn_t ProcessFn);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Stop and join the threads of the pipeline (nothing to do if PipelineInit was not called)
+// ---------------------------------------------------------------------------------------------------------
+void PipelineClose();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if the readout stage runs in its own thread
+// ---------------------------------------------------------------------------------------------------------
+int PipelineThreaded();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Pause the readout thread; on return no readout is in progress. The thread is resumed
+//				by the next PipelineStep.
+// ---------------------------------------------------------------------------------------------------------
+void PipelinePauseReadout();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: One loop of the pipeline during the acquisition (called by the main loop)
+// Return:		ErrCode (ERR_NONE=OK)
+// ---------------------------------------------------------------------------------------------------------
+int PipelineStep();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Count the events lost because the queue of one board was full (called by the readout stage)
+// ---------------------------------------------------------------------------------------------------------
+void PipelineCountDropped(int bd, int nev);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Metrics of one stage (PSTAGE_xxx)
+// ---------------------------------------------------------------------------------------------------------
+const PipelineStageStats_t *GetPipelineStats(int stage);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Reset the metrics of the stages (run start)
+// ---------------------------------------------------------------------------------------------------------
+void ResetPipelineStats();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Write the metrics of the stages in the log
+// ---------------------------------------------------------------------------------------------------------
+void PrintPipelineStats();
+
+#endif
@@ -0,0 +1,120 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+* -----------------------------------------------------------------------------
+* WDPluginAPI is the only header needed to build a processing plugin (shared
+* library loaded with the PLUGIN option of the config file). It does not
+* depend on the WaveDemo or CAENDigitizer headers and it is kept binary
+* compatible for the same WD_PLUGIN_API_VERSION.
+******************************************************************************/
+
+#ifndef _WDPLUGINAPI_H
+#define _WDPLUGINAPI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WD_PLUGIN_API_VERSION	1
+
+#ifdef _WIN32
+	#define WD_PLUGIN_EXPORT	__declspec(dllexport)
+#else
+	#define WD_PLUGIN_EXPORT	__attribute__((visibility("default")))
+#endif
+
+// Name of the function exported by the plugin: const WDPlugin_t *WDPluginEntry(void)
+#define WD_PLUGIN_ENTRY_NAME	"WDPluginEntry"
+
+//****************************************************************************
+// Standard results of the waveform processor for one event of one channel
+//****************************************************************************
+typedef struct {
+	uint64_t TimeStamp;			// coarse time stamp (ns)
+	float FineTimeStamp;		// fine time stamp inside the record (ns); 0 = no pulse found
+	float Energy;				// energy (charge in the gate, calibrated)
+	float Baseline;				// baseline (ADC counts)
+	uint32_t EventCounter;		// event counter of the board
+	int Selected;				// 1 = event passed the selection (fine time stamp and CUT)
+} WDPluginResult_t;
+
+//****************************************************************************
+// One readout block of events of one channel
+//****************************************************************************
+typedef struct {
+	int Board;
+	int Channel;
+	int Thread;						// index of the processing thread (selects the per-thread state)
+	int NumEvents;					// number of events in the batch
+	int RecordLength;				// samples per waveform
+	float SamplingPeriod;			// ns per sample
+	const float *const *Samples;	// Samples[i] = waveform of event i (ADC counts); points to the readout buffers, read only
+	const WDPluginResult_t *Results;// Results[i] = standard results of event i
+	int NumColumns;					// output columns added by this plugin
+	double *Columns;				// Columns[i * NumColumns + c] = column c of event i (written by the plugin; 0 by default)
+} WDPluginBatch_t;
+
+//****************************************************************************
+// Services offered by the program to the plugin
+//****************************************************************************
+typedef struct WDPluginHost_s WDPluginHost_t;
+struct WDPluginHost_s {
+	int ApiVersion;				// WD_PLUGIN_API_VERSION of the program
+	const char *Args;			// text following the library path in the PLUGIN option
+	int NumThreads;				// number of processing threads (ThreadInit is called for each one)
+	void *Private;				// reserved for the program
+
+	// Add an output column (call from Init). The columns are written, for the selected events, in the
+	// file <run>_Plugin_<name>_<b>_<ch>.txt when the lists are saved. Return: column index, -1=error
+	int (*AddColumn)(WDPluginHost_t *host, const char *name);
+	// Add a histogram of nbin bins between xmin and xmax for each enabled channel (call from Init);
+	// saved as <run>_Plugin_<name>_<histo>_<b>_<ch>.txt with the other histograms. Return: histogram index, -1=error
+	int (*AddHistogram)(WDPluginHost_t *host, const char *name, int nbin, double xmin, double xmax);
+	// Add one count to a histogram (call from ProcessBatch; the host serializes the calls of the processing threads)
+	void (*Fill)(WDPluginHost_t *host, int histo, int b, int ch, double x);
+	// Write a message in the log (INFO/WARN/ERROR prefix recommended)
+	void (*Log)(WDPluginHost_t *host, const char *fmt, ...);
+};
+
+//****************************************************************************
+// Plugin descriptor returned by WDPluginEntry. Unused callbacks can be NULL.
+//****************************************************************************
+typedef struct {
+	int ApiVersion;				// must be WD_PLUGIN_API_VERSION
+	const char *Name;			// short name, used in the output file names
+
+	// Called once after loading; *ctx is the plugin context passed to the other callbacks. Return: 0=OK
+	int (*Init)(WDPluginHost_t *host, void **ctx);
+	// Called once for each processing thread; return the state passed to ProcessBatch by that thread
+	void *(*ThreadInit)(void *ctx, int thread);
+	void (*ThreadExit)(void *ctx, void *tstate);
+	// Called when an acquisition run starts/stops
+	int (*StartRun)(void *ctx, const char *RunName);
+	int (*StopRun)(void *ctx);
+	// Called for each readout block and channel, after the standard processing and selection. The batches of
+	// different channels can run at the same time in different threads (PIPELINE_PLUGIN_THREADS): the
+	// context must be read only here, per-thread data go in tstate. Return: 0=OK
+	int (*ProcessBatch)(void *ctx, void *tstate, const WDPluginBatch_t *batch);
+	// Called before unloading
+	void (*Exit)(void *ctx);
+} WDPlugin_t;
+
+typedef const WDPlugin_t *(*WDPluginEntry_t)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
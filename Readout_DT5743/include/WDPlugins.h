@@ -0,0 +1,97 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDPLUGINS_H
+#define _WDPLUGINS_H
+
+#include "WaveDemo.h"
+#include "WDPluginAPI.h"
+
+// Processing plugins (shared libraries listed in the PLUGIN options of the config file, see WDPluginAPI.h).
+// During the event processing the selected and rejected events of each channel are queued (pointers to
+// the readout buffers, no copy); at the end of the processing of a readout block the queue of each channel
+// is passed to every plugin as one batch, before the buffers can be overwritten by the next readout.
+// The batches of different channels can run in parallel (plugin stage of the pipeline, see WDPipeline.h).
+
+#define PLUGIN_MAX_THREADS		8		// max num of processing threads with a plugin state
+#define PLUGIN_MAX_COLUMNS		32		// max num of output columns of one plugin
+#define PLUGIN_MAX_HISTOS		16		// max num of histograms of one plugin
+#define PLUGIN_MAX_NAME			32		// max length of the column and histogram names
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Load the plugins of WDcfg.Plugins and call their Init and ThreadInit
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int LoadPlugins();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Call ThreadExit and Exit of the plugins, then unload them
+// ---------------------------------------------------------------------------------------------------------
+void UnloadPlugins();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if at least one plugin is loaded
+// ---------------------------------------------------------------------------------------------------------
+int PluginsEnabled();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Queue a processed event of one channel for the next batch
+// Inputs:		b, ch = board and channel
+//				event = event (must stay in the readout buffer until PluginsProcessChannel)
+//				selected = 1 if the event passed the selection
+// ---------------------------------------------------------------------------------------------------------
+void PluginsQueueEvent(int b, int ch, WaveDemoEvent_t *event, int selected);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Number of threads of the plugin stage (the plugins have one state for each one)
+// ---------------------------------------------------------------------------------------------------------
+int PluginsNumThreads();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Pass the queued events to the plugins and write their output columns: call
+//				PluginsPrepareBatches once, then PluginsProcessChannel for every board and channel (different
+//				channels can be processed by different threads at the same time)
+// Inputs:		thread = index of the calling thread of the plugin stage
+// Return:		PluginsPrepareBatches: 0=OK, -1=error; PluginsProcessChannel: events in the batch, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int PluginsPrepareBatches();
+int PluginsProcessChannel(int thread, int b, int ch);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Run start (reset the plugin histograms and call StartRun)
+// ---------------------------------------------------------------------------------------------------------
+int PluginsStartRun();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Run stop (call StopRun and close the column files); called by CloseOutputDataFiles
+// ---------------------------------------------------------------------------------------------------------
+int PluginsStopRun();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Reset the histograms of all the plugins
+// ---------------------------------------------------------------------------------------------------------
+void ResetPluginHistograms();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Save the histograms of all the plugins; called by SaveAllHistograms
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int SavePluginHistograms();
+
+#endif
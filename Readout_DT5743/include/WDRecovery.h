@@ -0,0 +1,72 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDRECOVERY_H
+#define _WDRECOVERY_H
+
+#include "WaveDemo.h"
+
+// Readout recovery after link or board errors (READOUT_RECOVERY_ATTEMPTS > 0 in the config file).
+// A failed readout or an internal communication timeout (register 0x8178) of one board does not stop
+// the program: the board is stopped, cleared and closed, then it is opened and programmed again with the
+// settings of WDcfg and the acquisition goes on in the same run (with synchronized boards, all the boards
+// are stopped and started again). The first attempt is immediate, the next ones are delayed by
+// RECOVERY_RETRY_DELAY ms times the number of failed attempts.
+// During a run:
+//  - the time stamps of the restarted boards are shifted (WDh->TDCOffset) so that they keep increasing
+//    and include the time spent in the recovery
+//  - the recovery time is dead time of all the channels of the restarted boards (WDstats.RecoveryTime)
+//  - a discontinuity is written into the markers file, the ASCII list/waveform files of the channels
+//    of the restarted boards ("# DISCONTINUITY ...") and the status stream ("recovery" record)
+
+#define RECOVERY_RETRY_DELAY		1000	// ms between the first two attempts (multiplied by the failed attempts)
+#define RECOVERY_HEALTH_PERIOD		1000	// ms between two checks of the board fail status during the run
+#define RECOVERY_MAX_PENDING		16		// discontinuities waiting to be written into the output files
+
+// Reopen and program one board (and restart the acquisition if StartAcq = 1); Return: 0=OK, -1=error
+typedef int(*RecoveryRestartFn_t)(int bd, int StartAcq);
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if the recovery is enabled
+// ---------------------------------------------------------------------------------------------------------
+int RecoveryEnabled();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Reset the time stamp offsets and the discontinuities (run start)
+// ---------------------------------------------------------------------------------------------------------
+void ResetRecovery();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Recover one board after an error; called by the readout stage (during the run) or by the
+//				main loop (acquisition stopped), i.e. by the only thread that accesses the boards
+// Inputs:		bd = board index
+//				reason = short description of the error
+//				RestartFn = function that reopens and programs the board
+// Return:		0=OK, -1=error (all the attempts failed)
+// ---------------------------------------------------------------------------------------------------------
+int RecoverBoard(int bd, const char *reason, RecoveryRestartFn_t RestartFn);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Write the discontinuities of the recoveries completed by the readout stage into the output
+//				files and the status stream (called by the main loop)
+// Return:		number of discontinuities written
+// ---------------------------------------------------------------------------------------------------------
+int PollRecoveries();
+
+#endif
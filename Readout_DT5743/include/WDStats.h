@@ -30,8 +30,9 @@ int ResetStatistics();
 
 // --------------------------------------------------------------------------------------------------------- 
 // Description: Calculate some statistcs (rates, etc...) in the Stats struct
+// Inputs: CurrentTime = host clock in ns (HostClockNs)
 // Return: 0=OK, -1=error
 // --------------------------------------------------------------------------------------------------------- 
-int UpdateStatistics(uint64_t CurrentTime);
+int UpdateStatistics(int64_t CurrentTime);
 
 #endif
\ No newline at end of file
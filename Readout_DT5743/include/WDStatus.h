@@ -0,0 +1,136 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDSTATUS_H
+#define _WDSTATUS_H
+
+#include "WaveDemo.h"
+
+// Machine-readable status stream (JSON Lines, one record per line).
+// Every record has the fields "ev" (record type) and "t" (host time in ms since epoch).
+//   {"ev":"hello","t":...,"version":1}   (first record written when the stream is opened)
+//   {"ev":"state","t":...,"state":"ready|running|stopped|completed|error|exit","run":"..."}
+//   {"ev":"progress","t":...,"elapsed_s":...,"max_time_s":...,"events":...,"max_events":...}
+//   {"ev":"stats","t":...,"real_time_ms":...,"events":...,"bytes":...,"recoveries":...,"readout_mbps":...,"channels":[...],"pipeline":[...]}
+//        "pipeline": one object per stage; the process stage has also "occupancy" (mean %), "slice_mean", "slice_max",
+//        "slice_limit", "drains", "yields" (processing scheduler, see WDPipeline.h)
+//        "latency" (LATENCY_TRACKING = YES): {"board":...,"stage":"read|decoded|processed|histogrammed|written|published",
+//        "n":...,"p50_ms":...,"p90_ms":...,"p99_ms":...,"max_ms":...} for each stage with events (see WDLatency.h)
+//   {"ev":"file","t":...,"kind":"...","board":...,"channel":...,"path":"..."}
+//   {"ev":"error","t":...,"code":...,"msg":"..."}
+//   {"ev":"marker","t":...,"step":...,"settling":0|1,"board_time_ns":...,"hv":...,"hv_mon":...,"thr":...}
+//   {"ev":"recovery","t":...,"board":...,"all_boards":0|1,"attempts":...,"dead_time_ms":...,"board_time_ns":...,"reason":"..."}
+//   {"ev":"histo","t":...,"board":...,"channel":...,"kind":"energy|time","nbin":...,"entries":...,"ovf":...,"unf":...,
+//        "full":0|1,"bins":[i0,c0,i1,c1,...]}   (STATUS_HISTOGRAMS, after each stats record)
+//        "bins": index and new content of the bins changed since the previous record of the same histogram;
+//        "full":1 (first record, histogram reset or new number of bins) = the bins not listed are empty.
+//   {"ev":"thr_point","t":...,"point":...,"thr":...,"discr":"LED|CFD","board":...,"channel":...,"events":...,
+//        "triggered":...,"rate":...,"energy_mean":...}   (threshold emulation in the reprocessing, see WDThrEmul.h)
+//   {"ev":"calib","t":...,"board":...,"channel":...,"time_offset":...,"time_rms":...,"gain_m":...,"gain_q":...,
+//        "events":...}   (pulser calibration, see WDCalib.h)
+#define STATUS_FORMAT_VERSION		1
+
+#define STATUS_STATE_READY			"ready"
+#define STATUS_STATE_RUNNING		"running"
+#define STATUS_STATE_STOPPED		"stopped"
+#define STATUS_STATE_COMPLETED		"completed"
+#define STATUS_STATE_ERROR			"error"
+#define STATUS_STATE_EXIT			"exit"
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Open the status stream
+// Inputs:		dest = "-" for stdout, "fd:N" for an inherited file descriptor, otherwise a file path
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int OpenStatusStream(const char *dest);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Close the status stream (if open)
+// ---------------------------------------------------------------------------------------------------------
+void CloseStatusStream();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if the status stream is open
+// ---------------------------------------------------------------------------------------------------------
+int StatusStreamEnabled();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Redirect the human-oriented console output (stdout) to the null device.
+//              Must be called after OpenStatusStream when the stream goes to stdout.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int DisableConsoleOutput();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit a state transition record
+// ---------------------------------------------------------------------------------------------------------
+int StatusState(const char *state);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit a batch progress record
+// ---------------------------------------------------------------------------------------------------------
+int StatusProgress(uint64_t ElapsedSeconds, uint64_t MaxTime, uint64_t Events, uint64_t MaxEvents);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit a snapshot of WDstats (counts and rates per channel); call after UpdateStatistics
+// ---------------------------------------------------------------------------------------------------------
+int StatusStats();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit the changes of the histograms selected by STATUS_HISTOGRAMS since the previous call
+//				(called by StatusStats; the histograms are filled by the same thread)
+// ---------------------------------------------------------------------------------------------------------
+int StatusHistograms();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit an output file record (b, ch = -1 for files that are not per channel)
+// ---------------------------------------------------------------------------------------------------------
+int StatusFile(const char *kind, int b, int ch, const char *path);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit an error record
+// ---------------------------------------------------------------------------------------------------------
+int StatusError(int code, const char *msg);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit a scan step marker record
+// ---------------------------------------------------------------------------------------------------------
+int StatusMarker(const WaveDemoMarker_t *m);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit a record for the recovery of a board after a readout error (see WDRecovery.h)
+// ---------------------------------------------------------------------------------------------------------
+int StatusRecovery(const WaveDemoDiscontinuity_t *d);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit the result of one point and channel of the threshold emulation (see WDThrEmul.h)
+// Inputs:		point = index of the point, Threshold = threshold (V), discr = "LED" or "CFD"
+//				events = events of the channel in the file, triggered = events above the emulated threshold
+//				rate = triggered events / time span of the board (Hz), EnergyMean = mean energy (ADC counts)
+// ---------------------------------------------------------------------------------------------------------
+int StatusThrPoint(int point, float Threshold, const char *discr, int b, int ch, uint64_t events, uint64_t triggered, float rate, float EnergyMean);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Emit the calibration of one channel (see WDCalib.h)
+// Inputs:		TimeOffset, TimeRms = time offset from the TOF start channel and its rms (ns)
+//				GainM, GainQ = gain (E_ref = GainM * E + GainQ), events = pulser events of the channel
+// ---------------------------------------------------------------------------------------------------------
+int StatusCalibration(int b, int ch, float TimeOffset, float TimeRms, float GainM, float GainQ, uint64_t events);
+
+#endif
@@ -0,0 +1,66 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDTHREMUL_H
+#define _WDTHREMUL_H
+
+#include "WaveDemo.h"
+
+// Threshold emulation in the reprocessing of a raw data file (--reprocess with EMULATE_THRESHOLDS).
+// A threshold scan needs one acquisition at the lowest threshold: in the replay each waveform is processed again by
+// the software discriminator once for each emulated point (threshold x discriminator, EMULATE_DISCR), and each point
+// accumulates its own counts, energy and time histograms, so the whole threshold curve comes from one pass over the
+// file. The CFD of an emulated point is armed at threshold x CFD_ATTEN (CFD_THRESHOLD is ignored). The points with a
+// threshold below the one of the acquisition lack the waveforms the board didn't trigger on (their rates are lower
+// limits); the event cut (CUT) is not applied to the emulated points.
+// Outputs (data path): <prefix>thr_emulation.txt with one line per point and channel (triggered events, rate over
+// the time span of the board, mean energy), and the histograms of each point: <prefix>Ehisto_<b>_<ch>_thrNN.txt and
+// <prefix>Thisto_<b>_<ch>_thrNN.txt, or records of the histogram archive with Step = NN and HARC_FLAG_EMULATED.
+// With the status stream, one "thr_point" record per point and channel (see WDStatus.h).
+
+#define EMUL_FILE_NAME		"thr_emulation.txt"
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Allocate the points of the emulation (call after InitWaveProcess, with the board parameters set)
+// Return:		number of points (0 = emulation disabled), -1=error
+// ---------------------------------------------------------------------------------------------------------
+int InitThrEmulation();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Process the channels of one event at each emulated point (the results of the nominal settings
+//				in the event are not changed)
+// Inputs:		bd = board of the event
+//				event = event read from the raw data file
+//				channelsEnabled = channels present in the event
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int ThrEmulationEvent(int bd, WaveDemoEvent_t *event, const char channelsEnabled[MAX_CH]);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Write the summary and the histograms of the points and send them on the status stream
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int SaveThrEmulation();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Free the points
+// ---------------------------------------------------------------------------------------------------------
+void CloseThrEmulation();
+
+#endif
@@ -0,0 +1,57 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+
+#ifndef _WDVERIFY_H
+#define _WDVERIFY_H
+
+#include "WaveDemo.h"
+
+// Differential verification of the waveform processor (--verify). Each waveform of the corpus is processed by the
+// reference path (WP_KERNEL_FUSED, no cache) and by each variant:
+//   split         WP_KERNEL_SPLIT (vectorizable loops)
+//   cache-energy  processor cache with the timing stage hit and the energy stage recomputed (the entry is filled
+//                 with a different gate first)
+//   cache-hit     processor cache with both stages hit
+// The baseline, fine time stamp and energy of each waveform must agree within the tolerances below, and so must the
+// energy and fine time histograms of the whole corpus (same binning as the acquisition). Corpus: synthetic
+// waveforms of the enabled channels (pulses of both polarities, below and above the threshold, at the edges of the
+// record, saturated, baseline only), plus the waveforms of a raw data file (--verify-file). For each mismatching
+// waveform (up to VFY_MAX_REPRO per variant) a reproducer is written in the data path: verify_<variant>_<n>.txt,
+// with the board, channel, results and samples; `--verify-file <reproducer>` replays it alone with the settings of
+// the config file.
+
+#define VFY_TOL_BASELINE	1e-3	// ADC counts
+#define VFY_TOL_TIME		1e-3	// ns
+#define VFY_TOL_ENERGY		1e-4	// relative (absolute below 1 ADC count x sample)
+#define VFY_TOL_HISTO		1e-3	// fraction of the entries that can move to another bin
+#define VFY_NUM_SYNTH		512		// synthetic waveforms per enabled channel
+#define VFY_GATE_DELTA		8		// samples added to the gate to fill the cache for the cache-energy variant
+#define VFY_MAX_REPRO		16		// reproducers written per variant
+#define VFY_REPRO_TAG		"# WaveDemo verification reproducer"
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Run the verification and write the report in the log
+//				(call after InitWaveProcess, with the board parameters set)
+// Inputs:		corpus = raw data file to add to the synthetic waveforms or reproducer to replay (NULL or "" = none)
+// Return:		0=all the variants agree, 1=mismatch, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int RunVerification(const char *corpus);
+
+#endif
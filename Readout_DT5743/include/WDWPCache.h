@@ -0,0 +1,98 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _WDWPCACHE_H
+#define _WDWPCACHE_H
+
+#include "WaveDemo.h"
+
+// Memoization of the waveform processor for the offline reprocessing of raw data files (--reprocess, WP_CACHE = YES).
+// The results of each channel of each event are stored in a cache file next to the raw data file (<raw file>.wpcache),
+// one entry per stage, keyed by a hash of the raw samples and of the parameters the stage depends on:
+//   WPC_STAGE_TIMING: baseline, smoothing, discriminator and time interpolation -> baseline, crossing, fine time
+//   WPC_STAGE_ENERGY: energy gate (the key includes the timing key) -> gate integral
+// A replay that changes only the gate takes the timing from the cache and integrates the raw samples in the gate;
+// a replay with the same settings doesn't run the processor at all. The entries are pure functions of their keys,
+// so the replays with different settings share the same file (the new entries are appended).
+// On a hit the processed traces are not produced (the cache is not used when the waveforms are saved).
+
+#define WPC_FILE_EXT		".wpcache"
+#define WPC_MAGIC			"WDWPC002"		// file header: magic (8 bytes) + entry size (uint32)
+#define WPC_HASH_INIT		0xcbf29ce484222325ULL	// FNV-1a offset basis
+
+#define WPC_STAGE_TIMING	0
+#define WPC_STAGE_ENERGY	1
+#define WPC_NSTAGES			2
+
+// One entry of the cache (same layout in memory and in the file)
+typedef struct {
+	uint64_t Key;
+	float Baseline;			// timing stage: baseline (ADC counts)
+	float TimeStamp;		// timing stage: fine time stamp (ns, 0 = not found)
+	float Energy;			// energy stage: integral in the energy gate
+	int32_t Ncross;			// timing stage: first sample after the crossing (0 = no trigger)
+	float LocalBaseline;	// timing stage: baseline of the quiet samples of the event (baseline tracking)
+} WPCacheEntry_t;
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Add data to a 64 bit FNV-1a hash
+// Inputs:		h = current hash (WPC_HASH_INIT for a new one)
+//				data, size = data to add
+// Return:		new hash
+// ---------------------------------------------------------------------------------------------------------
+uint64_t WPCacheHash(uint64_t h, const void *data, size_t size);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Load a cache file (created if not present); the new entries are appended to it
+// Inputs:		path = cache file
+// Return:		number of entries loaded, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int OpenWPCache(const char *path);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Flush and close the cache file and free the table
+// ---------------------------------------------------------------------------------------------------------
+void CloseWPCache();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Return 1 if a cache is open
+// ---------------------------------------------------------------------------------------------------------
+int WPCacheActive();
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Look for an entry
+// Inputs:		stage = WPC_STAGE_xxx (statistics)
+//				key = key of the entry
+// Outputs:		e = entry
+// Return:		1=found, 0=not found
+// ---------------------------------------------------------------------------------------------------------
+int WPCacheLookup(int stage, uint64_t key, WPCacheEntry_t *e);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Add an entry (e->Key) to the table and to the cache file
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int WPCacheStore(const WPCacheEntry_t *e);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Write the hits and misses of each stage in the log
+// ---------------------------------------------------------------------------------------------------------
+void PrintWPCacheStats();
+
+#endif
@@ -22,8 +22,11 @@
 // Function prototypes
 //****************************************************************************
 int InitWaveProcess();
+int UpdateChannelThreshold(int b, int ch);
 int CloseWaveProcess();
 int WaveformProcess(int b, int ch, WaveDemoEvent_t *event);
 int MultiWaveformProcess(WaveDemoEvent_t *event[], int n);
+int WaveformProcessVariant(int Kernel, int Cached, int b, int ch, int ns, const float *Wavein, Waveform_t *Wfm, float *Baseline, float *TimeStamp, float *Energy);
+int WaveformProcessKernel(int Kernel, int b, int ch, int ns, const float *Wavein, Waveform_t *Wfm, double *Result);
 
 #endif
\ No newline at end of file
@@ -51,6 +51,7 @@
 	#define		_INLINE_
 
 	#define SLEEP(x) Sleep(x)
+	#define YIELD() SwitchToThread()
 
 #else // linux
 	#include <sys/time.h>
@@ -59,6 +60,7 @@
 	#include <stdint.h>   /* C99 compliant compilers: uint64_t */
 	#include <ctype.h>    /* toupper() */
 	#include <termios.h>
+	#include <sched.h>
 	
 	#define scanf _scanf  // before calling the scanf function it is necessart to change termios settings
 
@@ -66,6 +68,7 @@
 	#define		_INLINE_		__inline__ 
 
 	#define SLEEP(x) usleep(x*1000)
+	#define YIELD() sched_yield()
 #endif
 
 #ifndef max
@@ -83,17 +86,19 @@
 #define DEFAULT_CONFIG_FILE  "/usr/local/etc/WaveDemoConfig.ini"
 #define GNUPLOT_DEFAULT_PATH ""
 #define DATA_FILE_PATH ""
+#define TUNE_PROFILE_FILE "/usr/local/etc/WaveDemoTune.txt"
 #else
 #define DEFAULT_CONFIG_FILE  "WaveDemoConfig.ini"  /* local directory */
 #define GNUPLOT_DEFAULT_PATH ""
 #define DATA_FILE_PATH ""
+#define TUNE_PROFILE_FILE "WaveDemoTune.txt"  /* local directory */
 #endif
 
 #define MAX_BD  4          /* max. number of boards */
 #define MAX_GR  8          /* max. number of groups for board */
 #define MAX_CH  16         /* max. number of channels for board */
 
-#define MAX_NUM_EVENTS_BLT 1000 /* maximum number of events to read out in one Block Transfer (range from 1 to 1023) */
+#define MAX_NUM_EVENTS_BLT 1000 /* default maximum number of events to read out in one Block Transfer (range from 1 to 1023) */
 
 #define MIN_DAC_RAW_VALUE	-1.25
 #define MAX_DAC_RAW_VALUE	+1.25
@@ -118,6 +123,18 @@
 
 #define EVT_BUF_SIZE		2000   // max num event in the circular buffer
 
+#define MAX_STEP_MARKERS	1024   // max num of scan step markers in one run
+
+#define MAX_PLUGINS			8      // max num of processing plugins (PLUGIN options)
+
+#define MAX_CUT_CODE		256    // max num of instructions in the compiled event cut
+#define MAX_CUT_STACK		32     // max stack depth of the event cut evaluator
+#define MAX_CUT_TEXT		1000   // max length of the event cut source text
+
+#define MAX_EMUL_THR		32     // max num of thresholds in the threshold emulation (EMULATE_THRESHOLDS)
+
+#define MAX_CAL_PATTERNS	8      // max num of pulse patterns in the pulser calibration (CALIBRATION_PATTERNS)
+
 #define SYNC_WIN		     100   // ns
 
 #define EMAXNBITS		(1<<14)		// Max num of bits for the Charge histograms
@@ -127,9 +144,44 @@
 // #define MAX_OUTPUT_FILE_SIZE   (2147483648) // 2 GB
 #define MAX_OUTPUT_FILE_SIZE   (1073741824) // 1 GB
 
+#define WP_KERNEL_FUSED		0	// waveform processor: one pass over the samples for all the stages
+#define WP_KERNEL_SPLIT		1	// waveform processor: one pass per stage (vectorizable loops)
+
+#define TINTERP_LINEAR		0	// fine time stamp: linear interpolation between the samples of the crossing
+#define TINTERP_CUBIC		1	// fine time stamp: cubic convolution (4 samples) around the crossing
+#define TINTERP_SINC		2	// fine time stamp: windowed sinc (8 samples) around the crossing
+
+#define BSL_TRACK_NONE		0	// baseline of each waveform from its own first NS_BASELINE samples
+#define BSL_TRACK_EMA		1	// baseline tracked over the events: exponential moving average
+#define BSL_TRACK_MEDIAN	2	// baseline tracked over the events: running median
+#define MAX_BSL_TRACK_EVENTS	64	// max events in the tracked baseline (BASELINE_TRACK_EVENTS)
+
+#define IDLE_SPIN			0	// readout loop without data: poll again immediately
+#define IDLE_YIELD			1	// readout loop without data: yield the CPU
+#define IDLE_SLEEP			2	// readout loop without data: sleep 1 ms
+
+#define AUTOTUNE_DISABLED	0	// use the default settings
+#define AUTOTUNE_AUTO		1	// load the host profile; run the autotuner if there is no matching profile
+#define AUTOTUNE_FORCE		2	// always run the autotuner and update the host profile
+
+#define PIPELINE_INLINE		0	// all the pipeline stages run in the main loop
+#define PIPELINE_THREADED	1	// the readout stage runs in its own thread
+
+#define QUEUE_DROP			0	// event queues full: the oldest (inline) or the new (threaded) events are lost
+#define QUEUE_BLOCK			1	// event queues full: the readout waits for free space
+
 #define HISTO_FILE_FORMAT_1COL		0  // ascii 1 coloumn
 #define HISTO_FILE_FORMAT_2COL		1  // ascii 1 coloumn
 #define HISTO_FILE_FORMAT_ANSI42	2  // xml ANSI42
+#define HISTO_FILE_FORMAT_ARCHIVE	3  // binary archive with all the histograms (see WDHArchive.h)
+
+#define STATUS_HISTO_ENERGY			0x1	// live energy histograms in the status stream
+#define STATUS_HISTO_TIME			0x2	// live time histograms in the status stream
+
+#define EMUL_DISCR_SAME				0	// threshold emulation with the discriminator of each channel
+#define EMUL_DISCR_LED				1	// threshold emulation with the leading edge discriminator
+#define EMUL_DISCR_CFD				2	// threshold emulation with the constant fraction discriminator
+#define EMUL_DISCR_BOTH				3	// threshold emulation with LED and CFD (two points per threshold)
 
 #define TAC_SPECTRUM_COMMON_START	0
 #define TAC_SPECTRUM_INTERVALS		1
@@ -197,6 +249,10 @@ typedef enum ERROR_CODES {
 	ERR_OUTFILE_WRITE,
 	ERR_BUFFERS,
 	ERR_BOARD_TIMEOUT,
+	ERR_PLUGIN,
+	ERR_PIPELINE,
+	ERR_RAW_READ,
+	ERR_VERIFY,
 	ERR_TBD,
 
 	ERR_DUMMY_LAST
@@ -266,14 +322,18 @@ typedef struct {
 	uint64_t BusyTimeGap[MAX_BD][MAX_CH];		// Sum of the DeadTime Gaps (saturation or busy); this is a real dead time (loss of triggers); it doesn't include dead time for pile-ups
 	float BusyTime[MAX_BD][MAX_CH];				// Percent of BusyTimeGap 
 
+	uint64_t RecoveryTime[MAX_BD];				// Time spent in the recovery of the board after readout errors (ns); dead time of all its channels
+	uint64_t PrevRecoveryTime[MAX_BD];			// Previous value of RecoveryTime (used to calculate the dead time)
+	uint32_t Recovery_cnt;						// Number of recoveries after readout errors (see WDRecovery.h)
+
 	uint64_t TotEvRead_cnt;						// Total Event read from the boards (sum of all channels)
 	uint64_t UnSyncEv_cnt;
 
 	// Times
-	uint64_t StartTime;							// Computer time at the start of the acquisition in ms
-	uint64_t LastUpdateTime;					// Computer time at the last statistics update
-	float AcqRealTime;							// Acquisition time (from the start) in ms
-	float AcqStopTime;							// Acquisition Stop time (from the start) in ms
+	int64_t StartTime;							// Host clock at the start of the acquisition in ns (see WDClock.h)
+	int64_t LastUpdateTime;						// Host clock at the last statistics update in ns
+	int64_t AcqRealTime;						// Acquisition time (from the start) in ns
+	int64_t AcqStopTime;						// Acquisition Stop time (from the start) in ns
 	int RealTimeSource;							// 0: real time from the time stamps; 1: real time from the computer
 	char AcqStartTimeString[32];				// Start Time in the format %Y-%m-%d %H:%M:%S
 	char AcqStopTimeString[32];					// Start Time in the format %Y-%m-%d %H:%M:%S
@@ -332,6 +392,53 @@ typedef struct {
 	Histogram1D_t TH[MAX_BD][MAX_CH];	    // Time Histograms 
 }  WaveDemoHistos_t;
 
+//****************************************************************************
+// Scan step marker (condition change injected by the control side during a continuous acquisition)
+//****************************************************************************
+typedef struct {
+	int StepId;					// Scan step id (0 = data before the first marker)
+	int Settling;				// 1 = conditions are settling (data to be excluded afterwards)
+	int HasHV;					// HVset/HVmon are valid
+	float HVset;				// HV set value (V)
+	float HVmon;				// HV readback (V)
+	int HasThreshold;			// Threshold is valid (applied to all the enabled channels)
+	float Threshold;			// Trigger threshold (V)
+	uint64_t HostTime;			// Host time when the marker was received (ms since epoch)
+	uint64_t BoardTime[MAX_BD];	// Board time (ns) of the newest event read from each board when the marker was received
+	char Label[64];				// Free text label
+} WaveDemoMarker_t;
+
+//****************************************************************************
+// Discontinuity of the data after the recovery of a board (see WDRecovery.h)
+//****************************************************************************
+typedef struct {
+	int Board;					// board that failed
+	int AllBoards;				// 1 = all the boards were restarted (synchronized boards)
+	int Attempts;				// attempts needed to recover the board
+	uint64_t HostTime;			// Host time when the error was detected (ms since epoch)
+	uint64_t BoardTime;			// Board time (ns) where the data resume (the time stamps are shifted by the recovery)
+	uint64_t DeadTime;			// Duration of the recovery (ms)
+	char Reason[64];			// Error that caused the recovery
+} WaveDemoDiscontinuity_t;
+
+//****************************************************************************
+// Event cut compiled from the CUT expressions of the config file (see WDCuts.h)
+//****************************************************************************
+typedef struct {
+	uint8_t Op;					// opcode (CUT_OP_xxx)
+	uint8_t Field;				// field of CUT_OP_FIELD (CUT_FIELD_xxx)
+	uint8_t Board;				// board of CUT_OP_FIELD (CUT_CURRENT = board of the channel being processed)
+	uint8_t Channel;			// channel of CUT_OP_FIELD (CUT_CURRENT = channel being processed)
+	double Value;				// constant of CUT_OP_CONST
+} WaveDemoCutInstr_t;
+
+typedef struct {
+	int Ncode;					// number of instructions (0 = no cut, all events pass)
+	int StackDepth;				// max stack depth required by the code
+	WaveDemoCutInstr_t Code[MAX_CUT_CODE];
+	char Text[MAX_CUT_TEXT];	// source text (CUT lines joined with &&)
+} WaveDemoCut_t;
+
 typedef struct {
 	float Baseline;				// Baseline (ADC counts)
 	float FineTimeStamp;		// Fine time stamp (in ns)
@@ -343,13 +450,16 @@ typedef struct {
 	CAEN_DGTZ_EventInfo_t EventInfo;
 	CAEN_DGTZ_X743_EVENT_t *Event;
 	WaveDemo_EVENT_plus_t EventPlus[MAX_V1743_GROUP_SIZE][MAX_X743_CHANNELS_X_GROUP];
+	uint64_t ReadTime;			// host monotonic time (us) when the event was read (see WDLatency.h)
 } WaveDemoEvent_t;
 
 typedef struct {
 	WaveDemoEvent_t *buffer[MAX_BD];
-	int head[MAX_BD];
-	int tail[MAX_BD];
+	volatile int head[MAX_BD];		// written by the readout stage (producer)
+	volatile int tail[MAX_BD];		// written by the processing stage (consumer)
+	volatile int release[MAX_BD];	// slots before release can be overwritten (= tail unless Hold)
 	int tmp_pos[MAX_BD];
+	int Hold;						// 1 = removed events stay valid until WDBuff_release (see WDPipeline.h)
 } WaveDemoBuffers_t;
 
 typedef struct {
@@ -378,6 +488,11 @@ typedef struct {
 	float CFDatten;			// CFD attenuation (between 0.0 and 1.0)
 	int CFDThreshold;
 	int TTFsmoothing;		// Smoothing factor in the trigger and timing filter (0 = disable)
+	int TimeInterp;			// interpolation of the discriminator crossing (TINTERP_xxx)
+	int BslTrack;			// baseline tracking over the events (BSL_TRACK_xxx)
+	int BslTrackEvents;		// events in the tracked baseline (EMA time constant or median window)
+	float BslTrackTol_V;	// max difference between the baseline of an event and the tracked one (in V)
+	float BslTrackTol_adc;	// same in ADC counts
 
 	float EnergyCoarseGain;	// Energy Coarse Gain (requested by the user); can be a power of two (1, 2, 4, 8...) or a fraction (0.5, 0.25, 0.125...)
 	float ECalibration_m;	// Energy Calibration slope (y=mx+q)
@@ -421,6 +536,8 @@ typedef struct {
 	uint32_t AllocatedSize, BufferSize, NumEvents;
 	int Nb, Ne;
 	WaveDemoEvent_t* RefEvent;
+	uint64_t TDCOffset;		// added to the time stamps of the board after a recovery (see WDRecovery.h)
+	uint64_t ReadTime;		// host monotonic time (us) of the last readout (see WDLatency.h)
 } WaveDemoBoardHandle_t;
 
 typedef struct {
@@ -460,7 +577,7 @@ typedef struct {
 	int OutFileFormat;				// 0=BINARY or 1=ASCII (only for list and waveforms files; raw data files are always binary)
 	int OutFileHeader;				// 0=NO or 1=YES
 	int OutFileTimeStampUnit;		// 0=ps, 1=ns, 2=us, 3=ms, 4=s
-	int HistoOutputFormat;			// 0=ASCII 1 column, 1= ASCII 2 column, 2=ANSI42
+	int HistoOutputFormat;			// 0=ASCII 1 column, 1= ASCII 2 column, 2=ANSI42, 3=binary archive
 	int ConfirmFileOverwrite;		// ask before overwriting output data file
 									// Run Number (used in output file names)
 	int RunNumber;					// Run Number (can be a number or timestamp)
@@ -483,6 +600,48 @@ typedef struct {
 	int BatchMode;          // 0=interactive (default), 1=batch with visualization, 2=batch without visualization
 	uint64_t BatchMaxEvents; // Maximum number of events to record (0=unlimited)
 	uint64_t BatchMaxTime;   // Maximum time in seconds (0=unlimited)
+
+	// Host tuning (see WDAutotune.h)
+	int Autotune;				// AUTOTUNE_DISABLED, AUTOTUNE_AUTO or AUTOTUNE_FORCE
+	char TuneProfileFile[500];	// per-host profile with the autotuner results
+	int WPKernel;				// waveform processor kernel variant (WP_KERNEL_xxx)
+	int MaxNumEventsBLT;		// max number of events in one block transfer
+	int WriteBufferSize;		// buffer size of the output files in bytes (0=C library default)
+	int IdleStrategy;			// what the readout loop does when no data is available (IDLE_xxx)
+
+	// Pipeline runtime (see WDPipeline.h)
+	int PipelineMode;			// PIPELINE_INLINE or PIPELINE_THREADED
+	int QueuePolicy;			// QUEUE_DROP or QUEUE_BLOCK: what the readout does when the event queues are full
+	int PluginThreads;			// threads of the plugin stage
+	float ProcessBudget;		// time budget of one processing slice in ms (0 = all the queued events)
+
+	// Event latency (see WDLatency.h)
+	int LatencyTracking;		// 1 = latency of the events from the trigger to the outputs
+
+	// Status stream (see WDStatus.h)
+	int StatusHistograms;		// STATUS_HISTO_xxx mask: histograms sent as deltas with the statistics
+
+	// Offline reprocessing (see WDWPCache.h)
+	int WPCache;				// 1 = results of the waveform processor cached next to the raw data file
+	int NumEmulThresholds;		// thresholds emulated in the reprocessing (see WDThrEmul.h); 0 = disabled
+	float EmulThresholds[MAX_EMUL_THR];	// emulated trigger thresholds (V)
+	int EmulDiscr;				// EMUL_DISCR_xxx: discriminators emulated for each threshold
+
+	// Pulser calibration (see WDCalib.h)
+	int CalEvents;				// pulser events per channel at each pattern (--calibrate)
+	int NumCalPatterns;			// pulse patterns of the calibration sweep
+	unsigned short CalPatterns[MAX_CAL_PATTERNS];
+	char CalibrationFile[500];	// calibration table applied by the processing ("" = none)
+
+	// Readout recovery (see WDRecovery.h)
+	int RecoveryAttempts;		// attempts to reopen a board after a readout error (0 = the errors stop the program)
+
+	// Event selection (see WDCuts.h)
+	WaveDemoCut_t Cut;			// compiled CUT expression; events that fail it are not counted, histogrammed or saved
+
+	// Processing plugins (see WDPluginAPI.h)
+	int NumPlugins;
+	char Plugins[MAX_PLUGINS][500];	// library path (can be quoted) followed by the plugin arguments
 } WaveDemoConfig_t;
 
 typedef struct {
@@ -524,10 +683,12 @@ typedef struct {
 	int Restart;
 	FILE *flist_merged;
 	FILE *OutputDataFile;
+	FILE *fmarkers;		// scan step markers file
 
 	// Batch mode runtime variables
-	uint64_t BatchStartTime;    // Start time for batch mode in ms
+	int64_t BatchStartTime;     // Host clock at the start of batch mode in ns (see WDClock.h)
 	uint64_t BatchEventsTotal;  // Total events processed in batch mode
+	int Calibration;			// 1 = pulser calibration run (--calibrate, see WDCalib.h)
 } WaveDemoRun_t;
 
 //****************************************************************************
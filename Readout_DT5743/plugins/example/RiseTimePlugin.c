@@ -0,0 +1,104 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+* -----------------------------------------------------------------------------
+* Example of processing plugin: 10%-90% rise time and peak amplitude of the
+* pulses (negative polarity), written as output columns and histogrammed.
+*
+* Build (only WDPluginAPI.h is needed):
+*   Linux:   gcc -O2 -shared -fPIC -I../../include RiseTimePlugin.c -o RiseTimePlugin.so
+*   Windows: cl /O2 /LD /I..\..\include RiseTimePlugin.c
+* Config file ([OPTIONS] section):
+*   PLUGIN = ./RiseTimePlugin.so 30        (optional argument: histogram range in ns)
+******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "WDPluginAPI.h"
+
+typedef struct {
+	WDPluginHost_t *host;
+	int col_rise, col_amp;
+	int h_rise;
+} RiseTime_t;
+
+static int Init(WDPluginHost_t *host, void **ctx)
+{
+	RiseTime_t *rt = (RiseTime_t *)calloc(1, sizeof(RiseTime_t));
+	double range = (host->Args != NULL && host->Args[0] != '\0') ? atof(host->Args) : 20.0;
+
+	if (rt == NULL || range <= 0)
+		return -1;
+	rt->host = host;
+	rt->col_rise = host->AddColumn(host, "RiseTime (ns)");
+	rt->col_amp = host->AddColumn(host, "Amplitude (adc)");
+	rt->h_rise = host->AddHistogram(host, "RiseTime", 1024, 0, range);
+	if (rt->col_rise < 0 || rt->col_amp < 0 || rt->h_rise < 0) {
+		free(rt);
+		return -1;
+	}
+	*ctx = rt;
+	return 0;
+}
+
+static int ProcessBatch(void *ctx, void *tstate, const WDPluginBatch_t *batch)
+{
+	RiseTime_t *rt = (RiseTime_t *)ctx;
+	(void)tstate;
+
+	for (int i = 0; i < batch->NumEvents; i++) {
+		const float *s = batch->Samples[i];
+		float bsl = batch->Results[i].Baseline;
+		int imin = 0, i10, i90;
+
+		if (s == NULL || !batch->Results[i].Selected)
+			continue;
+		for (int k = 1; k < batch->RecordLength; k++)
+			if (s[k] < s[imin])
+				imin = k;
+		float amp = bsl - s[imin];
+		if (amp <= 0)
+			continue;
+		// walk back from the peak to the 90% and 10% crossings
+		for (i90 = imin; i90 > 0 && bsl - s[i90] > 0.9f * amp; i90--);
+		for (i10 = i90; i10 > 0 && bsl - s[i10] > 0.1f * amp; i10--);
+		double rise = (i90 - i10) * batch->SamplingPeriod;
+
+		batch->Columns[i * batch->NumColumns + rt->col_rise] = rise;
+		batch->Columns[i * batch->NumColumns + rt->col_amp] = amp;
+		rt->host->Fill(rt->host, rt->h_rise, batch->Board, batch->Channel, rise);
+	}
+	return 0;
+}
+
+static void Exit(void *ctx)
+{
+	free(ctx);
+}
+
+static const WDPlugin_t Descriptor = {
+	WD_PLUGIN_API_VERSION,
+	"RiseTime",
+	Init,
+	NULL,			// ThreadInit: no per-thread state
+	NULL,			// ThreadExit
+	NULL,			// StartRun
+	NULL,			// StopRun
+	ProcessBatch,
+	Exit
+};
+
+WD_PLUGIN_EXPORT const WDPlugin_t *WDPluginEntry(void)
+{
+	return &Descriptor;
+}
@@ -0,0 +1,442 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDAutotune.h"
+#include "WDClock.h"
+#include "WDLogs.h"
+#include "WDWaveformProcess.h"
+
+#define MAX_PROFILE_LINES	256
+
+static const int BltSizes[] = { 32, 64, 128, 256, 512, 1000 };
+static const int WriteBufferSizes[] = { 0, 64 * 1024, 256 * 1024, 1024 * 1024 };
+static const char *KernelNames[] = { "fused", "split" };
+static const char *IdleNames[] = { "spin", "yield", "sleep" };
+
+static int TuneBd[MAX_BD * MAX_CH];		// enabled channels (board index)
+static int TuneCh[MAX_BD * MAX_CH];		// enabled channels (channel index)
+static int TuneNch = 0;					// number of enabled channels
+static float *TuneWaves = NULL;			// synthetic waveforms (TUNE_NUM_WAVES per enabled channel)
+static int TuneNs = 0;					// samples per waveform
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: name of this host (no spaces, used as key in the profile file)
+// ---------------------------------------------------------------------------------------------------------
+static void GetHostName(char *name, int size)
+{
+#ifdef WIN32
+	DWORD len = size;
+	if (!GetComputerNameA(name, &len))
+		strcpy(name, "unknown");
+#else
+	if (gethostname(name, size) != 0)
+		strcpy(name, "unknown");
+	name[size - 1] = '\0';
+#endif
+	for (char *c = name; *c; c++)
+		if (isspace((unsigned char)*c))
+			*c = '_';
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the list of the enabled channels
+// Return:		number of enabled channels
+// ---------------------------------------------------------------------------------------------------------
+static int GetEnabledChannels()
+{
+	TuneNch = 0;
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (WDcfg.boards[b].channels[ch].ChannelEnable) {
+				TuneBd[TuneNch] = b;
+				TuneCh[TuneNch] = ch;
+				TuneNch++;
+			}
+		}
+	}
+	return TuneNch;
+}
+
+static uint32_t NextRandom(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: generate the synthetic waveforms: baseline with noise and one pulse (with the configured
+//				polarity and above the trigger threshold) at a random position
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int MakeSyntheticWaves()
+{
+	uint32_t seed = 12345;
+
+	TuneNs = WDcfg.GlobalRecordLength;
+	TuneWaves = (float *)malloc((size_t)TuneNch * TUNE_NUM_WAVES * TuneNs * sizeof(float));
+	if (TuneWaves == NULL)
+		return -1;
+
+	for (int k = 0; k < TuneNch; k++) {
+		WaveDemoBoard_t *WDb = &WDcfg.boards[TuneBd[k]];
+		WaveDemoChannel_t *WDc = &WDb->channels[TuneCh[k]];
+		const float base = (WDb->CorrectionLevel == 0 || WDb->CorrectionLevel == 2) ? 2048.0f : 0.0f;
+		const float dir = (WDc->PulsePolarity == CAEN_DGTZ_PulsePolarityPositive) ? 1.0f : -1.0f;
+		const float amp0 = 2 * fabsf(1485 * WDc->TriggerThreshold_V) + 100;
+
+		for (int w = 0; w < TUNE_NUM_WAVES; w++) {
+			float *wave = TuneWaves + ((size_t)k * TUNE_NUM_WAVES + w) * TuneNs;
+			int pos = TuneNs / 5 + (int)(NextRandom(&seed) % (uint32_t)(2 * TuneNs / 5 + 1));
+			float amp = amp0 * (0.5f + (NextRandom(&seed) % 1000) / 1000.0f);
+			for (int i = 0; i < TuneNs; i++) {
+				float v = base + (float)((int)(NextRandom(&seed) % 5) - 2);
+				if (i >= pos)
+					v += dir * amp * (expf(-(i - pos) / 10.0f) - expf(-(i - pos) / 2.0f));
+				wave[i] = v;
+			}
+		}
+	}
+	return 0;
+}
+
+static int AllocateTuneWaveform(Waveform_t *wfm, int ns)
+{
+	memset(wfm, 0, sizeof(Waveform_t));
+	wfm->Ns = ns;
+	for (int a = 0; a < NUM_ATRACE; a++) {
+		wfm->AnalogTrace[a] = (float *)malloc(ns * sizeof(float));
+		if (wfm->AnalogTrace[a] == NULL)
+			return -1;
+	}
+	wfm->DigitalTraces = (uint8_t *)malloc(ns * sizeof(uint8_t));
+	return (wfm->DigitalTraces == NULL) ? -1 : 0;
+}
+
+static void FreeTuneWaveform(Waveform_t *wfm)
+{
+	for (int a = 0; a < NUM_ATRACE; a++)
+		free(wfm->AnalogTrace[a]);
+	free(wfm->DigitalTraces);
+	memset(wfm, 0, sizeof(Waveform_t));
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: process rate of one kernel variant on the synthetic waveforms
+// Outputs:		Checksum = sum of the results of one pass over all the waveforms
+// Return:		waveforms per second
+// ---------------------------------------------------------------------------------------------------------
+static double TimeKernel(int Kernel, Waveform_t *wfm, double *Checksum)
+{
+	double r, sum = 0;
+	uint64_t n = 0;
+	int64_t t0, t;
+
+	for (int k = 0; k < TuneNch; k++) {
+		for (int w = 0; w < TUNE_NUM_WAVES; w++) {
+			WaveformProcessKernel(Kernel, TuneBd[k], TuneCh[k], TuneNs, TuneWaves + ((size_t)k * TUNE_NUM_WAVES + w) * TuneNs, wfm, &r);
+			sum += r;
+		}
+	}
+	*Checksum = sum;
+
+	t0 = HostClockNs();
+	do {
+		for (int k = 0; k < TuneNch; k++) {
+			for (int w = 0; w < TUNE_NUM_WAVES; w++)
+				WaveformProcessKernel(Kernel, TuneBd[k], TuneCh[k], TuneNs, TuneWaves + ((size_t)k * TUNE_NUM_WAVES + w) * TuneNs, wfm, &r);
+			n += TUNE_NUM_WAVES;
+		}
+		t = HostClockNs() - t0;
+	} while (t < TUNE_MIN_TIME * NS_PER_MS);
+	return n * (double)NS_PER_S / t;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: event rate of the host side handling of one block transfer: copy of the block (as the
+//				readout buffer decoding does) and processing of all the events in the block. The link
+//				overhead per transfer can't be measured without the board: it favours larger blocks.
+// Inputs:		BlockSize = events per block
+//				Block, Src = buffers of BlockSize events
+// Return:		events per second
+// ---------------------------------------------------------------------------------------------------------
+static double TimeBlock(int BlockSize, float *Block, const float *Src, Waveform_t *wfm)
+{
+	const size_t EventSize = (size_t)TuneNch * TuneNs;
+	double r;
+	uint64_t n = 0;
+	int64_t t0, t;
+
+	t0 = HostClockNs();
+	do {
+		memcpy(Block, Src, BlockSize * EventSize * sizeof(float));
+		for (int e = 0; e < BlockSize; e++)
+			for (int k = 0; k < TuneNch; k++)
+				WaveformProcessKernel(WDcfg.WPKernel, TuneBd[k], TuneCh[k], TuneNs, Block + e * EventSize + (size_t)k * TuneNs, wfm, &r);
+		n += BlockSize;
+		t = HostClockNs() - t0;
+	} while (t < TUNE_MIN_TIME * NS_PER_MS);
+	return n * (double)NS_PER_S / t;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write rate of the ASCII waveform output (SaveWaveform format) with a given buffer size
+// Inputs:		BufferSize = output buffer size in bytes (0 = C library default)
+// Return:		MB per second, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static double TimeWriter(int BufferSize)
+{
+	char fname[300];
+	FILE *f;
+	int64_t t0, t;
+	long size;
+
+	sprintf(fname, "%sautotune.tmp", WDcfg.DataFilePath);
+	t0 = HostClockNs();
+	f = fopen(fname, "w");
+	if (f == NULL)
+		return -1;
+	if (BufferSize > 0)
+		setvbuf(f, NULL, _IOFBF, BufferSize);
+	for (int w = 0; ftell(f) < TUNE_FILE_SIZE; w = (w + 1) % TUNE_NUM_WAVES) {
+		const float *wave = TuneWaves + (size_t)w * TuneNs;
+		fprintf(f, "%lld %.3f %.3f %d\t", (long long)w * 1000, 12.345f, 6789.0f, TuneNs);
+		for (int i = 0; i < TuneNs; i++)
+			fprintf(f, "%d ", (int16_t)(wave[i]));
+		fprintf(f, "\n");
+	}
+	size = ftell(f);
+	fclose(f);
+	t = HostClockNs() - t0;
+	remove(fname);
+	return (double)size / (1024 * 1024) * NS_PER_S / (t > 0 ? t : 1);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: choose the idle strategy from the actual length of a 1 ms sleep on this host
+// Outputs:		SleepTime = average length of SLEEP(1) in ms
+// ---------------------------------------------------------------------------------------------------------
+static int ChooseIdleStrategy(double *SleepTime)
+{
+	int64_t t0 = HostClockNs();
+	for (int i = 0; i < 20; i++)
+		SLEEP(1);
+	*SleepTime = (double)(HostClockNs() - t0) / NS_PER_MS / 20.0;
+	// a coarse scheduler tick (e.g. 15.6 ms) would let the board buffers fill up while sleeping
+	return (*SleepTime <= 2.0) ? IDLE_SLEEP : IDLE_YIELD;
+}
+
+int RunAutotune()
+{
+	Waveform_t wfm;
+	double rate, best, ref_sum, sum;
+	int i, ret = 0;
+	// settings in use before the benchmarks (kept if the autotuner fails)
+	const int Kernel0 = WDcfg.WPKernel, Blt0 = WDcfg.MaxNumEventsBLT, WriteBuf0 = WDcfg.WriteBufferSize, Idle0 = WDcfg.IdleStrategy;
+
+	if (GetEnabledChannels() == 0) {
+		msg_printf(MsgLog, "WARN: Autotune: no enabled channels\n");
+		return -1;
+	}
+	printf("*** Autotuning the host settings (%d channels, %d samples)...\n", TuneNch, WDcfg.GlobalRecordLength);
+	msg_printf(MsgLog, "INFO: Autotune: %d channels, record length %d\n", TuneNch, WDcfg.GlobalRecordLength);
+	if (InitWaveProcess() < 0 || MakeSyntheticWaves() < 0 || AllocateTuneWaveform(&wfm, TuneNs) < 0) {
+		msg_printf(MsgLog, "WARN: Autotune: can't allocate the synthetic waveforms\n");
+		ret = -1;
+		goto Done;
+	}
+
+	// Waveform processor kernel (the variants must give the same results)
+	if (WDcfg.WaveformProcessor) {
+		best = TimeKernel(WP_KERNEL_FUSED, &wfm, &ref_sum);
+		WDcfg.WPKernel = WP_KERNEL_FUSED;
+		msg_printf(MsgLog, "INFO: Autotune: kernel %s = %.0f wfm/s\n", KernelNames[WP_KERNEL_FUSED], best);
+		rate = TimeKernel(WP_KERNEL_SPLIT, &wfm, &sum);
+		msg_printf(MsgLog, "INFO: Autotune: kernel %s = %.0f wfm/s\n", KernelNames[WP_KERNEL_SPLIT], rate);
+		if (sum != ref_sum)
+			msg_printf(MsgLog, "WARN: Autotune: kernel %s gives different results; not used\n", KernelNames[WP_KERNEL_SPLIT]);
+		else if (rate > best)
+			WDcfg.WPKernel = WP_KERNEL_SPLIT;
+	}
+
+	// Events per block transfer
+	{
+		const int nblt = sizeof(BltSizes) / sizeof(BltSizes[0]);
+		const size_t EventSize = (size_t)TuneNch * TuneNs;
+		const int MaxBlock = BltSizes[nblt - 1];
+		double rates[sizeof(BltSizes) / sizeof(BltSizes[0])];
+		float *Src = (float *)malloc(MaxBlock * EventSize * sizeof(float));
+		float *Block = (float *)malloc(MaxBlock * EventSize * sizeof(float));
+		if (Src != NULL && Block != NULL) {
+			for (int e = 0; e < MaxBlock; e++)
+				for (int k = 0; k < TuneNch; k++)
+					memcpy(Src + e * EventSize + (size_t)k * TuneNs, TuneWaves + ((size_t)k * TUNE_NUM_WAVES + e % TUNE_NUM_WAVES) * TuneNs, TuneNs * sizeof(float));
+			best = 0;
+			for (i = 0; i < nblt; i++) {
+				rates[i] = TimeBlock(BltSizes[i], Block, Src, &wfm);
+				best = max(best, rates[i]);
+				msg_printf(MsgLog, "INFO: Autotune: BLT %4d events = %.0f ev/s\n", BltSizes[i], rates[i]);
+			}
+			for (i = 0; i < nblt; i++)
+				if (rates[i] >= best * (1 - TUNE_BLT_TOLERANCE))
+					WDcfg.MaxNumEventsBLT = BltSizes[i];
+		}
+		else {
+			msg_printf(MsgLog, "WARN: Autotune: can't allocate the block buffers; BLT size not tuned\n");
+		}
+		free(Src);
+		free(Block);
+	}
+
+	// Output file buffer
+	best = 0;
+	for (i = 0; i < (int)(sizeof(WriteBufferSizes) / sizeof(WriteBufferSizes[0])); i++) {
+		rate = TimeWriter(WriteBufferSizes[i]);
+		if (rate < 0) {
+			msg_printf(MsgLog, "WARN: Autotune: can't write in %s; output buffer not tuned\n", WDcfg.DataFilePath);
+			break;
+		}
+		msg_printf(MsgLog, "INFO: Autotune: output buffer %7d bytes = %.1f MB/s\n", WriteBufferSizes[i], rate);
+		if (rate > best * 1.02) {  // larger buffers only if they are faster
+			best = rate;
+			WDcfg.WriteBufferSize = WriteBufferSizes[i];
+		}
+	}
+
+	// Idle strategy
+	WDcfg.IdleStrategy = ChooseIdleStrategy(&rate);
+	msg_printf(MsgLog, "INFO: Autotune: SLEEP(1) = %.1f ms\n", rate);
+
+	FreeTuneWaveform(&wfm);
+
+Done:
+	free(TuneWaves);
+	TuneWaves = NULL;
+	if (ret == 0) {
+		msg_printf(MsgLog, "INFO: Autotune result: kernel=%s BLT=%d write_buffer=%d idle=%s\n", KernelNames[WDcfg.WPKernel],
+			WDcfg.MaxNumEventsBLT, WDcfg.WriteBufferSize, IdleNames[WDcfg.IdleStrategy]);
+		printf("*** Autotune: kernel=%s BLT=%d write_buffer=%d idle=%s\n", KernelNames[WDcfg.WPKernel],
+			WDcfg.MaxNumEventsBLT, WDcfg.WriteBufferSize, IdleNames[WDcfg.IdleStrategy]);
+		ret = SaveTuneProfile();
+	}
+	if (ret < 0) {
+		// the tuned values are applied only together with a valid profile
+		WDcfg.WPKernel = Kernel0;
+		WDcfg.MaxNumEventsBLT = Blt0;
+		WDcfg.WriteBufferSize = WriteBuf0;
+		WDcfg.IdleStrategy = Idle0;
+		msg_printf(MsgLog, "WARN: Autotune failed; host settings not changed\n");
+	}
+	return ret;
+}
+
+int LoadTuneProfile()
+{
+	char line[512], host[64], phost[64];
+	int rl, nch, kernel, blt, wbuf, idle;
+	FILE *f;
+
+	f = fopen(WDcfg.TuneProfileFile, "r");
+	if (f == NULL)
+		return 0;
+	GetHostName(host, sizeof(host));
+	GetEnabledChannels();
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s %d %d %d %d %d %d", phost, &rl, &nch, &kernel, &blt, &wbuf, &idle) != 7)
+			continue;
+		if (strcmp(phost, host) != 0 || rl != WDcfg.GlobalRecordLength || nch != TuneNch)
+			continue;
+		fclose(f);
+		WDcfg.WPKernel = coerce(kernel, WP_KERNEL_FUSED, WP_KERNEL_SPLIT);
+		WDcfg.MaxNumEventsBLT = coerce(blt, 1, 1023);
+		WDcfg.WriteBufferSize = max(wbuf, 0);
+		WDcfg.IdleStrategy = coerce(idle, IDLE_SPIN, IDLE_SLEEP);
+		return 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+int SaveTuneProfile()
+{
+	static char lines[MAX_PROFILE_LINES][512];
+	char line[512], host[64], phost[64], date[32];
+	int rl, nch, nlines = 0;
+	time_t timer;
+	FILE *f;
+
+	GetHostName(host, sizeof(host));
+	GetEnabledChannels();
+
+	// keep the lines of the other hosts and setups
+	f = fopen(WDcfg.TuneProfileFile, "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL && nlines < MAX_PROFILE_LINES) {
+			if (line[0] == '#' || sscanf(line, "%63s %d %d", phost, &rl, &nch) != 3)
+				continue;
+			if (strcmp(phost, host) == 0 && rl == WDcfg.GlobalRecordLength && nch == TuneNch)
+				continue;
+			strcpy(lines[nlines++], line);
+		}
+		fclose(f);
+	}
+
+	f = fopen(WDcfg.TuneProfileFile, "w");
+	if (f == NULL) {
+		msg_printf(MsgLog, "WARN: Can't write the tuning profile %s\n", WDcfg.TuneProfileFile);
+		return -1;
+	}
+	time(&timer);
+	strftime(date, sizeof(date), "%Y-%m-%d_%H-%M-%S", localtime(&timer));
+	fprintf(f, "# WaveDemo host tuning profile (written by the autotuner)\n");
+	fprintf(f, "# Host RecordLength Channels Kernel(0=fused,1=split) BLT WriteBuffer Idle(0=spin,1=yield,2=sleep) Date\n");
+	for (int i = 0; i < nlines; i++)
+		fputs(lines[i], f);
+	fprintf(f, "%s %d %d %d %d %d %d %s\n", host, WDcfg.GlobalRecordLength, TuneNch, WDcfg.WPKernel,
+		WDcfg.MaxNumEventsBLT, WDcfg.WriteBufferSize, WDcfg.IdleStrategy, date);
+	fclose(f);
+	msg_printf(MsgLog, "INFO: Tuning profile saved -> %s\n", WDcfg.TuneProfileFile);
+	return 0;
+}
+
+int SetupHostTuning(int Force)
+{
+	static int Tuned = 0;	// the autotuner already ran in this process (a restart reloads the profile)
+	int mode = Force ? AUTOTUNE_FORCE : WDcfg.Autotune;
+	int ret;
+
+	if (mode == AUTOTUNE_DISABLED)
+		return 0;
+	if (mode == AUTOTUNE_FORCE && !Tuned) {
+		Tuned = 1;
+		return RunAutotune();
+	}
+	ret = LoadTuneProfile();
+	if (ret > 0) {
+		msg_printf(MsgLog, "INFO: Tuning profile loaded from %s: kernel=%s BLT=%d write_buffer=%d idle=%s\n", WDcfg.TuneProfileFile,
+			KernelNames[WDcfg.WPKernel], WDcfg.MaxNumEventsBLT, WDcfg.WriteBufferSize, IdleNames[WDcfg.IdleStrategy]);
+		return 0;
+	}
+	if (Tuned)
+		return -1;
+	// first start on this host (or new setup): run the autotuner
+	Tuned = 1;
+	return RunAutotune();
+}
@@ -28,6 +28,7 @@ int WDBuff_reset(WaveDemoBuffers_t *buff, int bd) {
 		return -1;
 	buff->head[bd] = 0;
 	buff->tail[bd] = 0;
+	buff->release[bd] = 0;
 	buff->tmp_pos[bd] = 0;
 	return 0;
 }
@@ -41,23 +42,26 @@ int WDBuff_full(WaveDemoBuffers_t *buff, int bd) {
 	// We determine "full" case by head being one position behind the tail
 	// Note that this means we are wasting one space in the buffer!
 	// Instead, you could have an "empty" flag and determine buffer full that way
-	return ((buff->head[bd] + 1) % EVT_BUF_SIZE) == buff->tail[bd] ? 1  : 0;
+	// The slots of the events removed but not yet released (Hold) are not free
+	return ((buff->head[bd] + 1) % EVT_BUF_SIZE) == buff->release[bd] ? 1  : 0;
 }
 
 int WDBuff_free_space(WaveDemoBuffers_t *buff, int bd) {
-	if (WDBuff_full(buff, bd))
-		return 0;
-	if (buff->head[bd] >= buff->tail[bd])
-		return EVT_BUF_SIZE - 1 - (buff->head[bd] - buff->tail[bd]);
+	int head = buff->head[bd];
+	int release = buff->release[bd];
+	if (head >= release)
+		return EVT_BUF_SIZE - 1 - (head - release);
 	else
-		return buff->tail[bd] - buff->head[bd] - 1;
+		return release - head - 1;
 }
 
 int WDBuff_used_space(WaveDemoBuffers_t *buff, int bd) {
-	if (buff->head[bd] >= buff->tail[bd])
-		return buff->head[bd] - buff->tail[bd];
+	int head = buff->head[bd];
+	int tail = buff->tail[bd];
+	if (head >= tail)
+		return head - tail;
 	else
-		return EVT_BUF_SIZE - buff->tail[bd] + buff->head[bd];
+		return EVT_BUF_SIZE - tail + head;
 }
 
 float WDBuff_occupancy(WaveDemoBuffers_t *buff, int bd) {
@@ -69,14 +73,26 @@ int WDBuff_remove(WaveDemoBuffers_t *buff, int bd, int num) {
 	int i = 0;
 	if (!buff->buffer[bd] || num < 0)
 		return -1;
+	// the consumer is done with the events before the producer can see the slots free
+	MEMORY_BARRIER();
 	for (i = 0; i < num; i++) {
 		if (WDBuff_empty(buff, bd))
 			break;
 		buff->tail[bd] = (buff->tail[bd] + 1) % EVT_BUF_SIZE;
 	}
+	if (!buff->Hold)
+		buff->release[bd] = buff->tail[bd];
 	return i;
 }
 
+int WDBuff_release(WaveDemoBuffers_t *buff, int bd) {
+	if (!buff->buffer[bd])
+		return -1;
+	MEMORY_BARRIER();
+	buff->release[bd] = buff->tail[bd];
+	return 0;
+}
+
 int WDBuff_get_write_pointer(WaveDemoBuffers_t *buff, int bd, WaveDemoEvent_t** event) {
 	if (!buff->buffer[bd] || WDBuff_full(buff, bd))
 		return -1;
@@ -89,6 +105,8 @@ int WDBuff_added(WaveDemoBuffers_t *buff, int bd, int num) {
 	int i = 0;
 	if (!buff->buffer[bd] || num < 0)
 		return -1;
+	// the events are written before the consumer can see them
+	MEMORY_BARRIER();
 	for (i = 0; i < num; i++) {
 		if (WDBuff_full(buff, bd))
 			break;
@@ -0,0 +1,475 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDCalib.h"
+#include "WDFiles.h"
+#include "WDLogs.h"
+#include "WDStatus.h"
+#include "WDWaveformProcess.h"
+
+// Accumulators of one channel at one pattern
+typedef struct {
+	uint64_t N;						// events
+	double ESum;					// sum of the energies (ADC counts)
+	uint64_t NT;					// events with the TOF start channel in coincidence
+	double TSum, T2Sum;				// time - time of the TOF start channel (ns)
+} CalAcc_t;
+
+// One line of the calibration table
+typedef struct {
+	int Valid;
+	float TimeOffset;				// ns, relative to the TOF start channel of the calibration run
+	float TimeRms;					// ns
+	float GainM, GainQ;				// E_ref = GainM * E + GainQ
+	int Patterns;					// patterns in the gain fit
+	uint64_t Events;
+} CalEntry_t;
+
+static CalAcc_t Acc[MAX_CAL_PATTERNS][MAX_BD][MAX_CH];
+static CalEntry_t Table[MAX_BD][MAX_CH];
+static int Step = 0;
+
+// constants applied by the processing (LoadCalibration)
+static int Applied = 0;
+static float GainM[MAX_BD][MAX_CH], GainQ[MAX_BD][MAX_CH], TimeCorr[MAX_BD][MAX_CH];
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+static int ChannelInUse(int b, int ch)
+{
+	return ch < WDcfg.handles[b].Nch && WDcfg.boards[b].channels[ch].ChannelEnable;
+}
+
+int StartCalibration()
+{
+	if (WDcfg.NumCalPatterns < 1) {
+		msg_printf(MsgLog, "ERROR: Calibration: no pulse patterns (CALIBRATION_PATTERNS)\n");
+		return -1;
+	}
+	if ((WDcfg.WaveformProcessor & 0x03) != 0x03)
+		msg_printf(MsgLog, "WARN: Calibration: the waveform processor must compute the time and the energy (WAVEFORM_PROCESSOR = 3)\n");
+	memset(Acc, 0, sizeof(Acc));
+	memset(Table, 0, sizeof(Table));
+	Step = 0;
+	Applied = 0;
+	for (int b = 0; b < MAX_BD; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+			if (!WDc->ChannelEnable)
+				continue;
+			WDc->EnablePulseChannels = 1;
+			WDc->PulsePattern = WDcfg.CalPatterns[0];
+		}
+	}
+	msg_printf(MsgLog, "INFO: Calibration: %d patterns, %d events per pattern\n", WDcfg.NumCalPatterns, WDcfg.CalEvents);
+	return 0;
+}
+
+void CalibrationEvent(int bd, int ch, WaveDemoEvent_t *event)
+{
+	const int BrdRef = WDcfg.TOFstartBoard, ChRef = WDcfg.TOFstartChannel;
+	const WaveDemoEvent_t *ref = WDcfg.handles[BrdRef].RefEvent;
+	CalAcc_t *a = &Acc[Step][bd][ch];
+	const WaveDemo_EVENT_plus_t *ep = &event->EventPlus[ch / 2][ch % 2];
+
+	a->N++;
+	a->ESum += ep->Energy;
+	if (ref == NULL || ref->EventPlus[ChRef / 2][ChRef % 2].FineTimeStamp == 0)
+		return;
+	double dt = ((double)event->Event->DataGroup[ch / 2].TDC - (double)ref->Event->DataGroup[ChRef / 2].TDC) * 5 +
+		(ep->FineTimeStamp - ref->EventPlus[ChRef / 2][ChRef % 2].FineTimeStamp);
+	if (fabs(dt) > SYNC_WIN)	// not the same pulse
+		return;
+	a->NT++;
+	a->TSum += dt;
+	a->T2Sum += dt * dt;
+}
+
+int CalibrationStepDone()
+{
+	for (int b = 0; b < WDcfg.NumBoards; b++)
+		for (int ch = 0; ch < MAX_CH; ch++)
+			if (ChannelInUse(b, ch) && Acc[Step][b][ch].N < (uint64_t)WDcfg.CalEvents)
+				return 0;
+	return 1;
+}
+
+int CalibrationNextStep()
+{
+	if (Step + 1 >= WDcfg.NumCalPatterns)
+		return 0;
+	Step++;
+	for (int b = 0; b < MAX_BD; b++)
+		for (int ch = 0; ch < MAX_CH; ch++)
+			if (WDcfg.boards[b].channels[ch].ChannelEnable)
+				WDcfg.boards[b].channels[ch].PulsePattern = WDcfg.CalPatterns[Step];
+	msg_printf(MsgLog, "INFO: Calibration: pattern 0x%04X (%d of %d)\n", WDcfg.CalPatterns[Step], Step + 1, WDcfg.NumCalPatterns);
+	return 1;
+}
+
+// fit the table from the accumulators of the patterns 0 to Step
+static int FitCalibration()
+{
+	double Eref[MAX_CAL_PATTERNS] = { 0 };
+	int nref[MAX_CAL_PATTERNS] = { 0 }, ncal = 0;
+
+	// reference response of each pattern: mean over the channels
+	for (int s = 0; s <= Step; s++) {
+		for (int b = 0; b < WDcfg.NumBoards; b++) {
+			for (int ch = 0; ch < MAX_CH; ch++) {
+				if (ChannelInUse(b, ch) && Acc[s][b][ch].N > 0) {
+					Eref[s] += Acc[s][b][ch].ESum / Acc[s][b][ch].N;
+					nref[s]++;
+				}
+			}
+		}
+		if (nref[s] > 0)
+			Eref[s] /= nref[s];
+	}
+
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			CalEntry_t *t = &Table[b][ch];
+			double sx = 0, sy = 0, sxx = 0, sxy = 0, nt = 0, st = 0, stt = 0;
+			int n = 0;
+			memset(t, 0, sizeof(*t));
+			if (!ChannelInUse(b, ch))
+				continue;
+			for (int s = 0; s <= Step; s++) {
+				const CalAcc_t *a = &Acc[s][b][ch];
+				t->Events += a->N;
+				nt += a->NT;
+				st += a->TSum;
+				stt += a->T2Sum;
+				if (a->N == 0)
+					continue;
+				double x = a->ESum / a->N;
+				sx += x;
+				sy += Eref[s];
+				sxx += x * x;
+				sxy += x * Eref[s];
+				n++;
+			}
+			if (n == 0 || sx == 0)
+				continue;
+			double den = n * sxx - sx * sx;
+			if (n >= 2 && fabs(den) > 1e-9 * sxx * n) {
+				t->GainM = (float)((n * sxy - sx * sy) / den);
+				t->GainQ = (float)((sy - t->GainM * sx) / n);
+			}
+			else {
+				t->GainM = (float)(sy / sx);
+				t->GainQ = 0;
+			}
+			t->Patterns = n;
+			if (b == WDcfg.TOFstartBoard && ch == WDcfg.TOFstartChannel) {
+				t->TimeOffset = 0;
+				t->TimeRms = 0;
+			}
+			else if (nt > 0) {
+				t->TimeOffset = (float)(st / nt);
+				t->TimeRms = (float)sqrt(max(stt / nt - (st / nt) * (st / nt), 0));
+			}
+			else {
+				msg_printf(MsgLog, "WARN: Calibration: board %d channel %d has no event in coincidence with the TOF start channel\n", b, ch);
+			}
+			if (n < Step + 1)
+				msg_printf(MsgLog, "WARN: Calibration: board %d channel %d has events at %d patterns of %d\n", b, ch, n, Step + 1);
+			t->Valid = 1;
+			ncal++;
+		}
+	}
+	return ncal;
+}
+
+int FinishCalibration(char *TableFile)
+{
+	char fname[500];
+	time_t now = time(NULL);
+	FILE *f;
+	int ncal = FitCalibration();
+
+	if (ncal <= 0) {
+		msg_printf(MsgLog, "ERROR: Calibration: no pulser events\n");
+		return -1;
+	}
+	CreateCalibrationFileName(fname);
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		msg_printf(MsgLog, "ERROR: Can't open the calibration file %s\n", fname);
+		return -1;
+	}
+	fprintf(f, "%s %s", CALIB_FILE_TAG, ctime(&now));
+	fprintf(f, "# TOF start: board %d channel %d; patterns:", WDcfg.TOFstartBoard, WDcfg.TOFstartChannel);
+	for (int s = 0; s <= Step; s++)
+		fprintf(f, " 0x%04X", WDcfg.CalPatterns[s]);
+	fprintf(f, "\n#%5s %5s %12s %12s %12s %12s %8s %12s\n", "Board", "Ch", "Toffset(ns)", "Trms(ns)", "GainM", "GainQ", "Patterns", "Events");
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			const CalEntry_t *t = &Table[b][ch];
+			if (!t->Valid)
+				continue;
+			fprintf(f, " %5d %5d %12.4f %12.4f %12.6f %12.4f %8d %12llu\n", b, ch, t->TimeOffset, t->TimeRms, t->GainM, t->GainQ,
+				t->Patterns, (unsigned long long)t->Events);
+			StatusCalibration(b, ch, t->TimeOffset, t->TimeRms, t->GainM, t->GainQ, t->Events);
+		}
+	}
+	fclose(f);
+	StatusFile("calibration", -1, -1, fname);
+	msg_printf(MsgLog, "INFO: Calibration of %d channels saved in %s\n", ncal, fname);
+	if (TableFile != NULL)
+		strcpy(TableFile, fname);
+	return ncal;
+}
+
+int LoadCalibration(const char *path)
+{
+	char line[500];
+	int n = 0, b, ch, patterns;
+	float toff, trms, m, q;
+	unsigned long long events;
+	FILE *f = fopen(path, "r");
+
+	Applied = 0;
+	if (f == NULL) {
+		msg_printf(MsgLog, "ERROR: Can't open the calibration file %s\n", path);
+		return -1;
+	}
+	if (fgets(line, sizeof(line), f) == NULL || strncmp(line, CALIB_FILE_TAG, strlen(CALIB_FILE_TAG)) != 0) {
+		msg_printf(MsgLog, "ERROR: %s is not a calibration file\n", path);
+		fclose(f);
+		return -1;
+	}
+	memset(Table, 0, sizeof(Table));
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%d %d %f %f %f %f %d %llu", &b, &ch, &toff, &trms, &m, &q, &patterns, &events) != 8 ||
+			b < 0 || b >= MAX_BD || ch < 0 || ch >= MAX_CH) {
+			msg_printf(MsgLog, "WARN: Calibration file %s: invalid line %s", path, line);
+			continue;
+		}
+		Table[b][ch] = (CalEntry_t){ 1, toff, trms, m, q, patterns, events };
+		n++;
+	}
+	fclose(f);
+
+	// constants of the processing: the channels without calibration are left unchanged
+	const float TimeRef = Table[WDcfg.TOFstartBoard][WDcfg.TOFstartChannel].TimeOffset;
+	for (b = 0; b < MAX_BD; b++) {
+		for (ch = 0; ch < MAX_CH; ch++) {
+			const CalEntry_t *t = &Table[b][ch];
+			GainM[b][ch] = t->Valid ? t->GainM : 1;
+			GainQ[b][ch] = t->Valid ? t->GainQ : 0;
+			TimeCorr[b][ch] = t->Valid ? t->TimeOffset - TimeRef : 0;
+			if (!t->Valid && b < WDcfg.NumBoards && WDcfg.boards[b].channels[ch].ChannelEnable && ch < WDcfg.handles[b].Nch)
+				msg_printf(MsgLog, "WARN: Board %d channel %d is not in the calibration file\n", b, ch);
+		}
+	}
+	if (!Table[WDcfg.TOFstartBoard][WDcfg.TOFstartChannel].Valid)
+		msg_printf(MsgLog, "WARN: The TOF start channel is not in the calibration file; time offsets relative to the calibration run\n");
+	Applied = 1;
+	msg_printf(MsgLog, "INFO: Calibration %s (%d channels) applied\n", path, n);
+	return n;
+}
+
+float CalibratedEnergy(int bd, int ch, float Energy)
+{
+	return Applied ? GainM[bd][ch] * Energy + GainQ[bd][ch] : Energy;
+}
+
+float CalibrationTimeCorr(int bd, int ch)
+{
+	return Applied ? TimeCorr[bd][ch] : 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Simulated pulser
+// ---------------------------------------------------------------------------------------------------------
+
+static uint32_t NextRandom(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+static float Uniform(uint32_t *seed)	// -1 to 1
+{
+	return 2.0f * (NextRandom(seed) % 1000001) / 1000000.0f - 1.0f;
+}
+
+static int BitCount(unsigned short v)
+{
+	int n = 0;
+	for (; v; v >>= 1)
+		n += v & 1;
+	return n;
+}
+
+static int AllocateSimEvent(WaveDemoEvent_t *ev, int ns)
+{
+	ev->Event = (CAEN_DGTZ_X743_EVENT_t *)calloc(1, sizeof(CAEN_DGTZ_X743_EVENT_t));
+	if (ev->Event == NULL)
+		return -1;
+	for (int ch = 0; ch < MAX_CH; ch++) {
+		Waveform_t *wfm = (Waveform_t *)calloc(1, sizeof(Waveform_t));
+		ev->EventPlus[ch / 2][ch % 2].Waveforms = wfm;
+		ev->Event->DataGroup[ch / 2].DataChannel[ch % 2] = (float *)calloc(ns, sizeof(float));
+		if (wfm == NULL || ev->Event->DataGroup[ch / 2].DataChannel[ch % 2] == NULL)
+			return -1;
+		wfm->Ns = ns;
+		for (int a = 0; a < NUM_ATRACE; a++) {
+			wfm->AnalogTrace[a] = (float *)malloc(ns * sizeof(float));
+			if (wfm->AnalogTrace[a] == NULL)
+				return -1;
+		}
+		wfm->DigitalTraces = (uint8_t *)malloc(ns * sizeof(uint8_t));
+		if (wfm->DigitalTraces == NULL)
+			return -1;
+	}
+	for (int g = 0; g < MAX_GR; g++) {
+		ev->Event->GrPresent[g] = 1;
+		ev->Event->DataGroup[g].ChSize = ns;
+	}
+	return 0;
+}
+
+static void FreeSimEvent(WaveDemoEvent_t *ev)
+{
+	for (int ch = 0; ch < MAX_CH; ch++) {
+		Waveform_t *wfm = ev->EventPlus[ch / 2][ch % 2].Waveforms;
+		if (wfm != NULL) {
+			for (int a = 0; a < NUM_ATRACE; a++)
+				free(wfm->AnalogTrace[a]);
+			free(wfm->DigitalTraces);
+			free(wfm);
+		}
+		if (ev->Event != NULL)
+			free(ev->Event->DataGroup[ch / 2].DataChannel[ch % 2]);
+	}
+	free(ev->Event);
+	memset(ev, 0, sizeof(*ev));
+}
+
+int RunCalibrationSim()
+{
+	static WaveDemoEvent_t events[MAX_BD];
+	float Delay[MAX_BD][MAX_CH], Gain[MAX_BD][MAX_CH], GainMean = 0;
+	const int ns = WDcfg.GlobalRecordLength;
+	const int BrdRef = WDcfg.TOFstartBoard, ChRef = WDcfg.TOFstartChannel;
+	uint32_t seed = 4242;
+	int nch = 0, bad = 0, ret = -1;
+
+	if ((WDcfg.WaveformProcessor & 0x03) != 0x03) {
+		msg_printf(MsgLog, "ERROR: Calibration: the waveform processor must compute the time and the energy (WAVEFORM_PROCESSOR = 3)\n");
+		return -1;
+	}
+	if (StartCalibration() < 0)
+		return -1;
+	memset(events, 0, sizeof(events));
+	for (int b = 0; b < WDcfg.NumBoards; b++)
+		if (AllocateSimEvent(&events[b], ns) < 0)
+			goto Done;
+
+	// response of the simulated channels
+	for (int b = 0; b < MAX_BD; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			Delay[b][ch] = CAL_SIM_MAX_DELAY * Uniform(&seed);
+			Gain[b][ch] = 1 + CAL_SIM_MAX_GAIN * Uniform(&seed);
+			if (b < WDcfg.NumBoards && ChannelInUse(b, ch)) {
+				GainMean += Gain[b][ch];
+				nch++;
+			}
+		}
+	}
+	if (nch == 0) {
+		msg_printf(MsgLog, "ERROR: Calibration: no enabled channel\n");
+		goto Done;
+	}
+	GainMean /= nch;
+	msg_printf(MsgLog, "INFO: Calibration: simulated pulser on %d channels\n", nch);
+
+	// sweep: the charge of a pattern is proportional to its set bits
+	do {
+		const unsigned short pattern = WDcfg.CalPatterns[Step];
+		for (int n = 0; n < CAL_SIM_EVENTS; n++) {
+			const float jitter = (NextRandom(&seed) % 1000) / 1000.0f;	// phase of the pulse (samples)
+			for (int b = 0; b < WDcfg.NumBoards; b++) {
+				WaveDemoBoard_t *WDb = &WDcfg.boards[b];
+				const float Ts = WDcfg.handles[b].Ts;
+				const float base = (WDb->CorrectionLevel == 0 || WDb->CorrectionLevel == 2) ? 2048.0f : 0.0f;
+				for (int g = 0; g < MAX_GR; g++)
+					events[b].Event->DataGroup[g].TDC = (uint64_t)n * 1000;
+				for (int ch = 0; ch < MAX_CH; ch++) {
+					WaveDemoChannel_t *WDc = &WDb->channels[ch];
+					float *wave = events[b].Event->DataGroup[ch / 2].DataChannel[ch % 2];
+					const float dir = (WDc->PulsePolarity == CAEN_DGTZ_PulsePolarityPositive) ? 1.0f : -1.0f;
+					const float amp = (2 * fabsf(1485 * WDc->TriggerThreshold_V) + 100) * BitCount(pattern) * Gain[b][ch];
+					const float pos = ns / 4 + jitter + Delay[b][ch] / Ts;
+					for (int i = 0; i < ns; i++) {
+						float v = base + (float)((int)(NextRandom(&seed) % 5) - 2);
+						if (i >= pos)
+							v += dir * amp * (expf(-(i - pos) / 10.0f) - expf(-(i - pos) / 2.0f));
+						wave[i] = v;
+					}
+				}
+			}
+			// all the channels are processed before the time differences are taken
+			WDcfg.handles[BrdRef].RefEvent = &events[BrdRef];
+			for (int b = 0; b < WDcfg.NumBoards; b++) {
+				for (int ch = 0; ch < MAX_CH; ch++) {
+					if (!ChannelInUse(b, ch))
+						continue;
+					events[b].EventPlus[ch / 2][ch % 2].FineTimeStamp = 0;
+					WaveformProcess(b, ch, &events[b]);
+				}
+			}
+			for (int b = 0; b < WDcfg.NumBoards; b++)
+				for (int ch = 0; ch < MAX_CH; ch++)
+					if (ChannelInUse(b, ch) && events[b].EventPlus[ch / 2][ch % 2].FineTimeStamp != 0)
+						CalibrationEvent(b, ch, &events[b]);
+		}
+	} while (CalibrationNextStep());
+	WDcfg.handles[BrdRef].RefEvent = NULL;
+
+	if (FinishCalibration(NULL) < 0)
+		goto Done;
+
+	// the table must give back the simulated channels
+	msg_printf(MsgLog, "INFO:   board  ch  Toffset(ns) expected  GainM  expected  result\n");
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			const CalEntry_t *t = &Table[b][ch];
+			if (!ChannelInUse(b, ch))
+				continue;
+			const float toff = Delay[b][ch] - Delay[BrdRef][ChRef];
+			const float m = GainMean / Gain[b][ch];
+			// with the LED the offsets include the walk of the different amplitudes: only the gain is checked
+			const int cfd = WDcfg.boards[b].channels[ch].DiscrMode == 1 && WDcfg.boards[BrdRef].channels[ChRef].DiscrMode == 1;
+			const int ok = t->Valid && (!cfd || fabsf(t->TimeOffset - toff) <= CAL_SIM_TOL_TIME) && fabsf(t->GainM / m - 1) <= CAL_SIM_TOL_GAIN;
+			msg_printf(MsgLog, "INFO:   %5d %3d %11.4f %8.4f %6.4f %9.4f  %s\n", b, ch, t->TimeOffset, toff, t->GainM, m, ok ? "OK" : "FAIL");
+			bad += !ok;
+		}
+	}
+	msg_printf(MsgLog, "%s: Calibration on the simulated pulser: %d channels, %d mismatching\n", bad ? "ERROR" : "INFO", nch, bad);
+	ret = bad ? 1 : 0;
+
+Done:
+	for (int b = 0; b < MAX_BD; b++)
+		FreeSimEvent(&events[b]);
+	return ret;
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+
+#include "WDClock.h"
+
+static volatile int MockEnabled = 0;
+static volatile int64_t MockTime = 0;
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+int64_t HostClockNs()
+{
+	if (MockEnabled)
+		return MockTime;
+#ifdef WIN32
+	static LARGE_INTEGER freq = { 0 };
+	LARGE_INTEGER cnt;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&cnt);
+	return (int64_t)(cnt.QuadPart / freq.QuadPart) * NS_PER_S + (int64_t)(cnt.QuadPart % freq.QuadPart) * NS_PER_S / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NS_PER_S + ts.tv_nsec;
+#endif
+}
+
+int64_t HostClockMs()
+{
+	return HostClockNs() / NS_PER_MS;
+}
+
+uint64_t WallClockMs()
+{
+	if (MockEnabled)
+		return (uint64_t)(MockTime / NS_PER_MS);
+#ifdef WIN32
+	struct __timeb64 timebuffer;
+	_ftime64(&timebuffer);
+	return (uint64_t)timebuffer.time * 1000 + timebuffer.millitm;
+#else
+	struct timeval t1;
+	gettimeofday(&t1, NULL);
+	return (uint64_t)t1.tv_sec * 1000 + t1.tv_usec / 1000;
+#endif
+}
+
+void SetMockClock(int64_t Time)
+{
+	MockTime = Time;
+	MockEnabled = 1;
+}
+
+void AdvanceMockClock(int64_t Dt)
+{
+	if (MockEnabled)
+		MockTime += Dt;
+}
+
+void ReleaseMockClock()
+{
+	MockEnabled = 0;
+}
@@ -0,0 +1,414 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDCuts.h"
+
+// Compiler state (recursive descent parser emitting postfix code)
+typedef struct {
+	const char *expr;		// start of the expression (for the error position)
+	const char *p;			// current position
+	WaveDemoCut_t *cut;		// output code
+	int depth;				// stack depth after the code emitted so far
+	char *err;				// error description
+} CutParser_t;
+
+static int ParseOr(CutParser_t *ps);
+
+/* ###########################################################################
+*  Compiler
+*  ########################################################################### */
+
+static int CutError(CutParser_t *ps, const char *what)
+{
+	sprintf(ps->err, "%s at position %d", what, (int)(ps->p - ps->expr) + 1);
+	return -1;
+}
+
+static void SkipSpaces(CutParser_t *ps)
+{
+	while (*ps->p && isspace((unsigned char)*ps->p))
+		ps->p++;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: consume the token tok if it is the next one
+// Return:		1=consumed, 0=not found
+// ---------------------------------------------------------------------------------------------------------
+static int Accept(CutParser_t *ps, const char *tok)
+{
+	size_t len = strlen(tok);
+	SkipSpaces(ps);
+	if (strncmp(ps->p, tok, len) != 0)
+		return 0;
+	// don't split the two chars operators (e.g. '<' in "<=", '!' in "!=")
+	if (len == 1 && strchr("<>!=", tok[0]) && ps->p[1] == '=')
+		return 0;
+	ps->p += len;
+	return 1;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: append an instruction; Push = change of the stack depth (+1, 0, -1)
+// ---------------------------------------------------------------------------------------------------------
+static int Emit(CutParser_t *ps, int Op, int Push, int Field, int Board, int Channel, double Value)
+{
+	WaveDemoCut_t *cut = ps->cut;
+	if (cut->Ncode >= MAX_CUT_CODE)
+		return CutError(ps, "expression too long");
+	cut->Code[cut->Ncode].Op = (uint8_t)Op;
+	cut->Code[cut->Ncode].Field = (uint8_t)Field;
+	cut->Code[cut->Ncode].Board = (uint8_t)Board;
+	cut->Code[cut->Ncode].Channel = (uint8_t)Channel;
+	cut->Code[cut->Ncode].Value = Value;
+	cut->Ncode++;
+	ps->depth += Push;
+	if (ps->depth > MAX_CUT_STACK)
+		return CutError(ps, "expression too complex");
+	if (ps->depth > cut->StackDepth)
+		cut->StackDepth = ps->depth;
+	return 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: parse "[n]"
+// ---------------------------------------------------------------------------------------------------------
+static int ParseIndex(CutParser_t *ps, int max, int *index)
+{
+	char *end;
+	long val;
+	if (!Accept(ps, "["))
+		return CutError(ps, "'[' expected");
+	SkipSpaces(ps);
+	val = strtol(ps->p, &end, 10);
+	if (end == ps->p)
+		return CutError(ps, "index expected");
+	if (val < 0 || val >= max)
+		return CutError(ps, "index out of range");
+	ps->p = end;
+	if (!Accept(ps, "]"))
+		return CutError(ps, "']' expected");
+	*index = (int)val;
+	return 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: primary := number | '(' or ')' | func '(' args ')' | field ['[' b ']' '[' ch ']']
+// ---------------------------------------------------------------------------------------------------------
+static int ParsePrimary(CutParser_t *ps)
+{
+	char name[16];
+	int len = 0;
+
+	SkipSpaces(ps);
+	if (isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+		char *end;
+		double val = strtod(ps->p, &end);
+		if (end == ps->p)
+			return CutError(ps, "invalid number");
+		ps->p = end;
+		return Emit(ps, CUT_OP_CONST, 1, 0, 0, 0, val);
+	}
+	if (Accept(ps, "(")) {
+		if (ParseOr(ps) < 0)
+			return -1;
+		if (!Accept(ps, ")"))
+			return CutError(ps, "')' expected");
+		return 0;
+	}
+
+	while (isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_') {
+		if (len >= (int)sizeof(name) - 1)
+			return CutError(ps, "unknown name");
+		name[len] = (char)toupper((unsigned char)ps->p[len]);
+		len++;
+	}
+	name[len] = '\0';
+	if (len == 0)
+		return CutError(ps, *ps->p ? "syntax error" : "unexpected end of expression");
+	ps->p += len;
+
+	// functions
+	if (strcmp(name, "ABS") == 0 || strcmp(name, "MIN") == 0 || strcmp(name, "MAX") == 0) {
+		if (!Accept(ps, "("))
+			return CutError(ps, "'(' expected");
+		if (ParseOr(ps) < 0)
+			return -1;
+		if (name[1] == 'B') {
+			if (!Accept(ps, ")"))
+				return CutError(ps, "')' expected");
+			return Emit(ps, CUT_OP_ABS, 0, 0, 0, 0, 0);
+		}
+		if (!Accept(ps, ","))
+			return CutError(ps, "',' expected");
+		if (ParseOr(ps) < 0)
+			return -1;
+		if (!Accept(ps, ")"))
+			return CutError(ps, "')' expected");
+		return Emit(ps, name[1] == 'I' ? CUT_OP_MIN : CUT_OP_MAX, -1, 0, 0, 0, 0);
+	}
+
+	// fields
+	if (strcmp(name, "BD") == 0)
+		return Emit(ps, CUT_OP_FIELD, 1, CUT_FIELD_BD, CUT_CURRENT, CUT_CURRENT, 0);
+	if (strcmp(name, "CH") == 0)
+		return Emit(ps, CUT_OP_FIELD, 1, CUT_FIELD_CH, CUT_CURRENT, CUT_CURRENT, 0);
+	if (strcmp(name, "MULT") == 0)
+		return Emit(ps, CUT_OP_FIELD, 1, CUT_FIELD_MULT, CUT_CURRENT, CUT_CURRENT, 0);
+	if (len == 1 && strchr("ETBV", name[0])) {
+		int field = name[0] == 'E' ? CUT_FIELD_E : name[0] == 'T' ? CUT_FIELD_T : name[0] == 'B' ? CUT_FIELD_B : CUT_FIELD_V;
+		int b = CUT_CURRENT, ch = CUT_CURRENT;
+		SkipSpaces(ps);
+		if (*ps->p == '[') {
+			if (ParseIndex(ps, MAX_BD, &b) < 0 || ParseIndex(ps, MAX_CH, &ch) < 0)
+				return -1;
+		}
+		return Emit(ps, CUT_OP_FIELD, 1, field, b, ch, 0);
+	}
+	ps->p -= len;
+	return CutError(ps, "unknown name");
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: unary := ('-' | '!') unary | primary
+// ---------------------------------------------------------------------------------------------------------
+static int ParseUnary(CutParser_t *ps)
+{
+	if (Accept(ps, "-")) {
+		if (ParseUnary(ps) < 0)
+			return -1;
+		return Emit(ps, CUT_OP_NEG, 0, 0, 0, 0, 0);
+	}
+	if (Accept(ps, "!")) {
+		if (ParseUnary(ps) < 0)
+			return -1;
+		return Emit(ps, CUT_OP_NOT, 0, 0, 0, 0, 0);
+	}
+	if (Accept(ps, "+"))
+		return ParseUnary(ps);
+	return ParsePrimary(ps);
+}
+
+static int ParseMul(CutParser_t *ps)
+{
+	if (ParseUnary(ps) < 0)
+		return -1;
+	for (;;) {
+		int op;
+		if (Accept(ps, "*"))		op = CUT_OP_MUL;
+		else if (Accept(ps, "/"))	op = CUT_OP_DIV;
+		else return 0;
+		if (ParseUnary(ps) < 0 || Emit(ps, op, -1, 0, 0, 0, 0) < 0)
+			return -1;
+	}
+}
+
+static int ParseAdd(CutParser_t *ps)
+{
+	if (ParseMul(ps) < 0)
+		return -1;
+	for (;;) {
+		int op;
+		if (Accept(ps, "+"))		op = CUT_OP_ADD;
+		else if (Accept(ps, "-"))	op = CUT_OP_SUB;
+		else return 0;
+		if (ParseMul(ps) < 0 || Emit(ps, op, -1, 0, 0, 0, 0) < 0)
+			return -1;
+	}
+}
+
+static int ParseRel(CutParser_t *ps)
+{
+	if (ParseAdd(ps) < 0)
+		return -1;
+	for (;;) {
+		int op;
+		if (Accept(ps, "<="))		op = CUT_OP_LE;
+		else if (Accept(ps, ">="))	op = CUT_OP_GE;
+		else if (Accept(ps, "<"))	op = CUT_OP_LT;
+		else if (Accept(ps, ">"))	op = CUT_OP_GT;
+		else return 0;
+		if (ParseAdd(ps) < 0 || Emit(ps, op, -1, 0, 0, 0, 0) < 0)
+			return -1;
+	}
+}
+
+static int ParseEq(CutParser_t *ps)
+{
+	if (ParseRel(ps) < 0)
+		return -1;
+	for (;;) {
+		int op;
+		if (Accept(ps, "=="))		op = CUT_OP_EQ;
+		else if (Accept(ps, "!="))	op = CUT_OP_NE;
+		else return 0;
+		if (ParseRel(ps) < 0 || Emit(ps, op, -1, 0, 0, 0, 0) < 0)
+			return -1;
+	}
+}
+
+static int ParseAnd(CutParser_t *ps)
+{
+	if (ParseEq(ps) < 0)
+		return -1;
+	while (Accept(ps, "&&")) {
+		if (ParseEq(ps) < 0 || Emit(ps, CUT_OP_AND, -1, 0, 0, 0, 0) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int ParseOr(CutParser_t *ps)
+{
+	if (ParseAnd(ps) < 0)
+		return -1;
+	while (Accept(ps, "||")) {
+		if (ParseAnd(ps) < 0 || Emit(ps, CUT_OP_OR, -1, 0, 0, 0, 0) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int CompileCut(const char *expr, WaveDemoCut_t *cut, char *err)
+{
+	static WaveDemoCut_t tmp;
+	CutParser_t ps;
+
+	// compile after the existing code: the old result stays at the bottom of the stack
+	tmp = *cut;
+	ps.expr = expr;
+	ps.p = expr;
+	ps.cut = &tmp;
+	ps.depth = cut->Ncode > 0 ? 1 : 0;
+	ps.err = err;
+	if (ParseOr(&ps) < 0)
+		return -1;
+	SkipSpaces(&ps);
+	if (*ps.p != '\0')
+		return CutError(&ps, "syntax error");
+	if (cut->Ncode > 0 && Emit(&ps, CUT_OP_AND, -1, 0, 0, 0, 0) < 0)
+		return -1;
+
+	if (cut->Ncode > 0) {
+		if (strlen(tmp.Text) + strlen(expr) + 8 >= MAX_CUT_TEXT) {
+			sprintf(err, "expression too long");
+			return -1;
+		}
+		strcat(tmp.Text, " && (");
+		strcat(tmp.Text, expr);
+		strcat(tmp.Text, ")");
+	}
+	else {
+		sprintf(tmp.Text, "(%.*s)", MAX_CUT_TEXT - 3, expr);
+	}
+	*cut = tmp;
+	return 0;
+}
+
+void ClearCut(WaveDemoCut_t *cut)
+{
+	cut->Ncode = 0;
+	cut->StackDepth = 0;
+	cut->Text[0] = '\0';
+}
+
+/* ###########################################################################
+*  Evaluator
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: value of a field of one channel (0 if the channel is not in the event)
+// ---------------------------------------------------------------------------------------------------------
+static double ChannelField(WaveDemoEvent_t *events[MAX_BD], int b, int ch, int field)
+{
+	WaveDemo_EVENT_plus_t *ep;
+	if (b >= WDcfg.NumBoards || ch >= WDcfg.handles[b].Nch || events[b] == NULL)
+		return 0;
+	if (!WDcfg.boards[b].channels[ch].ChannelEnable || !events[b]->Event->GrPresent[ch / 2])
+		return 0;
+	ep = &events[b]->EventPlus[ch / 2][ch % 2];
+	switch (field) {
+	case CUT_FIELD_E: return ep->Energy;
+	case CUT_FIELD_T: return (double)events[b]->Event->DataGroup[ch / 2].TDC * 5 + ep->FineTimeStamp;
+	case CUT_FIELD_B: return ep->Baseline;
+	case CUT_FIELD_V: return ep->FineTimeStamp != 0;
+	}
+	return 0;
+}
+
+static int Multiplicity(WaveDemoEvent_t *events[MAX_BD])
+{
+	int mult = 0;
+	for (int b = 0; b < WDcfg.NumBoards; b++)
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++)
+			if (ChannelField(events, b, ch, CUT_FIELD_V) != 0)
+				mult++;
+	return mult;
+}
+
+int EvalCut(const WaveDemoCut_t *cut, WaveDemoEvent_t *events[MAX_BD], int b, int ch)
+{
+	double stack[MAX_CUT_STACK];
+	int sp = 0, mult = -1;
+
+	if (cut->Ncode == 0)
+		return 1;
+	for (int i = 0; i < cut->Ncode; i++) {
+		const WaveDemoCutInstr_t *in = &cut->Code[i];
+		double x;
+		switch (in->Op) {
+		case CUT_OP_CONST:
+			stack[sp++] = in->Value;
+			break;
+		case CUT_OP_FIELD:
+			if (in->Field == CUT_FIELD_BD)
+				x = b;
+			else if (in->Field == CUT_FIELD_CH)
+				x = ch;
+			else if (in->Field == CUT_FIELD_MULT) {
+				if (mult < 0)
+					mult = Multiplicity(events);
+				x = mult;
+			}
+			else
+				x = ChannelField(events, in->Board == CUT_CURRENT ? b : in->Board, in->Channel == CUT_CURRENT ? ch : in->Channel, in->Field);
+			stack[sp++] = x;
+			break;
+		case CUT_OP_NEG: stack[sp - 1] = -stack[sp - 1]; break;
+		case CUT_OP_NOT: stack[sp - 1] = stack[sp - 1] == 0; break;
+		case CUT_OP_ABS: stack[sp - 1] = fabs(stack[sp - 1]); break;
+		default:
+			// binary operators
+			x = stack[--sp];
+			switch (in->Op) {
+			case CUT_OP_ADD: stack[sp - 1] += x; break;
+			case CUT_OP_SUB: stack[sp - 1] -= x; break;
+			case CUT_OP_MUL: stack[sp - 1] *= x; break;
+			case CUT_OP_DIV: stack[sp - 1] /= x; break;
+			case CUT_OP_MIN: stack[sp - 1] = stack[sp - 1] < x ? stack[sp - 1] : x; break;
+			case CUT_OP_MAX: stack[sp - 1] = stack[sp - 1] > x ? stack[sp - 1] : x; break;
+			case CUT_OP_LT:  stack[sp - 1] = stack[sp - 1] < x; break;
+			case CUT_OP_LE:  stack[sp - 1] = stack[sp - 1] <= x; break;
+			case CUT_OP_GT:  stack[sp - 1] = stack[sp - 1] > x; break;
+			case CUT_OP_GE:  stack[sp - 1] = stack[sp - 1] >= x; break;
+			case CUT_OP_EQ:  stack[sp - 1] = stack[sp - 1] == x; break;
+			case CUT_OP_NE:  stack[sp - 1] = stack[sp - 1] != x; break;
+			case CUT_OP_AND: stack[sp - 1] = stack[sp - 1] != 0 && x != 0; break;
+			case CUT_OP_OR:  stack[sp - 1] = stack[sp - 1] != 0 || x != 0; break;
+			}
+			break;
+		}
+	}
+	return stack[0] != 0;
+}
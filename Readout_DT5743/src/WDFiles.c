@@ -15,6 +15,13 @@
 
 #include "WDFiles.h"
 #include "WDLogs.h"
+#include "WDClock.h"
+#include "WDStatus.h"
+#include "WDMarkers.h"
+#include "WDPlugins.h"
+#include "WDHArchive.h"
+#include "WDThrEmul.h"
+#include "WDCalib.h"
 
 uint64_t OutFileSize = 0; // Size of the output data file (in bytes)
 
@@ -26,8 +33,21 @@ uint64_t OutFileSize = 0; // Size of the output data file (in bytes)
 #define OUTPUTFILE_TYPE_THISTO			5
 #define OUTPUTFILE_TYPE_RUN_INFO		6
 #define OUTPUTFILE_TYPE_TDCLIST			7
+#define OUTPUTFILE_TYPE_MARKERS			8
+#define OUTPUTFILE_TYPE_HARCHIVE		9
 
 
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Open an output data file with the buffer size of the host profile (WDcfg.WriteBufferSize)
+// Return:		file pointer, NULL=error
+// --------------------------------------------------------------------------------------------------------- 
+FILE *OpenOutputFile(const char *fname, const char *mode) {
+	FILE *f = fopen(fname, mode);
+	if (f != NULL && WDcfg.WriteBufferSize > 0)
+		setvbuf(f, NULL, _IOFBF, WDcfg.WriteBufferSize);
+	return f;
+}
+
 /* Return pointer to first non-whitespace char in given string. */
 static char* lskip(const char* s)
 {
@@ -81,14 +101,18 @@ static int CreateOutputFolder() {
 // Description: create the file name for an output file
 // Return:		0=OK, -1=error
 // --------------------------------------------------------------------------------------------------------- 
-static int CreateOutputFileName(int FileType, int b, int ch, char *fname) {
-	char prefix[256], hext[10], wlext[10];
+static void GetOutputFilePrefix(char *prefix) {
 	if (WDcfg.isRunNumberTimestamp) {
 		sprintf(prefix, "%s%s_", WDcfg.DataFilePath, WDrun.DataTimeFilename);
 	}
 	else {
 		sprintf(prefix, "%s%03d_", WDcfg.DataFilePath, WDcfg.RunNumber);
 	}
+}
+
+static int CreateOutputFileName(int FileType, int b, int ch, char *fname) {
+	char prefix[256], hext[10], wlext[10];
+	GetOutputFilePrefix(prefix);
 
 	if (WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ANSI42) sprintf(hext, "n42");
 	else sprintf(hext, "txt");
@@ -113,6 +137,10 @@ static int CreateOutputFileName(int FileType, int b, int ch, char *fname) {
 		sprintf(fname, "%sPSDhisto_%d_%d.%s", prefix, b, ch, hext);
 	} else if (FileType == OUTPUTFILE_TYPE_RUN_INFO) {
 		sprintf(fname, "%srun_info.txt", prefix);
+	} else if (FileType == OUTPUTFILE_TYPE_MARKERS) {
+		sprintf(fname, "%smarkers.txt", prefix);
+	} else if (FileType == OUTPUTFILE_TYPE_HARCHIVE) {
+		sprintf(fname, "%s%s", prefix, HARC_FILE_NAME);
 	} else {
 		fname[0] = '\0';
 		return -1;
@@ -120,6 +148,59 @@ static int CreateOutputFileName(int FileType, int b, int ch, char *fname) {
 	return 0;
 }
 
+// --------------------------------------------------------------------------------------------------------- 
+// Description: create the file name for a plugin output file (<prefix>Plugin_<name>[_<item>]_<b>_<ch>.txt)
+// Inputs:		Plugin = plugin name
+//				Item = histogram name (NULL for the columns file)
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int CreatePluginFileName(const char *Plugin, const char *Item, int b, int ch, char *fname) {
+	char prefix[256];
+	GetOutputFilePrefix(prefix);
+	if (Item != NULL)
+		sprintf(fname, "%sPlugin_%s_%s_%d_%d.txt", prefix, Plugin, Item, b, ch);
+	else
+		sprintf(fname, "%sPlugin_%s_%d_%d.txt", prefix, Plugin, b, ch);
+	return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: create the file name of the histogram archive (<prefix>histos.wdh)
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int CreateHistoArchiveFileName(char *fname) {
+	return CreateOutputFileName(OUTPUTFILE_TYPE_HARCHIVE, 0, 0, fname);
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: create the file name for an output of the threshold emulation: the summary (<prefix>thr_emulation.txt)
+//				or a histogram of one point (<prefix><Item>_<b>_<ch>_thrNN.txt)
+// Inputs:		Item = "Ehisto" or "Thisto" (NULL for the summary)
+//				point = index of the emulated point
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int CreateThrEmulationFileName(const char *Item, int point, int b, int ch, char *fname) {
+	char prefix[256];
+	GetOutputFilePrefix(prefix);
+	if (Item != NULL)
+		sprintf(fname, "%s%s_%d_%d_thr%02d.txt", prefix, Item, b, ch, point);
+	else
+		sprintf(fname, "%s%s", prefix, EMUL_FILE_NAME);
+	return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Name of the table written by the pulser calibration (see WDCalib.h)
+// Outputs:		fname = <prefix>calibration.txt
+// Return:		0=OK
+// --------------------------------------------------------------------------------------------------------- 
+int CreateCalibrationFileName(char *fname) {
+	char prefix[256];
+	GetOutputFilePrefix(prefix);
+	sprintf(fname, "%s%s", prefix, CALIB_FILE_NAME);
+	return 0;
+}
+
 
 // --------------------------------------------------------------------------------------------------------- 
 // Description: check if the output data files are already present
@@ -153,17 +234,23 @@ int CheckOutputDataFilePresence() {
 		fclose(of);
 	}
 
+	// Histogram archive
+	if (WDcfg.SaveHistograms && WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_HARCHIVE, 0, 0, fname);
+		if ((of = fopen(fname, "r")) != NULL) return -1;
+	}
+
 	// Histograms, Lists and Waveforms
 	for (b = 0; b < WDcfg.NumBoards; b++) {
 		for (ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
 			if (WDcfg.boards[b].channels[ch].ChannelEnable) {
-				if (WDcfg.SaveHistograms & 0x1) {
+				if ((WDcfg.SaveHistograms & 0x1) && WDcfg.HistoOutputFormat != HISTO_FILE_FORMAT_ARCHIVE) {
 					CreateOutputFileName(OUTPUTFILE_TYPE_EHISTO, b, ch, fname);
 					//WDrun.OutputDataFile = fopen(fname, "rb");
 					if ((of = fopen(fname, "r")) != NULL) return -1;
 					fclose(of);
 				}
-				if (WDcfg.SaveHistograms & 0x2) {
+				if ((WDcfg.SaveHistograms & 0x2) && WDcfg.HistoOutputFormat != HISTO_FILE_FORMAT_ARCHIVE) {
 					CreateOutputFileName(OUTPUTFILE_TYPE_THISTO, b, ch, fname);
 					//WDrun.OutputDataFile = fopen(fname, "rb");
 					if ((of = fopen(fname, "r")) != NULL) return -1;
@@ -219,7 +306,7 @@ int OpenOutputDataFiles() {
 
 	if (WDcfg.SaveRawData) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_RAW, 0, 0, fname);
-		WDrun.OutputDataFile = fopen(fname, "wb");
+		WDrun.OutputDataFile = OpenOutputFile(fname, "wb");
 		if (WDrun.OutputDataFile == NULL) {
 			msg_printf(MsgLog, "Can't open Output Data File %s\n", fname);
 			return -1;
@@ -259,6 +346,11 @@ int CloseOutputDataFiles() {
 		fclose(WDrun.flist_merged);
 		WDrun.flist_merged = NULL;
 	}
+	if (WDrun.fmarkers != NULL) {
+		fclose(WDrun.fmarkers);
+		WDrun.fmarkers = NULL;
+	}
+	PluginsStopRun();
 	for (b = 0; b < WDcfg.NumBoards; b++) {
 		for (ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
 			if (WDcfg.runs[b].flist[ch] != NULL) {
@@ -328,7 +420,8 @@ void ReadEventX743(FILE* inputFile, CAEN_DGTZ_X743_EVENT_t* event, char channels
 					fread(&event->DataGroup[g].TimeCount[c], sizeof(event->DataGroup[g].TimeCount[c]), 1, inputFile);
 
 					if (event->DataGroup[g].ChSize > 0) {
-						event->DataGroup[g].DataChannel[c] = malloc(event->DataGroup[g].ChSize * sizeof(float));
+						// the buffer of the previous event of the board is reused
+						event->DataGroup[g].DataChannel[c] = realloc(event->DataGroup[g].DataChannel[c], event->DataGroup[g].ChSize * sizeof(float));
 						if (event->DataGroup[g].DataChannel[c]) {
 							for (unsigned int s = 0; s < event->DataGroup[g].ChSize; s++) {
 								fread(&event->DataGroup[g].DataChannel[c][s], sizeof(event->DataGroup[g].DataChannel[c][s]), 1, inputFile);
@@ -341,6 +434,39 @@ void ReadEventX743(FILE* inputFile, CAEN_DGTZ_X743_EVENT_t* event, char channels
 	}
 }
 
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Read the next event from a raw data file (after the header)
+// Inputs:		inputFile = raw data file
+// In/Out:		eventPtr = one event per board (allocated when NULL; the waveforms are reallocated)
+// Outputs:		bd = board of the event
+//				channelsEnabled = channels saved in the event
+// Return:		1=event read, 0=end of file, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int ReadRawEvent(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int *bd, char channelsEnabled[MAX_CH]) {
+	if (fread(bd, sizeof(*bd), 1, inputFile) != 1) {
+		if (feof(inputFile))
+			return 0;
+		perror("Error reading the file");
+		return -1;
+	}
+	if (*bd < 0 || *bd >= MAX_BD) return -1;
+
+	if (!eventPtr[*bd]) {
+		eventPtr[*bd] = malloc(sizeof(WaveDemoEvent_t));
+		if (!eventPtr[*bd]) return -1;
+		memset(eventPtr[*bd], 0, sizeof(WaveDemoEvent_t));
+		eventPtr[*bd]->Event = calloc(1, sizeof(CAEN_DGTZ_X743_EVENT_t));
+		if (!eventPtr[*bd]->Event) return -1;
+	}
+
+	ReadEventInfo(inputFile, &eventPtr[*bd]->EventInfo);
+	memset(channelsEnabled, 0, MAX_CH);
+	ReadEventX743(inputFile, eventPtr[*bd]->Event, channelsEnabled);
+	if (feof(inputFile))
+		return 0;	// truncated event (file not closed by the acquisition)
+	return 1;
+}
+
 int ReadRawData(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int printFlag) {
 	if (inputFile == NULL) return -1;
 
@@ -360,29 +486,10 @@ int ReadRawData(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int printFla
 	}
 
 	int n_evnt = 0;
-	while (!feof(inputFile)) {
-		int bd;
-		if (fread(&bd, sizeof(bd), 1, inputFile) != 1) {
-			if (feof(inputFile)) {
-				break;
-			} else {
-				perror("Error reading the file");
-				return -1;
-			}
-		}
-
-		if (bd >= MAX_BD) return -1;
-
-		if (!eventPtr[bd]) {
-			eventPtr[bd] = malloc(sizeof(WaveDemoEvent_t));
-			if (!eventPtr[bd]) return -1;
-			memset(eventPtr[bd], 0, sizeof(WaveDemoEvent_t));
-			eventPtr[bd]->Event = calloc(1, sizeof(CAEN_DGTZ_X743_EVENT_t));
-			if (!eventPtr[bd]->Event) return -1;
-		}
-
+	int bd, ret;
+	char channelsEnabled[MAX_CH] = { 0 };
+	while ((ret = ReadRawEvent(inputFile, eventPtr, &bd, channelsEnabled)) == 1) {
 		CAEN_DGTZ_EventInfo_t *eventInfo = &eventPtr[bd]->EventInfo;
-		ReadEventInfo(inputFile, eventInfo);
 		if (printFlag) {
 			printf("EventCounter: %u\n", eventInfo->EventCounter);
 			printf("TriggerTimeTag: %u\n", eventInfo->TriggerTimeTag);
@@ -390,8 +497,6 @@ int ReadRawData(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int printFla
 		}
 
 		CAEN_DGTZ_X743_EVENT_t *eventX743 = eventPtr[bd]->Event;
-		char channelsEnabled[MAX_CH] = { 0 };
-		ReadEventX743(inputFile, eventX743, channelsEnabled);
 		if (printFlag) {
 			printf("groupPresent: ");
 			for (int g = 0; g < MAX_V1743_GROUP_SIZE; g++) {
@@ -432,6 +537,8 @@ int ReadRawData(FILE* inputFile, WaveDemoEvent_t *eventPtr[MAX_BD], int printFla
 
 		n_evnt++;
 	}
+	if (ret < 0)
+		return -1;
 
 	if (printFlag) {
 		printf("Number of events found: %d\n", n_evnt);
@@ -531,9 +638,9 @@ int SaveTDCList(int bd, int ch, WaveDemoEvent_t *event) {
 	if (WDr->ftdc[ch] == NULL) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_TDCLIST, bd, ch, fname);
 		if (WDcfg.OutFileFormat == OUTFILE_ASCII)
-			WDr->ftdc[ch] = fopen(fname, "w");
+			WDr->ftdc[ch] = OpenOutputFile(fname, "w");
 		else
-			WDr->flist[ch] = fopen(fname, "wb");
+			WDr->flist[ch] = OpenOutputFile(fname, "wb");
 		if (WDr->ftdc[ch] == NULL)
 			return -1;
 	}
@@ -589,31 +696,218 @@ int SaveHistogram(char *FileName, Histogram1D_t Histo) {
 
 
 // --------------------------------------------------------------------------------------------------------- 
-// Description: Save all histograms to output file
+// Description: Add the scan step suffix (_stepNNN, _stepNNNs for settling) to a histogram file name
+// Inputs:		fname = file name (modified)
+//				step = step id (-1 = no suffix)
+//				settling = 1 if the segment was taken while the conditions were settling
+// --------------------------------------------------------------------------------------------------------- 
+static void AddStepSuffix(char *fname, int step, int settling) {
+	char ext[16], *dot;
+	if (step < 0)
+		return;
+	dot = strrchr(fname, '.');
+	if (dot == NULL || strlen(dot) >= sizeof(ext))
+		return;
+	strcpy(ext, dot);
+	sprintf(dot, "_step%03d%s%s", step, settling ? "s" : "", ext);
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Append the energy or time histogram of one channel to the open histogram archive
+// Inputs:		type = HARC_TYPE_ENERGY or HARC_TYPE_TIME
+//				b, ch, step, settling = see SaveChannelHistograms
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+static int ArchiveChannelHistogram(int type, int b, int ch, int step, int settling) {
+	HArchiveRecord_t r;
+	WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	const WaveDemoMarker_t *m = GetChannelMarker(b, ch);
+
+	memset(&r, 0, sizeof(r));
+	r.Type = (uint16_t)type;
+	r.Board = (int16_t)b;
+	r.Channel = (int16_t)ch;
+	r.Step = step;
+	r.Flags = settling ? HARC_FLAG_SETTLING : 0;
+	if (m != NULL && m->HasHV) {
+		r.Flags |= HARC_FLAG_HV;
+		r.HVset = m->HVset;
+		r.HVmon = m->HVmon;
+	}
+	r.Threshold = WDc->TriggerThreshold_V;
+	if (type == HARC_TYPE_ENERGY) {
+		strcpy(r.Name, "energy");
+		strcpy(r.Unit, "ch");
+		r.Xmin = 0;
+		r.Xmax = WDcfg.EHnbin;
+		r.CalibM = WDc->ECalibration_m;
+		r.CalibQ = WDc->ECalibration_q;
+		return ArchiveHistogram(&r, &WDhistos.EH[b][ch]);
+	}
+	strcpy(r.Name, "time");
+	strcpy(r.Unit, "ns");
+	r.Xmin = WDcfg.THmin;
+	r.Xmax = WDcfg.THmax;
+	return ArchiveHistogram(&r, &WDhistos.TH[b][ch]);
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Save the histograms of one channel to output file
+// Inputs:		b = board index
+//				ch = channel
+//				step = scan step id of the histogram content (-1 = whole run)
+//				settling = 1 if the step segment is flagged as settling
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int SaveChannelHistograms(int b, int ch, int step, int settling) {
+	int ret = 0;
+	char fname[300];
+
+	if (WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_HARCHIVE, 0, 0, fname);
+		if (BeginHistoArchive(fname) < 0) {
+			EndHistoArchive();
+			return -1;
+		}
+		if (WDcfg.SaveHistograms & 0x1)
+			ret |= ArchiveChannelHistogram(HARC_TYPE_ENERGY, b, ch, step, settling);
+		if (WDcfg.SaveHistograms & 0x2)
+			ret |= ArchiveChannelHistogram(HARC_TYPE_TIME, b, ch, step, settling);
+		ret |= EndHistoArchive();
+		return ret;
+	}
+	if (WDcfg.SaveHistograms & 0x1) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_EHISTO, b, ch, fname);
+		AddStepSuffix(fname, step, settling);
+		ret |= SaveHistogram(fname, WDhistos.EH[b][ch]);
+	}
+	if (WDcfg.SaveHistograms & 0x2) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_THISTO, b, ch, fname);
+		AddStepSuffix(fname, step, settling);
+		ret |= SaveHistogram(fname, WDhistos.TH[b][ch]);
+	}
+	return ret;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Save all histograms to output file. With scan step markers, the histograms contain only
+//				the current step segment of each channel and are saved with the step suffix.
 // Return:		0=OK, -1=error
 // --------------------------------------------------------------------------------------------------------- 
 int SaveAllHistograms() {
 	int b, ch, ret = 0;
+	int step, settling;
 	char fname[300];
 
+	// one open of the archive for all the histograms
+	if (WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_HARCHIVE, 0, 0, fname);
+		ret |= BeginHistoArchive(fname);
+	}
 	/* Save Histograms to file for each board/channel */
 	for (b = 0; b < WDcfg.NumBoards; b++) {
 		for (ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
 			if (WDcfg.boards[b].channels[ch].ChannelEnable) {
-				if (WDcfg.SaveHistograms & 0x1) {
-					CreateOutputFileName(OUTPUTFILE_TYPE_EHISTO, b, ch, fname);
-					ret |= SaveHistogram(fname, WDhistos.EH[b][ch]);
-				}
-				if (WDcfg.SaveHistograms & 0x2) {
-					CreateOutputFileName(OUTPUTFILE_TYPE_THISTO, b, ch, fname);
-					ret |= SaveHistogram(fname, WDhistos.TH[b][ch]);
-				}
+				step = GetChannelStep(b, ch, &settling);
+				ret |= SaveChannelHistograms(b, ch, step, settling);
 			}
 		}
 	}
+	ret |= SavePluginHistograms();
+	if (WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE)
+		ret |= EndHistoArchive();
 	return ret;
 }
 
+// Open the markers file and write the header (if not already open)
+static int OpenMarkersFile() {
+	char fname[300];
+
+	if (WDrun.fmarkers == NULL) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_MARKERS, 0, 0, fname);
+		WDrun.fmarkers = fopen(fname, "w");
+		if (WDrun.fmarkers == NULL)
+			return -1;
+		fprintf(WDrun.fmarkers, "#%5s %8s %20s %20s %10s %10s %10s %s\n", "Step", "Settling", "HostTime(ms)", "BoardTime(ns)", "HVset", "HVmon", "Thr(V)", "Label");
+	}
+	return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Append a scan step marker to the markers file
+// Inputs:		m = marker
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int SaveMarker(const WaveDemoMarker_t *m) {
+	if (OpenMarkersFile() < 0)
+		return -1;
+	// one board time per board, separated by commas
+	fprintf(WDrun.fmarkers, "%6d %8d %20llu ", m->StepId, m->Settling, (unsigned long long)m->HostTime);
+	for (int b = 0; b < WDcfg.NumBoards; b++)
+		fprintf(WDrun.fmarkers, b == 0 ? "%20llu" : ",%llu", (unsigned long long)m->BoardTime[b]);
+	fprintf(WDrun.fmarkers, " ");
+	if (m->HasHV)	fprintf(WDrun.fmarkers, "%10.2f %10.2f ", m->HVset, m->HVmon);
+	else			fprintf(WDrun.fmarkers, "%10s %10s ", "-", "-");
+	if (m->HasThreshold)	fprintf(WDrun.fmarkers, "%10.4f ", m->Threshold);
+	else					fprintf(WDrun.fmarkers, "%10s ", "-");
+	fprintf(WDrun.fmarkers, "%s\n", m->Label[0] ? m->Label : "-");
+	fflush(WDrun.fmarkers);
+	return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Write a scan step marker line into the ASCII list and waveform files of one channel,
+//				so that the data can be segmented when reading the files back.
+//				Binary files are not modified (use the markers file and the board time stamps).
+// Inputs:		b = board index
+//				ch = channel
+//				m = marker
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int SaveMarkerInStreams(int b, int ch, const WaveDemoMarker_t *m) {
+	WaveDemoBoardRun_t *WDr = &WDcfg.runs[b];
+	if (WDcfg.OutFileFormat != OUTFILE_ASCII)
+		return 0;
+	if (WDr->flist[ch] != NULL)
+		fprintf(WDr->flist[ch], "# MARKER step=%d settling=%d board_time_ns=%llu\n", m->StepId, m->Settling, (unsigned long long)m->BoardTime[b]);
+	if (WDr->fwave[ch] != NULL)
+		fprintf(WDr->fwave[ch], "# MARKER step=%d settling=%d board_time_ns=%llu\n", m->StepId, m->Settling, (unsigned long long)m->BoardTime[b]);
+	return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Append a data discontinuity (recovery of a board after a readout error) to the markers file
+//				as a comment line, so that the step markers keep their format
+// Inputs:		d = discontinuity
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int SaveDiscontinuity(const WaveDemoDiscontinuity_t *d) {
+	if (OpenMarkersFile() < 0)
+		return -1;
+	fprintf(WDrun.fmarkers, "# DISCONTINUITY board=%d all_boards=%d host_time_ms=%llu board_time_ns=%llu dead_time_ms=%llu attempts=%d reason=%s\n",
+		d->Board, d->AllBoards, (unsigned long long)d->HostTime, (unsigned long long)d->BoardTime, (unsigned long long)d->DeadTime, d->Attempts, d->Reason);
+	fflush(WDrun.fmarkers);
+	return 0;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Write a data discontinuity line into the ASCII list and waveform files of one channel
+// Inputs:		b = board index
+//				ch = channel
+//				d = discontinuity
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int SaveDiscontinuityInStreams(int b, int ch, const WaveDemoDiscontinuity_t *d) {
+	WaveDemoBoardRun_t *WDr = &WDcfg.runs[b];
+	if (WDcfg.OutFileFormat != OUTFILE_ASCII)
+		return 0;
+	if (WDr->flist[ch] != NULL)
+		fprintf(WDr->flist[ch], "# DISCONTINUITY board_time_ns=%llu dead_time_ms=%llu\n", (unsigned long long)d->BoardTime, (unsigned long long)d->DeadTime);
+	if (WDr->fwave[ch] != NULL)
+		fprintf(WDr->fwave[ch], "# DISCONTINUITY board_time_ns=%llu dead_time_ms=%llu\n", (unsigned long long)d->BoardTime, (unsigned long long)d->DeadTime);
+	return 0;
+}
+
 // --------------------------------------------------------------------------------------------------------- 
 // Description: Save one event to the List file
 // Inputs:		bd = board index
@@ -641,9 +935,9 @@ int SaveList(int bd, int ch, WaveDemoEvent_t *event) {
 	if (WDr->flist[ch] == NULL) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_LIST, bd, ch, fname);
 		if (WDcfg.OutFileFormat == OUTFILE_ASCII)
-			WDr->flist[ch] = fopen(fname, "w");
+			WDr->flist[ch] = OpenOutputFile(fname, "w");
 		else
-			WDr->flist[ch] = fopen(fname, "wb");
+			WDr->flist[ch] = OpenOutputFile(fname, "wb");
 		if (WDr->flist[ch] == NULL)
 			return -1;
 		new_file = true;
@@ -651,9 +945,9 @@ int SaveList(int bd, int ch, WaveDemoEvent_t *event) {
 	if ((WDcfg.SaveLists & 0x2) && (WDrun.flist_merged == NULL)) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_LIST_MERGED, 0, 0, fname);
 		if (WDcfg.OutFileFormat == OUTFILE_ASCII)
-			WDrun.flist_merged = fopen(fname, "w");
+			WDrun.flist_merged = OpenOutputFile(fname, "w");
 		else
-			WDrun.flist_merged = fopen(fname, "wb");
+			WDrun.flist_merged = OpenOutputFile(fname, "wb");
 		if (WDrun.flist_merged == NULL)
 			return -1;
 	}
@@ -730,9 +1024,9 @@ int SaveWaveform(int bd, int ch, WaveDemoEvent_t *event) {
 	if (WDr->fwave[ch] == NULL) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_WAVE, bd, ch, fname);
 		if (WDcfg.OutFileFormat == OUTFILE_BINARY)
-			WDr->fwave[ch] = fopen(fname, "wb");
+			WDr->fwave[ch] = OpenOutputFile(fname, "wb");
 		else
-			WDr->fwave[ch] = fopen(fname, "w");
+			WDr->fwave[ch] = OpenOutputFile(fname, "w");
 	}
 	if (WDr->fwave[ch] == NULL)
 		return -1;
@@ -747,9 +1041,9 @@ int SaveWaveform(int bd, int ch, WaveDemoEvent_t *event) {
 
 		CreateOutputFileName(OUTPUTFILE_TYPE_WAVE, bd, ch, fname);
 		if (WDcfg.OutFileFormat == OUTFILE_BINARY)
-			WDr->fwave[ch] = fopen(fname, "wb");
+			WDr->fwave[ch] = OpenOutputFile(fname, "wb");
 		else
-			WDr->fwave[ch] = fopen(fname, "w");
+			WDr->fwave[ch] = OpenOutputFile(fname, "w");
 
 		if (WDr->fwave[ch] == NULL)
 			return -1;
@@ -799,7 +1093,7 @@ int SaveRunInfo(char *ConfigFileName) {
 	fprintf(rinf, "-----------------------------------------------------------------\n");
 	fprintf(rinf, "Acquisition started at %s\n", WDstats.AcqStartTimeString);
 	fprintf(rinf, "Acquisition stopped at %s\n", WDstats.AcqStopTimeString);
-	fprintf(rinf, "Acquisition stopped after %.2f s (RealTime)\n", WDstats.AcqStopTime / 1000);
+	fprintf(rinf, "Acquisition stopped after %.2f s (RealTime)\n", (double)WDstats.AcqStopTime / NS_PER_S);
 	fprintf(rinf, "Total processed events = %llu\n", WDstats.TotEvRead_cnt);
 	fprintf(rinf, "Total bytes = %.4f MB\n", (float)WDstats.RxByte_cnt / (1024 * 1024));
 	for (b = 0; b < WDcfg.NumBoards; b++) {
@@ -842,16 +1136,25 @@ void PrintOutputFilesSummary() {
 	if (WDcfg.SaveRunInfo) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_RUN_INFO, 0, 0, fname);
 		printf("  %s\n", fname);
+		StatusFile("run_info", -1, -1, fname);
 	}
 	// Raw data
 	if (WDcfg.SaveRawData) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_RAW, 0, 0, fname);
 		printf("  %s\n", fname);
+		StatusFile("raw", -1, -1, fname);
 	}
 	// Merged list file
 	if (WDcfg.SaveLists & 0x2) {
 		CreateOutputFileName(OUTPUTFILE_TYPE_LIST_MERGED, 0, 0, fname);
 		printf("  %s\n", fname);
+		StatusFile("list_merged", -1, -1, fname);
+	}
+	// Histogram archive
+	if (WDcfg.SaveHistograms && WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE) {
+		CreateOutputFileName(OUTPUTFILE_TYPE_HARCHIVE, 0, 0, fname);
+		printf("  %s\n", fname);
+		StatusFile("histo_archive", -1, -1, fname);
 	}
 	// Per channel files
 	for (b = 0; b < WDcfg.NumBoards; b++) {
@@ -861,22 +1164,27 @@ void PrintOutputFilesSummary() {
 			if (WDcfg.SaveTDCList) {
 				CreateOutputFileName(OUTPUTFILE_TYPE_TDCLIST, b, ch, fname);
 				printf("  %s\n", fname);
+				StatusFile("tdc_list", b, ch, fname);
 			}
 			if (WDcfg.SaveLists & 0x1) {
 				CreateOutputFileName(OUTPUTFILE_TYPE_LIST, b, ch, fname);
 				printf("  %s\n", fname);
+				StatusFile("list", b, ch, fname);
 			}
 			if (WDcfg.SaveWaveforms) {
 				CreateOutputFileName(OUTPUTFILE_TYPE_WAVE, b, ch, fname);
 				printf("  %s\n", fname);
+				StatusFile("wave", b, ch, fname);
 			}
-			if (WDcfg.SaveHistograms & 0x1) {
+			if ((WDcfg.SaveHistograms & 0x1) && WDcfg.HistoOutputFormat != HISTO_FILE_FORMAT_ARCHIVE) {
 				CreateOutputFileName(OUTPUTFILE_TYPE_EHISTO, b, ch, fname);
 				printf("  %s\n", fname);
+				StatusFile("ehisto", b, ch, fname);
 			}
-			if (WDcfg.SaveHistograms & 0x2) {
+			if ((WDcfg.SaveHistograms & 0x2) && WDcfg.HistoOutputFormat != HISTO_FILE_FORMAT_ARCHIVE) {
 				CreateOutputFileName(OUTPUTFILE_TYPE_THISTO, b, ch, fname);
 				printf("  %s\n", fname);
+				StatusFile("thisto", b, ch, fname);
 			}
 		}
 	}
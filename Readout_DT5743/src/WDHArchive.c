@@ -0,0 +1,111 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDHArchive.h"
+#include "WDLogs.h"
+
+#include <time.h>
+
+static FILE *fArchive = NULL;
+static int Depth = 0;			// nesting level of BeginHistoArchive
+static int Error = 0;			// write error since the outermost BeginHistoArchive
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// check the header of an existing archive
+static int CheckHeader(const char *fname)
+{
+	HArchiveHeader_t h;
+	FILE *f = fopen(fname, "rb");
+	int ret;
+
+	if (f == NULL)
+		return 1;	// not present
+	ret = (fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.Magic, HARC_MAGIC, 8) == 0 &&
+		h.HeaderSize == sizeof(HArchiveHeader_t) && h.RecordSize == sizeof(HArchiveRecord_t)) ? 0 : -1;
+	fclose(f);
+	return ret;
+}
+
+int BeginHistoArchive(const char *fname)
+{
+	HArchiveHeader_t h;
+	int ret;
+
+	if (Depth++ > 0)
+		return (fArchive != NULL) ? 0 : -1;
+	Error = 0;
+	ret = CheckHeader(fname);
+	if (ret < 0) {
+		msg_printf(MsgLog, "WARN: %s is not a histogram archive of this version; it is overwritten\n", fname);
+		remove(fname);
+		ret = 1;
+	}
+	fArchive = fopen(fname, "ab");
+	if (fArchive == NULL) {
+		msg_printf(MsgLog, "ERROR: Can't open the histogram archive %s\n", fname);
+		return -1;
+	}
+	setvbuf(fArchive, NULL, _IOFBF, HARC_BUFFER_SIZE);
+	if (ret == 1) {
+		memset(&h, 0, sizeof(h));
+		memcpy(h.Magic, HARC_MAGIC, 8);
+		h.HeaderSize = sizeof(HArchiveHeader_t);
+		h.RecordSize = sizeof(HArchiveRecord_t);
+		h.RunNumber = WDcfg.RunNumber;
+		h.CreationTime = (uint64_t)time(NULL);
+		snprintf(h.StartTime, sizeof(h.StartTime), "%s", WDstats.AcqStartTimeString);
+		strcpy(h.Software, "WaveDemo x743");
+		if (fwrite(&h, sizeof(h), 1, fArchive) != 1)
+			Error = 1;
+	}
+	return 0;
+}
+
+int EndHistoArchive()
+{
+	if (Depth == 0)
+		return -1;
+	if (--Depth > 0)
+		return 0;
+	if (fArchive == NULL)
+		return -1;
+	if (fclose(fArchive) != 0)
+		Error = 1;
+	fArchive = NULL;
+	if (Error)
+		msg_printf(MsgLog, "ERROR: Write error in the histogram archive\n");
+	return Error ? -1 : 0;
+}
+
+int ArchiveHistogram(HArchiveRecord_t *r, const Histogram1D_t *Histo)
+{
+	if (fArchive == NULL || Histo->H_data == NULL)
+		return -1;
+	r->Magic = HARC_RECORD_MAGIC;
+	r->Nbin = Histo->Nbin;
+	r->Entries = Histo->H_cnt;
+	r->Overflow = Histo->Ovf_cnt;
+	r->Underflow = Histo->Unf_cnt;
+	r->SaveTime = (uint64_t)time(NULL);
+	if (fwrite(r, sizeof(*r), 1, fArchive) != 1 ||
+		fwrite(Histo->H_data, sizeof(uint32_t), Histo->Nbin, fArchive) != Histo->Nbin) {
+		Error = 1;
+		return -1;
+	}
+	return 0;
+}
@@ -15,7 +15,7 @@
 
 #include "WDHisto.h"
 
-static int CreateHistogram1D(int Nbin, char *Title, char *Xlabel, char *Ylabel, Histogram1D_t *Histo) {
+int CreateHistogram1D(int Nbin, char *Title, char *Xlabel, char *Ylabel, Histogram1D_t *Histo) {
 	Histo->H_data = (uint32_t *)malloc(Nbin * sizeof(uint32_t));
 	Histo->Nbin = Nbin;
 	Histo->H_cnt = 0;
@@ -42,13 +42,13 @@ static int DestroyHistogram2D(Histogram2D_t Histo) {
 	return 0;
 }
 
-static int DestroyHistogram1D(Histogram1D_t Histo) {
+int DestroyHistogram1D(Histogram1D_t Histo) {
 	free(Histo.H_data);
 	Histo.H_data = NULL;
 	return 0;
 }
 
-static int ResetHistogram1D(Histogram1D_t *Histo) {
+int ResetHistogram1D(Histogram1D_t *Histo) {
 	memset(Histo->H_data, 0, Histo->Nbin * sizeof(uint32_t));
 	Histo->H_cnt = 0;
 	Histo->Ovf_cnt = 0;
@@ -124,6 +124,18 @@ int ResetHistograms()
 	return 0;
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// Description: Reset the histograms of one channel
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int ResetChannelHistograms(int b, int ch)
+{
+	if (WDhistos.EH[b][ch].H_data == NULL || WDhistos.TH[b][ch].H_data == NULL)
+		return -1;
+	ResetHistogram1D(&WDhistos.EH[b][ch]);
+	ResetHistogram1D(&WDhistos.TH[b][ch]);
+	return 0;
+}
 
 // --------------------------------------------------------------------------------------------------------- 
 // Description: Add one count to the histogram 1D
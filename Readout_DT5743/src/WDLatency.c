@@ -0,0 +1,168 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDLatency.h"
+#include "WDClock.h"
+#include "WDLogs.h"
+
+// Map from board time to host time of one board: host(us) = y0 + a + b * (t(ns) - x0) + Envelope.
+// Written by the readout stage, read by the other stages (a stale value only changes the latency by the drift
+// of one block).
+typedef struct {
+	double S, Sx, Sy, Sxx, Sxy;		// weighted sums of the fit (x = board time in ns, y = host time in us)
+	double x0, y0;					// origin of the fit (first block)
+	double a, b;					// fit parameters
+	double Res[LAT_ENVELOPE];		// residuals of the last blocks
+	int Nres;
+	double Envelope;				// min of Res
+	volatile int Valid;
+} LatencyFit_t;
+
+static const char *StageNames[LAT_NSTAGES] = { "read", "decoded", "processed", "histogrammed", "written", "published" };
+static LatencyFit_t Fit[MAX_BD];
+static uint32_t Histo[LAT_NSTAGES][MAX_BD][LAT_NBINS];
+static uint64_t Count[LAT_NSTAGES][MAX_BD];
+static uint64_t MaxLat[LAT_NSTAGES][MAX_BD];
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+uint64_t LatencyClock()
+{
+	return (uint64_t)(HostClockNs() / NS_PER_US);
+}
+
+void ResetLatency()
+{
+	memset(Fit, 0, sizeof(Fit));
+	memset(Histo, 0, sizeof(Histo));
+	memset(Count, 0, sizeof(Count));
+	memset(MaxLat, 0, sizeof(MaxLat));
+}
+
+void LatencyBlockRead(int b, uint64_t ReadTime, uint64_t TDC)
+{
+	LatencyFit_t *F = &Fit[b];
+	double x, y, det, r;
+
+	if (!WDcfg.LatencyTracking)
+		return;
+	if (F->S == 0) {
+		F->x0 = (double)TDC * 5;
+		F->y0 = (double)ReadTime;
+	}
+	x = (double)TDC * 5 - F->x0;
+	y = (double)ReadTime - F->y0;
+	F->S = LAT_FIT_LAMBDA * F->S + 1;
+	F->Sx = LAT_FIT_LAMBDA * F->Sx + x;
+	F->Sy = LAT_FIT_LAMBDA * F->Sy + y;
+	F->Sxx = LAT_FIT_LAMBDA * F->Sxx + x * x;
+	F->Sxy = LAT_FIT_LAMBDA * F->Sxy + x * y;
+	det = F->S * F->Sxx - F->Sx * F->Sx;
+	if (det > 0 && F->Sxx > 0) {
+		F->b = (F->S * F->Sxy - F->Sx * F->Sy) / det;
+		F->a = (F->Sy - F->b * F->Sx) / F->S;
+	}
+	else {
+		F->b = 1e-3;	// 1 us every 1000 ns until the fit has two different points
+		F->a = y - F->b * x;
+	}
+
+	// lower envelope of the arrivals (residuals of the last blocks)
+	r = y - (F->a + F->b * x);
+	F->Res[F->Nres++ % LAT_ENVELOPE] = r;
+	F->Envelope = r;
+	for (int i = 0; i < LAT_ENVELOPE && i < F->Nres; i++)
+		if (F->Res[i] < F->Envelope)
+			F->Envelope = F->Res[i];
+	F->Valid = 1;
+}
+
+void LatencyRecord(int stage, int b, const WaveDemoEvent_t *event, int ch)
+{
+	LatencyFit_t *F = &Fit[b];
+	uint64_t now, lat;
+	double trigger;
+	int g = ch / 2, bin;
+
+	if (!WDcfg.LatencyTracking || !F->Valid)
+		return;
+	if (ch < 0)
+		for (g = 0; g < MAX_V1743_GROUP_SIZE - 1 && !event->Event->GrPresent[g]; g++);
+	now = (stage == LAT_READ) ? event->ReadTime : LatencyClock();
+	trigger = F->y0 + F->a + F->b * ((double)event->Event->DataGroup[g].TDC * 5 - F->x0) + F->Envelope;
+	lat = ((double)now > trigger) ? (uint64_t)((double)now - trigger) : 0;
+
+	bin = (lat > 0) ? (int)(LAT_BINS_PER_OCTAVE * log2((double)lat + 1)) : 0;
+	if (bin >= LAT_NBINS)
+		bin = LAT_NBINS - 1;
+	Histo[stage][b][bin]++;
+	Count[stage][b]++;
+	if (lat > MaxLat[stage][b])
+		MaxLat[stage][b] = lat;
+}
+
+const char *LatencyStageName(int stage)
+{
+	return (stage >= 0 && stage < LAT_NSTAGES) ? StageNames[stage] : "";
+}
+
+// upper edge of a latency bin in ms
+static float BinEdge(int bin)
+{
+	return (float)((pow(2.0, (double)(bin + 1) / LAT_BINS_PER_OCTAVE) - 1) / 1000);
+}
+
+uint64_t GetLatencySummary(int stage, int b, LatencySummary_t *s)
+{
+	uint64_t n = Count[stage][b], sum = 0;
+	float *p[3] = { &s->P50, &s->P90, &s->P99 };
+	double q[3] = { 0.50, 0.90, 0.99 };
+	int k = 0;
+
+	memset(s, 0, sizeof(*s));
+	s->Count = n;
+	if (n == 0)
+		return 0;
+	for (int bin = 0; bin < LAT_NBINS && k < 3; bin++) {
+		sum += Histo[stage][b][bin];
+		while (k < 3 && sum >= q[k] * n)
+			*p[k++] = BinEdge(bin);
+	}
+	s->Max = (float)MaxLat[stage][b] / 1000;
+	// the bin edges can exceed the max
+	for (k = 0; k < 3; k++)
+		if (*p[k] > s->Max)
+			*p[k] = s->Max;
+	return n;
+}
+
+void PrintLatencyStats()
+{
+	LatencySummary_t s;
+
+	if (!WDcfg.LatencyTracking)
+		return;
+	msg_printf(MsgLog, "INFO: Latency (ms) board stage             events        p50        p90        p99        max\n");
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int st = 0; st < LAT_NSTAGES; st++) {
+			if (GetLatencySummary(st, b, &s) == 0)
+				continue;
+			msg_printf(MsgLog, "INFO:   %13d %-13s %10llu %10.3f %10.3f %10.3f %10.3f\n", b, StageNames[st],
+				(unsigned long long)s.Count, s.P50, s.P90, s.P99, s.Max);
+		}
+	}
+}
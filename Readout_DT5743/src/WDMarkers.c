@@ -0,0 +1,263 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDMarkers.h"
+#include "WDClock.h"
+#include "WDFiles.h"
+#include "WDHisto.h"
+#include "WDLogs.h"
+#include "WDPipeline.h"
+#include "WDStatus.h"
+#include "WDWaveformProcess.h"
+
+static FILE *fMarkerIn = NULL;						// marker input file (written by the control side)
+static WaveDemoMarker_t Markers[MAX_STEP_MARKERS];	// markers received in the current run
+static int NumMarkers = 0;
+static int ChNext[MAX_BD][MAX_CH];					// index of the next marker to apply for each channel
+static int ChStep[MAX_BD][MAX_CH];					// current step of each channel
+static int ChSettling[MAX_BD][MAX_CH];				// current step of each channel is settling
+static int EndRequested = 0;
+static int64_t LastPollTime = 0;
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: newest time stamp (ns) read from the enabled channels of each board (the boards may not be
+//				synchronized: each one is compared with its own time stamps)
+// Outputs:		t = time of each board
+// ---------------------------------------------------------------------------------------------------------
+static void LatestBoardTimes(uint64_t *t)
+{
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		t[b] = 0;
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++)
+			if (WDcfg.boards[b].channels[ch].ChannelEnable && WDstats.LatestReadTstamp[b][ch] > t[b])
+				t[b] = WDstats.LatestReadTstamp[b][ch];
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: program the trigger threshold of the enabled channels of one board (takes effect immediately,
+//				while the software threshold is switched per channel when the step begins in the data)
+// ---------------------------------------------------------------------------------------------------------
+static int ProgramBoardThreshold(int b, float Threshold)
+{
+	WaveDemoBoard_t *WDb = &WDcfg.boards[b];
+	int ret = 0;
+	for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+		if (!WDb->channels[ch].ChannelEnable)
+			continue;
+		float valF = Threshold + WDb->channels[ch].DCOffset_V;
+		int reg_val = (int)((MAX_DAC_RAW_VALUE - valF) / (MAX_DAC_RAW_VALUE - MIN_DAC_RAW_VALUE) * 65535);  // Inverted Range
+		ret |= CAEN_DGTZ_SetChannelTriggerThreshold(WDcfg.handles[b].handle, ch, reg_val);
+	}
+	return ret;
+}
+
+static int ProgramThreshold(float Threshold)
+{
+	int ret = 0;
+	for (int b = 0; b < WDcfg.NumBoards; b++)
+		ret |= ProgramBoardThreshold(b, Threshold);
+	return ret;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: parse one line of the marker input file
+// Return:		1=marker, 0=no marker (comment, empty line or end command), -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int ParseMarkerLine(char *line, WaveDemoMarker_t *m)
+{
+	char *tok, *val;
+	int has_step = 0;
+
+	memset(m, 0, sizeof(*m));
+	tok = strtok(line, " \t\r\n");
+	if (tok == NULL || tok[0] == '#')
+		return 0;
+	if (strcmp(tok, "end") == 0) {
+		EndRequested = 1;
+		return 0;
+	}
+	for (; tok != NULL; tok = strtok(NULL, " \t\r\n")) {
+		val = strchr(tok, '=');
+		if (val == NULL)
+			return -1;
+		*val++ = '\0';
+		if (strcmp(tok, "step") == 0) {
+			m->StepId = atoi(val);
+			has_step = 1;
+		}
+		else if (strcmp(tok, "settling") == 0) {
+			m->Settling = atoi(val) ? 1 : 0;
+		}
+		else if (strcmp(tok, "hv") == 0) {
+			m->HVset = (float)atof(val);
+			m->HasHV = 1;
+		}
+		else if (strcmp(tok, "hv_mon") == 0) {
+			m->HVmon = (float)atof(val);
+			m->HasHV = 1;
+		}
+		else if (strcmp(tok, "thr") == 0) {
+			m->Threshold = (float)atof(val);
+			m->HasThreshold = 1;
+		}
+		else if (strcmp(tok, "label") == 0) {
+			strncpy(m->Label, val, sizeof(m->Label) - 1);
+		}
+	}
+	return has_step ? 1 : -1;
+}
+
+int OpenStepMarkers(const char *path)
+{
+	CloseStepMarkers();
+	fMarkerIn = fopen(path, "r");
+	if (fMarkerIn == NULL) {
+		// create an empty file that the control side will append to
+		FILE *f = fopen(path, "a");
+		if (f != NULL)
+			fclose(f);
+		fMarkerIn = fopen(path, "r");
+	}
+	if (fMarkerIn == NULL)
+		return -1;
+	ResetStepMarkers();
+	return 0;
+}
+
+void CloseStepMarkers()
+{
+	if (fMarkerIn != NULL)
+		fclose(fMarkerIn);
+	fMarkerIn = NULL;
+}
+
+int StepMarkersEnabled()
+{
+	return fMarkerIn != NULL;
+}
+
+void ResetStepMarkers()
+{
+	NumMarkers = 0;
+	EndRequested = 0;
+	LastPollTime = 0;
+	memset(ChNext, 0, sizeof(ChNext));
+	memset(ChStep, 0, sizeof(ChStep));
+	memset(ChSettling, 0, sizeof(ChSettling));
+}
+
+int PollStepMarkers(int64_t CurrentTime)
+{
+	char line[256];
+	long pos;
+	int nnew = 0;
+	WaveDemoMarker_t m;
+
+	if (fMarkerIn == NULL || (CurrentTime - LastPollTime) < MARKER_POLL_PERIOD * NS_PER_MS)
+		return 0;
+	LastPollTime = CurrentTime;
+
+	clearerr(fMarkerIn);
+	pos = ftell(fMarkerIn);
+	while (fgets(line, sizeof(line), fMarkerIn) != NULL) {
+		if (strchr(line, '\n') == NULL) {
+			// incomplete line (the control side is still writing): retry at the next poll
+			fseek(fMarkerIn, pos, SEEK_SET);
+			break;
+		}
+		pos = ftell(fMarkerIn);
+		int ret = ParseMarkerLine(line, &m);
+		if (ret < 0) {
+			msg_printf(MsgLog, "WARN: Invalid step marker ignored\n");
+			continue;
+		}
+		if (ret == 0)
+			continue;
+		if (NumMarkers >= MAX_STEP_MARKERS) {
+			msg_printf(MsgLog, "WARN: Too many step markers (max %d); marker for step %d ignored\n", MAX_STEP_MARKERS, m.StepId);
+			continue;
+		}
+		// the time stamps and the board registers are shared with the readout thread: pause it (resumed by the next PipelineStep)
+		PipelinePauseReadout();
+		m.HostTime = WallClockMs();
+		LatestBoardTimes(m.BoardTime);
+		if (m.HasThreshold && ProgramThreshold(m.Threshold) != 0)
+			msg_printf(MsgLog, "WARN: Can't program the trigger threshold for step %d\n", m.StepId);
+		Markers[NumMarkers++] = m;
+		SaveMarker(&m);
+		StatusMarker(&m);
+		nnew++;
+	}
+	clearerr(fMarkerIn);
+	return nnew;
+}
+
+int ApplyStepMarkers(int b, int ch, uint64_t EventTime)
+{
+	int ret = 0;
+	while (ChNext[b][ch] < NumMarkers && EventTime > Markers[ChNext[b][ch]].BoardTime[b]) {
+		WaveDemoMarker_t *m = &Markers[ChNext[b][ch]];
+		// close the current segment of this channel
+		if (WDcfg.SaveHistograms)
+			ret |= SaveChannelHistograms(b, ch, ChStep[b][ch], ChSettling[b][ch]);
+		ResetChannelHistograms(b, ch);
+		// open the new one
+		ChStep[b][ch] = m->StepId;
+		ChSettling[b][ch] = m->Settling;
+		if (m->HasThreshold) {
+			WDcfg.boards[b].channels[ch].TriggerThreshold_V = m->Threshold;
+			UpdateChannelThreshold(b, ch);
+		}
+		SaveMarkerInStreams(b, ch, m);
+		ChNext[b][ch]++;
+	}
+	return ret;
+}
+
+int GetChannelStep(int b, int ch, int *settling)
+{
+	if (fMarkerIn == NULL) {
+		*settling = 0;
+		return -1;
+	}
+	*settling = ChSettling[b][ch];
+	return ChStep[b][ch];
+}
+
+const WaveDemoMarker_t *GetChannelMarker(int b, int ch)
+{
+	if (fMarkerIn == NULL || ChNext[b][ch] == 0)
+		return NULL;
+	return &Markers[ChNext[b][ch] - 1];
+}
+
+int StepMarkersEndRequested()
+{
+	return EndRequested;
+}
+
+int RestoreStepThreshold(int b)
+{
+	// the newest threshold sent by the control side (ProgramBoard wrote the one of the configuration)
+	for (int i = NumMarkers - 1; i >= 0; i--)
+		if (Markers[i].HasThreshold)
+			return ProgramBoardThreshold(b, Markers[i].Threshold);
+	return 0;
+}
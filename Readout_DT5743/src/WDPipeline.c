@@ -0,0 +1,554 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDPipeline.h"
+#include "WDBuffers.h"
+#include "WDClock.h"
+#include "WDPlugins.h"
+#include "WDLogs.h"
+
+#ifdef WIN32
+	#define THREAD_T				HANDLE
+	#define THREAD_FN(name)			DWORD WINAPI name(LPVOID arg)
+	#define THREAD_RETURN			return 0
+	#define THREAD_CREATE(t, fn, a)	(((t) = CreateThread(NULL, 0, fn, a, 0, NULL)) != NULL ? 0 : -1)
+	#define THREAD_JOIN(t)			{ WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+	#define MUTEX_T					CRITICAL_SECTION
+	#define MUTEX_INIT(m)			InitializeCriticalSection(&(m))
+	#define MUTEX_DESTROY(m)		DeleteCriticalSection(&(m))
+	#define LOCK(m)					EnterCriticalSection(&(m))
+	#define UNLOCK(m)				LeaveCriticalSection(&(m))
+	#define COND_T					CONDITION_VARIABLE
+	#define COND_INIT(c)			InitializeConditionVariable(&(c))
+	#define COND_DESTROY(c)
+	#define COND_WAIT(c, m)			SleepConditionVariableCS(&(c), &(m), INFINITE)
+	#define COND_WAKE_ALL(c)		WakeAllConditionVariable(&(c))
+#else
+	#include <pthread.h>
+	#define THREAD_T				pthread_t
+	#define THREAD_FN(name)			void *name(void *arg)
+	#define THREAD_RETURN			return NULL
+	#define THREAD_CREATE(t, fn, a)	(pthread_create(&(t), NULL, fn, a) == 0 ? 0 : -1)
+	#define THREAD_JOIN(t)			pthread_join(t, NULL)
+	#define MUTEX_T					pthread_mutex_t
+	#define MUTEX_INIT(m)			pthread_mutex_init(&(m), NULL)
+	#define MUTEX_DESTROY(m)		pthread_mutex_destroy(&(m))
+	#define LOCK(m)					pthread_mutex_lock(&(m))
+	#define UNLOCK(m)				pthread_mutex_unlock(&(m))
+	#define COND_T					pthread_cond_t
+	#define COND_INIT(c)			pthread_cond_init(&(c), NULL)
+	#define COND_DESTROY(c)			pthread_cond_destroy(&(c))
+	#define COND_WAIT(c, m)			pthread_cond_wait(&(c), &(m))
+	#define COND_WAKE_ALL(c)		pthread_cond_broadcast(&(c))
+#endif
+
+static PipelineStageStats_t Stats[PSTAGE_NUM] = {
+	[PSTAGE_READOUT] = { .Name = "readout", .Threads = 1 },
+	[PSTAGE_PROCESS] = { .Name = "process", .Threads = 1 },
+	[PSTAGE_PLUGINS] = { .Name = "plugins", .Threads = 1 },
+};
+static PipelineReadoutFn_t Readout = NULL;
+static PipelineProcessFn_t Process = NULL;
+static int Initialized = 0;
+
+// Readout thread (THREADED mode)
+static THREAD_T ReadoutThread;
+static MUTEX_T ReadoutMutex;					// held by the readout thread while it reads
+static COND_T ReadoutWake;
+static int ReadoutThreadOn = 0;
+static volatile int ReadoutRun = 0;				// 0 = readout thread paused
+static volatile int ReadoutQuit = 0;
+static volatile int ReadoutError = ERR_NONE;	// error of the readout stage (the thread stops)
+
+// State of the readout seen by the processing scheduler (written by the readout stage)
+static volatile int ReadoutIdle = 0;			// the last readout found no data or was blocked by full queues
+static volatile int ReadoutPressure = 0;		// the last block transfer of a board was full (more data in the board)
+static float CostPerEvent = 0;					// processing time per event (us, moving average)
+
+// Events lost because the queues were full: written by the readout stage, folded into WDstats by the main thread
+static volatile uint64_t DroppedTot[MAX_BD];
+static uint64_t DroppedFolded[MAX_BD];
+
+// Worker threads of the plugin stage (the main thread is worker 0)
+static THREAD_T PoolThread[PLUGIN_MAX_THREADS];
+static int PoolSize = 1;
+static MUTEX_T PoolMutex;
+static COND_T PoolWork, PoolDone;
+static int PoolQuit = 0;
+static int PoolGeneration = 0;					// incremented for each set of batches
+static int PoolNitems = 0;						// channels of the current set
+static int PoolNext = 0;						// next channel to take
+static int PoolCompleted = 0;					// channels done
+static uint64_t PoolEvents = 0;					// events passed to the plugins
+static int PoolItemB[MAX_BD * MAX_CH], PoolItemCh[MAX_BD * MAX_CH];
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// time in us (for the stage metrics)
+static uint64_t get_time_us()
+{
+	return (uint64_t)(HostClockNs() / NS_PER_US);
+}
+
+// what the readout does when there is no data (WDcfg.IdleStrategy)
+static void Idle()
+{
+	if (WDcfg.IdleStrategy == IDLE_SLEEP)
+		SLEEP(1);
+	else if (WDcfg.IdleStrategy == IDLE_YIELD)
+		YIELD();
+}
+
+static int QueuesEmpty()
+{
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+		if (!WDBuff_empty(&WDbuff, bd))
+			return 0;
+	return 1;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: back-pressure of the BLOCK policy: the readout can go on if all the queues have space for
+//				a full block transfer. In synchronized mode a full queue can't be emptied while the queue
+//				of another board is empty (no event to match): the readout goes on and the events are lost.
+// ---------------------------------------------------------------------------------------------------------
+static int ReadoutHasSpace()
+{
+	int full = 0, empty = 0;
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
+		if (WDBuff_free_space(&WDbuff, bd) < WDcfg.MaxNumEventsBLT)
+			full = 1;
+		if (WDcfg.SyncEnable && WDBuff_empty(&WDbuff, bd))
+			empty = 1;
+	}
+	return !full || empty;
+}
+
+// events removed from the queues since the tail positions in 'tail'
+static int EventsRemoved(const int *tail)
+{
+	int n = 0;
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+		n += (WDBuff_get_end(&WDbuff, bd) - tail[bd] + EVT_BUF_SIZE) % EVT_BUF_SIZE;
+	return n;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: readout stage (one block per board)
+// Return:		ErrCode; *NumEvents = events read
+// ---------------------------------------------------------------------------------------------------------
+static int RunReadoutStage(uint64_t *NumEvents)
+{
+	uint64_t t0 = get_time_us();
+	int ret;
+
+	*NumEvents = 0;
+	ret = Readout(NumEvents);
+	ReadoutIdle = (*NumEvents == 0);
+	ReadoutPressure = 0;
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+		if ((int)WDcfg.handles[bd].NumEvents >= WDcfg.MaxNumEventsBLT)
+			ReadoutPressure = 1;
+	Stats[PSTAGE_READOUT].BusyTime += get_time_us() - t0;
+	Stats[PSTAGE_READOUT].Calls++;
+	Stats[PSTAGE_READOUT].Items += *NumEvents;
+	return ret;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: processing scheduler: max events per board of the next slice (see WDPipeline.h)
+// Inputs:		used = max number of events in the queues
+//				occupancy = max occupancy of the queues (%)
+// ---------------------------------------------------------------------------------------------------------
+static int ScheduleSlice(int used, float occupancy)
+{
+	float budget = WDcfg.ProcessBudget * 1000;	// in us
+	int n;
+
+	if (budget <= 0 || CostPerEvent <= 0 || used == 0)
+		return used;	// no limit, or no estimate of the processing time yet
+	if (ReadoutIdle || occupancy >= SCHED_HIGH_WATER) {
+		budget *= SCHED_DRAIN_FACTOR;
+		Stats[PSTAGE_PROCESS].Drains++;
+	}
+	else if (!ReadoutThreadOn && ReadoutPressure) {
+		// the readout thread doesn't wait for the processing: yield only in INLINE mode
+		budget /= SCHED_YIELD_DIVIDER;
+		Stats[PSTAGE_PROCESS].Yields++;
+	}
+	n = (int)(budget / (CostPerEvent * WDcfg.NumBoards));
+	if (n < SCHED_MIN_SLICE)
+		n = SCHED_MIN_SLICE;
+	return n;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: processing stage (one slice of the events in the queues)
+// Return:		number of events processed
+// ---------------------------------------------------------------------------------------------------------
+static int RunProcessStage()
+{
+	int tail[MAX_BD];
+	int nev, used_max = 0, limit;
+	float occupancy = 0;
+	uint64_t t0 = get_time_us(), dt;
+
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
+		int used = WDBuff_used_space(&WDbuff, bd);
+		float occ = WDBuff_occupancy(&WDbuff, bd);
+		tail[bd] = WDBuff_get_end(&WDbuff, bd);
+		if (used > used_max)
+			used_max = used;
+		if (occ > occupancy)
+			occupancy = occ;
+	}
+	if (used_max > Stats[PSTAGE_PROCESS].QueueMax)
+		Stats[PSTAGE_PROCESS].QueueMax = used_max;
+	limit = ScheduleSlice(used_max, occupancy);
+	Process(limit);
+	nev = EventsRemoved(tail);
+	dt = get_time_us() - t0;
+	if (nev > 0)
+		CostPerEvent = (CostPerEvent == 0) ? (float)dt / nev : 0.875f * CostPerEvent + 0.125f * (float)dt / nev;
+	Stats[PSTAGE_PROCESS].BusyTime += dt;
+	Stats[PSTAGE_PROCESS].Calls++;
+	Stats[PSTAGE_PROCESS].Items += nev;
+	Stats[PSTAGE_PROCESS].OccupancySum += occupancy;
+	Stats[PSTAGE_PROCESS].SliceLimit = limit;
+	if (nev > Stats[PSTAGE_PROCESS].SliceMax)
+		Stats[PSTAGE_PROCESS].SliceMax = nev;
+	return nev;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: take and process the channels of the current set of batches until there are no more
+// ---------------------------------------------------------------------------------------------------------
+static void RunPluginItems(int thread)
+{
+	int item, nev;
+
+	LOCK(PoolMutex);
+	while (PoolNext < PoolNitems) {
+		item = PoolNext++;
+		UNLOCK(PoolMutex);
+		nev = PluginsProcessChannel(thread, PoolItemB[item], PoolItemCh[item]);
+		LOCK(PoolMutex);
+		if (nev > 0)
+			PoolEvents += nev;
+		if (++PoolCompleted == PoolNitems)
+			COND_WAKE_ALL(PoolDone);
+	}
+	UNLOCK(PoolMutex);
+}
+
+static THREAD_FN(PluginWorker)
+{
+	int thread = (int)(intptr_t)arg;
+	int generation = 0;
+
+	LOCK(PoolMutex);
+	while (1) {
+		while (!PoolQuit && PoolGeneration == generation)
+			COND_WAIT(PoolWork, PoolMutex);
+		if (PoolQuit)
+			break;
+		generation = PoolGeneration;
+		UNLOCK(PoolMutex);
+		RunPluginItems(thread);
+		LOCK(PoolMutex);
+	}
+	UNLOCK(PoolMutex);
+	THREAD_RETURN;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: plugin stage: the batches of all the channels, shared among the workers
+// ---------------------------------------------------------------------------------------------------------
+static void RunPluginStage()
+{
+	uint64_t t0 = get_time_us();
+	int n = 0;
+
+	PluginsPrepareBatches();
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (!WDcfg.boards[b].channels[ch].ChannelEnable)
+				continue;
+			PoolItemB[n] = b;
+			PoolItemCh[n] = ch;
+			n++;
+		}
+	}
+	LOCK(PoolMutex);
+	PoolNitems = n;
+	PoolNext = 0;
+	PoolCompleted = 0;
+	PoolEvents = 0;
+	PoolGeneration++;
+	if (PoolSize > 1)
+		COND_WAKE_ALL(PoolWork);
+	UNLOCK(PoolMutex);
+	RunPluginItems(0);
+	LOCK(PoolMutex);
+	while (PoolCompleted < PoolNitems)
+		COND_WAIT(PoolDone, PoolMutex);
+	Stats[PSTAGE_PLUGINS].Items += PoolEvents;
+	UNLOCK(PoolMutex);
+
+	// the events passed to the plugins can now be overwritten by the readout
+	if (WDbuff.Hold)
+		for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+			WDBuff_release(&WDbuff, bd);
+	Stats[PSTAGE_PLUGINS].BusyTime += get_time_us() - t0;
+	Stats[PSTAGE_PLUGINS].Calls++;
+}
+
+static THREAD_FN(ReadoutLoop)
+{
+	uint64_t nev, t0;
+	int ret;
+
+	(void)arg;
+	LOCK(ReadoutMutex);
+	while (!ReadoutQuit) {
+		if (!ReadoutRun) {
+			COND_WAIT(ReadoutWake, ReadoutMutex);
+			continue;
+		}
+		if (WDcfg.QueuePolicy == QUEUE_BLOCK && !ReadoutHasSpace()) {
+			ReadoutIdle = 1;
+			t0 = get_time_us();
+			UNLOCK(ReadoutMutex);
+			Idle();
+			LOCK(ReadoutMutex);
+			Stats[PSTAGE_READOUT].WaitTime += get_time_us() - t0;
+			continue;
+		}
+		ret = RunReadoutStage(&nev);
+		if (ret != ERR_NONE) {
+			ReadoutError = ret;
+			ReadoutRun = 0;
+			continue;
+		}
+		if (nev == 0) {
+			UNLOCK(ReadoutMutex);
+			Idle();
+			LOCK(ReadoutMutex);
+		}
+	}
+	UNLOCK(ReadoutMutex);
+	THREAD_RETURN;
+}
+
+int PipelineInit(PipelineReadoutFn_t ReadoutFn, PipelineProcessFn_t ProcessFn)
+{
+	PipelineClose();
+	Readout = ReadoutFn;
+	Process = ProcessFn;
+	ReadoutRun = 0;
+	ReadoutQuit = 0;
+	ReadoutError = ERR_NONE;
+	PoolQuit = 0;
+	PoolGeneration = 0;
+	PoolSize = PluginsEnabled() ? PluginsNumThreads() : 1;
+	// with the readout running in parallel, the events must stay valid until the plugins have seen them
+	WDbuff.Hold = (WDcfg.PipelineMode == PIPELINE_THREADED) && PluginsEnabled();
+
+	MUTEX_INIT(ReadoutMutex);
+	COND_INIT(ReadoutWake);
+	MUTEX_INIT(PoolMutex);
+	COND_INIT(PoolWork);
+	COND_INIT(PoolDone);
+	Initialized = 1;
+	ResetPipelineStats();
+
+	for (int t = 1; t < PoolSize; t++) {
+		if (THREAD_CREATE(PoolThread[t], PluginWorker, (void *)(intptr_t)t) < 0) {
+			msg_printf(MsgLog, "ERROR: Can't create the plugin thread %d\n", t);
+			PoolSize = t;
+			PipelineClose();
+			return -1;
+		}
+	}
+	if (WDcfg.PipelineMode == PIPELINE_THREADED) {
+		if (THREAD_CREATE(ReadoutThread, ReadoutLoop, NULL) < 0) {
+			msg_printf(MsgLog, "ERROR: Can't create the readout thread\n");
+			PipelineClose();
+			return -1;
+		}
+		ReadoutThreadOn = 1;
+	}
+	msg_printf(MsgLog, "INFO: Pipeline: %s readout, %s queues, %d plugin thread(s)\n",
+		ReadoutThreadOn ? "threaded" : "inline", WDcfg.QueuePolicy == QUEUE_BLOCK ? "blocking" : "dropping", PoolSize);
+	return 0;
+}
+
+void PipelineClose()
+{
+	if (!Initialized)
+		return;
+	if (ReadoutThreadOn) {
+		LOCK(ReadoutMutex);
+		ReadoutQuit = 1;
+		COND_WAKE_ALL(ReadoutWake);
+		UNLOCK(ReadoutMutex);
+		THREAD_JOIN(ReadoutThread);
+		ReadoutThreadOn = 0;
+	}
+	LOCK(PoolMutex);
+	PoolQuit = 1;
+	COND_WAKE_ALL(PoolWork);
+	UNLOCK(PoolMutex);
+	for (int t = 1; t < PoolSize; t++)
+		THREAD_JOIN(PoolThread[t]);
+	PoolSize = 1;
+	WDbuff.Hold = 0;
+	MUTEX_DESTROY(ReadoutMutex);
+	COND_DESTROY(ReadoutWake);
+	MUTEX_DESTROY(PoolMutex);
+	COND_DESTROY(PoolWork);
+	COND_DESTROY(PoolDone);
+	Initialized = 0;
+}
+
+int PipelineThreaded()
+{
+	return ReadoutThreadOn;
+}
+
+void PipelinePauseReadout()
+{
+	if (!ReadoutThreadOn)
+		return;
+	ReadoutRun = 0;
+	// the readout thread holds the mutex while it reads: wait for the end of the current block
+	LOCK(ReadoutMutex);
+	UNLOCK(ReadoutMutex);
+}
+
+static void ResumeReadout()
+{
+	if (ReadoutRun || ReadoutError != ERR_NONE)
+		return;
+	LOCK(ReadoutMutex);
+	ReadoutRun = 1;
+	COND_WAKE_ALL(ReadoutWake);
+	UNLOCK(ReadoutMutex);
+}
+
+// events lost by the readout thread: counted in the statistics by the main thread (owner of WDstats.EvLost_cnt)
+static void FoldDropped()
+{
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
+		uint64_t tot = DroppedTot[bd];
+		uint64_t n = tot - DroppedFolded[bd];
+		if (n == 0)
+			continue;
+		DroppedFolded[bd] = tot;
+		for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++) {
+			WDstats.EvLost_cnt[bd][ch] += n;
+			WDstats.EvProcessed_cnt[bd][ch] += n;
+		}
+	}
+}
+
+int PipelineStep()
+{
+	uint64_t nev = 0, t0;
+	int ret;
+
+	if (ReadoutThreadOn) {
+		ResumeReadout();
+		if (ReadoutError != ERR_NONE)
+			return ReadoutError;
+		if (RunProcessStage() == 0 && QueuesEmpty()) {
+			t0 = get_time_us();
+			Idle();
+			Stats[PSTAGE_PROCESS].WaitTime += get_time_us() - t0;
+		}
+		if (PluginsEnabled())
+			RunPluginStage();
+		FoldDropped();
+		return ERR_NONE;
+	}
+
+	// with the BLOCK policy the readout is skipped until the processing below frees enough space
+	if (WDcfg.QueuePolicy == QUEUE_DROP || ReadoutHasSpace()) {
+		ret = RunReadoutStage(&nev);
+		if (ret != ERR_NONE)
+			return ret;
+		if (nev == 0 && WDcfg.IdleStrategy != IDLE_SPIN && QueuesEmpty()) {
+			t0 = get_time_us();
+			Idle();
+			Stats[PSTAGE_READOUT].WaitTime += get_time_us() - t0;
+		}
+	}
+	else {
+		ReadoutIdle = 1;	// blocked: drain the queues
+	}
+	RunProcessStage();
+	// one batch per channel with the events of this readout block (before the next readout can overwrite them)
+	if (PluginsEnabled())
+		RunPluginStage();
+	return ERR_NONE;
+}
+
+void PipelineCountDropped(int bd, int nev)
+{
+	Stats[PSTAGE_READOUT].Dropped += nev;
+	if (ReadoutThreadOn)
+		DroppedTot[bd] += nev;
+}
+
+const PipelineStageStats_t *GetPipelineStats(int stage)
+{
+	if (stage < 0 || stage >= PSTAGE_NUM)
+		return NULL;
+	return &Stats[stage];
+}
+
+void ResetPipelineStats()
+{
+	for (int s = 0; s < PSTAGE_NUM; s++) {
+		const char *name = Stats[s].Name;
+		memset(&Stats[s], 0, sizeof(Stats[s]));
+		Stats[s].Name = name;
+		Stats[s].Threads = 1;
+	}
+	Stats[PSTAGE_PLUGINS].Threads = PoolSize;
+	for (int bd = 0; bd < MAX_BD; bd++)
+		DroppedFolded[bd] = DroppedTot[bd];
+}
+
+void PrintPipelineStats()
+{
+	const PipelineStageStats_t *P = &Stats[PSTAGE_PROCESS];
+
+	msg_printf(MsgLog, "INFO: Pipeline stage  threads      calls       items   busy(ms)   wait(ms)    dropped  queue_max\n");
+	for (int s = 0; s < PSTAGE_NUM; s++) {
+		const PipelineStageStats_t *S = &Stats[s];
+		if (s == PSTAGE_PLUGINS && !PluginsEnabled())
+			continue;
+		msg_printf(MsgLog, "INFO:   %-13s %7d %10llu %11llu %10.1f %10.1f %10llu %10d\n", S->Name, S->Threads,
+			(unsigned long long)S->Calls, (unsigned long long)S->Items, S->BusyTime / 1000.0, S->WaitTime / 1000.0,
+			(unsigned long long)S->Dropped, S->QueueMax);
+	}
+	if (P->Calls > 0)
+		msg_printf(MsgLog, "INFO: Process scheduler: budget %.1f ms, %.1f us/event, slice mean %.1f max %d, occupancy mean %.1f%%, drains %llu, yields %llu\n",
+			WDcfg.ProcessBudget, CostPerEvent, (double)P->Items / P->Calls, P->SliceMax, P->OccupancySum / P->Calls,
+			(unsigned long long)P->Drains, (unsigned long long)P->Yields);
+}
@@ -0,0 +1,555 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDPlugins.h"
+#include "WDFiles.h"
+#include "WDHArchive.h"
+#include "WDHisto.h"
+#include "WDLogs.h"
+#include "WDStatus.h"
+
+#ifdef WIN32
+	#define LIB_HANDLE				HMODULE
+	#define LIB_OPEN(path)			LoadLibraryA(path)
+	#define LIB_SYMBOL(lib, name)	((void *)GetProcAddress(lib, name))
+	#define LIB_CLOSE(lib)			FreeLibrary(lib)
+	#define MUTEX_T					CRITICAL_SECTION
+	#define MUTEX_INIT(m)			InitializeCriticalSection(&(m))
+	#define LOCK(m)					EnterCriticalSection(&(m))
+	#define UNLOCK(m)				LeaveCriticalSection(&(m))
+#else
+	#include <dlfcn.h>
+	#define LIB_HANDLE				void *
+	#define LIB_OPEN(path)			dlopen(path, RTLD_NOW | RTLD_LOCAL)
+	#define LIB_SYMBOL(lib, name)	dlsym(lib, name)
+	#define LIB_CLOSE(lib)			dlclose(lib)
+	#include <pthread.h>
+	#define MUTEX_T					pthread_mutex_t
+	#define MUTEX_INIT(m)			pthread_mutex_init(&(m), NULL)
+	#define LOCK(m)					pthread_mutex_lock(&(m))
+	#define UNLOCK(m)				pthread_mutex_unlock(&(m))
+#endif
+
+// Loaded plugin
+typedef struct {
+	WDPluginHost_t Host;							// services offered to the plugin (Host.Private = this)
+	const WDPlugin_t *Desc;							// descriptor returned by WDPluginEntry
+	LIB_HANDLE Lib;
+	void *Ctx;										// plugin context (from Init)
+	void *ThreadState[PLUGIN_MAX_THREADS];			// per-thread state (from ThreadInit)
+	char Args[500];
+	int Loading;									// 1 while Init is running (AddColumn/AddHistogram allowed)
+	int NumColumns;
+	char ColumnName[PLUGIN_MAX_COLUMNS][PLUGIN_MAX_NAME];
+	int NumHistos;
+	char HistoName[PLUGIN_MAX_HISTOS][PLUGIN_MAX_NAME];
+	double HistoMin[PLUGIN_MAX_HISTOS];
+	double HistoMax[PLUGIN_MAX_HISTOS];
+	Histogram1D_t Histo[PLUGIN_MAX_HISTOS][MAX_BD][MAX_CH];
+	FILE *fcol[MAX_BD][MAX_CH];						// output column files
+} Plugin_t;
+
+// Batch buffers of one processing thread
+typedef struct {
+	const float **Samples;
+	WDPluginResult_t *Results;
+	double *Columns;
+} PluginScratch_t;
+
+static Plugin_t *Plugins[MAX_PLUGINS];
+static int NumPlugins = 0;
+static int NumThreads = 1;							// threads of the plugin stage (WDcfg.PluginThreads)
+static PluginScratch_t Scratch[PLUGIN_MAX_THREADS];
+static int SaveColumns = 0;							// write the column files in the current batches
+static MUTEX_T HistoMutex;							// Fill from the processing threads (any channel can be filled)
+static int HistoMutexInit = 0;
+
+// Events queued for the next batch
+static WaveDemoEvent_t **Queue[MAX_BD][MAX_CH];
+static char *QueueSelected[MAX_BD][MAX_CH];
+static int QueueLen[MAX_BD][MAX_CH];
+static uint64_t QueueDropped[MAX_BD][MAX_CH];		// events not queued in the current run (queue full)
+
+/* ###########################################################################
+*  Services for the plugins
+*  ########################################################################### */
+
+static int HostAddColumn(WDPluginHost_t *host, const char *name)
+{
+	Plugin_t *p = (Plugin_t *)host->Private;
+	if (!p->Loading || p->NumColumns >= PLUGIN_MAX_COLUMNS)
+		return -1;
+	strncpy(p->ColumnName[p->NumColumns], name, PLUGIN_MAX_NAME - 1);
+	return p->NumColumns++;
+}
+
+static int HostAddHistogram(WDPluginHost_t *host, const char *name, int nbin, double xmin, double xmax)
+{
+	Plugin_t *p = (Plugin_t *)host->Private;
+	int h = p->NumHistos;
+	if (!p->Loading || h >= PLUGIN_MAX_HISTOS || nbin <= 1 || xmax <= xmin)
+		return -1;
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (!WDcfg.boards[b].channels[ch].ChannelEnable)
+				continue;
+			CreateHistogram1D(nbin, (char *)name, "", "Cnt", &p->Histo[h][b][ch]);
+			if (p->Histo[h][b][ch].H_data == NULL)
+				return -1;
+			ResetHistogram1D(&p->Histo[h][b][ch]);
+		}
+	}
+	strncpy(p->HistoName[h], name, PLUGIN_MAX_NAME - 1);
+	p->HistoMin[h] = xmin;
+	p->HistoMax[h] = xmax;
+	return p->NumHistos++;
+}
+
+static void HostFill(WDPluginHost_t *host, int histo, int b, int ch, double x)
+{
+	Plugin_t *p = (Plugin_t *)host->Private;
+	Histogram1D_t *H;
+	if (histo < 0 || histo >= p->NumHistos || b < 0 || b >= MAX_BD || ch < 0 || ch >= MAX_CH)
+		return;
+	H = &p->Histo[histo][b][ch];
+	if (H->H_data == NULL)
+		return;
+	int bin = (x < p->HistoMin[histo]) ? -1 : (int)((x - p->HistoMin[histo]) * H->Nbin / (p->HistoMax[histo] - p->HistoMin[histo]));
+	if (NumThreads > 1) {
+		LOCK(HistoMutex);
+		Histo1D_AddCount(H, bin);
+		UNLOCK(HistoMutex);
+	}
+	else {
+		Histo1D_AddCount(H, bin);
+	}
+}
+
+static void HostLog(WDPluginHost_t *host, const char *fmt, ...)
+{
+	Plugin_t *p = (Plugin_t *)host->Private;
+	char str[1000];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(str, sizeof(str), fmt, args);
+	va_end(args);
+	msg_printf(MsgLog, "[%s] %s", p->Desc->Name, str);
+	if (str[0] != '\0' && str[strlen(str) - 1] != '\n')
+		msg_printf(MsgLog, "\n");
+}
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: split the PLUGIN option in library path (can be quoted) and arguments
+// ---------------------------------------------------------------------------------------------------------
+static void SplitPluginOption(const char *opt, char *path, char *args)
+{
+	const char *end;
+	while (isspace((unsigned char)*opt))
+		opt++;
+	if (*opt == '"') {
+		opt++;
+		end = strchr(opt, '"');
+		if (end == NULL)
+			end = opt + strlen(opt);
+	}
+	else {
+		for (end = opt; *end && !isspace((unsigned char)*end); end++);
+	}
+	sprintf(path, "%.*s", (int)(end - opt), opt);
+	if (*end == '"')
+		end++;
+	while (isspace((unsigned char)*end))
+		end++;
+	strcpy(args, end);
+}
+
+static void FreePlugin(Plugin_t *p)
+{
+	for (int h = 0; h < PLUGIN_MAX_HISTOS; h++)
+		for (int b = 0; b < MAX_BD; b++)
+			for (int ch = 0; ch < MAX_CH; ch++)
+				if (p->Histo[h][b][ch].H_data != NULL)
+					DestroyHistogram1D(p->Histo[h][b][ch]);
+	if (p->Lib != NULL)
+		LIB_CLOSE(p->Lib);
+	free(p);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: load one plugin
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int LoadPlugin(const char *opt)
+{
+	char path[500];
+	WDPluginEntry_t entry;
+	Plugin_t *p = (Plugin_t *)calloc(1, sizeof(Plugin_t));
+
+	if (p == NULL)
+		return -1;
+	SplitPluginOption(opt, path, p->Args);
+	p->Lib = LIB_OPEN(path);
+	if (p->Lib == NULL) {
+#ifdef WIN32
+		msg_printf(MsgLog, "ERROR: Can't load the plugin %s (error %lu)\n", path, (unsigned long)GetLastError());
+#else
+		msg_printf(MsgLog, "ERROR: Can't load the plugin %s (%s)\n", path, dlerror());
+#endif
+		FreePlugin(p);
+		return -1;
+	}
+	entry = (WDPluginEntry_t)LIB_SYMBOL(p->Lib, WD_PLUGIN_ENTRY_NAME);
+	p->Desc = entry != NULL ? entry() : NULL;
+	if (p->Desc == NULL || p->Desc->Name == NULL) {
+		msg_printf(MsgLog, "ERROR: %s is not a WaveDemo plugin (%s not found)\n", path, WD_PLUGIN_ENTRY_NAME);
+		FreePlugin(p);
+		return -1;
+	}
+	if (p->Desc->ApiVersion != WD_PLUGIN_API_VERSION) {
+		msg_printf(MsgLog, "ERROR: Plugin %s: API version %d not supported (expected %d)\n", p->Desc->Name, p->Desc->ApiVersion, WD_PLUGIN_API_VERSION);
+		FreePlugin(p);
+		return -1;
+	}
+
+	p->Host.ApiVersion = WD_PLUGIN_API_VERSION;
+	p->Host.Args = p->Args;
+	p->Host.NumThreads = NumThreads;
+	p->Host.Private = p;
+	p->Host.AddColumn = HostAddColumn;
+	p->Host.AddHistogram = HostAddHistogram;
+	p->Host.Fill = HostFill;
+	p->Host.Log = HostLog;
+
+	p->Loading = 1;
+	if (p->Desc->Init != NULL && p->Desc->Init(&p->Host, &p->Ctx) != 0) {
+		msg_printf(MsgLog, "ERROR: Plugin %s: initialization failed\n", p->Desc->Name);
+		FreePlugin(p);
+		return -1;
+	}
+	p->Loading = 0;
+	for (int t = 0; t < NumThreads; t++)
+		p->ThreadState[t] = p->Desc->ThreadInit != NULL ? p->Desc->ThreadInit(p->Ctx, t) : NULL;
+
+	Plugins[NumPlugins++] = p;
+	msg_printf(MsgLog, "INFO: Plugin %s loaded from %s (%d columns, %d histograms)\n", p->Desc->Name, path, p->NumColumns, p->NumHistos);
+	return 0;
+}
+
+int LoadPlugins()
+{
+	int maxcol = 1;
+
+	UnloadPlugins();
+	if (WDcfg.NumPlugins == 0)
+		return 0;
+	NumThreads = WDcfg.PluginThreads;
+	if (NumThreads < 1)
+		NumThreads = 1;
+	if (NumThreads > PLUGIN_MAX_THREADS)
+		NumThreads = PLUGIN_MAX_THREADS;
+	if (!HistoMutexInit) {
+		MUTEX_INIT(HistoMutex);
+		HistoMutexInit = 1;
+	}
+	for (int i = 0; i < WDcfg.NumPlugins; i++)
+		if (LoadPlugin(WDcfg.Plugins[i]) < 0)
+			return -1;
+
+	// batch queues of the enabled channels and buffers of the processing threads
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (!WDcfg.boards[b].channels[ch].ChannelEnable)
+				continue;
+			Queue[b][ch] = (WaveDemoEvent_t **)malloc(EVT_BUF_SIZE * sizeof(WaveDemoEvent_t *));
+			QueueSelected[b][ch] = (char *)malloc(EVT_BUF_SIZE);
+			if (Queue[b][ch] == NULL || QueueSelected[b][ch] == NULL)
+				return -1;
+			QueueLen[b][ch] = 0;
+		}
+	}
+	for (int i = 0; i < NumPlugins; i++)
+		if (Plugins[i]->NumColumns > maxcol)
+			maxcol = Plugins[i]->NumColumns;
+	for (int t = 0; t < NumThreads; t++) {
+		Scratch[t].Samples = (const float **)malloc(EVT_BUF_SIZE * sizeof(float *));
+		Scratch[t].Results = (WDPluginResult_t *)malloc(EVT_BUF_SIZE * sizeof(WDPluginResult_t));
+		Scratch[t].Columns = (double *)malloc((size_t)EVT_BUF_SIZE * maxcol * sizeof(double));
+		if (Scratch[t].Samples == NULL || Scratch[t].Results == NULL || Scratch[t].Columns == NULL)
+			return -1;
+	}
+	return 0;
+}
+
+void UnloadPlugins()
+{
+	for (int i = NumPlugins - 1; i >= 0; i--) {
+		Plugin_t *p = Plugins[i];
+		for (int t = 0; t < NumThreads; t++)
+			if (p->Desc->ThreadExit != NULL)
+				p->Desc->ThreadExit(p->Ctx, p->ThreadState[t]);
+		if (p->Desc->Exit != NULL)
+			p->Desc->Exit(p->Ctx);
+		FreePlugin(p);
+		Plugins[i] = NULL;
+	}
+	NumPlugins = 0;
+	for (int b = 0; b < MAX_BD; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			free(Queue[b][ch]);
+			free(QueueSelected[b][ch]);
+			Queue[b][ch] = NULL;
+			QueueSelected[b][ch] = NULL;
+			QueueLen[b][ch] = 0;
+		}
+	}
+	for (int t = 0; t < PLUGIN_MAX_THREADS; t++) {
+		free((void *)Scratch[t].Samples);
+		free(Scratch[t].Results);
+		free(Scratch[t].Columns);
+		memset(&Scratch[t], 0, sizeof(Scratch[t]));
+	}
+}
+
+int PluginsEnabled()
+{
+	return NumPlugins > 0;
+}
+
+void PluginsQueueEvent(int b, int ch, WaveDemoEvent_t *event, int selected)
+{
+	if (Queue[b][ch] == NULL)
+		return;
+	if (QueueLen[b][ch] >= EVT_BUF_SIZE) {
+		QueueDropped[b][ch]++;
+		return;
+	}
+	Queue[b][ch][QueueLen[b][ch]] = event;
+	QueueSelected[b][ch][QueueLen[b][ch]] = (char)selected;
+	QueueLen[b][ch]++;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: append the output columns of the selected events to the column file of the channel
+//				(the file is opened by PluginsPrepareBatches)
+// ---------------------------------------------------------------------------------------------------------
+static int WriteColumns(Plugin_t *p, const WDPluginBatch_t *batch)
+{
+	FILE *f = p->fcol[batch->Board][batch->Channel];
+	if (f == NULL)
+		return -1;
+	for (int i = 0; i < batch->NumEvents; i++) {
+		const WDPluginResult_t *r = &batch->Results[i];
+		if (!r->Selected)
+			continue;
+		fprintf(f, "%.3f", (double)r->TimeStamp + r->FineTimeStamp);
+		for (int c = 0; c < p->NumColumns; c++)
+			fprintf(f, "\t%g", batch->Columns[i * p->NumColumns + c]);
+		fprintf(f, "\n");
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: open the column file of a plugin for one channel
+// ---------------------------------------------------------------------------------------------------------
+static int OpenColumnFile(Plugin_t *p, int b, int ch)
+{
+	char fname[300];
+
+	CreatePluginFileName(p->Desc->Name, NULL, b, ch, fname);
+	p->fcol[b][ch] = OpenOutputFile(fname, "w");
+	if (p->fcol[b][ch] == NULL)
+		return -1;
+	StatusFile("plugin", b, ch, fname);
+	if (WDcfg.OutFileHeader) {
+		fprintf(p->fcol[b][ch], "Time (ns)");
+		for (int c = 0; c < p->NumColumns; c++)
+			fprintf(p->fcol[b][ch], "\t%s", p->ColumnName[c]);
+		fprintf(p->fcol[b][ch], "\n");
+	}
+	return 0;
+}
+
+int PluginsNumThreads()
+{
+	return NumThreads;
+}
+
+int PluginsPrepareBatches()
+{
+	int ret = 0;
+
+	SaveColumns = WDcfg.SaveLists && (WDrun.ContinuousWrite || WDrun.SingleWrite);
+	if (!SaveColumns)
+		return 0;
+	// the files are opened here, so that the channels can then be processed by different threads
+	for (int i = 0; i < NumPlugins; i++) {
+		Plugin_t *p = Plugins[i];
+		if (p->NumColumns == 0)
+			continue;
+		for (int b = 0; b < WDcfg.NumBoards; b++)
+			for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++)
+				if (QueueLen[b][ch] > 0 && p->fcol[b][ch] == NULL && OpenColumnFile(p, b, ch) < 0)
+					ret = -1;
+	}
+	return ret;
+}
+
+int PluginsProcessChannel(int thread, int b, int ch)
+{
+	PluginScratch_t *S = &Scratch[thread];
+	WDPluginBatch_t batch;
+	int ret = 0;
+	int n = QueueLen[b][ch];
+
+	if (n == 0)
+		return 0;
+
+	// views of the queued events (the samples are not copied)
+	int ns = Queue[b][ch][0]->Event->DataGroup[ch / 2].ChSize;
+	if (ns > WDcfg.GlobalRecordLength)
+		ns = WDcfg.GlobalRecordLength;
+	for (int i = 0; i < n; i++) {
+		WaveDemoEvent_t *ev = Queue[b][ch][i];
+		WaveDemo_EVENT_plus_t *ep = &ev->EventPlus[ch / 2][ch % 2];
+		WDPluginResult_t *r = &S->Results[i];
+		S->Samples[i] = ev->Event->DataGroup[ch / 2].DataChannel[ch % 2];
+		r->TimeStamp = ev->Event->DataGroup[ch / 2].TDC * 5;
+		r->FineTimeStamp = ep->FineTimeStamp;
+		r->Energy = ep->Energy;
+		r->Baseline = ep->Baseline;
+		r->EventCounter = ev->EventInfo.EventCounter;
+		r->Selected = QueueSelected[b][ch][i];
+	}
+	batch.Board = b;
+	batch.Channel = ch;
+	batch.Thread = thread;
+	batch.NumEvents = n;
+	batch.RecordLength = ns;
+	batch.SamplingPeriod = WDcfg.handles[b].Ts;
+	batch.Samples = S->Samples;
+	batch.Results = S->Results;
+
+	for (int i = 0; i < NumPlugins; i++) {
+		Plugin_t *p = Plugins[i];
+		if (p->Desc->ProcessBatch == NULL)
+			continue;
+		batch.NumColumns = p->NumColumns;
+		batch.Columns = S->Columns;
+		if (p->NumColumns > 0)
+			memset(S->Columns, 0, (size_t)n * p->NumColumns * sizeof(double));
+		if (p->Desc->ProcessBatch(p->Ctx, p->ThreadState[thread], &batch) != 0)
+			ret = -1;
+		if (SaveColumns && p->NumColumns > 0 && WriteColumns(p, &batch) < 0)
+			ret = -1;
+	}
+	QueueLen[b][ch] = 0;
+	return ret < 0 ? -1 : n;
+}
+
+int PluginsStartRun()
+{
+	int ret = 0;
+	ResetPluginHistograms();
+	memset(QueueLen, 0, sizeof(QueueLen));
+	memset(QueueDropped, 0, sizeof(QueueDropped));
+	for (int i = 0; i < NumPlugins; i++)
+		if (Plugins[i]->Desc->StartRun != NULL && Plugins[i]->Desc->StartRun(Plugins[i]->Ctx, WDrun.DataTimeFilename) != 0)
+			ret = -1;
+	return ret;
+}
+
+int PluginsStopRun()
+{
+	int ret = 0;
+	for (int b = 0; b < MAX_BD; b++)
+		for (int ch = 0; ch < MAX_CH; ch++)
+			if (QueueDropped[b][ch] > 0)
+				msg_printf(MsgLog, "WARN: Plugins: %llu events of board %d channel %d not processed (batch queue full)\n",
+					(unsigned long long)QueueDropped[b][ch], b, ch);
+	for (int i = 0; i < NumPlugins; i++) {
+		Plugin_t *p = Plugins[i];
+		if (p->Desc->StopRun != NULL && p->Desc->StopRun(p->Ctx) != 0)
+			ret = -1;
+		for (int b = 0; b < MAX_BD; b++) {
+			for (int ch = 0; ch < MAX_CH; ch++) {
+				if (p->fcol[b][ch] != NULL)
+					fclose(p->fcol[b][ch]);
+				p->fcol[b][ch] = NULL;
+			}
+		}
+	}
+	return ret;
+}
+
+void ResetPluginHistograms()
+{
+	for (int i = 0; i < NumPlugins; i++)
+		for (int h = 0; h < Plugins[i]->NumHistos; h++)
+			for (int b = 0; b < MAX_BD; b++)
+				for (int ch = 0; ch < MAX_CH; ch++)
+					if (Plugins[i]->Histo[h][b][ch].H_data != NULL)
+						ResetHistogram1D(&Plugins[i]->Histo[h][b][ch]);
+}
+
+int SavePluginHistograms()
+{
+	char fname[300];
+	int ret = 0;
+	int archive = (WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE);
+	HArchiveRecord_t r;
+
+	if (NumPlugins == 0)
+		return 0;
+	if (archive) {
+		CreateHistoArchiveFileName(fname);
+		ret |= BeginHistoArchive(fname);
+	}
+	for (int i = 0; i < NumPlugins; i++) {
+		Plugin_t *p = Plugins[i];
+		for (int h = 0; h < p->NumHistos; h++) {
+			char aname[sizeof(r.Name)];	// name of the archive records (fixed size)
+			if (archive && snprintf(aname, sizeof(aname), "%s.%s", p->Desc->Name, p->HistoName[h]) >= (int)sizeof(aname))
+				msg_printf(MsgLog, "WARN: Plugin %s: histogram name %s truncated in the archive\n", p->Desc->Name, p->HistoName[h]);
+			for (int b = 0; b < MAX_BD; b++) {
+				for (int ch = 0; ch < MAX_CH; ch++) {
+					if (p->Histo[h][b][ch].H_data == NULL)
+						continue;
+					if (archive) {
+						memset(&r, 0, sizeof(r));
+						r.Type = HARC_TYPE_PLUGIN;
+						r.Board = (int16_t)b;
+						r.Channel = (int16_t)ch;
+						r.Step = -1;
+						r.Xmin = p->HistoMin[h];
+						r.Xmax = p->HistoMax[h];
+						memcpy(r.Name, aname, sizeof(r.Name));
+						ret |= ArchiveHistogram(&r, &p->Histo[h][b][ch]);
+						continue;
+					}
+					CreatePluginFileName(p->Desc->Name, p->HistoName[h], b, ch, fname);
+					ret |= SaveHistogram(fname, p->Histo[h][b][ch]);
+				}
+			}
+		}
+	}
+	if (archive)
+		ret |= EndHistoArchive();
+	return ret;
+}
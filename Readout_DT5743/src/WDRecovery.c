@@ -0,0 +1,136 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDRecovery.h"
+#include "WDBuffers.h"
+#include "WDClock.h"
+#include "WDFiles.h"
+#include "WDLogs.h"
+#include "WDStatus.h"
+
+// Discontinuities queued by the thread that recovers the boards (readout stage) for the main loop
+static WaveDemoDiscontinuity_t Pending[RECOVERY_MAX_PENDING];
+static volatile uint32_t PendingHead = 0;	// written by the readout stage
+static volatile uint32_t PendingTail = 0;	// written by the main loop
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// 1 if board b is restarted by the recovery described by d
+static int Restarted(const WaveDemoDiscontinuity_t *d, int b)
+{
+	return d->AllBoards || b == d->Board;
+}
+
+int RecoveryEnabled()
+{
+	return WDcfg.RecoveryAttempts > 0;
+}
+
+void ResetRecovery()
+{
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		WDcfg.handles[b].TDCOffset = 0;
+		WDstats.RecoveryTime[b] = 0;
+		WDstats.PrevRecoveryTime[b] = 0;
+	}
+	WDstats.Recovery_cnt = 0;
+	PendingHead = 0;
+	PendingTail = 0;
+}
+
+int RecoverBoard(int bd, const char *reason, RecoveryRestartFn_t RestartFn)
+{
+	WaveDemoDiscontinuity_t d;
+	int running = WDrun.AcqRun;
+	uint64_t LatestTstamp = 0;
+	int64_t t0 = HostClockNs(), DeadTime;
+
+	memset(&d, 0, sizeof(d));
+	d.Board = bd;
+	d.AllBoards = running && WDcfg.SyncEnable;	// the synchronized boards start together
+	d.HostTime = WallClockMs();
+	strncpy(d.Reason, reason, sizeof(d.Reason) - 1);
+	msg_printf(MsgLog, "WARN: %s on board %d; trying to recover the board\n", reason, bd);
+
+	for (d.Attempts = 1; d.Attempts <= WDcfg.RecoveryAttempts; d.Attempts++) {
+		if (d.Attempts > 1)
+			SLEEP(RECOVERY_RETRY_DELAY * (d.Attempts - 1));
+		if (RestartFn(bd, running) == 0)
+			break;
+		msg_printf(MsgLog, "WARN: Recovery attempt %d of board %d failed\n", d.Attempts, bd);
+	}
+	DeadTime = HostClockNs() - t0;
+	d.DeadTime = (uint64_t)(DeadTime / NS_PER_MS);
+	if (d.Attempts > WDcfg.RecoveryAttempts) {
+		msg_printf(MsgLog, "ERROR: Can't recover board %d after %d attempts\n", bd, WDcfg.RecoveryAttempts);
+		return -1;
+	}
+	msg_printf(MsgLog, "INFO: Board %d recovered in %llu ms (attempts: %d)\n", bd, (unsigned long long)d.DeadTime, d.Attempts);
+	if (!running)
+		return 0;
+
+	// The time stamps of the restarted boards start again from 0: shift them after the newest one read
+	// before the error plus the recovery time, so that the times of the run keep increasing
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		if (!Restarted(&d, b))
+			continue;
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++)
+			if (WDstats.LatestReadTstamp[b][ch] > LatestTstamp)
+				LatestTstamp = WDstats.LatestReadTstamp[b][ch];
+	}
+	d.BoardTime = LatestTstamp + (uint64_t)DeadTime;
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		if (!Restarted(&d, b))
+			continue;
+		WDcfg.handles[b].TDCOffset = d.BoardTime / 5;	// TDC unit = 5 ns
+		WDstats.RecoveryTime[b] += (uint64_t)DeadTime;
+	}
+	WDstats.Recovery_cnt++;
+
+	// queue the discontinuity for the output files (written by the main loop)
+	if (PendingHead - PendingTail < RECOVERY_MAX_PENDING) {
+		Pending[PendingHead % RECOVERY_MAX_PENDING] = d;
+		MEMORY_BARRIER();
+		PendingHead++;
+	}
+	else {
+		msg_printf(MsgLog, "WARN: Too many recoveries; the discontinuity of board %d is not written into the output files\n", bd);
+	}
+	return 0;
+}
+
+int PollRecoveries()
+{
+	int n = 0;
+	while (PendingTail != PendingHead) {
+		const WaveDemoDiscontinuity_t *d = &Pending[PendingTail % RECOVERY_MAX_PENDING];
+		MEMORY_BARRIER();
+		SaveDiscontinuity(d);
+		for (int b = 0; b < WDcfg.NumBoards; b++) {
+			if (!Restarted(d, b))
+				continue;
+			for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++)
+				if (WDcfg.boards[b].channels[ch].ChannelEnable)
+					SaveDiscontinuityInStreams(b, ch, d);
+		}
+		StatusRecovery(d);
+		MEMORY_BARRIER();
+		PendingTail++;
+		n++;
+	}
+	return n;
+}
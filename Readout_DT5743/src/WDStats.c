@@ -17,27 +17,13 @@
 #include <CAENDigitizer.h>
 
 #include "WaveDemo.h"
+#include "WDClock.h"
+#include "WDPipeline.h"
 
 /* ###########################################################################
 *  Functions
 *  ########################################################################### */
 
-static long get_time()
-{
-
-	long time_ms;
-#ifdef WIN32
-	struct _timeb timebuffer;
-	_ftime(&timebuffer);
-	time_ms = (long)timebuffer.time * 1000 + (long)timebuffer.millitm;
-#else
-	struct timeval t1;
-	gettimeofday(&t1, NULL);
-	time_ms = (t1.tv_sec) * 1000 + t1.tv_usec / 1000;
-#endif
-	return time_ms;
-}
-
 // --------------------------------------------------------------------------------------------------------- 
 // Description: Reset all the counters, histograms, etc...
 // Return: 0=OK, -1=error
@@ -48,7 +34,7 @@ int ResetStatistics()
 	memset(&WDstats, 0, sizeof(WDstats));
 	if (WDrun.AcqRun) {
 		//StartAcquisition();
-		WDstats.StartTime = get_time();
+		WDstats.StartTime = HostClockNs();
 	}
 	return 0;
 }
@@ -58,43 +44,48 @@ int ResetStatistics()
 // Description: Calculate some statistcs (rates, etc...) in the WDstats struct
 // Return: 0=OK, -1=error
 // --------------------------------------------------------------------------------------------------------- 
-int UpdateStatistics(uint64_t CurrentTime)
+int UpdateStatistics(int64_t CurrentTime)
 {
 	int b, ch;
+	// The read counters (BlockRead, RxByte, EvRead, LatestReadTstamp, LatestProcTstamp) are written by the readout
+	// stage: pause the readout thread so that they are read and reset between two blocks (resumed by the next PipelineStep)
+	PipelinePauseReadout();
 	// Calculate Real Time (i.e. total acquisition time from the start of run).
 	// If possible, the real time is taken form the most recent time stamp (coming from any channel),
-	// otherwise it is taken from the computer time (much less precise)
+	// otherwise it is taken from the computer time (much less precise). Both are integer ns: no rounding
+	// however long the run is
 	if (WDstats.LatestProcTstampAll > WDstats.PrevProcTstampAll) {
-		WDstats.AcqRealTime = (float)(WDstats.LatestProcTstampAll / 1e6f);	// Acquisition Real time from board in ms
+		WDstats.AcqRealTime = (int64_t)WDstats.LatestProcTstampAll;		// Acquisition Real time from board
 		WDstats.RealTimeSource = REALTIME_FROM_BOARDS;
 	}
 	else {
-		WDstats.AcqRealTime = (float)(CurrentTime - WDstats.StartTime);	// time from computer in ms
+		WDstats.AcqRealTime = CurrentTime - WDstats.StartTime;		// time from computer (host clock)
 		WDstats.RealTimeSource = REALTIME_FROM_COMPUTER;
 	}
-	// Calculate the data throughput rate from the boards to the computer
-	if (WDrun.IntegratedRates)
-		WDstats.RxByte_rate = (float)(WDstats.RxByte_cnt) / (WDstats.AcqRealTime*1048.576f);
-	else
-		WDstats.RxByte_rate = (float)(WDstats.RxByte_cnt - WDstats.RxByte_pcnt) / ((float)(CurrentTime - WDstats.LastUpdateTime)*1048.576f);
+	// Calculate the data throughput rate from the boards to the computer (MB/s)
+	if (WDrun.IntegratedRates && WDstats.AcqRealTime > 0)
+		WDstats.RxByte_rate = (float)((double)WDstats.RxByte_cnt * NS_PER_S / ((double)WDstats.AcqRealTime * 1048576));
+	else if (!WDrun.IntegratedRates && CurrentTime > WDstats.LastUpdateTime)
+		WDstats.RxByte_rate = (float)((double)(WDstats.RxByte_cnt - WDstats.RxByte_pcnt) * NS_PER_S / ((double)(CurrentTime - WDstats.LastUpdateTime) * 1048576));
 	WDstats.RxByte_pcnt = WDstats.RxByte_cnt;
 	WDstats.BlockRead_cnt = 0;
 	WDstats.LastUpdateTime = CurrentTime;
 
 	// calculate counts and rater for each channel
 	for (b = 0; b < WDcfg.NumBoards; b++) {
+		uint64_t RecoveryTime = WDstats.RecoveryTime[b];	// updated by the readout stage (see WDRecovery.h)
 		for (ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
 			if (WDcfg.boards[b].channels[ch].ChannelEnable) {
 				WDstats.EvRead_rate[b][ch] = 0;
 				WDstats.EvFilt_rate[b][ch] = 0;
 				WDstats.EvOutput_rate[b][ch] = 0;
 				if (WDrun.IntegratedRates && (WDstats.LatestReadTstamp[b][ch] > 0)) {
-					float elapsed = (float)(WDstats.LatestReadTstamp[b][ch]) / 1e9f;   // elapsed time (in seconds) of read events
+					double elapsed = (double)(WDstats.LatestReadTstamp[b][ch]) / NS_PER_S;   // elapsed time (in seconds) of read events
 					WDstats.EvRead_rate[b][ch] = WDstats.EvRead_cnt[b][ch] / elapsed;  // events read from the board
 					WDstats.EvFilt_rate[b][ch] = WDstats.EvFilt_cnt[b][ch] / elapsed;  // events that passed the SW filters (cuts and correlation)
 				}
 				else if (WDstats.LatestReadTstamp[b][ch] > WDstats.PrevReadTstamp[b][ch]) {
-					float elapsed = (float)(WDstats.LatestReadTstamp[b][ch] - WDstats.PrevReadTstamp[b][ch]) / 1e9f;  // elapsed time (in seconds) of read events
+					double elapsed = (double)(WDstats.LatestReadTstamp[b][ch] - WDstats.PrevReadTstamp[b][ch]) / NS_PER_S;  // elapsed time (in seconds) of read events
 					WDstats.EvRead_rate[b][ch] = (WDstats.EvRead_cnt[b][ch] - WDstats.EvRead_pcnt[b][ch]) / elapsed;  // events read from the board
 					WDstats.EvFilt_rate[b][ch] = (WDstats.EvFilt_cnt[b][ch] - WDstats.EvFilt_pcnt[b][ch]) / elapsed;  // events that passed the SW filters (cuts and correlation)
 				}
@@ -117,16 +108,16 @@ int UpdateStatistics(uint64_t CurrentTime)
 						WDstats.EvInput_rate[b][ch] = 0;
 					}
 					else if (WDrun.IntegratedRates) {
-						WDstats.EvInput_rate[b][ch] = WDstats.EvInput_cnt[b][ch] / ((float)WDstats.ICRUpdateTime[b][ch] / 1e9f);
+						WDstats.EvInput_rate[b][ch] = WDstats.EvInput_cnt[b][ch] / ((double)WDstats.ICRUpdateTime[b][ch] / NS_PER_S);
 						WDstats.EvInput_pcnt[b][ch] = WDstats.EvInput_cnt[b][ch];
 						WDstats.PrevICRUpdateTime[b][ch] = WDstats.ICRUpdateTime[b][ch];
 					}
 					else if (WDstats.ICRUpdateTime[b][ch] > WDstats.PrevICRUpdateTime[b][ch]) {
-						WDstats.EvInput_rate[b][ch] = (WDstats.EvInput_cnt[b][ch] - WDstats.EvInput_pcnt[b][ch]) / ((float)(WDstats.ICRUpdateTime[b][ch] - WDstats.PrevICRUpdateTime[b][ch]) / 1000000000);
+						WDstats.EvInput_rate[b][ch] = (WDstats.EvInput_cnt[b][ch] - WDstats.EvInput_pcnt[b][ch]) / ((double)(WDstats.ICRUpdateTime[b][ch] - WDstats.PrevICRUpdateTime[b][ch]) / NS_PER_S);
 						WDstats.EvInput_pcnt[b][ch] = WDstats.EvInput_cnt[b][ch];
 						WDstats.PrevICRUpdateTime[b][ch] = WDstats.ICRUpdateTime[b][ch];
 					}
-					else if (((float)WDstats.PrevICRUpdateTime[b][ch] / 1e6) < (WDstats.AcqRealTime - 5000)) {  // if there is no ICR update after 5 sec, assume ICR=Read Rate
+					else if ((int64_t)WDstats.PrevICRUpdateTime[b][ch] < WDstats.AcqRealTime - 5 * NS_PER_S) {  // if there is no ICR update after 5 sec, assume ICR=Read Rate
 						WDstats.EvInput_rate[b][ch] = WDstats.EvRead_rate[b][ch];
 					}
 				}
@@ -141,12 +132,12 @@ int UpdateStatistics(uint64_t CurrentTime)
 				}
 				else {
 					if (WDrun.IntegratedRates && (WDstats.LostTrgUpdateTime[b][ch] > 0)) {
-						WDstats.EvLost_rate[b][ch] = WDstats.EvLost_cnt[b][ch] / ((float)WDstats.LostTrgUpdateTime[b][ch] / 1e9f);
+						WDstats.EvLost_rate[b][ch] = WDstats.EvLost_cnt[b][ch] / ((double)WDstats.LostTrgUpdateTime[b][ch] / NS_PER_S);
 						WDstats.EvLost_pcnt[b][ch] = WDstats.EvLost_cnt[b][ch];
 						WDstats.PrevLostTrgUpdateTime[b][ch] = WDstats.LostTrgUpdateTime[b][ch];
 					}
 					else if (WDstats.LostTrgUpdateTime[b][ch] > WDstats.PrevLostTrgUpdateTime[b][ch]) {
-						WDstats.EvLost_rate[b][ch] = (WDstats.EvLost_cnt[b][ch] - WDstats.EvLost_pcnt[b][ch]) / ((float)(WDstats.LostTrgUpdateTime[b][ch] - WDstats.PrevLostTrgUpdateTime[b][ch]) / 1e9f);
+						WDstats.EvLost_rate[b][ch] = (WDstats.EvLost_cnt[b][ch] - WDstats.EvLost_pcnt[b][ch]) / ((double)(WDstats.LostTrgUpdateTime[b][ch] - WDstats.PrevLostTrgUpdateTime[b][ch]) / NS_PER_S);
 						WDstats.EvLost_pcnt[b][ch] = WDstats.EvLost_cnt[b][ch];
 						WDstats.PrevLostTrgUpdateTime[b][ch] = WDstats.LostTrgUpdateTime[b][ch];
 					}
@@ -167,6 +158,17 @@ int UpdateStatistics(uint64_t CurrentTime)
 				if (WDstats.DeadTime[b][ch] < 0)	WDstats.DeadTime[b][ch] = 0;
 				if (WDstats.DeadTime[b][ch] > 1) 	WDstats.DeadTime[b][ch] = 1;
 
+				// The board doesn't accept triggers while it is recovered after a readout error
+				// (the time stamps after the recovery include the recovery time)
+				float RecoveryFraction = 0;
+				if (WDrun.IntegratedRates && (WDstats.LatestReadTstamp[b][ch] > 0))
+					RecoveryFraction = (float)RecoveryTime / WDstats.LatestReadTstamp[b][ch];
+				else if (WDstats.LatestReadTstamp[b][ch] > WDstats.PrevReadTstamp[b][ch])
+					RecoveryFraction = (float)(RecoveryTime - WDstats.PrevRecoveryTime[b]) / (WDstats.LatestReadTstamp[b][ch] - WDstats.PrevReadTstamp[b][ch]);
+				if (RecoveryFraction > 1) RecoveryFraction = 1;
+				if (RecoveryFraction > 0)
+					WDstats.DeadTime[b][ch] = 1 - (1 - WDstats.DeadTime[b][ch]) * (1 - RecoveryFraction);
+
 				// Percent of Busy time in the board (memory full; during this time the board is not able to accept triggers)
 				WDstats.BusyTime[b][ch] = 0;
 				if (WDstats.LatestReadTstamp[b][ch] > WDstats.PrevReadTstamp[b][ch]) {
@@ -196,6 +198,7 @@ int UpdateStatistics(uint64_t CurrentTime)
 				WDstats.BusyTimeGap[b][ch] = 0;
 			}
 		}
+		WDstats.PrevRecoveryTime[b] = RecoveryTime;
 	}
 	WDstats.PrevProcTstampAll = WDstats.LatestProcTstampAll;
 	return 0;
@@ -0,0 +1,385 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDStatus.h"
+#include "WDBuffers.h"
+#include "WDClock.h"
+#include "WDLatency.h"
+#include "WDPipeline.h"
+
+#ifdef WIN32
+	#include <io.h>
+	#define dup _dup
+	#define fdopen _fdopen
+	#define NULL_DEVICE "NUL"
+#else
+	#define NULL_DEVICE "/dev/null"
+#endif
+
+static FILE *fStatus = NULL;	// status stream (NULL = disabled)
+
+// Live histograms: contents at the previous histo record (index 0 = energy, 1 = time)
+typedef struct {
+	uint32_t *Bins;
+	uint32_t Nbin;
+	uint32_t Entries, Ovf, Unf;
+} HistoShadow_t;
+static HistoShadow_t Shadow[MAX_BD][MAX_CH][2];
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write a string as a quoted JSON string (escape quotes, backslashes and control chars)
+// ---------------------------------------------------------------------------------------------------------
+static void WriteJsonString(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; s && *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", f);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the common head of a record ({"ev":"<type>","t":<ms>)
+// ---------------------------------------------------------------------------------------------------------
+static void BeginRecord(const char *type)
+{
+	fprintf(fStatus, "{\"ev\":\"%s\",\"t\":%llu", type, (unsigned long long)WallClockMs());
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: terminate the record and flush it (one write per record)
+// ---------------------------------------------------------------------------------------------------------
+static int EndRecord()
+{
+	fputs("}\n", fStatus);
+	return fflush(fStatus) == 0 ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write a float as a JSON number (JSON has no NaN/Inf)
+// ---------------------------------------------------------------------------------------------------------
+static void WriteJsonFloat(FILE *f, const char *key, float val)
+{
+	if (val != val || val > 3.4e38f || val < -3.4e38f)
+		val = 0;
+	fprintf(f, ",\"%s\":%.3f", key, val);
+}
+
+int OpenStatusStream(const char *dest)
+{
+	CloseStatusStream();
+	if (dest == NULL || dest[0] == '\0')
+		return 0;
+
+	if (strcmp(dest, "-") == 0) {
+		// duplicate stdout, so that the stream survives DisableConsoleOutput()
+		int fd = dup(fileno(stdout));
+		if (fd >= 0)
+			fStatus = fdopen(fd, "w");
+	}
+	else if (strncmp(dest, "fd:", 3) == 0) {
+		int fd = atoi(dest + 3);
+		if (fd >= 0)
+			fStatus = fdopen(fd, "w");
+	}
+	else {
+		fStatus = fopen(dest, "w");
+	}
+
+	if (fStatus == NULL)
+		return -1;
+	BeginRecord("hello");
+	fprintf(fStatus, ",\"version\":%d", STATUS_FORMAT_VERSION);
+	return EndRecord();
+}
+
+void CloseStatusStream()
+{
+	if (fStatus != NULL)
+		fclose(fStatus);
+	fStatus = NULL;
+	for (int b = 0; b < MAX_BD; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			for (int k = 0; k < 2; k++) {
+				if (Shadow[b][ch][k].Bins != NULL)
+					free(Shadow[b][ch][k].Bins);
+				memset(&Shadow[b][ch][k], 0, sizeof(HistoShadow_t));
+			}
+		}
+	}
+}
+
+int StatusStreamEnabled()
+{
+	return fStatus != NULL;
+}
+
+int DisableConsoleOutput()
+{
+	fflush(stdout);
+	if (freopen(NULL_DEVICE, "w", stdout) == NULL)
+		return -1;
+	return 0;
+}
+
+int StatusState(const char *state)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("state");
+	fputs(",\"state\":", fStatus);
+	WriteJsonString(fStatus, state);
+	if (WDrun.DataTimeFilename[0] != '\0') {
+		fputs(",\"run\":", fStatus);
+		WriteJsonString(fStatus, WDrun.DataTimeFilename);
+	}
+	return EndRecord();
+}
+
+int StatusProgress(uint64_t ElapsedSeconds, uint64_t MaxTime, uint64_t Events, uint64_t MaxEvents)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("progress");
+	fprintf(fStatus, ",\"elapsed_s\":%llu,\"max_time_s\":%llu,\"events\":%llu,\"max_events\":%llu",
+		(unsigned long long)ElapsedSeconds, (unsigned long long)MaxTime,
+		(unsigned long long)Events, (unsigned long long)MaxEvents);
+	return EndRecord();
+}
+
+int StatusStats()
+{
+	int b, ch, first = 1;
+	if (fStatus == NULL) return 0;
+	BeginRecord("stats");
+	fprintf(fStatus, ",\"real_time_ms\":%lld,\"events\":%llu,\"bytes\":%llu,\"recoveries\":%u",
+		(long long)(WDstats.AcqRealTime / NS_PER_MS), (unsigned long long)WDstats.TotEvRead_cnt, (unsigned long long)WDstats.RxByte_cnt, WDstats.Recovery_cnt);
+	WriteJsonFloat(fStatus, "readout_mbps", WDstats.RxByte_rate);
+	fputs(",\"channels\":[", fStatus);
+	for (b = 0; b < WDcfg.NumBoards; b++) {
+		for (ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (!WDcfg.boards[b].channels[ch].ChannelEnable)
+				continue;
+			fprintf(fStatus, "%s{\"board\":%d,\"channel\":%d,\"read\":%llu,\"filt\":%llu,\"processed\":%llu",
+				first ? "" : ",", b, ch,
+				(unsigned long long)WDstats.EvRead_cnt[b][ch], (unsigned long long)WDstats.EvFilt_cnt[b][ch],
+				(unsigned long long)WDstats.EvProcessed_cnt[b][ch]);
+			WriteJsonFloat(fStatus, "read_rate", WDstats.EvRead_rate[b][ch]);
+			WriteJsonFloat(fStatus, "filt_rate", WDstats.EvFilt_rate[b][ch]);
+			WriteJsonFloat(fStatus, "input_rate", WDstats.EvInput_rate[b][ch]);
+			WriteJsonFloat(fStatus, "dead_time", WDstats.DeadTime[b][ch]);
+			WriteJsonFloat(fStatus, "match", WDstats.MatchingRatio[b][ch]);
+			WriteJsonFloat(fStatus, "queue_occupancy", WDBuff_occupancy(&WDbuff, b));
+			fputc('}', fStatus);
+			first = 0;
+		}
+	}
+	fputc(']', fStatus);
+	fputs(",\"pipeline\":[", fStatus);
+	for (int s = 0; s < PSTAGE_NUM; s++) {
+		const PipelineStageStats_t *S = GetPipelineStats(s);
+		fprintf(fStatus, "%s{\"stage\":\"%s\",\"threads\":%d,\"calls\":%llu,\"items\":%llu,\"busy_ms\":%.1f,\"wait_ms\":%.1f,\"dropped\":%llu,\"queue_max\":%d",
+			s == 0 ? "" : ",", S->Name, S->Threads, (unsigned long long)S->Calls, (unsigned long long)S->Items,
+			S->BusyTime / 1000.0, S->WaitTime / 1000.0, (unsigned long long)S->Dropped, S->QueueMax);
+		// processing scheduler: occupancy of the queues and events drained per slice
+		if (s == PSTAGE_PROCESS && S->Calls > 0) {
+			WriteJsonFloat(fStatus, "occupancy", (float)(S->OccupancySum / S->Calls));
+			WriteJsonFloat(fStatus, "slice_mean", (float)S->Items / S->Calls);
+			fprintf(fStatus, ",\"slice_max\":%d,\"slice_limit\":%d,\"drains\":%llu,\"yields\":%llu",
+				S->SliceMax, S->SliceLimit, (unsigned long long)S->Drains, (unsigned long long)S->Yields);
+		}
+		fputc('}', fStatus);
+	}
+	fputc(']', fStatus);
+	if (WDcfg.LatencyTracking) {
+		LatencySummary_t L;
+		first = 1;
+		fputs(",\"latency\":[", fStatus);
+		for (b = 0; b < WDcfg.NumBoards; b++) {
+			for (int st = 0; st < LAT_NSTAGES; st++) {
+				if (GetLatencySummary(st, b, &L) == 0)
+					continue;
+				fprintf(fStatus, "%s{\"board\":%d,\"stage\":\"%s\",\"n\":%llu", first ? "" : ",", b,
+					LatencyStageName(st), (unsigned long long)L.Count);
+				WriteJsonFloat(fStatus, "p50_ms", L.P50);
+				WriteJsonFloat(fStatus, "p90_ms", L.P90);
+				WriteJsonFloat(fStatus, "p99_ms", L.P99);
+				WriteJsonFloat(fStatus, "max_ms", L.Max);
+				fputc('}', fStatus);
+				first = 0;
+			}
+		}
+		fputc(']', fStatus);
+	}
+	if (EndRecord() < 0)
+		return -1;
+	return StatusHistograms();
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the record of one histogram with the bins changed since the previous record (none if
+//              nothing changed); the shadow copy is updated
+// ---------------------------------------------------------------------------------------------------------
+static int HistoDelta(int b, int ch, const char *kind, const Histogram1D_t *H, HistoShadow_t *S)
+{
+	int full = 0, first = 1;
+	uint32_t i;
+
+	if (H->H_data == NULL || H->Nbin == 0)
+		return 0;
+	if (S->Bins == NULL || S->Nbin != H->Nbin) {
+		if (S->Bins != NULL)
+			free(S->Bins);
+		S->Bins = (uint32_t *)calloc(H->Nbin, sizeof(uint32_t));
+		if (S->Bins == NULL) {
+			S->Nbin = 0;
+			return -1;
+		}
+		S->Nbin = H->Nbin;
+		full = 1;
+	}
+	else if (H->H_cnt < S->Entries) {
+		// histogram reset (new run or scan step): only the bins filled since then are sent
+		memset(S->Bins, 0, S->Nbin * sizeof(uint32_t));
+		full = 1;
+	}
+	if (!full && H->H_cnt == S->Entries && H->Ovf_cnt == S->Ovf && H->Unf_cnt == S->Unf &&
+		memcmp(H->H_data, S->Bins, H->Nbin * sizeof(uint32_t)) == 0)
+		return 0;
+
+	BeginRecord("histo");
+	fprintf(fStatus, ",\"board\":%d,\"channel\":%d,\"kind\":\"%s\",\"nbin\":%u,\"entries\":%u,\"ovf\":%u,\"unf\":%u,\"full\":%d,\"bins\":[",
+		b, ch, kind, H->Nbin, H->H_cnt, H->Ovf_cnt, H->Unf_cnt, full);
+	for (i = 0; i < H->Nbin; i++) {
+		if (H->H_data[i] == S->Bins[i])
+			continue;	// in a full record, the shadow is empty: only the filled bins are listed
+		S->Bins[i] = H->H_data[i];
+		fprintf(fStatus, "%s%u,%u", first ? "" : ",", i, S->Bins[i]);
+		first = 0;
+	}
+	fputc(']', fStatus);
+	S->Entries = H->H_cnt;
+	S->Ovf = H->Ovf_cnt;
+	S->Unf = H->Unf_cnt;
+	return EndRecord();
+}
+
+int StatusHistograms()
+{
+	int b, ch, ret = 0;
+	if (fStatus == NULL || WDcfg.StatusHistograms == 0) return 0;
+	for (b = 0; b < WDcfg.NumBoards; b++) {
+		for (ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (!WDcfg.boards[b].channels[ch].ChannelEnable)
+				continue;
+			if ((WDcfg.StatusHistograms & STATUS_HISTO_ENERGY) && HistoDelta(b, ch, "energy", &WDhistos.EH[b][ch], &Shadow[b][ch][0]) < 0)
+				ret = -1;
+			if ((WDcfg.StatusHistograms & STATUS_HISTO_TIME) && HistoDelta(b, ch, "time", &WDhistos.TH[b][ch], &Shadow[b][ch][1]) < 0)
+				ret = -1;
+		}
+	}
+	return ret;
+}
+
+int StatusFile(const char *kind, int b, int ch, const char *path)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("file");
+	fputs(",\"kind\":", fStatus);
+	WriteJsonString(fStatus, kind);
+	if (b >= 0)  fprintf(fStatus, ",\"board\":%d", b);
+	if (ch >= 0) fprintf(fStatus, ",\"channel\":%d", ch);
+	fputs(",\"path\":", fStatus);
+	WriteJsonString(fStatus, path);
+	return EndRecord();
+}
+
+int StatusError(int code, const char *msg)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("error");
+	fprintf(fStatus, ",\"code\":%d,\"msg\":", code);
+	WriteJsonString(fStatus, msg);
+	return EndRecord();
+}
+
+int StatusMarker(const WaveDemoMarker_t *m)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("marker");
+	fprintf(fStatus, ",\"step\":%d,\"settling\":%d,\"board_time_ns\":%llu",
+		m->StepId, m->Settling, (unsigned long long)m->BoardTime[0]);
+	if (WDcfg.NumBoards > 1) {
+		for (int b = 0; b < WDcfg.NumBoards; b++)
+			fprintf(fStatus, "%s%llu", b == 0 ? ",\"board_times_ns\":[" : ",", (unsigned long long)m->BoardTime[b]);
+		fputc(']', fStatus);
+	}
+	if (m->HasHV) {
+		WriteJsonFloat(fStatus, "hv", m->HVset);
+		WriteJsonFloat(fStatus, "hv_mon", m->HVmon);
+	}
+	if (m->HasThreshold)
+		WriteJsonFloat(fStatus, "thr", m->Threshold);
+	if (m->Label[0] != '\0') {
+		fputs(",\"label\":", fStatus);
+		WriteJsonString(fStatus, m->Label);
+	}
+	return EndRecord();
+}
+
+int StatusRecovery(const WaveDemoDiscontinuity_t *d)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("recovery");
+	fprintf(fStatus, ",\"board\":%d,\"all_boards\":%d,\"attempts\":%d,\"dead_time_ms\":%llu,\"board_time_ns\":%llu,\"reason\":",
+		d->Board, d->AllBoards, d->Attempts, (unsigned long long)d->DeadTime, (unsigned long long)d->BoardTime);
+	WriteJsonString(fStatus, d->Reason);
+	return EndRecord();
+}
+
+int StatusThrPoint(int point, float Threshold, const char *discr, int b, int ch, uint64_t events, uint64_t triggered, float rate, float EnergyMean)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("thr_point");
+	fprintf(fStatus, ",\"point\":%d,\"thr\":%.5f,\"discr\":", point, (Threshold == Threshold) ? Threshold : 0);
+	WriteJsonString(fStatus, discr);
+	fprintf(fStatus, ",\"board\":%d,\"channel\":%d,\"events\":%llu,\"triggered\":%llu",
+		b, ch, (unsigned long long)events, (unsigned long long)triggered);
+	WriteJsonFloat(fStatus, "rate", rate);
+	WriteJsonFloat(fStatus, "energy_mean", EnergyMean);
+	return EndRecord();
+}
+
+int StatusCalibration(int b, int ch, float TimeOffset, float TimeRms, float GainM, float GainQ, uint64_t events)
+{
+	if (fStatus == NULL) return 0;
+	BeginRecord("calib");
+	fprintf(fStatus, ",\"board\":%d,\"channel\":%d", b, ch);
+	fprintf(fStatus, ",\"time_offset\":%.4f,\"time_rms\":%.4f,\"gain_m\":%.6f", (TimeOffset == TimeOffset) ? TimeOffset : 0,
+		(TimeRms == TimeRms) ? TimeRms : 0, (GainM == GainM) ? GainM : 0);
+	WriteJsonFloat(fStatus, "gain_q", GainQ);
+	fprintf(fStatus, ",\"events\":%llu", (unsigned long long)events);
+	return EndRecord();
+}
@@ -0,0 +1,351 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDThrEmul.h"
+#include "WDCalib.h"
+#include "WDFiles.h"
+#include "WDHArchive.h"
+#include "WDHisto.h"
+#include "WDLogs.h"
+#include "WDStatus.h"
+#include "WDWPCache.h"
+#include "WDWaveformProcess.h"
+
+// One emulated point: threshold and discriminator, with the results of each channel
+typedef struct {
+	float Threshold;						// trigger threshold (V)
+	int DiscrMode;							// 0=LED, 1=CFD, -1=discriminator of the channel
+	uint64_t Triggered[MAX_BD][MAX_CH];		// events above the threshold
+	double EnergySum[MAX_BD][MAX_CH];		// sum of the energies of the triggered events (ADC counts)
+	double PrevTime[MAX_BD][MAX_CH];		// time of the previous triggered event (ns, TAC_SPECTRUM_INTERVALS)
+	double RefTime;							// time of the TOF start channel in the last event of its board (ns, <0 = no trigger)
+	Histogram1D_t EH[MAX_BD][MAX_CH];		// energy histograms (binning of the acquisition)
+	Histogram1D_t TH[MAX_BD][MAX_CH];		// time histograms (binning of the acquisition)
+} EmulPoint_t;
+
+// Settings of a channel changed by the emulation
+typedef struct {
+	float TriggerThreshold_V;
+	float TriggerThreshold_adc;
+	int DiscrMode;
+	int CFDThreshold;
+} EmulSavedChannel_t;
+
+static EmulPoint_t *Points = NULL;
+static int NumPoints = 0;
+static Waveform_t Wfm;							// traces of the processor (not used)
+static uint64_t Events[MAX_BD][MAX_CH];			// events of each channel in the file
+static uint64_t FirstTime[MAX_BD], LastTime[MAX_BD];	// time span of the events of each board (ns)
+static int HasTime[MAX_BD];
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+static int AllocateEmulWaveform(Waveform_t *wfm, int ns)
+{
+	memset(wfm, 0, sizeof(Waveform_t));
+	wfm->Ns = ns;
+	for (int a = 0; a < NUM_ATRACE; a++) {
+		wfm->AnalogTrace[a] = (float *)malloc(ns * sizeof(float));
+		if (wfm->AnalogTrace[a] == NULL)
+			return -1;
+	}
+	wfm->DigitalTraces = (uint8_t *)malloc(ns * sizeof(uint8_t));
+	return (wfm->DigitalTraces == NULL) ? -1 : 0;
+}
+
+static void FreeEmulWaveform(Waveform_t *wfm)
+{
+	for (int a = 0; a < NUM_ATRACE; a++)
+		free(wfm->AnalogTrace[a]);
+	free(wfm->DigitalTraces);
+	memset(wfm, 0, sizeof(Waveform_t));
+}
+
+static const char *DiscrName(const EmulPoint_t *p, int b, int ch)
+{
+	int mode = (p->DiscrMode >= 0) ? p->DiscrMode : WDcfg.boards[b].channels[ch].DiscrMode;
+	return (mode == 1) ? "CFD" : "LED";
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: set the threshold and discriminator of a point in the settings of a channel
+// Outputs:		s = settings to restore with RestoreChannel
+// ---------------------------------------------------------------------------------------------------------
+static void ApplyPoint(const EmulPoint_t *p, int b, int ch, EmulSavedChannel_t *s)
+{
+	WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	s->TriggerThreshold_V = WDc->TriggerThreshold_V;
+	s->TriggerThreshold_adc = WDc->TriggerThreshold_adc;
+	s->DiscrMode = WDc->DiscrMode;
+	s->CFDThreshold = WDc->CFDThreshold;
+	WDc->TriggerThreshold_V = p->Threshold;
+	if (p->DiscrMode >= 0)
+		WDc->DiscrMode = p->DiscrMode;
+	WDc->CFDThreshold = -1;		// the CFD is armed at threshold x attenuation
+	UpdateChannelThreshold(b, ch);
+}
+
+static void RestoreChannel(int b, int ch, const EmulSavedChannel_t *s)
+{
+	WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	WDc->TriggerThreshold_V = s->TriggerThreshold_V;
+	WDc->TriggerThreshold_adc = s->TriggerThreshold_adc;
+	WDc->DiscrMode = s->DiscrMode;
+	WDc->CFDThreshold = s->CFDThreshold;
+}
+
+int InitThrEmulation()
+{
+	int nd = (WDcfg.EmulDiscr == EMUL_DISCR_BOTH) ? 2 : 1;
+	int below = 0;
+
+	CloseThrEmulation();
+	if (WDcfg.NumEmulThresholds == 0)
+		return 0;
+	if (!(WDcfg.WaveformProcessor & 0x01)) {
+		msg_printf(MsgLog, "WARN: The threshold emulation needs the timing of the waveform processor; disabled\n");
+		return 0;
+	}
+	if (AllocateEmulWaveform(&Wfm, WDcfg.GlobalRecordLength) < 0)
+		return -1;
+	Points = (EmulPoint_t *)calloc(WDcfg.NumEmulThresholds * nd, sizeof(EmulPoint_t));
+	if (Points == NULL)
+		return -1;
+	NumPoints = WDcfg.NumEmulThresholds * nd;
+
+	for (int i = 0; i < NumPoints; i++) {
+		EmulPoint_t *p = &Points[i];
+		p->Threshold = WDcfg.EmulThresholds[i / nd];
+		if (WDcfg.EmulDiscr == EMUL_DISCR_BOTH)
+			p->DiscrMode = i % nd;
+		else
+			p->DiscrMode = (WDcfg.EmulDiscr == EMUL_DISCR_SAME) ? -1 : (WDcfg.EmulDiscr == EMUL_DISCR_CFD);
+		p->RefTime = -1;
+		for (int b = 0; b < WDcfg.NumBoards; b++) {
+			for (int ch = 0; ch < MAX_CH; ch++) {
+				WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+				if (!WDc->ChannelEnable)
+					continue;
+				if (fabsf(p->Threshold) < fabsf(WDc->TriggerThreshold_V))
+					below = 1;
+				CreateHistogram1D(WDcfg.EHnbin, "Energy", "Channels", "Cnt", &p->EH[b][ch]);
+				CreateHistogram1D(WDcfg.THnbin, "Time", "ns", "Cnt", &p->TH[b][ch]);
+				if (p->EH[b][ch].H_data == NULL || p->TH[b][ch].H_data == NULL)
+					return -1;
+				ResetHistogram1D(&p->EH[b][ch]);
+				ResetHistogram1D(&p->TH[b][ch]);
+			}
+		}
+	}
+	memset(Events, 0, sizeof(Events));
+	memset(HasTime, 0, sizeof(HasTime));
+	if (below)
+		msg_printf(MsgLog, "WARN: Emulated thresholds below the threshold of the acquisition: their rates are lower limits\n");
+	msg_printf(MsgLog, "INFO: Threshold emulation: %d points\n", NumPoints);
+	return NumPoints;
+}
+
+int ThrEmulationEvent(int bd, WaveDemoEvent_t *event, const char channelsEnabled[MAX_CH])
+{
+	char present[MAX_CH];
+	float TimeStamp[MAX_CH], Energy[MAX_CH], Baseline;
+	const int RefCh = WDcfg.TOFstartChannel;
+	uint64_t EventTime = 0;
+	int found = 0;
+
+	if (NumPoints == 0 || bd >= WDcfg.NumBoards)
+		return 0;
+	for (int ch = 0; ch < MAX_CH; ch++) {
+		present[ch] = channelsEnabled[ch] && event->Event->GrPresent[ch / 2] && WDcfg.boards[bd].channels[ch].ChannelEnable;
+		if (!present[ch])
+			continue;
+		Events[bd][ch]++;
+		if (!found) {
+			EventTime = event->Event->DataGroup[ch / 2].TDC * 5;
+			found = 1;
+		}
+	}
+	if (!found)
+		return 0;
+	if (!HasTime[bd] || EventTime < FirstTime[bd])
+		FirstTime[bd] = EventTime;
+	if (!HasTime[bd] || EventTime > LastTime[bd])
+		LastTime[bd] = EventTime;
+	HasTime[bd] = 1;
+
+	for (int i = 0; i < NumPoints; i++) {
+		EmulPoint_t *p = &Points[i];
+		EmulSavedChannel_t saved;
+
+		// discriminator of all the channels first (the TOF start channel is the reference of the others)
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (!present[ch])
+				continue;
+			int ns = event->Event->DataGroup[ch / 2].ChSize;
+			if (ns > WDcfg.GlobalRecordLength)
+				ns = WDcfg.GlobalRecordLength;
+			ApplyPoint(p, bd, ch, &saved);
+			if (WaveformProcessVariant(WDcfg.WPKernel, WPCacheActive(), bd, ch, ns,
+				event->Event->DataGroup[ch / 2].DataChannel[ch % 2], &Wfm, &Baseline, &TimeStamp[ch], &Energy[ch]) < 0)
+				TimeStamp[ch] = 0;
+			RestoreChannel(bd, ch, &saved);
+		}
+		if (bd == WDcfg.TOFstartBoard)
+			p->RefTime = (present[RefCh] && TimeStamp[RefCh] != 0) ?
+				(double)event->Event->DataGroup[RefCh / 2].TDC * 5 + TimeStamp[RefCh] : -1;
+
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (!present[ch] || TimeStamp[ch] == 0)
+				continue;
+			const WaveDemoChannel_t *WDc = &WDcfg.boards[bd].channels[ch];
+			double time = (double)event->Event->DataGroup[ch / 2].TDC * 5 + TimeStamp[ch];
+			Energy[ch] = CalibratedEnergy(bd, ch, Energy[ch]);
+			p->Triggered[bd][ch]++;
+			p->EnergySum[bd][ch] += Energy[ch];
+			Histo1D_AddCount(&p->EH[bd][ch], (int)(Energy[ch] / (WDc->EnergyCoarseGain * 1024 / WDcfg.EHnbin)));
+			if (WDcfg.TspectrumMode == TAC_SPECTRUM_INTERVALS) {
+				double dt = time - p->PrevTime[bd][ch];
+				p->PrevTime[bd][ch] = time;
+				time = dt;
+			}
+			else if (p->RefTime >= 0) {
+				time -= p->RefTime + CalibrationTimeCorr(bd, ch);
+			}
+			else {
+				continue;	// no start
+			}
+			Histo1D_AddCount(&p->TH[bd][ch], (int)((time - WDcfg.THmin) * WDcfg.THnbin / (WDcfg.THmax - WDcfg.THmin)));
+		}
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: save the histograms of one point and channel (text files or histogram archive)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int SaveEmulHistograms(int i, int b, int ch)
+{
+	EmulPoint_t *p = &Points[i];
+	WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	char fname[300];
+	int ret = 0;
+
+	if (WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE) {
+		HArchiveRecord_t r;
+		memset(&r, 0, sizeof(r));
+		r.Flags = HARC_FLAG_EMULATED;
+		r.Board = (int16_t)b;
+		r.Channel = (int16_t)ch;
+		r.Step = i;
+		r.Threshold = p->Threshold;
+		if (WDcfg.SaveHistograms & 0x1) {
+			r.Type = HARC_TYPE_ENERGY;
+			strcpy(r.Name, "energy");
+			strcpy(r.Unit, "ch");
+			r.Xmin = 0;
+			r.Xmax = WDcfg.EHnbin;
+			r.CalibM = WDc->ECalibration_m;
+			r.CalibQ = WDc->ECalibration_q;
+			ret |= ArchiveHistogram(&r, &p->EH[b][ch]);
+		}
+		if (WDcfg.SaveHistograms & 0x2) {
+			r.Type = HARC_TYPE_TIME;
+			strcpy(r.Name, "time");
+			strcpy(r.Unit, "ns");
+			r.Xmin = WDcfg.THmin;
+			r.Xmax = WDcfg.THmax;
+			r.CalibM = r.CalibQ = 0;
+			ret |= ArchiveHistogram(&r, &p->TH[b][ch]);
+		}
+		return ret;
+	}
+	if (WDcfg.SaveHistograms & 0x1) {
+		CreateThrEmulationFileName("Ehisto", i, b, ch, fname);
+		ret |= SaveHistogram(fname, p->EH[b][ch]);
+	}
+	if (WDcfg.SaveHistograms & 0x2) {
+		CreateThrEmulationFileName("Thisto", i, b, ch, fname);
+		ret |= SaveHistogram(fname, p->TH[b][ch]);
+	}
+	return ret;
+}
+
+int SaveThrEmulation()
+{
+	char fname[300];
+	FILE *f;
+	int ret = 0;
+
+	if (NumPoints == 0)
+		return 0;
+	CreateThrEmulationFileName(NULL, 0, 0, 0, fname);
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		msg_printf(MsgLog, "ERROR: Can't open the threshold emulation file %s\n", fname);
+		return -1;
+	}
+	fprintf(f, "#%5s %10s %5s %5s %5s %12s %12s %12s %12s\n", "Point", "Thr(V)", "Discr", "Board", "Ch", "Events", "Triggered", "Rate(Hz)", "EMean");
+	if (WDcfg.SaveHistograms && WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE) {
+		CreateHistoArchiveFileName(fname);
+		ret |= BeginHistoArchive(fname);
+	}
+	for (int i = 0; i < NumPoints; i++) {
+		EmulPoint_t *p = &Points[i];
+		for (int b = 0; b < WDcfg.NumBoards; b++) {
+			double span = HasTime[b] ? (LastTime[b] - FirstTime[b]) * 1e-9 : 0;
+			for (int ch = 0; ch < MAX_CH; ch++) {
+				if (!WDcfg.boards[b].channels[ch].ChannelEnable || Events[b][ch] == 0)
+					continue;
+				double rate = (span > 0) ? p->Triggered[b][ch] / span : 0;
+				double emean = p->Triggered[b][ch] ? p->EnergySum[b][ch] / p->Triggered[b][ch] : 0;
+				fprintf(f, " %5d %10.5f %5s %5d %5d %12llu %12llu %12.3f %12.2f\n", i, p->Threshold, DiscrName(p, b, ch), b, ch,
+					(unsigned long long)Events[b][ch], (unsigned long long)p->Triggered[b][ch], rate, emean);
+				StatusThrPoint(i, p->Threshold, DiscrName(p, b, ch), b, ch, Events[b][ch], p->Triggered[b][ch], (float)rate, (float)emean);
+				if (WDcfg.SaveHistograms)
+					ret |= SaveEmulHistograms(i, b, ch);
+			}
+		}
+	}
+	if (WDcfg.SaveHistograms && WDcfg.HistoOutputFormat == HISTO_FILE_FORMAT_ARCHIVE)
+		ret |= EndHistoArchive();
+	fclose(f);
+	CreateThrEmulationFileName(NULL, 0, 0, 0, fname);
+	StatusFile("thr_emulation", -1, -1, fname);
+	msg_printf(MsgLog, "INFO: Threshold emulation (%d points) saved in %s\n", NumPoints, fname);
+	if (ret)
+		msg_printf(MsgLog, "WARN: Can't save the histograms of the threshold emulation\n");
+	return ret ? -1 : 0;
+}
+
+void CloseThrEmulation()
+{
+	if (Points != NULL) {
+		for (int i = 0; i < NumPoints; i++) {
+			for (int b = 0; b < MAX_BD; b++) {
+				for (int ch = 0; ch < MAX_CH; ch++) {
+					free(Points[i].EH[b][ch].H_data);
+					free(Points[i].TH[b][ch].H_data);
+				}
+			}
+		}
+		free(Points);
+	}
+	Points = NULL;
+	NumPoints = 0;
+	FreeEmulWaveform(&Wfm);
+}
@@ -0,0 +1,431 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+
+#include "WDVerify.h"
+#include "WDLogs.h"
+#include "WDFiles.h"
+#include "WDHisto.h"
+#include "WDWaveformProcess.h"
+#include "WDWPCache.h"
+
+#define VAR_REFERENCE		0
+#define VAR_SPLIT			1
+#define VAR_CACHE_ENERGY	2
+#define VAR_CACHE_HIT		3
+#define NUM_VARIANTS		4
+
+#define QTY_BASELINE		0
+#define QTY_TIME			1
+#define QTY_ENERGY			2
+#define NUM_QTY				3
+
+typedef struct {
+	const char *Name;
+	int Kernel;				// WP_KERNEL_xxx
+	int Cached;				// through the processor cache
+} VerifyVariant_t;
+
+typedef struct {
+	uint64_t Nwave;				// waveforms processed
+	uint64_t Nbad;				// waveforms with at least one result out of tolerance
+	uint64_t Nerr;				// processor errors
+	uint64_t Mismatch[NUM_QTY];	// results out of tolerance
+	double MaxDev[NUM_QTY];		// max deviation from the reference (energy: relative)
+	int Nrepro;					// reproducers written
+	Histogram1D_t EH;			// energy histogram (binning of the acquisition)
+	Histogram1D_t TH;			// fine time stamp histogram
+} VerifyStats_t;
+
+static const VerifyVariant_t Variants[NUM_VARIANTS] = {
+	{ "reference",		WP_KERNEL_FUSED, 0 },
+	{ "split",			WP_KERNEL_SPLIT, 0 },
+	{ "cache-energy",	WP_KERNEL_FUSED, 1 },
+	{ "cache-hit",		WP_KERNEL_FUSED, 1 },
+};
+static const char *QtyNames[NUM_QTY] = { "baseline", "time", "energy" };
+static const double Tolerance[NUM_QTY] = { VFY_TOL_BASELINE, VFY_TOL_TIME, VFY_TOL_ENERGY };
+
+static VerifyStats_t Stats[NUM_VARIANTS];
+static Waveform_t Wfm;				// traces of the processor (not compared)
+static int CacheReady = 0;			// the cached variants are run
+static int Replay = 0;				// replay of a reproducer (no new reproducers)
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+static int AllocateVerifyWaveform(Waveform_t *wfm, int ns)
+{
+	memset(wfm, 0, sizeof(Waveform_t));
+	wfm->Ns = ns;
+	for (int a = 0; a < NUM_ATRACE; a++) {
+		wfm->AnalogTrace[a] = (float *)malloc(ns * sizeof(float));
+		if (wfm->AnalogTrace[a] == NULL)
+			return -1;
+	}
+	wfm->DigitalTraces = (uint8_t *)malloc(ns * sizeof(uint8_t));
+	return (wfm->DigitalTraces == NULL) ? -1 : 0;
+}
+
+static void FreeVerifyWaveform(Waveform_t *wfm)
+{
+	for (int a = 0; a < NUM_ATRACE; a++)
+		free(wfm->AnalogTrace[a]);
+	free(wfm->DigitalTraces);
+	memset(wfm, 0, sizeof(Waveform_t));
+}
+
+static uint32_t NextRandom(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the histograms of a variant with the results of one waveform (energy with the binning of
+//				EventProcessing, fine time stamp over the record)
+// ---------------------------------------------------------------------------------------------------------
+static void FillHistograms(int v, int b, int ch, int ns, const float *r)
+{
+	const WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+
+	Histo1D_AddCount(&Stats[v].EH, (int)(r[QTY_ENERGY] / (WDc->EnergyCoarseGain * 1024 / WDcfg.EHnbin)));
+	if (r[QTY_TIME] != 0)
+		Histo1D_AddCount(&Stats[v].TH, (int)(r[QTY_TIME] * WDcfg.THnbin / (ns * WDcfg.handles[b].Ts)));
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write a reproducer of a mismatching waveform in the data path
+// ---------------------------------------------------------------------------------------------------------
+static void WriteReproducer(int v, int b, int ch, int ns, const float *wave, float r[NUM_VARIANTS][NUM_QTY])
+{
+	char fname[300];
+	FILE *f;
+
+	sprintf(fname, "%sverify_%s_%d.txt", WDcfg.DataFilePath, Variants[v].Name, Stats[v].Nrepro++);
+	f = fopen(fname, "w");
+	if (f == NULL) {
+		msg_printf(MsgLog, "WARN: Can't write the reproducer %s\n", fname);
+		return;
+	}
+	fprintf(f, "%s\n", VFY_REPRO_TAG);
+	fprintf(f, "# %-12s baseline %.9g time %.9g energy %.9g\n", Variants[VAR_REFERENCE].Name, r[VAR_REFERENCE][QTY_BASELINE], r[VAR_REFERENCE][QTY_TIME], r[VAR_REFERENCE][QTY_ENERGY]);
+	fprintf(f, "# %-12s baseline %.9g time %.9g energy %.9g\n", Variants[v].Name, r[v][QTY_BASELINE], r[v][QTY_TIME], r[v][QTY_ENERGY]);
+	fprintf(f, "BOARD %d\nCHANNEL %d\nSAMPLES %d\n", b, ch, ns);
+	for (int i = 0; i < ns; i++)
+		fprintf(f, "%.9g\n", wave[i]);
+	fclose(f);
+	msg_printf(MsgLog, "WARN: Verification: %s differs from the reference (board %d, channel %d) -> %s\n", Variants[v].Name, b, ch, fname);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: process one waveform with the reference and with each variant and compare the results
+// ---------------------------------------------------------------------------------------------------------
+static void VerifyWaveform(int b, int ch, int ns, const float *wave)
+{
+	WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	float r[NUM_VARIANTS][NUM_QTY];
+
+	if (ns > WDcfg.GlobalRecordLength)
+		ns = WDcfg.GlobalRecordLength;
+	for (int v = 0; v < NUM_VARIANTS; v++) {
+		const VerifyVariant_t *V = &Variants[v];
+		if (V->Cached && !CacheReady)
+			continue;
+		if (v == VAR_CACHE_ENERGY) {
+			// fill the cache with a longer gate: the timing entry is shared, the energy one is not
+			const float GateWidth = WDc->GateWidth;
+			WDc->GateWidth += VFY_GATE_DELTA * WDcfg.handles[b].Ts;
+			WaveformProcessVariant(V->Kernel, 1, b, ch, ns, wave, &Wfm, &r[v][QTY_BASELINE], &r[v][QTY_TIME], &r[v][QTY_ENERGY]);
+			WDc->GateWidth = GateWidth;
+		}
+		Stats[v].Nwave++;
+		if (WaveformProcessVariant(V->Kernel, V->Cached, b, ch, ns, wave, &Wfm, &r[v][QTY_BASELINE], &r[v][QTY_TIME], &r[v][QTY_ENERGY]) < 0) {
+			Stats[v].Nerr++;
+			continue;
+		}
+		FillHistograms(v, b, ch, ns, r[v]);
+		if (v == VAR_REFERENCE)
+			continue;
+
+		int bad = 0;
+		for (int q = 0; q < NUM_QTY; q++) {
+			double dev = fabs((double)r[v][q] - (double)r[VAR_REFERENCE][q]);
+			if (q == QTY_ENERGY)
+				dev /= max(1.0, fabs((double)r[VAR_REFERENCE][q]));
+			if (dev > Stats[v].MaxDev[q])
+				Stats[v].MaxDev[q] = dev;
+			if (dev > Tolerance[q]) {
+				Stats[v].Mismatch[q]++;
+				bad = 1;
+			}
+		}
+		if (bad) {
+			Stats[v].Nbad++;
+			if (!Replay && Stats[v].Nrepro < VFY_MAX_REPRO)
+				WriteReproducer(v, b, ch, ns, wave, r);
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: synthetic corpus: VFY_NUM_SYNTH waveforms per enabled channel, cycling over the cases of the
+//				processor (baseline with noise and at most one pulse)
+// Return:		number of waveforms, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int VerifySynthetic()
+{
+	const int ns = WDcfg.GlobalRecordLength;
+	float *wave = (float *)malloc(ns * sizeof(float));
+	uint32_t seed = 4242;
+	int n = 0;
+
+	if (wave == NULL)
+		return -1;
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			WaveDemoBoard_t *WDb = &WDcfg.boards[b];
+			WaveDemoChannel_t *WDc = &WDb->channels[ch];
+			const float base = (WDb->CorrectionLevel == 0 || WDb->CorrectionLevel == 2) ? 2048.0f : 0.0f;
+			const float dir = (WDc->PulsePolarity == CAEN_DGTZ_PulsePolarityPositive) ? 1.0f : -1.0f;
+			const float thr = fabsf(1485 * WDc->TriggerThreshold_V) + 1;
+			if (!WDc->ChannelEnable)
+				continue;
+			for (int w = 0; w < VFY_NUM_SYNTH; w++) {
+				int pos = ns / 5 + (int)(NextRandom(&seed) % (uint32_t)(3 * ns / 5 + 1));
+				float amp = thr * (2 + (NextRandom(&seed) % 1000) / 100.0f), sgn = dir;
+				int clip = 0;
+				switch (w % 8) {
+				case 1: amp = thr * 1.1f; break;						// just above the threshold
+				case 2: amp = thr * 0.5f; break;						// below the threshold
+				case 3: amp = 0; break;									// baseline only
+				case 4: pos = (int)(NextRandom(&seed) % 8); break;		// start of the record
+				case 5: pos = ns - 1 - (int)(NextRandom(&seed) % 16); break;	// end of the record
+				case 6: amp = 8192; clip = 1; break;					// saturated
+				case 7: sgn = -dir; break;								// opposite polarity
+				default: break;
+				}
+				for (int i = 0; i < ns; i++) {
+					float v = base + (float)((int)(NextRandom(&seed) % 5) - 2);
+					if (i >= pos)	// peak of the shape is 0.53 at 2.6 samples
+						v += sgn * amp / 0.53f * (expf(-(i - pos) / 10.0f) - expf(-(i - pos) / 2.0f));
+					if (clip)
+						v = (v < 0) ? 0 : (v > 4095) ? 4095 : v;
+					wave[i] = v;
+				}
+				VerifyWaveform(b, ch, ns, wave);
+				n++;
+			}
+		}
+	}
+	free(wave);
+	return n;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: corpus of a raw data file (the enabled channels of the events of the boards in the config)
+// Return:		number of waveforms, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int VerifyRawFile(FILE *f)
+{
+	WaveDemoEvent_t *events[MAX_BD] = { NULL };
+	char txtHeader[80], FileFormat, channelsEnabled[MAX_CH];
+	uint32_t header[8] = { 0 };
+	int bd, ret, n = 0;
+
+	if (ReadRawHeader(f, txtHeader, &FileFormat, header, 8) != 0)
+		return -1;
+	while ((ret = ReadRawEvent(f, events, &bd, channelsEnabled)) == 1) {
+		CAEN_DGTZ_X743_EVENT_t *Event = events[bd]->Event;
+		if (bd >= WDcfg.NumBoards)
+			continue;
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (!channelsEnabled[ch] || !Event->GrPresent[ch / 2] || !WDcfg.boards[bd].channels[ch].ChannelEnable)
+				continue;
+			VerifyWaveform(bd, ch, Event->DataGroup[ch / 2].ChSize, Event->DataGroup[ch / 2].DataChannel[ch % 2]);
+			n++;
+		}
+	}
+	for (int b = 0; b < MAX_BD; b++) {
+		if (events[b] == NULL)
+			continue;
+		for (int ch = 0; ch < MAX_CH; ch++)
+			free(events[b]->Event->DataGroup[ch / 2].DataChannel[ch % 2]);
+		free(events[b]->Event);
+		free(events[b]);
+	}
+	return (ret < 0) ? -1 : n;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: corpus of a reproducer (after the tag line)
+// Return:		number of waveforms, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int VerifyReproducer(FILE *f)
+{
+	char line[200];
+	int b = -1, ch = -1, ns = 0;
+	float *wave;
+
+	while (ns == 0 && fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "BOARD %d", &b) != 1 && sscanf(line, "CHANNEL %d", &ch) != 1)
+			sscanf(line, "SAMPLES %d", &ns);
+	}
+	if (b < 0 || b >= WDcfg.NumBoards || ch < 0 || ch >= MAX_CH || ns <= 0) {
+		msg_printf(MsgLog, "ERROR: Invalid reproducer (board %d, channel %d, %d samples)\n", b, ch, ns);
+		return -1;
+	}
+	wave = (float *)malloc(ns * sizeof(float));
+	if (wave == NULL)
+		return -1;
+	for (int i = 0; i < ns; i++) {
+		if (fscanf(f, "%f", &wave[i]) != 1) {
+			free(wave);
+			return -1;
+		}
+	}
+	VerifyWaveform(b, ch, ns, wave);
+	free(wave);
+	return 1;
+}
+
+// entries of a histogram (in range, overflow and underflow)
+static uint64_t HistoEntries(const Histogram1D_t *h)
+{
+	return (uint64_t)h->H_cnt + h->Ovf_cnt + h->Unf_cnt;
+}
+
+// entries of a histogram that are in another bin of the reference one
+static uint64_t HistoMoved(const Histogram1D_t *ref, const Histogram1D_t *h)
+{
+	uint64_t d = 0;
+	for (uint32_t i = 0; i < ref->Nbin; i++)
+		d += (ref->H_data[i] > h->H_data[i]) ? ref->H_data[i] - h->H_data[i] : h->H_data[i] - ref->H_data[i];
+	d += (ref->Ovf_cnt > h->Ovf_cnt) ? ref->Ovf_cnt - h->Ovf_cnt : h->Ovf_cnt - ref->Ovf_cnt;
+	d += (ref->Unf_cnt > h->Unf_cnt) ? ref->Unf_cnt - h->Unf_cnt : h->Unf_cnt - ref->Unf_cnt;
+	return (d + 1) / 2;
+}
+
+int RunVerification(const char *corpus)
+{
+	char CacheFile[300] = "", line[200];
+	int ret = 0, nsynth, ncorpus = 0;
+	FILE *f;
+
+	if (!WDcfg.WaveformProcessor) {
+		msg_printf(MsgLog, "ERROR: The waveform processor is disabled (WAVEFORM_PROCESSOR): nothing to verify\n");
+		return -1;
+	}
+	memset(Stats, 0, sizeof(Stats));
+	Replay = 0;
+	for (int v = 0; v < NUM_VARIANTS; v++) {
+		CreateHistogram1D(WDcfg.EHnbin, "Energy", "Channels", "Counts", &Stats[v].EH);
+		CreateHistogram1D(WDcfg.THnbin, "Time", "Channels", "Counts", &Stats[v].TH);
+		if (Stats[v].EH.H_data == NULL || Stats[v].TH.H_data == NULL) {
+			ret = -1;
+			goto Done;
+		}
+		ResetHistogram1D(&Stats[v].EH);
+		ResetHistogram1D(&Stats[v].TH);
+	}
+	if (AllocateVerifyWaveform(&Wfm, WDcfg.GlobalRecordLength) < 0) {
+		ret = -1;
+		goto Done;
+	}
+
+	// empty cache for the cached variants
+	sprintf(CacheFile, "%sverify%s", WDcfg.DataFilePath, WPC_FILE_EXT);
+	remove(CacheFile);
+	CacheReady = (OpenWPCache(CacheFile) >= 0);
+	if (!CacheReady)
+		msg_printf(MsgLog, "WARN: Can't open the processor cache %s: the cached variants are skipped\n", CacheFile);
+
+	// a reproducer is replayed alone, the synthetic waveforms are added to a raw data file
+	if (corpus != NULL && corpus[0] != 0) {
+		f = fopen(corpus, "rb");
+		if (f == NULL) {
+			msg_printf(MsgLog, "ERROR: Can't open %s\n", corpus);
+			ret = -1;
+			goto Done;
+		}
+		Replay = (fgets(line, sizeof(line), f) != NULL && strncmp(line, VFY_REPRO_TAG, strlen(VFY_REPRO_TAG)) == 0);
+		if (Replay) {
+			ncorpus = VerifyReproducer(f);
+		}
+		else {
+			rewind(f);
+			ncorpus = VerifyRawFile(f);
+		}
+		fclose(f);
+		if (ncorpus < 0) {
+			msg_printf(MsgLog, "ERROR: Can't read the waveforms of %s\n", corpus);
+			ret = -1;
+			goto Done;
+		}
+	}
+	nsynth = Replay ? 0 : VerifySynthetic();
+	if (nsynth < 0) {
+		ret = -1;
+		goto Done;
+	}
+
+	// report
+	msg_printf(MsgLog, "INFO: Verification: %d synthetic waveforms, %d from %s\n", nsynth, ncorpus, (ncorpus > 0) ? corpus : "-");
+	msg_printf(MsgLog, "INFO:   variant       waveforms   bad  max dBaseline  max dTime(ns)  max dE(rel)  EH moved  TH moved  result\n");
+	for (int v = 1; v < NUM_VARIANTS; v++) {
+		VerifyStats_t *S = &Stats[v];
+		const uint64_t EHmoved = HistoMoved(&Stats[VAR_REFERENCE].EH, &S->EH);
+		const uint64_t THmoved = HistoMoved(&Stats[VAR_REFERENCE].TH, &S->TH);
+		int ok;
+		if (S->Nwave == 0) {
+			msg_printf(MsgLog, "INFO:   %-12s  skipped\n", Variants[v].Name);
+			continue;
+		}
+		ok = (S->Nbad == 0 && S->Nerr == 0 &&
+			EHmoved <= VFY_TOL_HISTO * HistoEntries(&Stats[VAR_REFERENCE].EH) &&
+			THmoved <= VFY_TOL_HISTO * HistoEntries(&Stats[VAR_REFERENCE].TH));
+		msg_printf(MsgLog, "INFO:   %-12s %10llu %5llu %14.3g %14.3g %12.3g %9llu %9llu  %s\n", Variants[v].Name,
+			(unsigned long long)S->Nwave, (unsigned long long)S->Nbad, S->MaxDev[QTY_BASELINE], S->MaxDev[QTY_TIME],
+			S->MaxDev[QTY_ENERGY], (unsigned long long)EHmoved, (unsigned long long)THmoved, ok ? "OK" : "FAILED");
+		for (int q = 0; q < NUM_QTY; q++)
+			if (S->Mismatch[q] > 0)
+				msg_printf(MsgLog, "WARN:   %s: %llu results of %s out of tolerance (%g)\n", Variants[v].Name, (unsigned long long)S->Mismatch[q], QtyNames[q], Tolerance[q]);
+		if (S->Nerr > 0)
+			msg_printf(MsgLog, "WARN:   %s: %llu processor errors\n", Variants[v].Name, (unsigned long long)S->Nerr);
+		if (!ok)
+			ret = 1;
+	}
+	if (Stats[VAR_REFERENCE].Nerr > 0) {
+		msg_printf(MsgLog, "ERROR: The reference processor failed on %llu waveforms\n", (unsigned long long)Stats[VAR_REFERENCE].Nerr);
+		ret = -1;
+	}
+
+Done:
+	CloseWPCache();
+	if (CacheFile[0] != 0)
+		remove(CacheFile);
+	FreeVerifyWaveform(&Wfm);
+	for (int v = 0; v < NUM_VARIANTS; v++) {
+		if (Stats[v].EH.H_data != NULL)
+			DestroyHistogram1D(Stats[v].EH);
+		if (Stats[v].TH.H_data != NULL)
+			DestroyHistogram1D(Stats[v].TH);
+	}
+	memset(Stats, 0, sizeof(Stats));
+	return ret;
+}
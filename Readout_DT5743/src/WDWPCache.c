@@ -0,0 +1,189 @@
+/******************************************************************************
+*
+* Copyright (C) 2017 CAEN SpA - www.caen.it - support.computing@caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This file is subject to the terms and conditions defined in file
+* 'CAEN_License_Agreement.txt', which is part of this source code package.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include "WDWPCache.h"
+#include "WDLogs.h"
+
+#define WPC_MIN_TABLE		(1 << 16)	// initial size of the table (entries)
+
+// Open addressing table (linear probing); Key = 0 marks an empty slot
+static WPCacheEntry_t *Table = NULL;
+static uint32_t TableSize = 0;			// power of 2
+static uint32_t TableUsed = 0;
+static FILE *fCache = NULL;
+static char CachePath[500];
+static uint64_t Hits[WPC_NSTAGES], Misses[WPC_NSTAGES];
+static uint32_t Loaded = 0, Stored = 0;
+
+/* ###########################################################################
+*  Functions
+*  ########################################################################### */
+
+uint64_t WPCacheHash(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	for (size_t i = 0; i < size; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;	// FNV-1a prime
+	}
+	return h;
+}
+
+// the keys are never 0 (empty slot)
+static uint64_t ValidKey(uint64_t key)
+{
+	return (key != 0) ? key : 1;
+}
+
+static WPCacheEntry_t *FindSlot(WPCacheEntry_t *t, uint32_t size, uint64_t key)
+{
+	uint32_t i = (uint32_t)(key ^ (key >> 32)) & (size - 1);
+	while (t[i].Key != 0 && t[i].Key != key)
+		i = (i + 1) & (size - 1);
+	return &t[i];
+}
+
+// add an entry to the table, doubling it when it is half full
+static int Insert(const WPCacheEntry_t *e)
+{
+	WPCacheEntry_t *slot;
+
+	if (2 * (TableUsed + 1) > TableSize) {
+		uint32_t size = (TableSize == 0) ? WPC_MIN_TABLE : 2 * TableSize;
+		WPCacheEntry_t *t = (WPCacheEntry_t *)calloc(size, sizeof(WPCacheEntry_t));
+		if (t == NULL)
+			return -1;
+		for (uint32_t i = 0; i < TableSize; i++)
+			if (Table[i].Key != 0)
+				*FindSlot(t, size, Table[i].Key) = Table[i];
+		free(Table);
+		Table = t;
+		TableSize = size;
+	}
+	slot = FindSlot(Table, TableSize, e->Key);
+	if (slot->Key == 0)
+		TableUsed++;
+	*slot = *e;
+	return 0;
+}
+
+int OpenWPCache(const char *path)
+{
+	char magic[8];
+	uint32_t esize = 0;
+	WPCacheEntry_t e;
+	FILE *f;
+
+	CloseWPCache();
+	memset(Hits, 0, sizeof(Hits));
+	memset(Misses, 0, sizeof(Misses));
+	Loaded = 0;
+	Stored = 0;
+	strncpy(CachePath, path, sizeof(CachePath) - 1);
+	CachePath[sizeof(CachePath) - 1] = 0;
+
+	// load the entries of the previous replays
+	f = fopen(path, "rb");
+	if (f != NULL) {
+		if (fread(magic, 1, 8, f) == 8 && memcmp(magic, WPC_MAGIC, 8) == 0 &&
+			fread(&esize, sizeof(esize), 1, f) == 1 && esize == sizeof(WPCacheEntry_t)) {
+			while (fread(&e, sizeof(e), 1, f) == 1) {
+				e.Key = ValidKey(e.Key);
+				if (Insert(&e) < 0) {
+					fclose(f);
+					CloseWPCache();
+					return -1;
+				}
+				Loaded++;
+			}
+			fclose(f);
+			fCache = fopen(path, "ab");
+		}
+		else {
+			fclose(f);
+			msg_printf(MsgLog, "WARN: %s is not a cache file of this version; it is overwritten\n", path);
+		}
+	}
+	if (fCache == NULL) {
+		fCache = fopen(path, "wb");
+		if (fCache == NULL) {
+			CloseWPCache();
+			return -1;
+		}
+		esize = sizeof(WPCacheEntry_t);
+		fwrite(WPC_MAGIC, 1, 8, fCache);
+		fwrite(&esize, sizeof(esize), 1, fCache);
+	}
+	return (int)Loaded;
+}
+
+void CloseWPCache()
+{
+	if (fCache != NULL)
+		fclose(fCache);
+	fCache = NULL;
+	free(Table);
+	Table = NULL;
+	TableSize = 0;
+	TableUsed = 0;
+}
+
+int WPCacheActive()
+{
+	return fCache != NULL;
+}
+
+int WPCacheLookup(int stage, uint64_t key, WPCacheEntry_t *e)
+{
+	WPCacheEntry_t *slot;
+
+	key = ValidKey(key);
+	if (Table != NULL) {
+		slot = FindSlot(Table, TableSize, key);
+		if (slot->Key == key) {
+			*e = *slot;
+			Hits[stage]++;
+			return 1;
+		}
+	}
+	Misses[stage]++;
+	return 0;
+}
+
+int WPCacheStore(const WPCacheEntry_t *e)
+{
+	WPCacheEntry_t v = *e;
+
+	if (fCache == NULL)
+		return -1;
+	v.Key = ValidKey(v.Key);
+	if (Insert(&v) < 0)
+		return -1;
+	if (fwrite(&v, sizeof(v), 1, fCache) != 1)
+		return -1;
+	Stored++;
+	return 0;
+}
+
+void PrintWPCacheStats()
+{
+	static const char *StageNames[WPC_NSTAGES] = { "timing", "energy" };
+
+	if (CachePath[0] == 0)
+		return;
+	msg_printf(MsgLog, "INFO: Processor cache %s: %u entries loaded, %u added\n", CachePath, Loaded, Stored);
+	for (int s = 0; s < WPC_NSTAGES; s++)
+		msg_printf(MsgLog, "INFO:   %-7s hits %llu, misses %llu\n", StageNames[s], (unsigned long long)Hits[s], (unsigned long long)Misses[s]);
+}
@@ -15,6 +15,9 @@
 
 #include "WaveDemo.h"
 #include "WDWaveformProcess.h"
+#include "WDWPCache.h"
+#include "WDCalib.h"
+#include "WDLogs.h"
 
 // --------------------------------------------------------------------------------------------------------- 
 // Global Variables
@@ -26,6 +29,30 @@ int WPmaxNs;			// Max num of samples in the WaveformProcessor
 int TrgShift;			// num of sample to shift for trigger jitter correction
 uint64_t CoarseTimeStampRef;
 
+#define INTERP_PHASES		64		// sub-sample positions in the interpolation tables
+#define INTERP_MAX_TAPS		8		// samples used by the longest interpolator (sinc)
+#define SINC_HALF_WIDTH		(INTERP_MAX_TAPS / 2)
+
+// polyphase tables: weight of the sample (crossing - 1 + k - taps / 2 + 1) at the position (crossing - 1 + p / INTERP_PHASES)
+static float InterpTable[3][INTERP_PHASES + 1][INTERP_MAX_TAPS];
+static const int InterpTaps[3] = { 2, 4, INTERP_MAX_TAPS };
+static int InterpTablesReady = 0;
+
+// baseline of one channel tracked over the events (BASELINE_TRACKING)
+typedef struct {
+	float Value;					// tracked baseline (ADC counts)
+	int Accepted;					// events in the tracked value (up to BslTrackEvents)
+	int Rejected;					// consecutive events rejected as outliers
+	int RingPos;					// next position in Ring
+	float Ring[MAX_BSL_TRACK_EVENTS];	// baselines of the last accepted events (median)
+	uint64_t NumTracked;			// events processed with the tracked baseline
+	uint64_t NumLocal;				// events processed with their own baseline (tracker not ready)
+	uint64_t NumOutliers;			// events rejected by the tracker
+	uint64_t NumResets;				// restarts of the tracker after BslTrackEvents consecutive outliers
+} BaselineTrack_t;
+
+static BaselineTrack_t BslTrack[MAX_BD][MAX_CH];
+
 static inline int roundUp(int numToRound, int multiple) {
 	if (multiple == 0)
 		return numToRound;
@@ -84,21 +111,292 @@ static void WaveformShift(Waveform_t *waves, int shift) {
 	}
 }
 
+// --------------------------------------------------------------------------------------------------------- 
+// Description: integral of the input signal in the energy gate
+// Inputs:		Wavein, wpns = input waveform
+//				baseline, sign = baseline and polarity of the signal
+//				ncross = trigger position (0 = not found)
+//				PreGate, Gwidth = gate (in samples)
+// Return:		integral (ADC counts)
+// --------------------------------------------------------------------------------------------------------- 
+static float GateIntegral(const float *Wavein, int wpns, float baseline, int sign, int ncross, int PreGate, int Gwidth) {
+	float q = 0;
+	if (ncross > 0) {
+		const int first = max(ncross, PreGate);
+		const int last = min(wpns - 1, ncross + Gwidth - PreGate);
+		for (int i = first; i <= last; i++)
+			q += sign * (baseline - Wavein[i - PreGate]);
+	}
+	return q;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Discriminator, analog traces and energy gate computed with one pass per stage (WP_KERNEL_SPLIT).
+//				Gives the same results as the single pass loop in SW_WaveformProcessor, but the stages without
+//				dependencies between samples are plain loops that the compiler can vectorize.
+// Inputs:		WDc = channel settings
+//				wpns = number of samples
+//				Wavein = input waveform
+//				baseline, sign, atten, CFDdelay, PreGate, Gwidth = discriminator parameters
+// Outputs:		Wavesout = analog and digital traces
+//				ncross = trigger position (0 = not found)
+//				ZCneg, ZCpos = discriminator values around the crossing
+//				Q = integral in the energy gate
+// --------------------------------------------------------------------------------------------------------- 
+static void SplitDiscriminator(const WaveDemoChannel_t *WDc, int wpns, const float *Wavein, float baseline, int sign, float atten,
+	int CFDdelay, int PreGate, int Gwidth, Waveform_t *Wavesout, int *ncross, float *ZCneg, float *ZCpos, float *Q) {
+	int i, armed = 0, nc = 0;
+
+	// discriminator waveform
+	if (WDc->DiscrMode == 1) {  // CFD
+		const int d = coerce(CFDdelay, 0, wpns);
+		for (i = 0; i < d; i++)
+			WPdiscr[i] = sign * (WPsmooth[i] - baseline);
+		for (; i < wpns; i++)
+			WPdiscr[i] = (float)(sign * (atten * (WPsmooth[i] - baseline) - (WPsmooth[i - CFDdelay] - baseline)));
+	}
+	else {  // LED
+		for (i = 0; i < wpns; i++)
+			WPdiscr[i] = sign * (WPsmooth[i] - baseline);
+	}
+
+	// trigger search
+	if (WDc->DiscrMode == 1) {
+		// use alternative threshold if defined or use TriggerThreshold * atten
+		float CFDThreshold = (WDc->CFDThreshold >= 0) ? WDc->CFDThreshold : WDc->TriggerThreshold_adc * atten;
+		CFDThreshold *= sign;
+		for (i = 0; i < wpns && nc == 0; i++) {
+			if (!armed && (WPdiscr[i] < CFDThreshold))
+				armed = 1;
+			if (armed && WPdiscr[i] >= 0) {
+				nc = i;
+				Wavesout->DigitalTraces[i] |= DTRACE_TRIGGER; // trigger
+				*ZCneg = WPdiscr[i - 1];
+				*ZCpos = WPdiscr[i];
+			}
+		}
+	}
+	else {
+		const float LEDThreshold = sign * WDc->TriggerThreshold_adc;
+		for (i = 1; i < wpns; i++) {
+			if (WPdiscr[i] < LEDThreshold) {
+				nc = i;
+				Wavesout->DigitalTraces[i] |= DTRACE_TRIGGER; // trigger
+				*ZCneg = LEDThreshold - WPdiscr[i - 1];
+				*ZCpos = LEDThreshold - WPdiscr[i];
+				break;
+			}
+		}
+	}
+
+	// analog traces
+	for (int a = 0; a < NUM_ATRACE; a++) {
+		float *trace = Wavesout->AnalogTrace[a];
+		if (trace == NULL)
+			continue;
+		switch (a) {
+		case 1:
+			memcpy(trace, WPdiscr, wpns * sizeof(float));
+			break;
+		case 2:
+			memcpy(trace, WPsmooth, wpns * sizeof(float));
+			break;
+		case 3:
+			for (i = 0; i < wpns; i++)
+				trace[i] = (nc != 0 && i >= nc) ? 0 : WDc->TriggerThreshold_adc;
+			break;
+		case 0:
+		default:
+			memcpy(trace, Wavein, wpns * sizeof(float));
+			break;
+		}
+	}
+
+	// energy gate
+	*Q = GateIntegral(Wavein, wpns, baseline, sign, nc, PreGate, Gwidth);
+	if (nc > 0) {
+		const int first = max(nc, PreGate);
+		const int last = min(wpns - 1, nc + Gwidth - PreGate);
+		for (i = first; i <= last; i++)
+			Wavesout->DigitalTraces[i - PreGate] |= DTRACE_ENERGY; // Energy gate
+	}
+
+	*ncross = nc;
+}
+
+// cubic convolution kernel (Keys, a = -0.5)
+static double CubicKernel(double x) {
+	const double a = -0.5;
+	x = fabs(x);
+	if (x < 1)
+		return (a + 2) * x * x * x - (a + 3) * x * x + 1;
+	if (x < 2)
+		return a * x * x * x - 5 * a * x * x + 8 * a * x - 4 * a;
+	return 0;
+}
+
+// sinc kernel with Lanczos window
+static double SincKernel(double x) {
+	const double pi = 3.14159265358979323846;
+	if (x == 0)
+		return 1;
+	if (fabs(x) >= SINC_HALF_WIDTH)
+		return 0;
+	return sin(pi * x) / (pi * x) * sin(pi * x / SINC_HALF_WIDTH) / (pi * x / SINC_HALF_WIDTH);
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: fill the polyphase tables of the interpolators (each phase normalized to unit DC gain)
+// --------------------------------------------------------------------------------------------------------- 
+static void InitInterpTables() {
+	if (InterpTablesReady)
+		return;
+	for (int m = 0; m < 3; m++) {
+		const int taps = InterpTaps[m];
+		for (int p = 0; p <= INTERP_PHASES; p++) {
+			double mu = (double)p / INTERP_PHASES, sum = 0, w[INTERP_MAX_TAPS];
+			for (int k = 0; k < taps; k++) {
+				double x = mu - (k - (taps / 2 - 1));
+				w[k] = (m == TINTERP_LINEAR) ? 1 - fabs(x) : (m == TINTERP_CUBIC) ? CubicKernel(x) : SincKernel(x);
+				sum += w[k];
+			}
+			for (int k = 0; k < taps; k++)
+				InterpTable[m][p][k] = (float)(w[k] / sum);
+		}
+	}
+	InterpTablesReady = 1;
+}
+
+// value of the waveform at (base + p / INTERP_PHASES); the samples outside the waveform are replaced by the first/last one
+static float InterpSample(int mode, const float *w, int wpns, int base, int p) {
+	const int taps = InterpTaps[mode];
+	const int first = base - (taps / 2 - 1);
+	const float *h = InterpTable[mode][p];
+	float v = 0;
+	if (first >= 0 && first + taps <= wpns) {
+		for (int k = 0; k < taps; k++)
+			v += h[k] * w[first + k];
+	}
+	else {
+		for (int k = 0; k < taps; k++)
+			v += h[k] * w[coerce(first + k, 0, wpns - 1)];
+	}
+	return v;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Band-limited interpolation of the discriminator crossing. The interpolated discriminator is
+//				searched by bisection on the table phases between the two samples of the crossing, then the
+//				last interval (1/INTERP_PHASES of sample) is interpolated linearly.
+// Inputs:		mode = interpolator (TINTERP_CUBIC or TINTERP_SINC)
+//				discr, wpns = discriminator waveform
+//				ncross = first sample after the crossing
+//				level, dir = the crossing is where dir * (discr - level) changes from negative to positive
+//				ZCneg, ZCpos = dir * (discr - level) at ncross - 1 and ncross
+// Return:		position of the crossing after the sample ncross - 1 (0 to 1 sample)
+// --------------------------------------------------------------------------------------------------------- 
+static float InterpolateCrossing(int mode, const float *discr, int wpns, int ncross, float level, int dir, float ZCneg, float ZCpos) {
+	int lo = 0, hi = INTERP_PHASES;
+	float flo = ZCneg, fhi = ZCpos;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		float f = dir * (InterpSample(mode, discr, wpns, ncross - 1, mid) - level);
+		if (f < 0) {
+			lo = mid;
+			flo = f;
+		}
+		else {
+			hi = mid;
+			fhi = f;
+		}
+	}
+	return (lo + (-flo) / (fhi - flo)) / INTERP_PHASES;
+}
+
+// median of the accepted baselines in the ring
+static float RingMedian(const BaselineTrack_t *t, int n) {
+	float v[MAX_BSL_TRACK_EVENTS];
+	for (int i = 0; i < n; i++) {
+		int j = i;
+		for (; j > 0 && v[j - 1] > t->Ring[i]; j--)
+			v[j] = v[j - 1];
+		v[j] = t->Ring[i];
+	}
+	return (n & 1) ? v[n / 2] : 0.5f * (v[n / 2 - 1] + v[n / 2]);
+}
+
+// tracker ready: it holds BslTrackEvents events
+static int BaselineTrackReady(const WaveDemoChannel_t *WDc, const BaselineTrack_t *t) {
+	return t->Accepted >= WDc->BslTrackEvents;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Baseline of one event with the baseline tracking. The baseline of the event (mean of its quiet
+//				samples before the pulse) is checked against the value tracked over the previous events: the
+//				events farther than BslTrackTol_adc (pulses or pile-up in the pre-trigger) are rejected and
+//				don't enter the tracker, BslTrackEvents consecutive rejections (a real baseline shift) restart it.
+//				Until the tracker holds BslTrackEvents events the event keeps its own baseline.
+// Inputs:		b, ch = board and channel
+//				local = baseline of the quiet samples of the event (ADC counts)
+//				update = 1 to add the event to the tracker, 0 to read the tracker only (variants, emulation)
+// Return:		baseline to use for the event (ADC counts)
+// --------------------------------------------------------------------------------------------------------- 
+static float TrackedBaseline(int b, int ch, float local, int update) {
+	const WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	BaselineTrack_t *t = &BslTrack[b][ch];
+	const int n = WDc->BslTrackEvents;
+	const int ready = BaselineTrackReady(WDc, t);
+	const float baseline = ready ? t->Value : local;
+
+	if (!update)
+		return baseline;
+	if (ready)
+		t->NumTracked++;
+	else
+		t->NumLocal++;
+
+	if (ready && fabsf(local - t->Value) > WDc->BslTrackTol_adc) {
+		t->NumOutliers++;
+		if (++t->Rejected < n)
+			return baseline;
+		// the baseline moved: start again from this event
+		t->NumResets++;
+		t->Accepted = 0;
+		t->RingPos = 0;
+	}
+	t->Rejected = 0;
+	t->Ring[t->RingPos] = local;
+	t->RingPos = (t->RingPos + 1) % n;
+	if (t->Accepted < n)
+		t->Accepted++;
+	if (WDc->BslTrack == BSL_TRACK_MEDIAN)
+		t->Value = RingMedian(t, t->Accepted);
+	else if (t->Accepted == 1)
+		t->Value = local;
+	else
+		t->Value += (local - t->Value) / t->Accepted;  // mean of the first events, then time constant n
+	return baseline;
+}
+
 // --------------------------------------------------------------------------------------------------------- 
 // Description: Off-line implementation of the discriminator (LED or CFD), time interpolation and energy.
 //				Also performs trigger jitter correction.
-// Inputs:		b = Board Number
+// Inputs:		Kernel = kernel variant (WP_KERNEL_FUSED or WP_KERNEL_SPLIT)
+//				b = Board Number
 //				c = channel number
 //				ns = number of samples
 //				Wavein = input waveform to process
 //				CoarseTimeStamp = time stamp provided by the board in the event (in counts)
+//				Track = 1 to add the event to the baseline tracker (see TrackedBaseline)
 // Outputs:		Wavesout = waveforms generated by the processor (e.g. CFD) and digital probes (e.g. Trigger)
 //				Baseline = result of the baseline calculation (in ADC counts)
+//				LocalBaseline = baseline of the quiet samples of the event (= Baseline without tracking)
 //				TimeStamp = result of the time interpolation in nanoseconds (=0 if it is not found)
 //				Energy = integration of the input signal into the energy gate (in ADC counts)
+//				Ncross = trigger position (0 = not found)
 // Return:		0=OK, -1=error
 // --------------------------------------------------------------------------------------------------------- 
-static int SW_WaveformProcessor(int b, int ch, int ns, const float *Wavein, uint64_t CoarseTimeStamp, Waveform_t *Wavesout, float *Baseline, float *TimeStamp, float* Energy) {
+static int SW_WaveformProcessor(int Kernel, int b, int ch, int ns, const float *Wavein, uint64_t CoarseTimeStamp, int Track, Waveform_t *Wavesout, float *Baseline, float *LocalBaseline, float *TimeStamp, float* Energy, int *Ncross) {
 	// get pointer to substructure
 	WaveDemoBoardHandle_t *WDh = &WDcfg.handles[b];
 	WaveDemoBoard_t *WDb = &WDcfg.boards[b];
@@ -159,10 +457,15 @@ static int SW_WaveformProcessor(int b, int ch, int ns, const float *Wavein, uint
 		}
 		WPsmooth[i] = smean / smn;  // smoothed input signal
 	}
+	*LocalBaseline = baseline;
+	if (WDc->BslTrack != BSL_TRACK_NONE)
+		baseline = TrackedBaseline(b, ch, baseline, Track);
 	*Baseline = baseline;
 
 	// calculate discriminator waveform (either LED or CFD)
-	for (int i = 0; i < wpns; i++) {
+	if (Kernel == WP_KERNEL_SPLIT)
+		SplitDiscriminator(WDc, wpns, Wavein, baseline, sign, atten, CFDdelay, PreGate, Gwidth, Wavesout, &ncross, &ZCneg, &ZCpos, &Q);
+	else for (int i = 0; i < wpns; i++) {
 		if (WDc->DiscrMode == 1) {  // CFD
 			// use alternative threshold if defined or use TriggerThreshold * atten
 			float CFDThreshold = (WDc->CFDThreshold >= 0) ? WDc->CFDThreshold : WDc->TriggerThreshold_adc * atten;
@@ -224,7 +527,16 @@ static int SW_WaveformProcessor(int b, int ch, int ns, const float *Wavein, uint
 	*TimeStamp = 0;
 	if (WDcfg.WaveformProcessor & 0x01) {
 		if (ncross > 0 && ZCneg < 0 && ZCpos >= 0) {
-			*TimeStamp = (ncross + ((-ZCneg) / (ZCpos - ZCneg))) * WDh->Ts; // fine time stamp is expressed in ns
+			float frac = (-ZCneg) / (ZCpos - ZCneg);
+			// at the lower sampling frequencies the linear interpolation loses resolution: interpolate
+			// the discriminator around the crossing (CFD: zero crossing; LED: threshold crossing)
+			if (WDc->TimeInterp != TINTERP_LINEAR) {
+				if (WDc->DiscrMode == 1)
+					frac = InterpolateCrossing(WDc->TimeInterp, WPdiscr, wpns, ncross, 0, 1, ZCneg, ZCpos);
+				else
+					frac = InterpolateCrossing(WDc->TimeInterp, WPdiscr, wpns, ncross, sign * WDc->TriggerThreshold_adc, -1, ZCneg, ZCpos);
+			}
+			*TimeStamp = (ncross + frac) * WDh->Ts; // fine time stamp is expressed in ns
 		}
 	}
 
@@ -233,6 +545,7 @@ static int SW_WaveformProcessor(int b, int ch, int ns, const float *Wavein, uint
 	if (WDcfg.WaveformProcessor & 0x02) {
 		*Energy = Q;
 	}
+	*Ncross = ncross;
 
 	// trigger jitter correction
 	if (WDcfg.WaveformProcessor & 0x04) {
@@ -272,31 +585,54 @@ int InitWaveProcess() {
 			memset(WPsmooth, 0, WDcfg.GlobalRecordLength * sizeof(float));
 
 		WPmaxNs = WDcfg.GlobalRecordLength; // to prevent longer waveform to make a memory overflow
+		InitInterpTables();
 	}
+	memset(BslTrack, 0, sizeof(BslTrack));
 
 	for (int b = 0; b < WDcfg.NumBoards; b++) {
-		// get pointer to substructure
-		WaveDemoBoard_t* WDb = &WDcfg.boards[b];
-		WaveDemoBoardHandle_t* WDh = &WDcfg.handles[b];
 		for (int c = 0; c < MAX_CH; c++) {
-			// get pointer to substructure
-			WaveDemoChannel_t* WDc = &WDb->channels[c];
-
-			int offset = (WDb->CorrectionLevel == 0 || WDb->CorrectionLevel == 2) ? 2048 : 0;
-			float trg_val = offset + (1485 * WDc->TriggerThreshold_V);
-			WDc->TriggerThreshold_adc = trg_val;
+			UpdateChannelThreshold(b, c);
 		}
 	}
 
 	return ret;
 }
 
+// --------------------------------------------------------------------------------------------------------- 
+// Description:	Convert the trigger threshold and the tolerance of the baseline tracker of one channel from V to
+//				ADC counts (software discriminator)
+// Inputs:		b = board index
+//				ch = channel
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int UpdateChannelThreshold(int b, int ch) {
+	// get pointer to substructure
+	WaveDemoBoard_t* WDb = &WDcfg.boards[b];
+	WaveDemoChannel_t* WDc = &WDb->channels[ch];
+
+	int offset = (WDb->CorrectionLevel == 0 || WDb->CorrectionLevel == 2) ? 2048 : 0;
+	float trg_val = offset + (1485 * WDc->TriggerThreshold_V);
+	WDc->TriggerThreshold_adc = trg_val;
+	WDc->BslTrackTol_adc = 1485 * WDc->BslTrackTol_V;
+	return 0;
+}
+
 
 // --------------------------------------------------------------------------------------------------------- 
 // Description:	Free memory buffer
 // Return:		0=OK, -1=error
 // --------------------------------------------------------------------------------------------------------- 
 int CloseWaveProcess() {
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			const BaselineTrack_t *t = &BslTrack[b][ch];
+			if (WDcfg.boards[b].channels[ch].BslTrack == BSL_TRACK_NONE || (t->NumTracked + t->NumLocal) == 0)
+				continue;
+			msg_printf(MsgLog, "INFO: Baseline tracking b%d ch%d: %.2f ADC, %llu events tracked, %llu with own baseline, %llu outliers, %llu restarts\n",
+				b, ch, t->Value, (unsigned long long)t->NumTracked, (unsigned long long)t->NumLocal,
+				(unsigned long long)t->NumOutliers, (unsigned long long)t->NumResets);
+		}
+	}
 	free(WPdiscr);
 	WPdiscr = NULL;
 	free(WPsmooth);
@@ -304,6 +640,99 @@ int CloseWaveProcess() {
 	return 0;
 }
 
+// key of the timing stage: raw samples and settings of the baseline, smoothing, discriminator and interpolation,
+// and the tracked baseline
+static uint64_t TimingKey(int b, int ch, int wpns, const float *Wavein) {
+	const WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	const int flags = WDcfg.WaveformProcessor & 0x01;
+	uint64_t h = WPC_HASH_INIT;
+	h = WPCacheHash(h, &wpns, sizeof(wpns));
+	h = WPCacheHash(h, Wavein, wpns * sizeof(float));
+	h = WPCacheHash(h, &flags, sizeof(flags));
+	h = WPCacheHash(h, &WDcfg.handles[b].Ts, sizeof(WDcfg.handles[b].Ts));
+	h = WPCacheHash(h, &WDc->NsBaseline, sizeof(WDc->NsBaseline));
+	h = WPCacheHash(h, &WDc->TriggerThreshold_adc, sizeof(WDc->TriggerThreshold_adc));
+	h = WPCacheHash(h, &WDc->TTFsmoothing, sizeof(WDc->TTFsmoothing));
+	h = WPCacheHash(h, &WDc->PulsePolarity, sizeof(WDc->PulsePolarity));
+	h = WPCacheHash(h, &WDc->DiscrMode, sizeof(WDc->DiscrMode));
+	h = WPCacheHash(h, &WDc->CFDdelay, sizeof(WDc->CFDdelay));
+	h = WPCacheHash(h, &WDc->CFDatten, sizeof(WDc->CFDatten));
+	h = WPCacheHash(h, &WDc->CFDThreshold, sizeof(WDc->CFDThreshold));
+	h = WPCacheHash(h, &WDc->TimeInterp, sizeof(WDc->TimeInterp));
+	// with the tracking the baseline comes from the tracker when it is ready
+	if (WDc->BslTrack != BSL_TRACK_NONE && BaselineTrackReady(WDc, &BslTrack[b][ch])) {
+		h = WPCacheHash(h, &BslTrack[b][ch].Value, sizeof(BslTrack[b][ch].Value));
+		h = WPCacheHash(h, &WDc->BslTrackTol_adc, sizeof(WDc->BslTrackTol_adc));
+	}
+	return h;
+}
+
+// key of the energy stage: timing key and settings of the gate
+static uint64_t EnergyKey(uint64_t TimingKey, int b, int ch) {
+	const WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	const int flags = WDcfg.WaveformProcessor & 0x02;
+	uint64_t h = WPCacheHash(WPC_HASH_INIT, &TimingKey, sizeof(TimingKey));
+	h = WPCacheHash(h, &flags, sizeof(flags));
+	h = WPCacheHash(h, &WDc->PreGate, sizeof(WDc->PreGate));
+	h = WPCacheHash(h, &WDc->GateWidth, sizeof(WDc->GateWidth));
+	return h;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: SW_WaveformProcessor with the results of the stages taken from the cache when their inputs
+//				didn't change (see WDWPCache.h). On a hit the output traces are not produced.
+//				On a hit the baseline tracker is updated with the baseline of the event stored in the entry.
+// Inputs/Outputs: as SW_WaveformProcessor
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+static int CachedWaveformProcessor(int b, int ch, int ns, const float *Wavein, uint64_t CoarseTimeStamp, int Track, Waveform_t *Wavesout, float *Baseline, float *TimeStamp, float *Energy) {
+	const WaveDemoChannel_t *WDc = &WDcfg.boards[b].channels[ch];
+	const int wpns = (ns <= WPmaxNs) ? ns : WPmaxNs;
+	WPCacheEntry_t t, e;
+	int ret = 0;
+
+	memset(&t, 0, sizeof(t));
+	memset(&e, 0, sizeof(e));
+	t.Key = TimingKey(b, ch, wpns, Wavein);
+	e.Key = EnergyKey(t.Key, b, ch);
+	if (!WPCacheLookup(WPC_STAGE_TIMING, t.Key, &t)) {
+		// full processing
+		int ncross = 0;
+		ret = SW_WaveformProcessor(WDcfg.WPKernel, b, ch, ns, Wavein, CoarseTimeStamp, Track, Wavesout, Baseline, &t.LocalBaseline, TimeStamp, Energy, &ncross);
+		if (ret < 0)
+			return ret;
+		t.Baseline = *Baseline;
+		t.TimeStamp = *TimeStamp;
+		t.Ncross = ncross;
+		WPCacheStore(&t);
+		if (!WPCacheLookup(WPC_STAGE_ENERGY, e.Key, &e)) {
+			e.Energy = *Energy;
+			WPCacheStore(&e);
+		}
+		return 0;
+	}
+
+	// timing from the cache
+	if (WDc->BslTrack != BSL_TRACK_NONE)
+		TrackedBaseline(b, ch, t.LocalBaseline, Track);
+	if (!WPCacheLookup(WPC_STAGE_ENERGY, e.Key, &e)) {
+		const int sign = (WDc->PulsePolarity == CAEN_DGTZ_PulsePolarityPositive) ? -1 : 1;
+		const int Gwidth = (int)(WDc->GateWidth / WDcfg.handles[b].Ts);
+		const int PreGate = (int)(WDc->PreGate / WDcfg.handles[b].Ts);
+		e.Energy = (WDcfg.WaveformProcessor & 0x02) ? GateIntegral(Wavein, wpns, t.Baseline, sign, t.Ncross, PreGate, Gwidth) : 0;
+		WPCacheStore(&e);
+	}
+	*Baseline = t.Baseline;
+	*TimeStamp = t.TimeStamp;
+	*Energy = e.Energy;
+	// the reference of the trigger jitter correction (the traces are not shifted)
+	if ((WDcfg.WaveformProcessor & 0x04) && b == WDcfg.TOFstartBoard && ch == WDcfg.TOFstartChannel && t.Ncross > 0) {
+		TrgShift = (wpns * WDcfg.TriggerFix / 100) - t.Ncross;
+		CoarseTimeStampRef = CoarseTimeStamp;
+	}
+	return 0;
+}
+
 // --------------------------------------------------------------------------------------------------------- 
 // Description: 
 // Inputs:		int b = Board Number
@@ -326,17 +755,77 @@ int WaveformProcess(int b, int ch, WaveDemoEvent_t *event) {
 	float *Wavein = event->Event->DataGroup[groupIndex].DataChannel[channelIndex];
 	//float CoarseTimeStamp = ((float)event->Event->DataGroup[ch / 2].TDC * 5) / WDcfg.handles[b].Ts; // changes TDC at 200 MHz (5 ns) to time of sampling rate
 	uint64_t CoarseTimeStamp = event->Event->DataGroup[ch / 2].TDC * 5;
-	float Baseline = 0, TimeStamp = 0, Energy = 0;
-	if (WDcfg.WaveformProcessor)
-		SW_WaveformProcessor(b, ch, ns, Wavein, CoarseTimeStamp, Wfm, &Baseline, &TimeStamp, &Energy);
+	float Baseline = 0, LocalBaseline = 0, TimeStamp = 0, Energy = 0;
+	int ncross = 0;
+	if (WDcfg.WaveformProcessor && WPCacheActive())
+		CachedWaveformProcessor(b, ch, ns, Wavein, CoarseTimeStamp, 1, Wfm, &Baseline, &TimeStamp, &Energy);
+	else if (WDcfg.WaveformProcessor)
+		SW_WaveformProcessor(WDcfg.WPKernel, b, ch, ns, Wavein, CoarseTimeStamp, 1, Wfm, &Baseline, &LocalBaseline, &TimeStamp, &Energy, &ncross);
 	EventPlus->Baseline = Baseline;
-	EventPlus->Energy = Energy;
+	EventPlus->Energy = CalibratedEnergy(b, ch, Energy);
 	if (TimeStamp != 0)
 		EventPlus->FineTimeStamp = TimeStamp;
 
 	return 0;
 }
 
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Process one waveform with a given variant (used by the verification harness to compare the
+//				variants with the reference). The processing buffers must be allocated (InitWaveProcess).
+//				The baseline tracker is read but not updated.
+// Inputs:		Kernel = kernel variant (WP_KERNEL_xxx)
+//				Cached = 1 to go through the processor cache (it must be open, see WDWPCache.h)
+//				b = Board Number
+//				ch = Channel Number
+//				ns = number of samples
+//				Wavein = input waveform
+// Outputs:		Wfm = waveforms generated by the processor (not produced on a cache hit)
+//				Baseline, TimeStamp, Energy = results of the processor
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int WaveformProcessVariant(int Kernel, int Cached, int b, int ch, int ns, const float *Wavein, Waveform_t *Wfm, float *Baseline, float *TimeStamp, float *Energy) {
+	int ret, ncross = 0;
+	float LocalBaseline;
+	// keep the trigger jitter correction state of the acquisition
+	int SavedTrgShift = TrgShift;
+	int SavedKernel = WDcfg.WPKernel;
+	uint64_t SavedTimeStampRef = CoarseTimeStampRef;
+
+	*Baseline = 0;
+	*TimeStamp = 0;
+	*Energy = 0;
+	if (Cached) {
+		WDcfg.WPKernel = Kernel;
+		ret = WPCacheActive() ? CachedWaveformProcessor(b, ch, ns, Wavein, 0, 0, Wfm, Baseline, TimeStamp, Energy) : -1;
+		WDcfg.WPKernel = SavedKernel;
+	}
+	else {
+		ret = SW_WaveformProcessor(Kernel, b, ch, ns, Wavein, 0, 0, Wfm, Baseline, &LocalBaseline, TimeStamp, Energy, &ncross);
+	}
+	TrgShift = SavedTrgShift;
+	CoarseTimeStampRef = SavedTimeStampRef;
+	return ret;
+}
+
+// --------------------------------------------------------------------------------------------------------- 
+// Description: Process one waveform with a given kernel variant (used by the autotuner to compare the variants).
+//				The processing buffers must be allocated (InitWaveProcess).
+// Inputs:		Kernel = kernel variant (WP_KERNEL_xxx)
+//				b = Board Number
+//				ch = Channel Number
+//				ns = number of samples
+//				Wavein = input waveform
+// Outputs:		Wfm = waveforms generated by the processor
+//				Result = Baseline + TimeStamp + Energy (to check that the variants agree)
+// Return:		0=OK, -1=error
+// --------------------------------------------------------------------------------------------------------- 
+int WaveformProcessKernel(int Kernel, int b, int ch, int ns, const float *Wavein, Waveform_t *Wfm, double *Result) {
+	float Baseline, TimeStamp, Energy;
+	int ret = WaveformProcessVariant(Kernel, 0, b, ch, ns, Wavein, Wfm, &Baseline, &TimeStamp, &Energy);
+	*Result = (double)Baseline + (double)TimeStamp + (double)Energy;
+	return ret;
+}
+
 int MultiWaveformProcess(WaveDemoEvent_t *events[], int n) {
 	int ret = 0;
 	TrgShift = 0;
@@ -18,6 +18,8 @@
 
 
 #include "WDconfig.h"
+#include "WDCuts.h"
+#include "WDPlugins.h"
 #include "ini.h"
 
 /*! \brief	
@@ -186,6 +188,46 @@ void SetDefaultConfiguration(WaveDemoConfig_t *WDcfg) {
 	WDcfg->BatchMaxEvents = 0;      // 0 = unlimited
 	WDcfg->BatchMaxTime = 0;        // 0 = unlimited
 
+	// Host tuning defaults (replaced by the autotune profile, if any)
+	WDcfg->Autotune = AUTOTUNE_DISABLED;
+	strcpy(WDcfg->TuneProfileFile, TUNE_PROFILE_FILE);
+	WDcfg->WPKernel = WP_KERNEL_FUSED;
+	WDcfg->MaxNumEventsBLT = MAX_NUM_EVENTS_BLT;
+	WDcfg->WriteBufferSize = 0;
+	WDcfg->IdleStrategy = IDLE_SPIN;
+
+	// Pipeline runtime: all the stages in the main loop
+	WDcfg->PipelineMode = PIPELINE_INLINE;
+	WDcfg->QueuePolicy = QUEUE_DROP;
+	WDcfg->PluginThreads = 1;
+	WDcfg->ProcessBudget = 20;
+
+	// Event latency: tracked
+	WDcfg->LatencyTracking = 1;
+
+	// Status stream: no live histograms
+	WDcfg->StatusHistograms = 0;
+
+	// Offline reprocessing: processor results cached, no threshold emulation
+	WDcfg->WPCache = 1;
+	WDcfg->NumEmulThresholds = 0;
+	WDcfg->EmulDiscr = EMUL_DISCR_SAME;
+	WDcfg->CalEvents = 2000;
+	WDcfg->NumCalPatterns = 3;
+	WDcfg->CalPatterns[0] = 0x0001;
+	WDcfg->CalPatterns[1] = 0x0003;
+	WDcfg->CalPatterns[2] = 0x000F;
+	WDcfg->CalibrationFile[0] = 0;
+
+	// Readout recovery: a few attempts before giving up
+	WDcfg->RecoveryAttempts = 3;
+
+	// Event selection: no cut
+	ClearCut(&WDcfg->Cut);
+
+	// No processing plugins
+	WDcfg->NumPlugins = 0;
+
 	for (int b = 0; b < MAX_BD; b++) {
 		// get pointer to substructure
 		WaveDemoBoard_t *WDb = &WDcfg->boards[b];
@@ -233,6 +275,10 @@ void SetDefaultConfiguration(WaveDemoConfig_t *WDcfg) {
 
 			WDc->CFDatten = 1.0;
 			WDc->TTFsmoothing = 0;
+			WDc->TimeInterp = TINTERP_LINEAR;
+			WDc->BslTrack = BSL_TRACK_NONE;
+			WDc->BslTrackEvents = 16;
+			WDc->BslTrackTol_V = 0.005f;
 
 			WDc->EnergyCoarseGain = 1 * 1024;
 			WDc->ECalibration_m = 1.0;
@@ -349,6 +395,22 @@ static int parseOptions(const char* name, const char* value, WaveDemoConfig_t* W
 			return 0;
 		}
 	}
+	// Histogram file format (1COL, 2COL, ANSI42 or ARCHIVE)
+	if (strcmp(name, "HISTO_FILE_FORMAT") == 0) {
+		GetString(value, str, "");
+		if (strcmp(str, "1COL") == 0)
+			WDcfg->HistoOutputFormat = HISTO_FILE_FORMAT_1COL;
+		else if (strcmp(str, "2COL") == 0)
+			WDcfg->HistoOutputFormat = HISTO_FILE_FORMAT_2COL;
+		else if (strcmp(str, "ANSI42") == 0)
+			WDcfg->HistoOutputFormat = HISTO_FILE_FORMAT_ANSI42;
+		else if (strcmp(str, "ARCHIVE") == 0)
+			WDcfg->HistoOutputFormat = HISTO_FILE_FORMAT_ARCHIVE;
+		else {
+			printf("%s: invalid histogram file format\n", value);
+			return 0;
+		}
+	}
 	// Header into output file (YES or NO)
 	if (strcmp(name, "OUTPUT_FILE_HEADER") == 0) 
 		WDcfg->OutFileHeader = getBoolValue(name, value) ? 1 : 0;
@@ -438,6 +500,193 @@ static int parseOptions(const char* name, const char* value, WaveDemoConfig_t* W
 		WDcfg->BatchMaxTime = (uint64_t)GetIntValueDefault(name, value, 0);
 	}
 
+	// Host tuning
+	if (strcmp(name, "AUTOTUNE") == 0) {
+		GetString(value, str, "");
+		if (streq(str, "DISABLED"))
+			WDcfg->Autotune = AUTOTUNE_DISABLED;
+		else if (streq(str, "AUTO"))
+			WDcfg->Autotune = AUTOTUNE_AUTO;
+		else if (streq(str, "FORCE"))
+			WDcfg->Autotune = AUTOTUNE_FORCE;
+		else {
+			printf("%s: invalid setting for %s (valid values: DISABLED, AUTO, FORCE)\n", value, name);
+			return 0;
+		}
+	}
+	if (strcmp(name, "TUNE_PROFILE_FILE") == 0)
+		GetString(value, WDcfg->TuneProfileFile, TUNE_PROFILE_FILE);
+
+	// Pipeline runtime
+	if (strcmp(name, "PIPELINE_MODE") == 0) {
+		GetString(value, str, "");
+		if (streq(str, "INLINE"))
+			WDcfg->PipelineMode = PIPELINE_INLINE;
+		else if (streq(str, "THREADED"))
+			WDcfg->PipelineMode = PIPELINE_THREADED;
+		else {
+			printf("%s: invalid setting for %s (valid values: INLINE, THREADED)\n", value, name);
+			return 0;
+		}
+	}
+	if (strcmp(name, "PIPELINE_QUEUE_POLICY") == 0) {
+		GetString(value, str, "");
+		if (streq(str, "DROP"))
+			WDcfg->QueuePolicy = QUEUE_DROP;
+		else if (streq(str, "BLOCK"))
+			WDcfg->QueuePolicy = QUEUE_BLOCK;
+		else {
+			printf("%s: invalid setting for %s (valid values: DROP, BLOCK)\n", value, name);
+			return 0;
+		}
+	}
+	if (strcmp(name, "PIPELINE_PLUGIN_THREADS") == 0) {
+		val = GetIntValueDefault(name, value, 1);
+		if (val < 1 || val > PLUGIN_MAX_THREADS) {
+			printf("%s: invalid setting for %s (valid values: 1 to %d)\n", value, name, PLUGIN_MAX_THREADS);
+			return 0;
+		}
+		WDcfg->PluginThreads = val;
+	}
+	if (strcmp(name, "PIPELINE_PROCESS_BUDGET") == 0) {
+		float budget = GetFloatValueDefault(name, value, 20);
+		if (budget < 0) {
+			printf("%s: invalid setting for %s (valid values: >= 0)\n", value, name);
+			return 0;
+		}
+		WDcfg->ProcessBudget = budget;
+	}
+
+	// Event latency
+	if (strcmp(name, "LATENCY_TRACKING") == 0)
+		WDcfg->LatencyTracking = getBoolValue(name, value);
+
+	// Live histograms in the status stream (NO, ENERGY, TIME or ALL)
+	if (strcmp(name, "STATUS_HISTOGRAMS") == 0) {
+		GetString(value, str, "");
+		if (strcmp(str, "NO") == 0)
+			WDcfg->StatusHistograms = 0;
+		else if (strcmp(str, "ENERGY") == 0)
+			WDcfg->StatusHistograms = STATUS_HISTO_ENERGY;
+		else if (strcmp(str, "TIME") == 0)
+			WDcfg->StatusHistograms = STATUS_HISTO_TIME;
+		else if (strcmp(str, "ALL") == 0)
+			WDcfg->StatusHistograms = STATUS_HISTO_ENERGY | STATUS_HISTO_TIME;
+		else {
+			printf("%s: invalid setting for %s (valid values: NO, ENERGY, TIME, ALL)\n", value, name);
+			return 0;
+		}
+	}
+
+	// Offline reprocessing
+	if (strcmp(name, "WP_CACHE") == 0)
+		WDcfg->WPCache = getBoolValue(name, value);
+
+	// Threshold emulation in the reprocessing: list of thresholds in V (separated by spaces or commas), NONE = disabled
+	if (strcmp(name, "EMULATE_THRESHOLDS") == 0) {
+		const char *p = streq(value, "NONE") ? "" : value;
+		char *end;
+		WDcfg->NumEmulThresholds = 0;
+		while (*p != '\0') {
+			if (*p == ' ' || *p == '\t' || *p == ',') {
+				p++;
+				continue;
+			}
+			double thr = strtod(p, &end);
+			if (end == p || WDcfg->NumEmulThresholds >= MAX_EMUL_THR) {
+				printf("%s: invalid setting for %s (max %d thresholds in V)\n", value, name, MAX_EMUL_THR);
+				WDcfg->NumEmulThresholds = 0;
+				return 0;
+			}
+			WDcfg->EmulThresholds[WDcfg->NumEmulThresholds++] = (float)thr;
+			p = end;
+		}
+	}
+	if (strcmp(name, "EMULATE_DISCR") == 0) {
+		GetString(value, str, "");
+		if (strcmp(str, "SAME") == 0)
+			WDcfg->EmulDiscr = EMUL_DISCR_SAME;
+		else if (strcmp(str, "LED") == 0)
+			WDcfg->EmulDiscr = EMUL_DISCR_LED;
+		else if (strcmp(str, "CFD") == 0)
+			WDcfg->EmulDiscr = EMUL_DISCR_CFD;
+		else if (strcmp(str, "BOTH") == 0)
+			WDcfg->EmulDiscr = EMUL_DISCR_BOTH;
+		else {
+			printf("%s: invalid setting for %s (valid values: SAME, LED, CFD, BOTH)\n", value, name);
+			return 0;
+		}
+	}
+
+	// Pulser calibration
+	if (strcmp(name, "CALIBRATION_EVENTS") == 0) {
+		val = GetIntValueDefault(name, value, 2000);
+		if (val < 1) {
+			printf("%s: invalid setting for %s\n", value, name);
+			return 0;
+		}
+		WDcfg->CalEvents = val;
+	}
+	if (strcmp(name, "CALIBRATION_PATTERNS") == 0) {
+		const char *p = value;
+		char *end;
+		WDcfg->NumCalPatterns = 0;
+		while (*p != '\0') {
+			if (*p == ' ' || *p == '\t' || *p == ',') {
+				p++;
+				continue;
+			}
+			long pattern = strtol(p, &end, 0);
+			if (end == p || pattern < 1 || pattern > 0xFFFF || WDcfg->NumCalPatterns >= MAX_CAL_PATTERNS) {
+				printf("%s: invalid setting for %s (max %d patterns of 16 bits)\n", value, name, MAX_CAL_PATTERNS);
+				WDcfg->NumCalPatterns = 0;
+				return 0;
+			}
+			WDcfg->CalPatterns[WDcfg->NumCalPatterns++] = (unsigned short)pattern;
+			p = end;
+		}
+	}
+	if (strcmp(name, "CALIBRATION_FILE") == 0) {
+		if (streq(value, "NONE") || strlen(value) >= sizeof(WDcfg->CalibrationFile))
+			WDcfg->CalibrationFile[0] = 0;
+		else
+			GetString(value, WDcfg->CalibrationFile, "");
+	}
+
+	// Readout recovery
+	if (strcmp(name, "READOUT_RECOVERY_ATTEMPTS") == 0) {
+		val = GetIntValueDefault(name, value, 3);
+		if (val < 0 || val > 100) {
+			printf("%s: invalid setting for %s (valid values: 0 to 100)\n", value, name);
+			return 0;
+		}
+		WDcfg->RecoveryAttempts = val;
+	}
+
+	// Event cut (compiled here; several CUT lines are joined with &&, NONE removes the previous ones)
+	if (strcmp(name, "CUT") == 0) {
+		char err[200];
+		if (value[0] == '\0' || streq(value, "NONE"))
+			ClearCut(&WDcfg->Cut);
+		else if (CompileCut(value, &WDcfg->Cut, err) < 0) {
+			printf("%s: invalid setting for %s (%s)\n", value, name, err);
+			return 0;
+		}
+	}
+
+	// Processing plugins (one line for each plugin)
+	if (strcmp(name, "PLUGIN") == 0) {
+		if (WDcfg->NumPlugins >= MAX_PLUGINS) {
+			printf("%s: too many plugins (max %d)\n", value, MAX_PLUGINS);
+			return 0;
+		}
+		if (strlen(value) >= sizeof(WDcfg->Plugins[0])) {
+			printf("%s: invalid setting for %s\n", value, name);
+			return 0;
+		}
+		strcpy(WDcfg->Plugins[WDcfg->NumPlugins++], value);
+	}
+
 	return 1;
 }
 
@@ -953,6 +1202,88 @@ static int parseChannelSettings(const char* name, const char* value, WaveDemoCon
 		else
 			WDcfg->boards[bd].channels[ch].TTFsmoothing = val;
 	}
+	//TIME_INTERPOLATION
+	if (strcmp(name, "TIME_INTERPOLATION") == 0) {
+		GetString(value, str, "");
+		if (strcmp(str, "LINEAR") == 0)
+			val = TINTERP_LINEAR;
+		else if (strcmp(str, "CUBIC") == 0)
+			val = TINTERP_CUBIC;
+		else if (strcmp(str, "SINC") == 0)
+			val = TINTERP_SINC;
+		else {
+			printf("%s: invalid setting for %s\n", value, name);
+			return 0;
+		}
+		if (bd == -1)
+			for (int i = 0; i < MAX_BD; i++)
+				for (int j = 0; j < MAX_CH; j++)
+					WDcfg->boards[i].channels[j].TimeInterp = val;
+		else if (ch == -1)
+			for (int i = 0; i < MAX_CH; i++)
+				WDcfg->boards[bd].channels[i].TimeInterp = val;
+		else
+			WDcfg->boards[bd].channels[ch].TimeInterp = val;
+	}
+	//BASELINE_TRACKING
+	if (strcmp(name, "BASELINE_TRACKING") == 0) {
+		GetString(value, str, "");
+		if (strcmp(str, "NONE") == 0 || strcmp(str, "NO") == 0)
+			val = BSL_TRACK_NONE;
+		else if (strcmp(str, "EMA") == 0)
+			val = BSL_TRACK_EMA;
+		else if (strcmp(str, "MEDIAN") == 0)
+			val = BSL_TRACK_MEDIAN;
+		else {
+			printf("%s: invalid setting for %s\n", value, name);
+			return 0;
+		}
+		if (bd == -1)
+			for (int i = 0; i < MAX_BD; i++)
+				for (int j = 0; j < MAX_CH; j++)
+					WDcfg->boards[i].channels[j].BslTrack = val;
+		else if (ch == -1)
+			for (int i = 0; i < MAX_CH; i++)
+				WDcfg->boards[bd].channels[i].BslTrack = val;
+		else
+			WDcfg->boards[bd].channels[ch].BslTrack = val;
+	}
+	//BASELINE_TRACK_EVENTS
+	if (strcmp(name, "BASELINE_TRACK_EVENTS") == 0) {
+		if (!GetIntOption(name, value, &val))
+			return 0;
+		if (val < 1 || val > MAX_BSL_TRACK_EVENTS) {
+			printf("%d: invalid option for %s (1 to %d)\n", val, name, MAX_BSL_TRACK_EVENTS);
+			return 0;
+		}
+		if (bd == -1)
+			for (int i = 0; i < MAX_BD; i++)
+				for (int j = 0; j < MAX_CH; j++)
+					WDcfg->boards[i].channels[j].BslTrackEvents = val;
+		else if (ch == -1)
+			for (int i = 0; i < MAX_CH; i++)
+				WDcfg->boards[bd].channels[i].BslTrackEvents = val;
+		else
+			WDcfg->boards[bd].channels[ch].BslTrackEvents = val;
+	}
+	//BASELINE_TRACK_TOL
+	if (strcmp(name, "BASELINE_TRACK_TOL") == 0) {
+		if (!GetFloatOption(name, value, &valF))
+			return 0;
+		if (valF <= 0) {
+			printf("%f: invalid option for %s\n", valF, name);
+			return 0;
+		}
+		if (bd == -1)
+			for (int i = 0; i < MAX_BD; i++)
+				for (int j = 0; j < MAX_CH; j++)
+					WDcfg->boards[i].channels[j].BslTrackTol_V = valF;
+		else if (ch == -1)
+			for (int i = 0; i < MAX_CH; i++)
+				WDcfg->boards[bd].channels[i].BslTrackTol_V = valF;
+		else
+			WDcfg->boards[bd].channels[ch].BslTrackTol_V = valF;
+	}
 
 	return 1;
 }
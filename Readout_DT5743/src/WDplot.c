@@ -31,12 +31,13 @@
 
 #include "WDplot.h"
 #include "WaveDemo.h"
+#include "WDClock.h"
 
 /* Global Variables */
 WDPlot_t PlotVar;
 int Busy = 0;
 int SetOption = 1;
-long Tfinish;
+int64_t Tfinish;	// host clock (ms) when gnuplot will have finished
 FILE *wplot = NULL, *hplot = NULL; // gnuplot pipes
 int LastHPlotType = -1;
 float GnuplotVersion = 0;
@@ -46,20 +47,6 @@ float GnuplotVersion = 0;
 #define Sleep(t) usleep((t)*1000);
 #endif
 
-static long get_time() {
-	long time_ms;
-#ifdef WIN32
-	struct _timeb timebuffer;
-	_ftime(&timebuffer);
-	time_ms = (long)timebuffer.time * 1000 + (long)timebuffer.millitm;
-#else
-	struct timeval t1;
-	gettimeofday(&t1, NULL);
-	time_ms = (t1.tv_sec) * 1000 + t1.tv_usec / 1000;
-#endif
-	return time_ms;
-}
-
 static int OpenGnuplot(FILE **gplot) {
 	FILE *vars = NULL;
 	char str[1000] = { 0 };
@@ -203,7 +190,7 @@ int PlotWaveforms() {
 	WaitTime = npts / 20;
 	if (WaitTime < 100)
 		WaitTime = 100;
-	Tfinish = get_time() + WaitTime;
+	Tfinish = HostClockMs() + WaitTime;
 	return 0;
 }
 
@@ -297,7 +284,7 @@ int ClosePlotter() {
 * \brief   Check if plot has finished
 ******************************************************************************/
 int IsPlotterBusy() {
-	if (get_time() > Tfinish)
+	if (HostClockMs() > Tfinish)
 		Busy = 0;
 	return Busy;
 }
@@ -32,11 +32,24 @@
 
 #include "WaveDemo.h"
 
+#include "WDAutotune.h"
 #include "WDBuffers.h"
+#include "WDCalib.h"
+#include "WDClock.h"
+#include "WDCuts.h"
 #include "WDFiles.h"
 #include "WDHisto.h"
+#include "WDLatency.h"
 #include "WDLogs.h"
+#include "WDMarkers.h"
+#include "WDPipeline.h"
+#include "WDPlugins.h"
+#include "WDRecovery.h"
 #include "WDStats.h"
+#include "WDStatus.h"
+#include "WDThrEmul.h"
+#include "WDVerify.h"
+#include "WDWPCache.h"
 #include "WDWaveformProcess.h"
 #include "WDconfig.h"
 #include "WDplot.h"
@@ -62,7 +75,11 @@ static char ErrMsg[ERR_DUMMY_LAST][100] = {
 	"Unmanaged board type",                             /* ERR_UNHANDLED_BOARD */
 	"Output file write error",                          /* ERR_OUTFILE_WRITE */
 	"Buffers error",									/* ERR_BUFFERS */
-	"Internal Communication Timeout"					/* ERR_BOARD_TIMEOUT */
+	"Internal Communication Timeout",					/* ERR_BOARD_TIMEOUT */
+	"Can't load the processing plugins",				/* ERR_PLUGIN */
+	"Can't start the pipeline threads",					/* ERR_PIPELINE */
+	"Can't read the raw data file",						/* ERR_RAW_READ */
+	"The processing variants differ from the reference",	/* ERR_VERIFY */
 	"To Be Defined",									/* ERR_TBD */
 };
 
@@ -88,29 +105,53 @@ int WPprogress = 0;
 /* ###########################################################################
 *  Functions
 *  ########################################################################### */
-/*! \fn      static long get_time()
-*   \brief   Get time in milliseconds
-*
-*   \return  time in msec
-*/
-static long get_time() {
-	long time_ms;
-#ifdef WIN32
-	struct _timeb timebuffer;
-	_ftime(&timebuffer);
-	time_ms = (long)timebuffer.time * 1000 + (long)timebuffer.millitm;
-#else
-	struct timeval t1;
-	gettimeofday(&t1, NULL);
-	time_ms = (t1.tv_sec) * 1000 + t1.tv_usec / 1000;
-#endif
-	return time_ms;
-}
 
 static int hexToInt(char ch) {
 	return ((ch | 432) * 239217992 & 0xffffffff) >> 28;
 }
 
+// Open the connection with one board and read the board information
+static ERROR_CODES_t OpenBoard(WaveDemoBoard_t *WDb, WaveDemoBoardHandle_t *WDh) {
+	unsigned int c32;
+
+	if (WDb->BaseAddress == 0 && WDb->LinkType == 0) //wait a bit before open desktop digitizers
+		SLEEP(1500);
+
+	if (WDb->BaseAddress != 0 && WDb->LinkType == 0)
+		printf("Loading SAM Correction Data from board. Please wait a few seconds...\n");
+
+	WDh->ret_open = CAEN_DGTZ_OpenDigitizer2(WDb->LinkType, (WDb->LinkType == CAEN_DGTZ_ETH_V4718) ? WDb->ipAddress : (void*)&(WDb->LinkNum), WDb->ConetNode, WDb->BaseAddress, &WDh->handle);
+
+	if (WDh->ret_open != CAEN_DGTZ_Success)
+		return ERR_DGZ_OPEN;
+	WDh->ret_last = CAEN_DGTZ_GetInfo(WDh->handle, &WDh->BoardInfo);
+	if (WDh->ret_last != CAEN_DGTZ_Success)
+		return ERR_BOARD_INFO_READ;
+
+	if (WDh->BoardInfo.FamilyCode != CAEN_DGTZ_XX743_FAMILY_CODE)
+		return ERR_UNHANDLED_BOARD;
+	else {
+		WDh->Nbit = 12;
+		if (WDh->BoardInfo.FormFactor == CAEN_DGTZ_VME64_FORM_FACTOR || WDh->BoardInfo.FormFactor == CAEN_DGTZ_VME64X_FORM_FACTOR) {
+			WDh->Ngroup = 8;
+			WDh->Nch = 16;
+		}
+		else if (WDh->BoardInfo.FormFactor == CAEN_DGTZ_DESKTOP_FORM_FACTOR || WDh->BoardInfo.FormFactor == CAEN_DGTZ_NIM_FORM_FACTOR) {
+			WDh->Ngroup = 4;
+			WDh->Nch = 8;
+		}
+	}
+
+	//Important for old versions of PCB!!!!
+	if (WDh->BoardInfo.PCB_Revision <= 3 && WDh->BoardInfo.FormFactor == CAEN_DGTZ_DESKTOP_FORM_FACTOR) {
+		CAEN_DGTZ_ReadRegister(WDh->handle, 0x8168 /* fan speed */, &c32 /* max speed */);
+		c32 |= 0x08;
+		CAEN_DGTZ_WriteRegister(WDh->handle, 0x8168 /* fan speed */, c32 /* max speed */);
+		msg_printf(MsgLog, "VERBOSE: Change fan speed (PCB_Revision: %u)\n", WDh->BoardInfo.PCB_Revision);
+	}
+	return ERR_NONE;
+}
+
 /*!
  * \fn	ERROR_CODES_t OpenDigitizers(WaveDemoConfig_t *WDcfg)
  *
@@ -123,57 +164,13 @@ static int hexToInt(char ch) {
 
 ERROR_CODES_t OpenDigitizers(WaveDemoConfig_t *WDcfg) {
 	ERROR_CODES_t ErrCode = ERR_NONE;
-	WaveDemoBoard_t *WDb;
-	WaveDemoBoardHandle_t *WDh;
-	unsigned int c32;
 	int i;
 
 	for (i = 0; i < WDcfg->NumBoards; i++) {
-		WDb = &WDcfg->boards[i];
-		WDh = &WDcfg->handles[i];
 		printf("Initialization board %d...\n", i);
-
-		if (WDb->BaseAddress == 0 && WDb->LinkType == 0) //wait a bit before open desktop digitizers
-			SLEEP(1500);
-
-		if (WDb->BaseAddress != 0 && WDb->LinkType == 0)
-			printf("Loading SAM Correction Data from board. Please wait a few seconds...\n");
-
-		WDh->ret_open = CAEN_DGTZ_OpenDigitizer2(WDb->LinkType, (WDb->LinkType == CAEN_DGTZ_ETH_V4718) ? WDb->ipAddress : (void*)&(WDb->LinkNum), WDb->ConetNode, WDb->BaseAddress, &WDh->handle);
-
-		if (WDh->ret_open != CAEN_DGTZ_Success) {
-			ErrCode = ERR_DGZ_OPEN;
+		ErrCode = OpenBoard(&WDcfg->boards[i], &WDcfg->handles[i]);
+		if (ErrCode != ERR_NONE)
 			break;
-		}
-		WDh->ret_last = CAEN_DGTZ_GetInfo(WDh->handle, &WDh->BoardInfo);
-		if (WDh->ret_last != CAEN_DGTZ_Success) {
-			ErrCode = ERR_BOARD_INFO_READ;
-			break;
-		}
-
-		if (WDh->BoardInfo.FamilyCode != CAEN_DGTZ_XX743_FAMILY_CODE) {
-			ErrCode = ERR_UNHANDLED_BOARD;
-			break;
-		}
-		else {
-			WDh->Nbit = 12;
-			if (WDh->BoardInfo.FormFactor == CAEN_DGTZ_VME64_FORM_FACTOR || WDh->BoardInfo.FormFactor == CAEN_DGTZ_VME64X_FORM_FACTOR) {
-				WDh->Ngroup = 8;
-				WDh->Nch = 16;
-			}
-			else if (WDh->BoardInfo.FormFactor == CAEN_DGTZ_DESKTOP_FORM_FACTOR || WDh->BoardInfo.FormFactor == CAEN_DGTZ_NIM_FORM_FACTOR) {
-				WDh->Ngroup = 4;
-				WDh->Nch = 8;
-			}
-		}
-
-		//Important for old versions of PCB!!!!
-		if (WDh->BoardInfo.PCB_Revision <= 3 && WDh->BoardInfo.FormFactor == CAEN_DGTZ_DESKTOP_FORM_FACTOR) {
-			CAEN_DGTZ_ReadRegister(WDh->handle, 0x8168 /* fan speed */, &c32 /* max speed */);
-			c32 |= 0x08;
-			CAEN_DGTZ_WriteRegister(WDh->handle, 0x8168 /* fan speed */, c32 /* max speed */);
-			msg_printf(MsgLog, "VERBOSE: Change fan speed (PCB_Revision: %u)\n", WDh->BoardInfo.PCB_Revision);
-		}
 	}
 	return ErrCode;
 }
@@ -241,6 +238,7 @@ void StopAcquisition(WaveDemoConfig_t *WDcfg) {
 	time_t timer;
 	struct tm* tm_info;
 	WaveDemoBoardHandle_t *WDh;
+	PipelinePauseReadout();
 	for (int i = 0; i < WDcfg->NumBoards; i++) {
 		WDh = &WDcfg->handles[i];
 		CAEN_DGTZ_SWStopAcquisition(WDh->handle);
@@ -281,6 +279,7 @@ int ReadData(WaveDemoConfig_t *WDcfg) {
 			ErrCode = ERR_READOUT;
 			break;
 		}
+		WDh->ReadTime = LatencyClock();
 		WDh->Nb += WDh->BufferSize;
 		WDh->NumEvents = 0;
 		if (WDh->BufferSize != 0) {
@@ -299,16 +298,16 @@ int ReadData(WaveDemoConfig_t *WDcfg) {
 }
 
 /*!
- * \fn	void CalcolateThroughput(WaveDemoConfig_t *WDcfg, WaveDemoRun_t *WDrun, uint64_t ElapsedTime)
+ * \fn	void CalcolateThroughput(WaveDemoConfig_t *WDcfg, WaveDemoRun_t *WDrun, int64_t ElapsedTime)
  *
  * \brief	Calcolate throughput and print to screen.
  *
  * \param [in,out]	WDcfg	   	If non-null, the dcfg.
  * \param [in,out]	WDrun	   	If non-null, the drun.
- * \param 		  	ElapsedTime	The elapsed time.
+ * \param 		  	ElapsedTime	The elapsed time (ns).
  */
 
-void ComputeThroughput(WaveDemoConfig_t *WDcfg, WaveDemoRun_t *WDrun, uint64_t ElapsedTime) {
+void ComputeThroughput(WaveDemoConfig_t *WDcfg, WaveDemoRun_t *WDrun, int64_t ElapsedTime) {
 	WaveDemoBoardHandle_t *WDh;
 	char boardstr[16] = "";
 	int i;
@@ -325,7 +324,7 @@ void ComputeThroughput(WaveDemoConfig_t *WDcfg, WaveDemoRun_t *WDrun, uint64_t E
 				else
 					printf("%sNo data...\n", boardstr);
 			else
-				printf("%sReading at %.2f MB/s (Trg Rate: %.2f Hz)\n", boardstr, (float)WDh->Nb / ((float)ElapsedTime*1048.576f), (float)WDh->Ne*1000.0f / (float)ElapsedTime);
+				printf("%sReading at %.2f MB/s (Trg Rate: %.2f Hz)\n", boardstr, (double)WDh->Nb * NS_PER_S / ((double)ElapsedTime * 1048576), (double)WDh->Ne * NS_PER_S / (double)ElapsedTime);
 		}
 		WDh->Nb = 0;
 		WDh->Ne = 0;
@@ -359,6 +358,9 @@ void memcpyEvent(CAEN_DGTZ_X743_EVENT_t *dst, const CAEN_DGTZ_X743_EVENT_t *src)
 }
 
 int EventProcessing(int bd, int ch, WaveDemoEvent_t *event) {
+	if (WDrun.Calibration)
+		CalibrationEvent(bd, ch, event);
+
 	// Energy Spectra 
 	int Ebin;
 	Ebin = (int)((event->EventPlus[ch / 2][ch % 2].Energy) / (WDcfg.boards[bd].channels[ch].EnergyCoarseGain * 1024 / WDcfg.EHnbin));
@@ -378,10 +380,11 @@ int EventProcessing(int bd, int ch, WaveDemoEvent_t *event) {
 		PrevChTimeStamp[bd][ch] = TDC * 5 + RealtiveFineTime;
 	}
 	else
-		time = (TDC - TDCRef) * 5 + (RealtiveFineTime - RealtiveFineTimeRef);  // delta T from Ref Channel (in ns)
+		time = (TDC - TDCRef) * 5 + (RealtiveFineTime - RealtiveFineTimeRef) - CalibrationTimeCorr(bd, ch);  // delta T from Ref Channel (in ns)
 
 	Tbin = (uint32_t)((time - WDcfg.THmin) * WDcfg.THnbin / (WDcfg.THmax - WDcfg.THmin));
 	Histo1D_AddCount(&WDhistos.TH[bd][ch], Tbin);
+	LatencyRecord(LAT_HISTOGRAMMED, bd, event, ch);
 
 	// Event Saving into the enabled output files
 	if (WDrun.ContinuousWrite || WDrun.SingleWrite) {
@@ -389,6 +392,8 @@ int EventProcessing(int bd, int ch, WaveDemoEvent_t *event) {
 			SaveList(bd, ch, event);
 		if (WDcfg.SaveWaveforms)
 			SaveWaveform(bd, ch, event);
+		if (WDcfg.SaveLists || WDcfg.SaveWaveforms)
+			LatencyRecord(LAT_WRITTEN, bd, event, ch);
 	}
 	return 0;
 }
@@ -526,6 +531,9 @@ int PlotMultiWaveforms(WaveDemoEvent_t* events[], int array_size, int bdplot, in
 	}
 	else {
 		addProgressIndicator(&WPprogress);
+		for (int i = 0; i < array_size; i++)
+			if (events[i] != NULL)
+				LatencyRecord(LAT_PUBLISHED, (bdplot == -1) ? i : bdplot, events[i], chplot);
 	}
 	return Tn;
 }
@@ -576,11 +584,12 @@ void PlotSingleEventOfBoard(int bd, WaveDemoEvent_t* event) {
 		}
 		else {
 			addProgressIndicator(&WPprogress);
+			LatencyRecord(LAT_PUBLISHED, bd, event, -1);
 		}
 	}
 }
 
-int ProcessesSynchronizedEvents() {
+int ProcessesSynchronizedEvents(int MaxEvents) {
 	WaveDemoEvent_t *events[MAX_BD] = { NULL };
 	uint64_t TDC_min = 0;
 	int groupIndex;
@@ -594,6 +603,9 @@ int ProcessesSynchronizedEvents() {
 	// can not check synchronization if at least one buffer is empty
 	if (min_buff_len == 0)
 		return 0;
+	// the rest is processed in the next slices (see the scheduler in WDPipeline.h)
+	if (min_buff_len > MaxEvents)
+		min_buff_len = MaxEvents;
 
 	for (int i = 0; i < min_buff_len; i++) {
 		int event_good[MAX_BD] = { 0 };
@@ -635,8 +647,23 @@ int ProcessesSynchronizedEvents() {
 		}
 
 		if (count_sync_evt == WDcfg.NumBoards) {
+			// Board plot (done by the decoding when the readout is not threaded)
+			int bdplot = WDrun.BrdToPlot;
+			if (PipelineThreaded() && (WDrun.ContinuousPlot || WDrun.SinglePlot) && bdplot < WDcfg.NumBoards && WDrun.WavePlotMode == WPLOT_MODE_1BD && !IsPlotterBusy()) {
+				PlotSingleEventOfBoard(bdplot, events[bdplot]);
+				WDrun.SinglePlot = 0;
+			}
+			// Scan step boundaries (markers from the control side)
+			if (StepMarkersEnabled()) {
+				for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+					for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++)
+						if (WDcfg.boards[bd].channels[ch].ChannelEnable)
+							ApplyStepMarkers(bd, ch, events[bd]->Event->DataGroup[ch / 2].TDC * 5);
+			}
 			// Process waveform. (Set timestamp, fine time, energy fields in EventPlus data structure)
 			MultiWaveformProcess(events, WDcfg.NumBoards);
+			for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+				LatencyRecord(LAT_PROCESSED, bd, events[bd], -1);
 			// Waveform Plotting
 			if ((WDrun.ContinuousPlot || WDrun.SinglePlot) && WDrun.WavePlotMode == WPLOT_MODE_STD && !IsPlotterBusy()) {
 				PlotMultiWaveforms(events, WDcfg.NumBoards, -1, -1);
@@ -662,6 +689,12 @@ int ProcessesSynchronizedEvents() {
 							// eliminates event with has no fine timestamp
 							if (events[bd]->EventPlus[ch / 2][ch % 2].FineTimeStamp == 0)
 								toProcess = false;
+							// user cut (CUT expressions in the config file)
+							if (toProcess && !EvalCut(&WDcfg.Cut, events, bd, ch))
+								toProcess = false;
+							// batch for the processing plugins (selected and rejected events)
+							if (PluginsEnabled())
+								PluginsQueueEvent(bd, ch, events[bd], toProcess);
 
 							if (toProcess) {
 								EventProcessing(bd, ch, events[bd]);
@@ -696,18 +729,22 @@ int ProcessesSynchronizedEvents() {
 	return 1;
 }
 
-int ProcessesUnsynchronizedEvents() {
+int ProcessesUnsynchronizedEvents(int MaxEvents) {
 	WaveDemoEvent_t* events[MAX_BD] = { NULL };
 
-	// gets number of events that has each board
+	// gets number of events that has each board (the queues can hold more than one readout block
+	// when the readout runs in its own thread)
 	unsigned int num_events[MAX_BD] = { 0 };
 	int max_num_events = 0;
 	for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
-		num_events[bd] = WDcfg.handles[bd].NumEvents;
+		num_events[bd] = WDBuff_used_space(&WDbuff, bd);
 		if ((int) num_events[bd] > max_num_events) {
 			max_num_events = (int) num_events[bd];
 		}
 	}
+	// the rest is processed in the next slices (see the scheduler in WDPipeline.h)
+	if (max_num_events > MaxEvents)
+		max_num_events = MaxEvents;
 
 	for (int i = 0; i < max_num_events; i++) {
 		for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
@@ -724,15 +761,39 @@ int ProcessesUnsynchronizedEvents() {
 			else
 				WDcfg.handles[bd].RefEvent = NULL;
 
+			// Board plot (done by the decoding when the readout is not threaded)
+			if (PipelineThreaded() && (WDrun.ContinuousPlot || WDrun.SinglePlot) && WDrun.BrdToPlot == bd && WDrun.WavePlotMode == WPLOT_MODE_1BD && !IsPlotterBusy()) {
+				PlotSingleEventOfBoard(bd, event);
+				WDrun.SinglePlot = 0;
+			}
+
 			for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++) {
 				if (WDcfg.boards[bd].channels[ch].ChannelEnable) {
-					bool toProcess = true;
+					// Scan step boundaries (markers from the control side)
+					if (StepMarkersEnabled())
+						ApplyStepMarkers(bd, ch, event->Event->DataGroup[ch / 2].TDC * 5);
 					// Process waveform. (Set timestamp, fine time, energy fields in EventPlus data structure)
 					WaveformProcess(bd, ch, event);
+				}
+			}
+			LatencyRecord(LAT_PROCESSED, bd, event, -1);
+			// the cut can use any channel of the board event, so it is evaluated when all of them are processed
+			WaveDemoEvent_t* board_event[MAX_BD] = { NULL };
+			board_event[bd] = event;
+
+			for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++) {
+				if (WDcfg.boards[bd].channels[ch].ChannelEnable) {
+					bool toProcess = true;
 
 					// eliminates event with has no fine timestamp
 					if (event->EventPlus[ch / 2][ch % 2].FineTimeStamp == 0)
 						toProcess = false;
+					// user cut (CUT expressions in the config file)
+					if (toProcess && !EvalCut(&WDcfg.Cut, board_event, bd, ch))
+						toProcess = false;
+					// batch for the processing plugins (selected and rejected events)
+					if (PluginsEnabled())
+						PluginsQueueEvent(bd, ch, event, toProcess);
 
 					if (toProcess) {
 						EventProcessing(bd, ch, event);
@@ -773,17 +834,30 @@ int MakeSpaceBuffers() {
 	for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
 		num_new_evt = WDcfg.handles[bd].NumEvents;
 		// check if buffer have space for adding the new events
-		if (WDBuff_free_space(&WDbuff, bd) < num_new_evt) {
-			// remove old events to make space
-			evt_removed = WDBuff_remove(&WDbuff, bd, num_new_evt);
-			if (evt_removed < 0) {
-				return -1;
-			}
-			// update statistics
-			for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++) {
-				WDstats.EvLost_cnt[bd][ch] += evt_removed;
-				WDstats.EvProcessed_cnt[bd][ch] += evt_removed;
-			}
+		int free_space = WDBuff_free_space(&WDbuff, bd);
+		if (free_space >= num_new_evt)
+			continue;
+		if (PipelineThreaded()) {
+			// the old events belong to the processing thread: the new events that don't fit are lost
+			// (counted in EvLost_cnt by the main thread)
+			evt_removed = num_new_evt - free_space;
+			WDcfg.handles[bd].NumEvents = free_space;
+			WDstats.TotEvRead_cnt += evt_removed;
+			for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++)
+				WDstats.EvRead_cnt[bd][ch] += evt_removed;
+			PipelineCountDropped(bd, evt_removed);
+			continue;
+		}
+		// remove old events to make space
+		evt_removed = WDBuff_remove(&WDbuff, bd, num_new_evt);
+		if (evt_removed < 0) {
+			return -1;
+		}
+		PipelineCountDropped(bd, evt_removed);
+		// update statistics
+		for (int ch = 0; ch < WDcfg.handles[bd].Nch; ch++) {
+			WDstats.EvLost_cnt[bd][ch] += evt_removed;
+			WDstats.EvProcessed_cnt[bd][ch] += evt_removed;
 		}
 	}
 	return 1;
@@ -798,7 +872,7 @@ void UpdateTimes4Stats(int bd, int ch, WaveDemoEvent_t *event) {
 	// Get the newest time stamp (used to calculate the real acquisition time)
 	if (time > WDstats.LatestProcTstampAll)
 		WDstats.LatestProcTstampAll = time;
-	WDstats.AcqStopTime = (float)(WDstats.LatestProcTstampAll / 1e6);
+	WDstats.AcqStopTime = (int64_t)WDstats.LatestProcTstampAll;
 	WDstats.LatestProcTstamp[bd][ch] = time;
 }
 
@@ -852,6 +926,14 @@ int EventsDecoding(WaveDemoConfig_t *WDcfg) {
 				ErrCode = ERR_EVENT_BUILD;
 				return ErrCode;
 			}
+			/* time stamps after a recovery of the board (see WDRecovery.h) */
+			if (WDh->TDCOffset != 0) {
+				for (int g = 0; g < MAX_V1743_GROUP_SIZE; g++)
+					event->Event->DataGroup[g].TDC += WDh->TDCOffset;
+			}
+			event->ReadTime = WDh->ReadTime;
+			LatencyRecord(LAT_READ, bd, event, -1);
+			LatencyRecord(LAT_DECODED, bd, event, -1);
 #if USE_EVT_BUFFERING
 			/* register event added in the buffer */
 			ret = WDBuff_added(&WDbuff, bd, 1);
@@ -888,14 +970,21 @@ int EventsDecoding(WaveDemoConfig_t *WDcfg) {
 				if (WDcfg->SaveRawData)
 					SaveRawData(bd, channelsEnabled, event);
 
-			/* Plot Waveforms */
-			if ((WDrun.ContinuousPlot || WDrun.SinglePlot) && WDrun.BrdToPlot == bd && WDrun.WavePlotMode == WPLOT_MODE_1BD && !IsPlotterBusy()) {
+			/* Plot Waveforms (by the processing stage when the readout is threaded) */
+			if (!PipelineThreaded() && (WDrun.ContinuousPlot || WDrun.SinglePlot) && WDrun.BrdToPlot == bd && WDrun.WavePlotMode == WPLOT_MODE_1BD && !IsPlotterBusy()) {
 				PlotSingleEventOfBoard(bd, event);
 				WDrun.SinglePlot = 0;
 			}
 		}
 
 		WDstats.TotEvRead_cnt += WDh->NumEvents;
+		/* map the board time to the host time with the newest event of the block */
+		for (int g = 0; g < MAX_V1743_GROUP_SIZE; g++) {
+			if (event->Event->GrPresent[g]) {
+				LatencyBlockRead(bd, WDh->ReadTime, event->Event->DataGroup[g].TDC);
+				break;
+			}
+		}
 		for (int ch = 0; ch < WDh->Nch; ch++) {
 			int groupIndex = ch / 2;
 			int channelIndex = ch % 2;
@@ -914,6 +1003,63 @@ int EventsDecoding(WaveDemoConfig_t *WDcfg) {
 	return ErrCode;
 }
 
+static int RestartBoard(int bd, int StartAcq);
+
+// Readout stage of the pipeline (see WDPipeline.h): software trigger, readout and decoding of one block per board
+int ReadoutStage(uint64_t *NumEvents) {
+	static int64_t LastHealthCheck = 0;
+	ERROR_CODES_t ErrCode;
+	int FailedBoard = -1;
+	int64_t now = HostClockNs();
+
+	/* Check the board fail status (the recovery is done here, by the thread that reads the boards) */
+	if (RecoveryEnabled() && (now - LastHealthCheck) > RECOVERY_HEALTH_PERIOD * NS_PER_MS) {
+		uint32_t d32 = 0;
+		LastHealthCheck = now;
+		for (int bd = 0; bd < WDcfg.NumBoards; bd++) {
+			CAEN_DGTZ_ReadRegister(WDcfg.handles[bd].handle, 0x8178, &d32);
+			if ((d32 & 0xF) != 0 && RecoverBoard(bd, "Internal Communication Timeout", RestartBoard) < 0)
+				return ERR_BOARD_TIMEOUT;
+		}
+	}
+
+	/* Send a software trigger to each board */
+	if (WDrun.ContinuousTrigger)
+		SendSWtrigger(&WDcfg);
+
+	/* Read data from all boards */
+	ErrCode = ReadData(&WDcfg);
+	if (ErrCode == ERR_READOUT && RecoveryEnabled()) {
+		/* keep the blocks read before the error; the failed board and the next ones are read in the next loop */
+		for (FailedBoard = 0; WDcfg.handles[FailedBoard].ret_last == CAEN_DGTZ_Success; FailedBoard++);
+		for (int bd = FailedBoard; bd < WDcfg.NumBoards; bd++)
+			WDcfg.handles[bd].NumEvents = 0;
+		ErrCode = ERR_NONE;
+	}
+	if (ErrCode != ERR_NONE)
+		return ErrCode;
+	for (int bd = 0; bd < WDcfg.NumBoards; bd++)
+		*NumEvents += WDcfg.handles[bd].NumEvents;
+
+	/* Decode and add events into the buffer */
+	/* Plot and save raw data for all unfiltered events */
+	ErrCode = EventsDecoding(&WDcfg);
+
+	/* Recover the failed board (after the decoding, so that the events already read keep their time stamps) */
+	if (ErrCode == ERR_NONE && FailedBoard >= 0 && RecoverBoard(FailedBoard, "Readout Error", RestartBoard) < 0)
+		ErrCode = ERR_READOUT;
+	return ErrCode;
+}
+
+// Processing stage of the pipeline: plot and save data of the filtered events (at most MaxEvents per board)
+int ProcessStage(int MaxEvents) {
+	if (WDcfg.SyncEnable)
+		ProcessesSynchronizedEvents(MaxEvents);
+	else
+		ProcessesUnsynchronizedEvents(MaxEvents);
+	return ERR_NONE;
+}
+
 ERROR_CODES_t AllocateReadoutBuffer(WaveDemoConfig_t *WDcfg) {
 	ERROR_CODES_t ErrCode = ERR_NONE;
 	WaveDemoBoardHandle_t *WDh;
@@ -1109,6 +1255,31 @@ int WriteRegisterBitmask(int32_t handle, uint32_t address, uint32_t data, uint32
 	return ret;
 }
 
+/*!
+ * \fn	float SamplingPeriod(CAEN_DGTZ_SAMFrequency_t SamplingFrequency, float Default)
+ *
+ * \brief	sampling period of a SAM sampling frequency.
+ *
+ * \param 		  	SamplingFrequency	SAM sampling frequency.
+ * \param 		  	Default	period returned for an unknown frequency.
+ *
+ * \return	sampling period in ns.
+ */
+
+static float SamplingPeriod(CAEN_DGTZ_SAMFrequency_t SamplingFrequency, float Default) {
+	switch (SamplingFrequency) {
+	case CAEN_DGTZ_SAM_3_2GHz:
+		return 0.3125f;
+	case CAEN_DGTZ_SAM_1_6GHz:
+		return 0.625f;
+	case CAEN_DGTZ_SAM_800MHz:
+		return 1.25f;
+	case CAEN_DGTZ_SAM_400MHz:
+		return 2.5f;
+	}
+	return Default;
+}
+
 /*!
  * \fn	int ProgramBoard(WaveDemoBoard_t *WDb, WaveDemoBoardHandle_t *WDh, char doReset)
  *
@@ -1163,20 +1334,7 @@ int ProgramBoard(WaveDemoBoard_t *WDb, WaveDemoBoardHandle_t *WDh, char doReset)
 
 	/* Set Sampling Frequency */
 	ret |= CAEN_DGTZ_SetSAMSamplingFrequency(handle, WDb->SamplingFrequency);
-	switch (WDb->SamplingFrequency) {
-	case CAEN_DGTZ_SAM_3_2GHz:
-		WDh->Ts = 0.3125f;
-		break;
-	case CAEN_DGTZ_SAM_1_6GHz:
-		WDh->Ts = 0.625f;
-		break;
-	case CAEN_DGTZ_SAM_800MHz:
-		WDh->Ts = 1.25f;
-		break;
-	case CAEN_DGTZ_SAM_400MHz:
-		WDh->Ts = 2.5f;
-		break;
-	}
+	WDh->Ts = SamplingPeriod(WDb->SamplingFrequency, WDh->Ts);
 
 	/* Set Pulser Parameters */
 	for (channel = 0; channel < NbOfChannels; channel++) {
@@ -1240,7 +1398,7 @@ int ProgramBoard(WaveDemoBoard_t *WDb, WaveDemoBoardHandle_t *WDh, char doReset)
 	ret |= CAEN_DGTZ_SetSAMCorrectionLevel(handle, WDb->CorrectionLevel);
 
 	/* Set MAX NUM EVENTS */
-	ret |= CAEN_DGTZ_SetMaxNumEventsBLT(handle, MAX_NUM_EVENTS_BLT);
+	ret |= CAEN_DGTZ_SetMaxNumEventsBLT(handle, WDcfg.MaxNumEventsBLT);
 
 	/* Set Recording Depth */
 	ret |= CAEN_DGTZ_SetRecordLength(handle, WDb->RecordLength);
@@ -1318,6 +1476,87 @@ int ProgramSynchronization(WaveDemoConfig_t *WDcfg) {
 	return ErrCode;
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// Description: Close, reopen and program again one board after a readout error (see WDRecovery.h); the
+//				settings are taken from WDcfg. With synchronized boards, all the boards are stopped and the
+//				acquisition is restarted as in StartAcquisition.
+// Inputs:		bd = board index
+//				StartAcq = 1 to restart the acquisition
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int RestartBoard(int bd, int StartAcq) {
+	WaveDemoBoard_t *WDb = &WDcfg.boards[bd];
+	WaveDemoBoardHandle_t *WDh = &WDcfg.handles[bd];
+	int AllBoards = StartAcq && WDcfg.SyncEnable;
+	uint32_t d32 = 0;
+
+	// stop and clear the board(s); the errors are ignored because the link can be down
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		if (b == bd || AllBoards) {
+			CAEN_DGTZ_SWStopAcquisition(WDcfg.handles[b].handle);
+			CAEN_DGTZ_ClearData(WDcfg.handles[b].handle);
+		}
+	}
+	if (WDh->buffer)
+		CAEN_DGTZ_FreeReadoutBuffer(&WDh->buffer);
+	if (WDh->ret_open == CAEN_DGTZ_Success)
+		CAEN_DGTZ_CloseDigitizer(WDh->handle);
+	WDh->ret_open = CAEN_DGTZ_GenericError;
+
+	// reopen and program the board
+	if (OpenBoard(WDb, WDh) != ERR_NONE)
+		return -1;
+	if (ProgramBoard(WDb, WDh, 1) < 0)
+		return -1;
+	// keep the threshold of the current scan step instead of the one of the configuration file
+	if (StepMarkersEnabled() && RestoreStepThreshold(bd) != 0)
+		return -1;
+	if (AllBoards && ProgramSynchronization(&WDcfg) != ERR_NONE)
+		return -1;
+	if (CAEN_DGTZ_ReadRegister(WDh->handle, 0x8178, &d32) != CAEN_DGTZ_Success || (d32 & 0xF) != 0)
+		return -1;
+	WDh->ret_last = CAEN_DGTZ_MallocReadoutBuffer(WDh->handle, &WDh->buffer, &WDh->AllocatedSize);
+	if (WDh->ret_last != CAEN_DGTZ_Success)
+		return -1;
+	WDh->BufferSize = 0;
+	WDh->NumEvents = 0;
+
+	if (!StartAcq)
+		return 0;
+	if (AllBoards) {
+		// start the slaves, then the master
+		for (int b = 1; b < WDcfg.NumBoards; b++)
+			CAEN_DGTZ_SWStartAcquisition(WDcfg.handles[b].handle);
+		CAEN_DGTZ_SWStartAcquisition(WDcfg.handles[0].handle);
+	}
+	else {
+		CAEN_DGTZ_SWStartAcquisition(WDh->handle);
+	}
+	return 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: Program the pulser of the enabled channels with the current pattern of the calibration sweep
+//				(see WDCalib.h); the acquisition is stopped, the event buffer is cleared (no event of the
+//				previous pattern can be mixed with the new one) and the acquisition is started again
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int ProgramCalibrationPattern() {
+	int ret = 0;
+
+	StopAcquisition(&WDcfg);
+	ResetEventBuffer();
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		WaveDemoBoard_t *WDb = &WDcfg.boards[b];
+		for (int ch = 0; ch < WDcfg.handles[b].Nch; ch++) {
+			if (WDb->channels[ch].ChannelEnable && WDb->channels[ch].EnablePulseChannels)
+				ret |= CAEN_DGTZ_EnableSAMPulseGen(WDcfg.handles[b].handle, ch, WDb->channels[ch].PulsePattern, CAEN_DGTZ_SAMPulseCont);
+		}
+	}
+	StartAcquisition(&WDcfg);
+	return (ret == CAEN_DGTZ_Success) ? 0 : -1;
+}
+
 void initializer(WaveDemoConfig_t *WDcfg) {
 	// some initializations
 	WDrun.Xunits = 1;
@@ -2051,6 +2290,7 @@ int CheckKeyboardCommands(WaveDemoRun_t *WDrun, WaveDemoConfig_t *WDcfg) {
 			c = getch();
 			if (c == 'y' || c == 'Y') {
 				ResetHistograms();
+				ResetPluginHistograms();
 				ResetStatistics();
 				printf("Reset done.\n");
 			}
@@ -2281,12 +2521,22 @@ void PrintStatistics() {
 	printf("Total bytes = %s\n", str);
 
 	if (WDstats.RealTimeSource == REALTIME_FROM_BOARDS)
-		printf("RealTime (from boards) = %.2f s", WDstats.AcqRealTime / 1000);
+		printf("RealTime (from boards) = %.2f s", (double)WDstats.AcqRealTime / NS_PER_S);
 	else
-		printf("RealTime (from computer) = %.2f s", WDstats.AcqRealTime / 1000);
+		printf("RealTime (from computer) = %.2f s", (double)WDstats.AcqRealTime / NS_PER_S);
 
 	printf("\n");
 	printf("Readout Rate = %.2f MB/s\n", WDstats.RxByte_rate);
+	if (WDcfg.LatencyTracking) {
+		LatencySummary_t L;
+		for (int b = 0; b < WDcfg.NumBoards; b++) {
+			printf("Latency Brd %d p50/p99 (ms):", b);
+			for (int st = 0; st < LAT_NSTAGES; st++)
+				if (GetLatencySummary(st, b, &L) > 0)
+					printf(" %s %.1f/%.1f", LatencyStageName(st), L.P50, L.P99);
+			printf("\n");
+		}
+	}
 
 	if (WDstats.UnSyncEv_cnt) {
 		printf("\n");
@@ -2341,6 +2591,22 @@ int CheckBatchModeConditions(WaveDemoRun_t *WDrun, WaveDemoConfig_t *WDcfg) {
 	}
 	WDrun->BatchEventsTotal = totalEvents;
 
+	// Check the steps of the pulser calibration sweep
+	if (WDrun->Calibration && CalibrationStepDone()) {
+		if (!CalibrationNextStep()) {
+			printf("\nBatch mode: Pulser calibration completed\n");
+			msg_printf(MsgLog, "INFO: Batch mode stopped - Pulser calibration completed\n");
+			WDrun->AcqRun = 0;
+			return 0;
+		}
+		if (ProgramCalibrationPattern() < 0) {
+			printf("\nBatch mode: Can't program the pulser pattern of the calibration\n");
+			msg_printf(MsgLog, "ERROR: Batch mode stopped - Can't program the pulser pattern of the calibration\n");
+			WDrun->AcqRun = 0;
+			return 0;
+		}
+	}
+
 	// Check event count condition
 	if (WDcfg->BatchMaxEvents > 0 && totalEvents >= WDcfg->BatchMaxEvents) {
 		printf("\nBatch mode: Maximum event count reached (%llu events)\n", 
@@ -2351,11 +2617,22 @@ int CheckBatchModeConditions(WaveDemoRun_t *WDrun, WaveDemoConfig_t *WDcfg) {
 		return 0;
 	}
 
+	// Check end of scan requested through the step markers
+	if (StepMarkersEndRequested()) {
+		printf("\nBatch mode: End of scan requested by the control side\n");
+		msg_printf(MsgLog, "INFO: Batch mode stopped - End of scan requested by the control side\n");
+		WDrun->AcqRun = 0;
+		return 0;
+	}
+
 	// Check time condition
+	uint64_t elapsedSeconds = (uint64_t)((HostClockNs() - WDrun->BatchStartTime) / NS_PER_S);
+	static uint64_t lastStatusTime = 0;
+	if (elapsedSeconds != lastStatusTime) {
+		StatusProgress(elapsedSeconds, WDcfg->BatchMaxTime, totalEvents, WDcfg->BatchMaxEvents);
+		lastStatusTime = elapsedSeconds;
+	}
 	if (WDcfg->BatchMaxTime > 0) {
-		uint64_t currentTime = get_time();
-		uint64_t elapsedSeconds = (currentTime - WDrun->BatchStartTime) / 1000;
-		
 		if (elapsedSeconds >= WDcfg->BatchMaxTime) {
 			printf("\nBatch mode: Maximum time reached (%llu seconds)\n", 
 				(unsigned long long)WDcfg->BatchMaxTime);
@@ -2382,6 +2659,245 @@ int CheckBatchModeConditions(WaveDemoRun_t *WDrun, WaveDemoConfig_t *WDcfg) {
 	return -1; // Continue acquisition
 }
 
+/*!
+ * \fn	void SetOfflineBoardParams()
+ *
+ * \brief	Board parameters that are read from the digitizers in the acquisition, for the offline modes
+ * 			(--reprocess, --verify): all the channels, 12 bit, sampling period of the config file.
+ */
+
+static void SetOfflineBoardParams() {
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		WaveDemoBoardHandle_t *WDh = &WDcfg.handles[b];
+		WDh->Nch = MAX_CH;
+		WDh->Ngroup = MAX_CH / 2;
+		WDh->Nbit = 12;
+		WDh->Ts = SamplingPeriod(WDcfg.boards[b].SamplingFrequency, 1.25f);
+	}
+}
+
+/*!
+ * \fn	static int RunClockSim()
+ *
+ * \brief	Check of the time accounting on the mock clock (--clock-sim, see WDClock.h): the real host clock never
+ * 			goes back; the real time of the statistics is exact to the ns after CLOCK_SIM_HOURS of run (in ms in a
+ * 			float it was rounded to 256 ms); the batch time limit stops the run at the first check after
+ * 			CLOCK_SIM_MAX_TIME s, exactly. The mock clock starts far from 0 (2^62 ns): only differences matter.
+ *
+ * \return	0=OK, 1=mismatch.
+ */
+static int RunClockSim() {
+	int err = 0, i;
+	int64_t t, prev, Start, Expected;
+
+	// real clock
+	prev = HostClockNs();
+	for (i = 0; i < CLOCK_SIM_READS; i++) {
+		t = HostClockNs();
+		if (t < prev) {
+			msg_printf(MsgLog, "ERROR: Clock check: the host clock went back by %lld ns\n", (long long)(prev - t));
+			err = 1;
+			break;
+		}
+		prev = t;
+	}
+
+	// real time of the statistics (from the computer: no time stamps), one update per hour
+	SetMockClock((int64_t)1 << 62);
+	memset(&WDstats, 0, sizeof(WDstats));
+	Start = HostClockNs();
+	WDstats.StartTime = Start;
+	for (i = 0; i < CLOCK_SIM_HOURS; i++) {
+		AdvanceMockClock(3600 * NS_PER_S);
+		UpdateStatistics(HostClockNs());
+	}
+	AdvanceMockClock(1);
+	UpdateStatistics(HostClockNs());
+	Expected = (int64_t)CLOCK_SIM_HOURS * 3600 * NS_PER_S + 1;
+	if (WDstats.AcqRealTime != Expected || WDstats.RealTimeSource != REALTIME_FROM_COMPUTER) {
+		msg_printf(MsgLog, "ERROR: Clock check: real time after %d h = %lld ns (expected %lld)\n", CLOCK_SIM_HOURS, (long long)WDstats.AcqRealTime, (long long)Expected);
+		err = 1;
+	}
+
+	// batch time limit, checked every ms
+	WDcfg.BatchMode = 1;
+	WDcfg.BatchMaxTime = CLOCK_SIM_MAX_TIME;
+	WDcfg.BatchMaxEvents = 0;
+	WDrun.Calibration = 0;
+	WDrun.BatchStartTime = HostClockNs();
+	WDrun.AcqRun = 1;
+	for (i = 0; i < 2 * CLOCK_SIM_MAX_TIME * 1000 && WDrun.AcqRun; i++) {
+		AdvanceMockClock(NS_PER_MS);
+		CheckBatchModeConditions(&WDrun, &WDcfg);
+	}
+	WDrun.AcqRun = 0;
+	if (i != CLOCK_SIM_MAX_TIME * 1000) {
+		msg_printf(MsgLog, "ERROR: Clock check: batch stopped after %d ms (limit %d s)\n", i, CLOCK_SIM_MAX_TIME);
+		err = 1;
+	}
+	ReleaseMockClock();
+	memset(&WDstats, 0, sizeof(WDstats));
+
+	if (!err)
+		msg_printf(MsgLog, "INFO: Clock check OK (monotonic host clock, exact real time after %d h, batch limit at %d s)\n", CLOCK_SIM_HOURS, CLOCK_SIM_MAX_TIME);
+	return err;
+}
+
+/*!
+ * \fn	ERROR_CODES_t ReprocessRawData(const char *path)
+ *
+ * \brief	Offline reprocessing of a raw data file (--reprocess). The events are processed with the settings
+ * 			of the config file as in the acquisition (each board on its own, as in the unsynchronized mode)
+ * 			and the histograms and lists are written into the data path. With WP_CACHE = YES the results of
+ * 			the waveform processor are memoized in the file <path>.wpcache (see WDWPCache.h), so that a
+ * 			replay with a different gate or discriminator only recomputes the stages that changed.
+ * 			With EMULATE_THRESHOLDS the events are also processed at each emulated threshold (see WDThrEmul.h).
+ * 			With --calibrate the file is a pulser run and the calibration table is computed from it (see WDCalib.h).
+ *
+ * \param	path	raw data file (SAVE_RAW_DATA = YES in the acquisition).
+ *
+ * \return	error code.
+ */
+
+static ERROR_CODES_t ReprocessRawData(const char *path) {
+	ERROR_CODES_t ErrCode = ERR_NONE;
+	WaveDemoEvent_t *events[MAX_BD] = { NULL };
+	char txtHeader[80], FileFormat, channelsEnabled[MAX_CH], CacheFile[520];
+	char ChannelFound[MAX_BD][MAX_CH] = { { 0 } };
+	uint32_t header[8] = { 0 }, AllocatedSize;
+	uint64_t nev = 0;
+	int64_t StartTime = HostClockNs();
+	int bd, ret;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL || ReadRawHeader(f, txtHeader, &FileFormat, header, 8) != 0) {
+		msg_printf(MsgLog, "ERROR: Can't read the raw data file %s\n", path);
+		if (f != NULL)
+			fclose(f);
+		return ERR_RAW_READ;
+	}
+	msg_printf(MsgLog, "INFO: Reprocessing %s\n", path);
+
+	// the channels that are not in the file are disabled at the end
+	SetOfflineBoardParams();
+	ErrCode = CheckTOFStartCh(&WDcfg);
+	if (ErrCode != ERR_NONE)
+		goto Done;
+	ErrCode = ERR_CONF;
+	if (WDrun.Calibration && StartCalibration() < 0)
+		goto Done;
+	if (!WDrun.Calibration && WDcfg.CalibrationFile[0] && LoadCalibration(WDcfg.CalibrationFile) < 0)
+		goto Done;
+
+	ErrCode = ERR_MALLOC;
+	if (CreateHistograms(&AllocatedSize) < 0 || InitWaveProcess() < 0 || InitThrEmulation() < 0)
+		goto Done;
+	ResetHistograms();
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		events[b] = (WaveDemoEvent_t *)calloc(1, sizeof(WaveDemoEvent_t));
+		if (events[b] == NULL)
+			goto Done;
+		events[b]->Event = (CAEN_DGTZ_X743_EVENT_t *)calloc(1, sizeof(CAEN_DGTZ_X743_EVENT_t));
+		if (events[b]->Event == NULL)
+			goto Done;
+		for (int ch = 0; ch < MAX_CH; ch++)
+			if (_AllocateWaveform(&events[b]->EventPlus[ch / 2][ch % 2].Waveforms, WDcfg.GlobalRecordLength) < 0)
+				goto Done;
+	}
+	WDcfg.handles[WDcfg.TOFstartBoard].RefEvent = events[WDcfg.TOFstartBoard];
+
+	// outputs (the raw data are not written again)
+	ErrCode = ERR_OUTFILE_WRITE;
+	WDcfg.SaveRawData = 0;
+	WDrun.ContinuousWrite = WDcfg.SaveLists || WDcfg.SaveWaveforms;
+	if (OpenOutputDataFiles() < 0)
+		goto Done;
+	ErrCode = ERR_NONE;
+
+	// memoization of the waveform processor
+	if (WDcfg.WPCache && WDcfg.WaveformProcessor) {
+		sprintf(CacheFile, "%s%s", path, WPC_FILE_EXT);
+		if (WDcfg.SaveWaveforms)
+			msg_printf(MsgLog, "WARN: The processor cache is not used when the waveforms are saved\n");
+		else if ((ret = OpenWPCache(CacheFile)) < 0)
+			msg_printf(MsgLog, "WARN: Can't open the processor cache %s\n", CacheFile);
+		else
+			msg_printf(MsgLog, "INFO: Processor cache %s (%d entries)\n", CacheFile, ret);
+	}
+
+	while ((ret = ReadRawEvent(f, events, &bd, channelsEnabled)) == 1) {
+		WaveDemoEvent_t *event = events[bd];
+		WaveDemoEvent_t *board_event[MAX_BD] = { NULL };
+		if (bd >= WDcfg.NumBoards)
+			continue;
+		board_event[bd] = event;
+
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (!channelsEnabled[ch] || !event->Event->GrPresent[ch / 2] || !WDcfg.boards[bd].channels[ch].ChannelEnable)
+				continue;
+			ChannelFound[bd][ch] = 1;
+			WDstats.EvRead_cnt[bd][ch]++;
+			// the event buffer is reused: no fine time stamp when the discriminator doesn't fire
+			event->EventPlus[ch / 2][ch % 2].FineTimeStamp = 0;
+			WaveformProcess(bd, ch, event);
+		}
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (!channelsEnabled[ch] || !event->Event->GrPresent[ch / 2] || !WDcfg.boards[bd].channels[ch].ChannelEnable)
+				continue;
+			if (event->EventPlus[ch / 2][ch % 2].FineTimeStamp != 0 && EvalCut(&WDcfg.Cut, board_event, bd, ch)) {
+				EventProcessing(bd, ch, event);
+				WDstats.EvFilt_cnt[bd][ch]++;
+			}
+			WDstats.EvProcessed_cnt[bd][ch]++;
+		}
+		ThrEmulationEvent(bd, event, channelsEnabled);
+		WDstats.TotEvRead_cnt++;
+		if (++nev % 100000 == 0)
+			printf("Reprocessed %llu events\n", (unsigned long long)nev);
+	}
+	if (ret < 0)
+		ErrCode = ERR_RAW_READ;
+
+	for (int b = 0; b < WDcfg.NumBoards; b++) {
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (WDcfg.boards[b].channels[ch].ChannelEnable && !ChannelFound[b][ch]) {
+				if (ch < 8)	// channels 8-15 don't exist on the desktop and NIM boards
+					msg_printf(MsgLog, "WARN: Board %d channel %d is enabled but it isn't in the raw data file\n", b, ch);
+				WDcfg.boards[b].channels[ch].ChannelEnable = 0;
+			}
+		}
+	}
+	if (WDcfg.SaveHistograms)
+		SaveAllHistograms();
+	SaveThrEmulation();
+	if (WDrun.Calibration)
+		FinishCalibration(NULL);
+	msg_printf(MsgLog, "INFO: Reprocessed %llu events in %.1f s\n", (unsigned long long)nev, (double)(HostClockNs() - StartTime) / NS_PER_S);
+	PrintWPCacheStats();
+
+Done:
+	CloseThrEmulation();
+	CloseWPCache();
+	CloseOutputDataFiles();
+	fclose(f);
+	for (int b = 0; b < MAX_BD; b++) {
+		if (events[b] == NULL)
+			continue;
+		for (int ch = 0; ch < MAX_CH; ch++) {
+			if (events[b]->EventPlus[ch / 2][ch % 2].Waveforms != NULL)
+				_FreeWaveform(events[b]->EventPlus[ch / 2][ch % 2].Waveforms);
+			if (events[b]->Event != NULL)
+				free(events[b]->Event->DataGroup[ch / 2].DataChannel[ch % 2]);
+		}
+		free(events[b]->Event);
+		free(events[b]);
+	}
+	for (int b = 0; b < WDcfg.NumBoards; b++)
+		WDcfg.handles[b].RefEvent = NULL;
+	return ErrCode;
+}
+
 /* ########################################################################### */
 /* MAIN                                                                        */
 /* ########################################################################### */
@@ -2403,8 +2919,8 @@ int main(int argc, char *argv[]) {
 	char ConfigFileName[100];
 	char MsgLogFileName[500];
 
-	uint64_t CurrentTime, ElapsedTime;
-	uint64_t PrevStatTime = 0, PrevLogTime = 0;
+	int64_t CurrentTime, ElapsedTime;				// host clock (ns, see WDClock.h)
+	int64_t PrevStatTime = 0, PrevLogTime = 0, PrevFailCheckTime = 0;
 	int ForceStatUpdate = 1;
 	int AcqRunGoFlag = 0;
 	int AcqRunStopFlag = 0;
@@ -2490,6 +3006,16 @@ int main(int argc, char *argv[]) {
 	uint64_t cmdline_max_time = 0;
 	char cmdline_datapath[200] = "";
 	int has_cmdline_overrides = 0;
+	char cmdline_status[200] = "";
+	char cmdline_markers[500] = "";
+	int cmdline_autotune = 0;
+	int cmdline_quiet = 0;
+	char cmdline_reprocess[500] = "";
+	int cmdline_verify = 0;
+	char cmdline_verify_file[500] = "";
+	int cmdline_calibrate = 0;
+	int cmdline_calibrate_sim = 0;
+	int cmdline_clock_sim = 0;
 	
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-') {
@@ -2508,6 +3034,28 @@ int main(int argc, char *argv[]) {
 				printf("  --max-time <seconds>        : Maximum time in seconds (overrides config)\n");
 				printf("  --output-path <path>        : Output data path (overrides config)\n");
 				printf("\n");
+				printf("Status Options:\n");
+				printf("  --status <dest>             : Write a JSON Lines status stream to <dest>\n");
+				printf("                                (file path, '-' for stdout, 'fd:N' for an open descriptor)\n");
+				printf("  --quiet                     : Disable the console output in batch mode (use with --status)\n");
+				printf("  --marker-file <path>        : Read scan step markers from <path> (continuous acquisition)\n");
+				printf("\n");
+				printf("Tuning Options:\n");
+				printf("  --autotune                  : Benchmark the host settings and update the tuning profile\n");
+				printf("  --calibrate                 : Pulser calibration of the channel delays and gains (batch run)\n");
+				printf("                                (with --reprocess: calibration from a raw file of a pulser run)\n");
+				printf("\n");
+				printf("Offline Options:\n");
+				printf("  --reprocess <raw file>      : Process a raw data file with the settings of the config file\n");
+				printf("                                (no digitizer; results of the processor cached in <raw file>.wpcache)\n");
+				printf("  --verify                    : Compare the waveform processor variants with the reference\n");
+				printf("                                on synthetic waveforms (no digitizer; exit code 1 on mismatch)\n");
+				printf("  --verify-file <file>        : --verify with the waveforms of a raw data file or reproducer\n");
+				printf("  --calibrate-sim             : Run the pulser calibration on simulated channels and check the\n");
+				printf("                                fitted delays and gains (no digitizer; exit code 1 on mismatch)\n");
+				printf("  --clock-sim                 : Check the time accounting of the statistics and of the batch\n");
+				printf("                                limits on the mock clock (no digitizer; exit code 1 on mismatch)\n");
+				printf("\n");
 				printf("Examples:\n");
 				printf("  %s --batch --max-events 10000 --output-path ./my_data/\n", argv[0]);
 				printf("  %s myconfig.ini --batch-mode 1 --max-time 300\n", argv[0]);
@@ -2565,6 +3113,61 @@ int main(int argc, char *argv[]) {
 					return -1;
 				}
 			}
+			else if (strcmp(argv[i], "--status") == 0) {
+				if (i + 1 < argc) {
+					strncpy(cmdline_status, argv[++i], sizeof(cmdline_status) - 1);
+				}
+				else {
+					printf("ERROR: --status requires a destination (path, '-' or 'fd:N')\n");
+					return -1;
+				}
+			}
+			else if (strcmp(argv[i], "--quiet") == 0) {
+				cmdline_quiet = 1;
+			}
+			else if (strcmp(argv[i], "--autotune") == 0) {
+				cmdline_autotune = 1;
+			}
+			else if (strcmp(argv[i], "--calibrate") == 0) {
+				cmdline_calibrate = 1;
+			}
+			else if (strcmp(argv[i], "--calibrate-sim") == 0) {
+				cmdline_calibrate_sim = 1;
+			}
+			else if (strcmp(argv[i], "--clock-sim") == 0) {
+				cmdline_clock_sim = 1;
+			}
+			else if (strcmp(argv[i], "--reprocess") == 0) {
+				if (i + 1 < argc) {
+					strncpy(cmdline_reprocess, argv[++i], sizeof(cmdline_reprocess) - 1);
+				}
+				else {
+					printf("ERROR: --reprocess requires a raw data file\n");
+					return -1;
+				}
+			}
+			else if (strcmp(argv[i], "--verify") == 0) {
+				cmdline_verify = 1;
+			}
+			else if (strcmp(argv[i], "--verify-file") == 0) {
+				if (i + 1 < argc) {
+					strncpy(cmdline_verify_file, argv[++i], sizeof(cmdline_verify_file) - 1);
+					cmdline_verify = 1;
+				}
+				else {
+					printf("ERROR: --verify-file requires a raw data file or a reproducer\n");
+					return -1;
+				}
+			}
+			else if (strcmp(argv[i], "--marker-file") == 0) {
+				if (i + 1 < argc) {
+					strncpy(cmdline_markers, argv[++i], sizeof(cmdline_markers) - 1);
+				}
+				else {
+					printf("ERROR: --marker-file requires a path\n");
+					return -1;
+				}
+			}
 			else {
 				printf("WARNING: Unknown option '%s' (use --help for usage)\n", argv[i]);
 			}
@@ -2620,8 +3223,89 @@ int main(int argc, char *argv[]) {
 		printf("*** Command-line overrides applied\n");
 	}
 
+	// Open the machine-readable status stream
+	if (strlen(cmdline_status) > 0) {
+		if (OpenStatusStream(cmdline_status) < 0)
+			msg_printf(MsgLog, "WARN: Can't open status stream %s\n", cmdline_status);
+		else
+			msg_printf(MsgLog, "INFO: Status stream -> %s\n", cmdline_status);
+	}
+	if (cmdline_quiet) {
+		if (WDcfg.BatchMode > 0) {
+			msg_printf(MsgLog, "INFO: Console output disabled (--quiet)\n");
+			DisableConsoleOutput();
+		}
+		else {
+			msg_printf(MsgLog, "WARN: --quiet is ignored in interactive mode\n");
+		}
+	}
+
+	// Open the scan step markers (continuous acquisition across scan steps)
+	if (strlen(cmdline_markers) > 0) {
+		if (OpenStepMarkers(cmdline_markers) < 0)
+			msg_printf(MsgLog, "WARN: Can't open step marker file %s\n", cmdline_markers);
+		else
+			msg_printf(MsgLog, "INFO: Step markers <- %s\n", cmdline_markers);
+	}
+
+	// Pulser calibration: the run ends with the last pattern of the sweep (batch mode)
+	if (cmdline_calibrate) {
+		WDrun.Calibration = 1;
+		if (strlen(cmdline_reprocess) == 0) {
+			if (WDcfg.BatchMode == 0)
+				WDcfg.BatchMode = 1;
+			WDcfg.BatchMaxEvents = 0;
+		}
+	}
+
 	initializer(&WDcfg);
 
+	// Offline reprocessing of a raw data file (no digitizer)
+	if (strlen(cmdline_reprocess) > 0) {
+		ErrCode = ReprocessRawData(cmdline_reprocess);
+		if (ErrCode == ERR_NONE)
+			StatusState(STATUS_STATE_COMPLETED);
+		goto QuitProgram;
+	}
+
+	// Verification of the waveform processor variants (no digitizer)
+	if (cmdline_verify) {
+		SetOfflineBoardParams();
+		if (InitWaveProcess() < 0) {
+			ErrCode = ERR_MALLOC;
+			goto QuitProgram;
+		}
+		ErrCode = (RunVerification(cmdline_verify_file) == 0) ? ERR_NONE : ERR_VERIFY;
+		if (ErrCode == ERR_NONE)
+			StatusState(STATUS_STATE_COMPLETED);
+		goto QuitProgram;
+	}
+
+	// Pulser calibration on simulated channels (no digitizer)
+	if (cmdline_calibrate_sim) {
+		SetOfflineBoardParams();
+		ErrCode = CheckTOFStartCh(&WDcfg);
+		if (ErrCode != ERR_NONE)
+			goto QuitProgram;
+		if (InitWaveProcess() < 0) {
+			ErrCode = ERR_MALLOC;
+			goto QuitProgram;
+		}
+		ErrCode = (RunCalibrationSim() == 0) ? ERR_NONE : ERR_VERIFY;
+		if (ErrCode == ERR_NONE)
+			StatusState(STATUS_STATE_COMPLETED);
+		goto QuitProgram;
+	}
+
+	// Time accounting on the mock clock (no digitizer)
+	if (cmdline_clock_sim) {
+		SetOfflineBoardParams();
+		ErrCode = (RunClockSim() == 0) ? ERR_NONE : ERR_VERIFY;
+		if (ErrCode == ERR_NONE)
+			StatusState(STATUS_STATE_COMPLETED);
+		goto QuitProgram;
+	}
+
 	/* *************************************************************************************** */
 	/* Open the digitizer and read the board information                                       */
 	/* *************************************************************************************** */
@@ -2633,10 +3317,22 @@ int main(int argc, char *argv[]) {
 	PrintDigitizersInfo(MsgLog, &WDcfg);
 
 Restart:
+	/* *************************************************************************************** */
+	/* Host tuning (profile or autotune)                                                       */
+	/* *************************************************************************************** */
+	if (SetupHostTuning(cmdline_autotune) < 0)
+		msg_printf(MsgLog, "WARN: Host tuning failed; using the default settings\n");
+	if (WDcfg.Cut.Ncode > 0)
+		msg_printf(MsgLog, "INFO: Event cut: %s (%d instructions)\n", WDcfg.Cut.Text, WDcfg.Cut.Ncode);
+
 	/* *************************************************************************************** */
 	/* Program the digitizer                                                                   */
 	/* *************************************************************************************** */
 	printf("*** Digitizers configuring...\n");
+	if (WDrun.Calibration && StartCalibration() < 0) {
+		ErrCode = ERR_CONF;
+		goto QuitProgram;
+	}
 	ErrCode = ProgramDigitizers(&WDcfg);
 	if (ErrCode != ERR_NONE) {
 		goto QuitProgram;
@@ -2659,6 +3355,10 @@ Restart:
 	ErrCode = CheckTOFStartCh(&WDcfg);
 	if (ErrCode != ERR_NONE)
 		goto QuitProgram;
+	if (!WDrun.Calibration && WDcfg.CalibrationFile[0] && LoadCalibration(WDcfg.CalibrationFile) < 0) {
+		ErrCode = ERR_CONF;
+		goto QuitProgram;
+	}
 
 	// Set plot mask
 	ConfigureChannelsPlot(&WDrun, &WDcfg);
@@ -2689,9 +3389,14 @@ Restart:
 	TotAllocSize += AllocatedSize;
 	if (InitWaveProcess() < 0) goto QuitProgram;
 	ResetHistograms();
+	ErrCode = ERR_PLUGIN;
+	if (LoadPlugins() < 0) goto QuitProgram;
+	ErrCode = ERR_PIPELINE;
+	if (PipelineInit(ReadoutStage, ProcessStage) < 0) goto QuitProgram;
 	ErrCode = ERR_NONE; // restore error code
 
 	msg_printf(MsgLog, "INFO: Ready.\n");
+	StatusState(STATUS_STATE_READY);
 	printf("\n");
 	
 	// Batch mode: start acquisition automatically
@@ -2723,7 +3428,7 @@ Restart:
 		printf("========================================\n");
 		printf("\n");
 		
-		WDrun.BatchStartTime = get_time();
+		WDrun.BatchStartTime = HostClockNs();
 		WDrun.BatchEventsTotal = 0;
 		StartAcquisition(&WDcfg);
 		WDrun.AcqRun = 1;
@@ -2741,12 +3446,14 @@ Restart:
 	
 	WDrun.Quit = 0;
 	WDrun.Restart = 0;
-	//PrevRateTime = get_time();
 	/* *************************************************************************************** */
 	/* Readout Loop                                                                            */
 	/* *************************************************************************************** */
 	while (!WDrun.Quit) {
 		// Check for keyboard commands (key pressed)
+		// the commands can access the boards and the output files: the readout thread must be paused
+		if (PipelineThreaded() && kbhit())
+			PipelinePauseReadout();
 		if (WDcfg.BatchMode == 2) {
 			// In batch mode 2 (no visualization), only check for soft stop keys (q or s)
 			if (kbhit()) {
@@ -2761,18 +3468,25 @@ Restart:
 					
 					// Print final statistics and file information
 					if (WDcfg.enableStats) {
-						UpdateStatistics(get_time());
+						UpdateStatistics(HostClockNs());
 						PrintStatistics();
+						StatusStats();
 					}
 					if (WDcfg.SaveRunInfo)
 						SaveRunInfo(ConfigFileName);
 					if (WDcfg.SaveHistograms)
 						SaveAllHistograms();
+					if (WDrun.Calibration)
+						FinishCalibration(NULL);
+					PollRecoveries();
+					PrintPipelineStats();
+					PrintLatencyStats();
 					CloseOutputDataFiles();
 					
 					printf("\n");
 					PrintOutputFilesSummary();
 					printf("========================================\n");
+					StatusState(STATUS_STATE_STOPPED);
 					
 					WDrun.Quit = 1; // Exit the loop
 					continue;
@@ -2798,18 +3512,25 @@ Restart:
 				printf("BATCH MODE COMPLETED\n");
 				printf("========================================\n");
 				if (WDcfg.enableStats) {
-					UpdateStatistics(get_time());
+					UpdateStatistics(HostClockNs());
 					PrintStatistics();
+					StatusStats();
 				}
 				if (WDcfg.SaveRunInfo)
 					SaveRunInfo(ConfigFileName);
 				if (WDcfg.SaveHistograms)
 					SaveAllHistograms();
+				if (WDrun.Calibration)
+					FinishCalibration(NULL);
+				PollRecoveries();
+				PrintPipelineStats();
+				PrintLatencyStats();
 				CloseOutputDataFiles();
 				
 				printf("\n");
 				PrintOutputFilesSummary();
 				printf("========================================\n");
+				StatusState(STATUS_STATE_COMPLETED);
 				
 				WDrun.Quit = 1; // Exit the loop
 				continue;
@@ -2818,6 +3539,7 @@ Restart:
 		
 		if (WDrun.Restart) {
 			// reload configurations from config file
+			PipelinePauseReadout();
 			f_ini = fopen(ConfigFileName, "r");
 			ParseConfigFile(f_ini, &WDcfg);
 			fclose(f_ini);
@@ -2826,11 +3548,12 @@ Restart:
 			continue;
 		}
 		// get current time
-		CurrentTime = get_time();
+		CurrentTime = HostClockNs();
 		if (WDrun.AcqRun == 0) {
 			if (AcqRunStopFlag) {
 				if (WDcfg.enableStats) {
 					UpdateStatistics(CurrentTime);
+					StatusStats();
 					if (WDrun.StatsMode >= 0)
 						PrintStatistics();
 				}
@@ -2838,22 +3561,29 @@ Restart:
 					SaveRunInfo(ConfigFileName);
 				if (WDcfg.SaveHistograms)
 					SaveAllHistograms();
+				PollRecoveries();
+				PrintPipelineStats();
+				PrintLatencyStats();
 				CloseOutputDataFiles();
 
 				//download and throw away events from all digitizers
 				DownloadAll();
 
 				msg_printf(MsgLog, "INFO: Stop Acquisition at %s\n", WDstats.AcqStopTimeString);
+				StatusState(STATUS_STATE_STOPPED);
 				printf("\n");
 				printf("[s] start/stop the acquisition, [q] quit, [?] help\n");
 				AcqRunStopFlag = 0;
 			}
-			if (CurrentTime % 1000 == 0) {
-				//Board Fail Status
+			if (CurrentTime - PrevFailCheckTime >= NS_PER_S) {
+				//Board Fail Status (once per second)
+				PrevFailCheckTime = CurrentTime;
 				uint32_t d32 = 0;
 				for (int b = 0; b < WDcfg.NumBoards; b++) {
 					CAEN_DGTZ_ReadRegister(WDcfg.handles[b].handle, 0x8178, &d32);
 					if ((d32 & 0xF) != 0) {
+						if (RecoveryEnabled() && RecoverBoard(b, "Internal Communication Timeout", RestartBoard) == 0)
+							continue;
 						printf("Error: Internal Communication Timeout occurred.\nPlease reset digitizer manually then restart the program\n");
 						ErrCode = ERR_BOARD_TIMEOUT;
 						goto QuitProgram;
@@ -2909,53 +3639,49 @@ Restart:
 				OpenPlotter2();
 			}
 
-			WDstats.StartTime = get_time();
+			WDstats.StartTime = HostClockNs();
 			PrevLogTime = WDstats.StartTime;
 			PrevStatTime = WDstats.StartTime;
 
 			ResetEventBuffer();
 			ResetHistograms();
+			ResetStepMarkers();
+			PluginsStartRun();
+			ResetPipelineStats();
+			ResetRecovery();
+			ResetLatency();
 			memset(PrevChTimeStamp, 0, sizeof(float) * MAX_CH * MAX_BD);
 
 			if (WDcfg.BatchMode == 0)
 				printf("Press [?] for help\n");
 			msg_printf(MsgLog, "INFO: Starting Acquisition at %s\n", WDstats.AcqStartTimeString);
+			StatusState(STATUS_STATE_RUNNING);
 			AcqRunGoFlag = 1;
 		}
 
-		/* Send a software trigger to each board */
-		if (WDrun.ContinuousTrigger) {
-			SendSWtrigger(&WDcfg);
-		}
-
-		/* Read data from all boards */
-		ErrCode = ReadData(&WDcfg);
+		/* Readout, processing and plugin stages (in this thread or in the pipeline threads) */
+		ErrCode = PipelineStep();
 		if (ErrCode != ERR_NONE) {
 			goto QuitProgram;
 		}
 
-		/* Decode and add events into the buffer */
-		/* Plot and save raw data for all unfiltered events */
-		ErrCode = EventsDecoding(&WDcfg);
-		if (ErrCode != ERR_NONE) {
-			goto QuitProgram;
-		}
+		/* Write the discontinuities of the boards recovered by the readout stage (if any) */
+		PollRecoveries();
 
-		/* Processes events */
-		/* Plot and save data of the filtered events */
-		if (WDcfg.SyncEnable) {
-			ProcessesSynchronizedEvents();
-		}
-		else {
-			ProcessesUnsynchronizedEvents();
+		/* Read the new step markers (if any) */
+		if (StepMarkersEnabled()) {
+			PollStepMarkers(CurrentTime);
 		}
 
 		/* Update statistics and print them onto the screen (once every second) */
-		ElapsedTime = CurrentTime - PrevLogTime; // in ms
+		ElapsedTime = CurrentTime - PrevLogTime; // in ns
 		if (WDcfg.enableStats || WDcfg.BatchMode > 0) {
-			if (ElapsedTime > 1000 && (WDrun.DoRefresh || WDrun.DoRefreshSingle || WDcfg.BatchMode > 0)) {
-				if (ForceStatUpdate || ((CurrentTime - PrevStatTime) > WDcfg.StatUpdateTime)) {
+			if (ElapsedTime > NS_PER_S && (WDrun.DoRefresh || WDrun.DoRefreshSingle || WDcfg.BatchMode > 0)) {
+				// the counters printed below are written by the readout stage: no readout while they are read
+				PipelinePauseReadout();
+				if (ForceStatUpdate || ((CurrentTime - PrevStatTime) > WDcfg.StatUpdateTime * NS_PER_MS)) {
 					UpdateStatistics(CurrentTime);
+					StatusStats();
 					PrevStatTime = CurrentTime;
 					ForceStatUpdate = 0;
 				}
@@ -2978,7 +3704,7 @@ Restart:
 		}
 
 		/* Plot histogram (skip in batch mode without visualization) */
-		if (ElapsedTime > 1000 && WDrun.HistoPlotType != HPLOT_DISABLED && WDcfg.BatchMode != 2) {
+		if (ElapsedTime > NS_PER_S && WDrun.HistoPlotType != HPLOT_DISABLED && WDcfg.BatchMode != 2) {
 			PlotSelectedHisto(WDrun.HistoPlotType, WDrun.Xunits);
 		}
 
@@ -2996,7 +3722,9 @@ QuitProgram:
 	}
 
 	/* stop the acquisition */
-	StopAcquisition(&WDcfg);
+	if (strlen(cmdline_reprocess) == 0 && !cmdline_verify && !cmdline_calibrate_sim && !cmdline_clock_sim)
+		StopAcquisition(&WDcfg);
+	PipelineClose();
 
 	/* close the plotter */
 	ClosePlotter();
@@ -3011,6 +3739,7 @@ QuitProgram:
 	FreeTraces();
 	DestroyHistograms();
 	CloseWaveProcess();
+	UnloadPlugins();
 
 	if (WDrun.Restart) {
 		msg_printf(MsgLog, "INFO: Restart.\n");
@@ -3018,12 +3747,15 @@ QuitProgram:
 	}
 
 	/* close the devices */
-	CloseDigitizers(&WDcfg);
+	if (strlen(cmdline_reprocess) == 0 && !cmdline_verify && !cmdline_calibrate_sim && !cmdline_clock_sim)
+		CloseDigitizers(&WDcfg);
 
 	/* print a possible error */
 	if (ErrCode) {
 		printf("\n");
 		msg_printf(MsgLog, "ERROR %d: %s\n", ErrCode, ErrMsg[ErrCode]);
+		StatusError(ErrCode, ErrMsg[ErrCode]);
+		StatusState(STATUS_STATE_ERROR);
 #ifdef WIN32
 		printf("\n");
 		// printf("Press a key to quit\n");
@@ -3035,6 +3767,10 @@ QuitProgram:
 	msg_printf(MsgLog, "INFO: End.\n");
 	if (MsgLog != NULL)
 		fclose(MsgLog);
+	StatusState(STATUS_STATE_EXIT);
+	CloseStatusStream();
+	CloseStepMarkers();
 
-	return 0;
+	// exit code of the verification (for scripts)
+	return ((cmdline_verify || cmdline_calibrate_sim || cmdline_clock_sim) && ErrCode != ERR_NONE) ? 1 : 0;
 }